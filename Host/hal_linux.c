@@ -0,0 +1,824 @@
+/*************************************************************************************************************
+----------------------------SIMULATORE DEL FIRMWARE SU LINUX (HAL CON REGISTRI SIMULATI)----------------------
+Esegue main.c su Linux con i registri simulati di hal_linux.h. Le periferiche avanzano in hal_linux_aggiorna(),
+che il firmware chiama ad ogni giro del ciclo principale e mentre aspetta la USART:
+-USART: i byte ricevuti entrano dalla ISR(USART_RX_vect), quelli trasmessi escono da hal_usart_scrivi();
+-timer 2: la ISR(TIMER2_COMPA_vect) viene chiamata ogni millisecondo, seguita dalle ISR(TIMER2_COMPB_vect)
+ dei fronti del PWM software;
+-timer 0 e 1: gli overflow (e il conteggio libero di TCNT1, con il confronto A) seguono prescaler e modalità impostati dal firmware;
+-pin: il simulatore può cambiare PINx e chiamare la ISR del pin change, come il pulsante e i dip switch sulla scheda
+ (nel fuzz a caso, con la pty SIGUSR2 preme il pulsante della priorità);
+-ADC: con l'avvio automatico, una conversione per millisecondo chiamando la ISR(ADC_vect); la tensione in ingresso
+ la decide il simulatore (nel fuzz è casuale, con la pty cambia con SIGUSR1, altrimenti è 0);
+-EEPROM: 1 KB in memoria, vuota (0xFF) all'avvio o letta da un file; ogni scrittura dura EEPROM_SCRITTURA_MS e poi,
+ con EERIE a '1', viene chiamata la ISR(EE_READY_vect).
+Una ISR viene chiamata solo se il bit I di SREG è a '1', e durante la ISR il bit resta a '0' come sulla scheda.
+L'autobaud e il tachimetro non sono simulati: non arrivano fronti su RXD e su ICP1.
+
+Compilazione (dalla cartella principale):	gcc -Wall -I. -o pwm_linux main.c Host/hal_linux.c
+Uso:
+	pwm_linux [file]		collega la seriale a una pty e stampa il nome del terminale da aprire (es. /dev/pts/3)
+					con screen, minicom o protocollo_host; il tempo e la velocità della seriale sono quelli della scheda.
+					Con un file, la EEPROM viene letta dal file all'avvio e salvata nel file ad ogni scrittura:
+					riavviando il simulatore con lo stesso file si prova il ripristino delle impostazioni
+	pwm_linux bench [n]		invia n comandi di testo (predefinito 100000) e poi n frame binari, uno alla volta
+					in attesa della risposta, e stampa comandi al secondo e byte per comando
+	pwm_linux fuzz [seme] [n]	invia n blocchi casuali (righe, frame, byte qualunque, pulsante, dip switch e corrente) e dopo ognuno
+					controlla con un frame OP_LEGGI_STATO che il firmware risponda e che lo stato sia valido
+Con bench e fuzz il tempo è simulato: passa un millisecondo ad ogni chiamata di hal_linux_aggiorna() e la seriale non ha
+limiti di velocità. Una prova di fuzz si ripete identica con lo stesso seme; in caso di errore l'uscita è 1.
+*************************************************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+
+#include "hal_linux.h"
+#undef main
+#include "protocollo.h"
+
+#define F_CPU 16000000UL //Frequenza della scheda simulata, come in main.c.
+#define SIM_BUF 4096 //Byte in attesa di entrare o di uscire dalla USART simulata.
+#define BENCH_N 100000
+#define FUZZ_N 2000
+#define FUZZ_ATTESA_MS 15000 //Tempo concesso al firmware per rispondere alla verifica (l'autobaud ne occupa 10000).
+#define FUZZ_PAUSA_MS 60 //Pausa dopo ogni blocco, più lunga del timeout dei frame incompleti (PROTO_TIMEOUT_MS in main.c).
+#define EEPROM_SCRITTURA_MS 4 //Durata della scrittura di un byte della EEPROM (3.4 ms sulla scheda).
+
+//Registri simulati.
+#define HAL_DEFINISCI8(nome) volatile uint8_t nome;
+#define HAL_DEFINISCI16(nome) volatile uint16_t nome;
+HAL_REGISTRI(HAL_DEFINISCI8, HAL_DEFINISCI16)
+
+//Firmware.
+int firmware_main(void);
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+void TIMER2_COMPA_vect(void);
+void TIMER2_COMPB_vect(void);
+
+//Vettori che il firmware può non avere, a seconda della configurazione (es. PWM_TIMER):
+//come su AVR, un interrupt senza ISR non fa niente.
+__attribute__((weak)) void TIMER0_OVF_vect(void){}
+__attribute__((weak)) void TIMER1_OVF_vect(void){}
+__attribute__((weak)) void TIMER1_COMPA_vect(void){}
+__attribute__((weak)) void PCINT0_vect(void){}
+__attribute__((weak)) void PCINT1_vect(void){}
+__attribute__((weak)) void PCINT2_vect(void){}
+__attribute__((weak)) void EE_READY_vect(void){}
+__attribute__((weak)) void ADC_vect(void){}
+
+enum modoSimulatore {MODO_PTY, MODO_BENCH, MODO_FUZZ};
+static int modo;
+
+//Coda dei byte che l'host invia alla scheda e buffer di quelli trasmessi dalla scheda verso la pty.
+static unsigned char ingresso[SIM_BUF];
+static unsigned int ingressoTesta, ingressoCoda;
+static unsigned char uscita[SIM_BUF];
+static unsigned int nUscita;
+static int ptyMaster = -1;
+
+static unsigned long long millisecondiSimulati;
+static const unsigned int prescaler[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static unsigned long timer1Anticipo; //Conteggi del timer 1 già fatti avanzare da usartRicevi() in questo millisecondo.
+static volatile unsigned int adcIngresso; //Tensione sull'ingresso dell'ADC selezionato, in conteggi a 10 bit (0-1023).
+
+//EEPROM simulata, file in cui viene salvata (solo in modalità pty) e millisecondi che mancano alla fine della scrittura in corso.
+static unsigned char eeprom[E2END + 1];
+static const char *eepromFile;
+static unsigned int eepromAttesa;
+
+//Stato delle prove bench e fuzz, aggiornato dai byte trasmessi dal firmware.
+static unsigned long righeRicevute; //Righe di testo complete ('\n') trasmesse dal firmware.
+static unsigned long byteRicevuti;
+static struct parserProtocollo parserUscita;
+static unsigned long frameRicevuti;
+static struct frameProtocollo ultimoFrame;
+
+//----------------------PERIFERICHE SIMULATE------------------------
+
+static void accoda(const unsigned char *dati, unsigned int n){
+	
+	while(n--){
+		if(((ingressoTesta + 1) % SIM_BUF) == ingressoCoda)
+		return;
+		ingresso[ingressoTesta] = *dati++;
+		ingressoTesta = (ingressoTesta + 1) % SIM_BUF;
+	}
+	
+}
+
+static void accodaRiga(const char *riga){
+	
+	accoda((const unsigned char *) riga, strlen(riga));
+	accoda((const unsigned char *) "\n", 1);
+	
+}
+
+static void scriviPty(void){
+	
+	unsigned int scritti = 0;
+	ssize_t n;
+	
+	while(scritti < nUscita){
+		n = write(ptyMaster, uscita + scritti, nUscita - scritti);
+		if(n <= 0)
+		break; //Nessuno ha aperto il terminale: i byte vanno persi, come su una seriale scollegata.
+		scritti += n;
+	}
+	
+	nUscita = 0;
+	
+}
+
+//Byte trasmesso dal firmware (scrittura di UDR0).
+void hal_linux_trasmetti(uint8_t c){
+	
+	if(modo == MODO_PTY){
+		if(nUscita == SIM_BUF)
+		scriviPty();
+		uscita[nUscita++] = c;
+		return;
+	}
+	
+	byteRicevuti++;
+	if(c == '\n')
+	righeRicevute++;
+	//I frame di telemetria arrivano quando vogliono: non sono risposte ai comandi e non contano.
+	if(proto_parse(&parserUscita, c) == PROTO_FRAME_OK && parserUscita.frame.opcode != (OP_DATI_TELEMETRIA | PROTO_RISPOSTA)){
+		ultimoFrame = parserUscita.frame;
+		frameRicevuti++;
+	}
+	
+}
+
+//Chiama una ISR con il bit I di SREG a '0', come fa l'hardware all'ingresso nell'interrupt.
+static void chiamaISR(void (*isr)(void)){
+	
+	SREG &= ~(1<<SREG_I);
+	isr();
+	SREG |= (1<<SREG_I);
+	
+}
+
+//Byte al millisecondo della seriale, dal baud rate impostato dal firmware (10 bit per byte).
+static double byteAlMillisecondo(void){
+	
+	double baud = (double) F_CPU / ((UCSR0A & (1<<U2X0)) ? 8 : 16) / (UBRR0 + 1);
+	
+	return baud / 10000.0;
+	
+}
+
+//Trasmissione: la ISR di registro dati vuoto viene chiamata finchè il firmware la tiene abilitata.
+static void usartTrasmetti(double *credito){
+	
+	while((UCSR0B & (1<<UDRIE0)) && (UCSR0B & (1<<TXEN0)) && *credito >= 1){
+		chiamaISR(USART_UDRE_vect);
+		*credito -= 1;
+	}
+	
+	if(!(UCSR0B & (1<<UDRIE0)))
+	UCSR0A |= (1<<TXC0);
+	
+}
+
+//Timer 1 in modalità normale: avanza di conteggi, con il confronto A e gli overflow che cadono in mezzo.
+static void timer1Libero(unsigned long conteggi){
+	
+	//Il confronto A scatta quando TCNT1 arriva a OCR1A: tra il conteggio successivo a quello attuale e l'ultimo di questo passo.
+	if((TIMSK1 & (1<<OCIE1A)) && (uint16_t)(OCR1A - TCNT1 - 1) < conteggi)
+	chiamaISR(TIMER1_COMPA_vect);
+	
+	conteggi += TCNT1;
+	while(conteggi > 0xFFFF){
+		conteggi -= 0x10000;
+		if(TIMSK1 & (1<<TOIE1))
+		chiamaISR(TIMER1_OVF_vect);
+	}
+	TCNT1 = conteggi;
+	
+}
+
+//Ricezione: un byte alla volta nel registro dati, poi la ISR. Con la ricezione spenta i byte vanno persi.
+//Se il timer 1 conta libero, tra un byte e l'altro avanza del tempo di un carattere: il silenzio del Modbus RTU si misura
+//con il timer 1 e i byte di un frame non devono sembrare arrivati tutti insieme. timer1() poi toglie i conteggi già fatti.
+static void usartRicevi(double *credito){
+	
+	unsigned int p = prescaler[TCCR1B & 7];
+	unsigned long passo = 0; //Conteggi del timer 1 in un carattere.
+	
+	if(p && !(TCCR1B & (3<<WGM12)) && !(TCCR1A & 3))
+	passo = F_CPU / 1000.0 / byteAlMillisecondo() / p;
+	
+	while(ingressoCoda != ingressoTesta && *credito >= 1){
+		if(passo){
+			timer1Libero(passo);
+			timer1Anticipo += passo;
+		}
+		
+		if((UCSR0B & (1<<RXEN0)) && (UCSR0B & (1<<RXCIE0))){
+			UDR0 = ingresso[ingressoCoda];
+			chiamaISR(USART_RX_vect);
+		}
+		ingressoCoda = (ingressoCoda + 1) % SIM_BUF;
+		*credito -= 1;
+	}
+	
+}
+
+//Timer 0: overflow ogni 256 conteggi in fast PWM, ogni 510 in phase correct (WGM0 = 1).
+static void timer0(void){
+	
+	static unsigned long resto;
+	unsigned long periodo = (unsigned long) prescaler[TCCR0B & 7] * (((TCCR0A & 3) == 1) ? 510 : 256);
+	
+	if(periodo == 0)
+	return;
+	
+	resto += F_CPU / 1000;
+	while(resto >= periodo){
+		resto -= periodo;
+		if(TIMSK0 & (1<<TOIE0))
+		chiamaISR(TIMER0_OVF_vect);
+	}
+	
+}
+
+//Timer 1: in modalità normale conta libero (base dei tempi), nelle modalità PWM il TOP è ICR1.
+static void timer1(void){
+	
+	static unsigned long resto, conteggio;
+	unsigned int p = prescaler[TCCR1B & 7];
+	unsigned char wgm = (((TCCR1B >> WGM12) & 3) << 2) | (TCCR1A & 3);
+	unsigned long conteggi, periodo;
+	
+	if(p == 0)
+	return;
+	
+	resto += F_CPU / 1000;
+	conteggi = resto / p;
+	resto %= p;
+	
+	if(wgm == 0){
+		//I conteggi fatti avanzare dalla ricezione sono già passati.
+		if(timer1Anticipo >= conteggi){
+			timer1Anticipo -= conteggi;
+			return;
+		}
+		timer1Libero(conteggi - timer1Anticipo);
+		timer1Anticipo = 0;
+		return;
+	}
+	
+	periodo = (wgm == 14) ? ICR1 + 1UL : 2UL * ICR1;
+	if(periodo == 0)
+	return;
+	
+	conteggio += conteggi;
+	while(conteggio >= periodo){
+		conteggio -= periodo;
+		if(TIMSK1 & (1<<TOIE1))
+		chiamaISR(TIMER1_OVF_vect);
+	}
+	
+}
+
+//Timer 2: il firmware lo programma con un periodo di 1 ms. Dopo il confronto A si eseguono i fronti del PWM software.
+static void timer2(void){
+	
+	unsigned char fronti = 0;
+	
+	if(!(TIMSK2 & (1<<OCIE2A)))
+	return;
+	
+	chiamaISR(TIMER2_COMPA_vect);
+	
+	while((TIMSK2 & (1<<OCIE2B)) && fronti++ < 64){
+		TCNT2 = OCR2B;
+		chiamaISR(TIMER2_COMPB_vect);
+	}
+	
+	TCNT2 = 0;
+	
+}
+
+//EEPROM: lettura immediata e scrittura che termina dopo EEPROM_SCRITTURA_MS. Come sulla scheda, l'interrupt di EEPROM pronta
+//continua ad arrivare finchè EERIE è a '1' e non c'è una scrittura in corso.
+void hal_linux_eeprom_leggi(void){
+	
+	EECR &= ~(1<<EERE);
+	EEDR = eeprom[EEAR & E2END];
+	
+}
+
+void hal_linux_eeprom_scrivi(void){
+	
+	FILE *f;
+	
+	EECR = (EECR & ~(1<<EEMPE)) | (1<<EEPE);
+	eeprom[EEAR & E2END] = EEDR;
+	eepromAttesa = EEPROM_SCRITTURA_MS;
+	
+	if(eepromFile && (f = fopen(eepromFile, "wb"))){
+		fwrite(eeprom, 1, sizeof(eeprom), f);
+		fclose(f);
+	}
+	
+}
+
+static void eepromAvanza(void){
+	
+	if(eepromAttesa && --eepromAttesa == 0)
+	EECR &= ~(1<<EEPE);
+	
+	if((EECR & (1<<EERIE)) && !(EECR & (1<<EEPE)))
+	chiamaISR(EE_READY_vect);
+	
+}
+
+//ADC: con l'avvio automatico c'è una conversione per millisecondo simulato (sulla scheda una per periodo del PWM),
+//con il valore di adcIngresso. Il segnale di avvio scelto dal firmware non viene simulato.
+static void adc(void){
+	
+	if((PRR & (1<<PRADC)) || !(ADCSRA & (1<<ADEN)) || !(ADCSRA & (1<<ADATE)))
+	return;
+	
+	ADC = (ADMUX & (1<<ADLAR)) ? adcIngresso << 6 : adcIngresso;
+	
+	if(ADCSRA & (1<<ADIE))
+	chiamaISR(ADC_vect);
+	else
+	ADCSRA |= (1<<ADIF);
+	
+}
+
+static void millisecondo(void){
+	
+	millisecondiSimulati++;
+	timer0();
+	timer1();
+	timer2();
+	adc();
+	eepromAvanza();
+	
+}
+
+//Cambia un pin di ingresso e, se il pin change è abilitato, chiama la sua ISR.
+static void cambiaPin(volatile uint8_t *pin, unsigned char bit, unsigned char livello){
+	
+	if(((*pin >> bit) & 1) == livello)
+	return;
+	
+	*pin ^= (1<<bit);
+	
+	if(pin == &PINB && (PCICR & (1<<PCIE0)) && (PCMSK0 & (1<<bit)))
+	chiamaISR(PCINT0_vect);
+	else if(pin == &PINC && (PCICR & (1<<PCIE1)) && (PCMSK1 & (1<<bit)))
+	chiamaISR(PCINT1_vect);
+	else if(pin == &PIND && (PCICR & (1<<PCIE2)) && (PCMSK2 & (1<<bit)))
+	chiamaISR(PCINT2_vect);
+	
+}
+
+//----------------------MODALITA' PTY------------------------
+
+//SIGUSR1: il rotore si blocca e la corrente va al fondo scala dell'ADC, oppure torna a 0.
+static void rotoreBloccato(int segnale){
+	
+	(void) segnale;
+	adcIngresso = adcIngresso ? 0 : 1023;
+	
+}
+
+//SIGUSR2: il pulsante viene premuto e rilasciato al prossimo millisecondo simulato, fuori dal gestore del segnale.
+static volatile sig_atomic_t pulsanteDaPremere;
+
+static void premiPulsante(int segnale){
+	
+	(void) segnale;
+	pulsanteDaPremere = 1;
+	
+}
+
+static void ptyApri(void){
+	
+	struct termios t;
+	char *nome;
+	int slave;
+	
+	ptyMaster = posix_openpt(O_RDWR | O_NOCTTY);
+	if(ptyMaster < 0 || grantpt(ptyMaster) || unlockpt(ptyMaster) || !(nome = ptsname(ptyMaster))){
+		perror("pty");
+		exit(2);
+	}
+	
+	//Il lato del terminale resta aperto in modalità raw: così la pty è valida anche quando nessun programma è collegato.
+	slave = open(nome, O_RDWR | O_NOCTTY);
+	if(slave >= 0 && !tcgetattr(slave, &t)){
+		cfmakeraw(&t);
+		tcsetattr(slave, TCSANOW, &t);
+	}
+	
+	fcntl(ptyMaster, F_SETFL, O_NONBLOCK);
+	fprintf(stderr, "Seriale simulata su %s\n", nome);
+	
+	signal(SIGUSR1, rotoreBloccato);
+	fprintf(stderr, "kill -USR1 %d blocca o sblocca il rotore (corrente oltre il fondo scala o nulla)\n", (int) getpid());
+	signal(SIGUSR2, premiPulsante);
+	fprintf(stderr, "kill -USR2 %d preme il pulsante della priorità tra locale e remoto\n", (int) getpid());
+	
+}
+
+static unsigned long long orologioMs(void){
+	
+	struct timespec t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
+	return (unsigned long long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+	
+}
+
+//Legge dalla pty i byte inviati dal terminale e fa passare i millisecondi trascorsi davvero.
+static void aggiornaPty(void){
+	
+	static unsigned long long precedente;
+	static double creditoRx, creditoTx;
+	unsigned char buf[256];
+	unsigned long long adesso = orologioMs();
+	unsigned int ms;
+	ssize_t n;
+	
+	if(precedente == 0)
+	precedente = adesso;
+	
+	if(ingressoTesta == ingressoCoda && (n = read(ptyMaster, buf, sizeof(buf))) > 0)
+	accoda(buf, n);
+	
+	ms = adesso - precedente;
+	if(ms == 0){
+		usleep(200);
+		return;
+	}
+	if(ms > 100)
+	ms = 100;
+	precedente = adesso;
+	
+	while(ms--){
+		if(pulsanteDaPremere){
+			pulsanteDaPremere = 0;
+			cambiaPin(&PINB, PINB7, 0);
+			cambiaPin(&PINB, PINB7, 1);
+		}
+		
+		creditoRx += byteAlMillisecondo();
+		creditoTx += byteAlMillisecondo();
+		usartRicevi(&creditoRx);
+		millisecondo();
+		usartTrasmetti(&creditoTx);
+		
+		//Senza byte da trasmettere o da ricevere il credito non si accumula, come una linea ferma.
+		if(ingressoTesta == ingressoCoda && creditoRx > 1)
+		creditoRx = 1;
+		if(!(UCSR0B & (1<<UDRIE0)) && creditoTx > 1)
+		creditoTx = 1;
+	}
+	
+	scriviPty();
+	
+}
+
+//----------------------BENCH------------------------
+
+static const char *comandiBench[] = {
+	"set 42.5", "up", "down", "step +5", "set 30 2", "step -2.5 2", "up 3", "freq 1000", "modo pc", "modo fast",
+	"set 0", "set 50; up; down", "pippo"
+};
+#define N_COMANDI_BENCH (sizeof(comandiBench) / sizeof(comandiBench[0]))
+
+static long benchN = BENCH_N;
+
+static double secondi(void){
+	
+	struct timespec t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
+	return t.tv_sec + t.tv_nsec / 1e9;
+	
+}
+
+static void stampaRisultato(const char *nome, long comandi, unsigned long byteRichiesta, unsigned long byteRisposta, double tempo){
+	
+	double perComando = (double) (byteRichiesta + byteRisposta) / comandi;
+	
+	printf("%s: %ld comandi in %.3f s, %.0f comandi/s; byte per comando: %.1f inviati + %.1f ricevuti",
+	nome, comandi, tempo, comandi / tempo, (double) byteRichiesta / comandi, (double) byteRisposta / comandi);
+	printf(" (a 9600 baud al massimo %.0f comandi/s)\n", 960.0 / perComando);
+	
+}
+
+//Un comando alla volta: il successivo parte quando è arrivata la risposta, come farebbe un programma sull'host.
+//Prima si passa alla modalità macchina (una sola riga di risposta per ogni riga di comandi) e si aspetta la fine del benvenuto.
+static void aggiornaBench(void){
+	
+	static enum {AVVIO, TESTO, BINARIO} fase = AVVIO;
+	static long inviati;
+	static unsigned long attese, byteRichiesta;
+	static unsigned long long fineAvvio;
+	static double inizio;
+	struct frameProtocollo f;
+	unsigned char buf[PROTO_MAX_FRAME];
+	unsigned char n;
+	const char *riga;
+	double credito = 1e9;
+	
+	usartRicevi(&credito);
+	millisecondo();
+	usartTrasmetti(&credito);
+	
+	if(ingressoTesta != ingressoCoda)
+	return;
+	
+	switch(fase){
+		
+		case AVVIO:
+		if(fineAvvio == 0){
+			accodaRiga("macchina 1");
+			fineAvvio = millisecondiSimulati + 100;
+		}
+		else if(millisecondiSimulati >= fineAvvio && !(UCSR0B & (1<<UDRIE0))){
+			fase = TESTO;
+			attese = righeRicevute;
+			byteRicevuti = 0;
+			inizio = secondi();
+		}
+		break;
+		
+		case TESTO:
+		if(righeRicevute < attese)
+		break;
+		if(inviati == benchN){
+			stampaRisultato("testo", inviati, byteRichiesta, byteRicevuti, secondi() - inizio);
+			fase = BINARIO;
+			inviati = 0;
+			attese = frameRicevuti;
+			byteRichiesta = 0;
+			byteRicevuti = 0;
+			inizio = secondi();
+			break;
+		}
+		riga = comandiBench[inviati % N_COMANDI_BENCH];
+		accodaRiga(riga);
+		byteRichiesta += strlen(riga) + 1;
+		attese = righeRicevute + 1;
+		inviati++;
+		break;
+		
+		case BINARIO: //Frame di impostazione del duty cycle e di lettura dello stato, alternati.
+		if(frameRicevuti < attese)
+		break;
+		if(inviati == benchN){
+			stampaRisultato("binario", inviati, byteRichiesta, byteRicevuti, secondi() - inizio);
+			exit(0);
+		}
+		memset(&f, 0, sizeof(f));
+		f.opcode = (inviati & 1) ? OP_LEGGI_STATO : OP_IMPOSTA_DC;
+		if(f.opcode == OP_IMPOSTA_DC){
+			f.lunghezza = 2;
+			proto_scrivi16(f.payload, (inviati * 7) % 1001);
+		}
+		n = proto_encode(buf, &f);
+		accoda(buf, n);
+		byteRichiesta += n;
+		attese = frameRicevuti + 1;
+		inviati++;
+		break;
+	}
+	
+}
+
+//----------------------FUZZ------------------------
+
+static unsigned long fuzzSemeIniziale = 1, fuzzSeme;
+static long fuzzN = FUZZ_N;
+
+static unsigned int casuale(unsigned int n){
+	
+	fuzzSeme = fuzzSeme * 1103515245UL + 12345UL;
+	
+	return (unsigned int) ((fuzzSeme >> 16) & 0x7FFF) % n;
+	
+}
+
+static const char *paroleFuzz[] = {
+	"set", "up", "down", "step", "freq", "modo", "rampa", "rpm", "macchina", "baud", "telemetria", "stats",
+	"corrente", "reset", "programma", "avvia", "stop", "ciclo", "gradini", "salva", "priorita", "locale", "remoto", "timeout",
+	"fast", "pc", "lin", "s", "auto", "0", "1", "2", "7", "42.5", "100", "1000", "57600", "-3", "+5", "99999", ";", "x"
+};
+#define N_PAROLE_FUZZ (sizeof(paroleFuzz) / sizeof(paroleFuzz[0]))
+
+//Pin del pulsante e dei dip switch: PB7, PB2, PC0-PC3, PD2, PD3, PD4, PD7.
+static volatile uint8_t *const pinFuzz[] = {&PINB, &PINB, &PINC, &PINC, &PINC, &PINC, &PIND, &PIND, &PIND, &PIND};
+static const unsigned char bitFuzz[] = {7, 2, 0, 1, 2, 3, 2, 3, 4, 7};
+
+static void bloccoFuzz(void){
+	
+	struct frameProtocollo f;
+	unsigned char buf[PROTO_MAX_FRAME + 40];
+	char riga[80];
+	unsigned int i, n;
+	
+	switch(casuale(6)){
+		
+		case 0: //Riga di parole dei comandi, spesso valida.
+		riga[0] = '\0';
+		n = 1 + casuale(4);
+		for(i = 0; i < n && strlen(riga) < 50; i++){
+			if(i)
+			strcat(riga, " ");
+			strcat(riga, paroleFuzz[casuale(N_PAROLE_FUZZ)]);
+		}
+		accodaRiga(riga);
+		break;
+		
+		case 1: //Riga di caratteri stampabili, anche lunga.
+		n = casuale(sizeof(riga) - 1);
+		for(i = 0; i < n; i++)
+		riga[i] = ' ' + casuale(95);
+		riga[n] = '\0';
+		accodaRiga(riga);
+		break;
+		
+		case 2: //Byte qualunque, compresi SYNC e caratteri non stampabili.
+		n = 1 + casuale(sizeof(buf) - 1);
+		for(i = 0; i < n; i++)
+		buf[i] = casuale(256);
+		accoda(buf, n);
+		break;
+		
+		case 3: //Frame binario con CRC corretto e campi casuali.
+		f.opcode = casuale(5);
+		f.canale = casuale(9);
+		f.lunghezza = casuale(4);
+		for(i = 0; i < f.lunghezza; i++)
+		f.payload[i] = casuale(256);
+		accoda(buf, proto_encode(buf, &f));
+		break;
+		
+		case 4: //Corrente del motore: spesso bassa, a volte oltre ogni soglia (fa scattare la protezione).
+		adcIngresso = casuale(4) ? casuale(256) : casuale(1024);
+		break;
+		
+		default: //Pulsante o dip switch.
+		i = casuale(sizeof(bitFuzz));
+		if(i == 0){
+			cambiaPin(pinFuzz[0], bitFuzz[0], 0);
+			cambiaPin(pinFuzz[0], bitFuzz[0], 1);
+		}
+		else
+		cambiaPin(pinFuzz[i], bitFuzz[i], casuale(2));
+		break;
+	}
+	
+}
+
+static void erroreFuzz(long blocco, const char *messaggio){
+	
+	fprintf(stderr, "fuzz: seme %lu, blocco %ld: %s\n", fuzzSemeIniziale, blocco, messaggio);
+	exit(1);
+	
+}
+
+//Dopo ogni blocco: pausa più lunga del timeout dei frame, poi OP_LEGGI_STATO finchè non arriva la risposta.
+static void aggiornaFuzz(void){
+	
+	static enum {BLOCCO, PAUSA, VERIFICA} fase = BLOCCO;
+	static long blocco;
+	static unsigned long long attesa, inizioVerifica;
+	static unsigned long frameAttesi;
+	struct frameProtocollo f;
+	unsigned char buf[PROTO_MAX_FRAME];
+	double credito = 1e9;
+	
+	usartRicevi(&credito);
+	millisecondo();
+	usartTrasmetti(&credito);
+	
+	switch(fase){
+		
+		case BLOCCO:
+		if(blocco == fuzzN){
+			printf("fuzz: %ld blocchi senza errori\n", fuzzN);
+			exit(0);
+		}
+		bloccoFuzz();
+		attesa = millisecondiSimulati + FUZZ_PAUSA_MS + casuale(20);
+		fase = PAUSA;
+		break;
+		
+		case PAUSA:
+		if(millisecondiSimulati < attesa || ingressoTesta != ingressoCoda)
+		break;
+		inizioVerifica = millisecondiSimulati;
+		attesa = 0;
+		fase = VERIFICA;
+		//Fallthrough - nessuna break: si invia subito la verifica.
+		
+		case VERIFICA:
+		if(frameRicevuti > frameAttesi && ultimoFrame.opcode == (OP_LEGGI_STATO | PROTO_RISPOSTA) && ultimoFrame.canale == 0){
+			if(ultimoFrame.lunghezza != 7 || proto_leggi16(ultimoFrame.payload) > 1000 || ultimoFrame.payload[2] > 1
+			|| ultimoFrame.payload[3] > 1 || ultimoFrame.payload[4] > 1)
+			erroreFuzz(blocco, "stato del canale non valido");
+			blocco++;
+			fase = BLOCCO;
+			break;
+		}
+		if(millisecondiSimulati - inizioVerifica > FUZZ_ATTESA_MS)
+		erroreFuzz(blocco, "il firmware non risponde");
+		if(millisecondiSimulati >= attesa){ //Ogni 200 ms si riprova: il frame può essere finito in mezzo a una riga scartata.
+			memset(&f, 0, sizeof(f));
+			f.opcode = OP_LEGGI_STATO;
+			frameAttesi = frameRicevuti;
+			accoda(buf, proto_encode(buf, &f));
+			attesa = millisecondiSimulati + 200;
+		}
+		break;
+	}
+	
+}
+
+//----------------------HAL------------------------
+
+void hal_linux_aggiorna(void){
+	
+	static char inCorso;
+	
+	UCSR0A |= (1<<UDRE0); //Il registro dati è sempre libero: i byte escono subito da hal_linux_trasmetti().
+	
+	//Con gli interrupt disabilitati le ISR aspettano; hal_linux_aggiorna() non deve chiamare se stessa attraverso le ISR.
+	if(!(SREG & (1<<SREG_I)) || inCorso)
+	return;
+	
+	inCorso = 1;
+	
+	if(modo == MODO_PTY)
+	aggiornaPty();
+	else if(modo == MODO_BENCH)
+	aggiornaBench();
+	else
+	aggiornaFuzz();
+	
+	inCorso = 0;
+	
+}
+
+int main(int argc, char **argv){
+	
+	FILE *f;
+	
+	if(argc >= 2 && !strcmp(argv[1], "bench")){
+		modo = MODO_BENCH;
+		if(argc >= 3)
+		benchN = atol(argv[2]);
+	}
+	else if(argc >= 2 && !strcmp(argv[1], "fuzz")){
+		modo = MODO_FUZZ;
+		if(argc >= 3)
+		fuzzSemeIniziale = strtoul(argv[2], NULL, 0);
+		if(argc >= 4)
+		fuzzN = atol(argv[3]);
+	}
+	else if(argc <= 2){
+		modo = MODO_PTY;
+		ptyApri();
+		if(argc == 2)
+		eepromFile = argv[1];
+	}
+	else{
+		fprintf(stderr, "uso: pwm_linux [file EEPROM] | pwm_linux bench [n] | pwm_linux fuzz [seme] [n]\n");
+		return 2;
+	}
+	
+	//EEPROM vuota, oppure il contenuto salvato dall'esecuzione precedente.
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	if(eepromFile && (f = fopen(eepromFile, "rb"))){
+		if(fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom))
+		fprintf(stderr, "%s: file EEPROM incompleto\n", eepromFile);
+		fclose(f);
+	}
+	
+	//Ingressi con il pull-up attivo: pulsante rilasciato e dip switch aperti leggono '1'.
+	PINB = PINC = PIND = 0xFF;
+	fuzzSeme = fuzzSemeIniziale;
+	UCSR0A = (1<<UDRE0);
+	
+	return firmware_main();
+	
+}
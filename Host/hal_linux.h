@@ -0,0 +1,265 @@
+/*************************************************************************************************************
+-----------------------------------HAL: REGISTRI SIMULATI SU LINUX--------------------------------------------
+Incluso da hal.h quando il firmware non viene compilato con avr-gcc. I registri dell'ATmega328P diventano variabili
+in memoria (definite in Host/hal_linux.c) con gli stessi nomi e gli stessi bit, le ISR diventano funzioni normali
+che il simulatore chiama quando la periferica simulata lo richiede, e la memoria flash è la memoria normale.
+
+Differenze da tenere presenti rispetto alla scheda:
+-int e unsigned int sono a 32 bit e non a 16: i conteggi che sulla scheda ripartono da 0 dopo 65535 qui continuano;
+-le ISR vengono eseguite solo dentro hal_aggiorna(), mai a metà di un'istruzione del main;
+-il main del firmware si chiama firmware_main(), perchè il main() del programma è quello del simulatore.
+*************************************************************************************************************/
+#ifndef HAL_LINUX_H_
+#define HAL_LINUX_H_
+
+#include <stdint.h>
+#include <string.h>
+
+//Elenco dei registri simulati: la stessa lista serve per le dichiarazioni (qui) e per le definizioni (hal_linux.c).
+#define HAL_REGISTRI(R8, R16) \
+	R8(DDRB) R8(DDRC) R8(DDRD) R8(PORTB) R8(PORTC) R8(PORTD) R8(PINB) R8(PINC) R8(PIND) \
+	R8(PCICR) R8(PCMSK0) R8(PCMSK1) R8(PCMSK2) R8(PCIFR) \
+	R8(TCCR0A) R8(TCCR0B) R8(TCNT0) R8(OCR0A) R8(OCR0B) R8(TIMSK0) R8(TIFR0) \
+	R8(TCCR1A) R8(TCCR1B) R8(TCCR1C) R16(TCNT1) R16(OCR1A) R16(OCR1B) R16(ICR1) R8(TIMSK1) R8(TIFR1) \
+	R8(TCCR2A) R8(TCCR2B) R8(TCNT2) R8(OCR2A) R8(OCR2B) R8(TIMSK2) R8(TIFR2) \
+	R8(UCSR0A) R8(UCSR0B) R8(UCSR0C) R16(UBRR0) R8(UDR0) \
+	R8(SREG) R8(SMCR) R8(PRR) R8(MCUCR) \
+	R8(ADMUX) R8(ADCSRA) R8(ADCSRB) R16(ADC) R8(DIDR0) R8(ACSR) \
+	R8(EECR) R8(EEDR) R16(EEAR) \
+	R8(GTCCR)
+
+#define HAL_EXTERN8(nome) extern volatile uint8_t nome;
+#define HAL_EXTERN16(nome) extern volatile uint16_t nome;
+HAL_REGISTRI(HAL_EXTERN8, HAL_EXTERN16)
+#define R8(n) extern volatile uint8_t n;
+#define R16(n) extern volatile uint16_t n;
+
+//Stato.
+#define SREG_I 7
+
+//Porte.
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDC4 4
+#define DDC5 5
+#define DDD5 5
+#define DDD6 6
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTB7 7
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+
+//Pin change.
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define PCINT7 7
+#define PCINT8 0
+#define PCINT9 1
+#define PCINT10 2
+#define PCINT11 3
+#define PCINT16 0
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT23 7
+
+//Timer 0.
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+
+//Timer 1.
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define ICIE1 5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+#define ICF1 5
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+
+//Timer 2.
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM21 1
+#define WGM20 0
+#define WGM22 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2 0
+#define OCF2B 2
+#define OCF2A 1
+#define TOV2 0
+
+//USART.
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UPM01 5
+#define UPM00 4
+#define UCSZ01 2
+#define UCSZ00 1
+
+//Sleep e riduzione dei consumi.
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define PRTWI 7
+#define PRTIM2 6
+#define PRTIM0 5
+#define PRTIM1 3
+#define PRSPI 2
+#define PRUSART0 1
+#define PRADC 0
+
+//Comparatore analogico.
+#define ACD 7
+
+//ADC.
+#define REFS0 6
+#define ADLAR 5
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+#define ADCH ((uint8_t) (ADC >> 8)) //Parte alta del risultato: con ADLAR a '1' sono gli 8 bit più significativi.
+
+//EEPROM.
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+#define E2END 0x3FF
+
+//Interrupt: sei() e cli() agiscono sul bit I di SREG, che il simulatore controlla prima di chiamare una ISR.
+#define ISR(vettore) void vettore(void)
+#define sei() (SREG |= (1<<SREG_I))
+#define cli() (SREG &= ~(1<<SREG_I))
+
+//Memoria flash: su Linux le costanti restano nella memoria normale. Le letture a 16 e 32 bit usano il tipo del dato,
+//perchè unsigned int e unsigned long qui sono più larghi che sulla scheda.
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(p))
+#define pgm_read_dword(p) (*(p))
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+
+//Operazioni con un effetto oltre al valore del registro (vedi hal.h).
+void hal_linux_trasmetti(uint8_t);
+void hal_linux_aggiorna(void);
+void hal_linux_eeprom_leggi(void);
+void hal_linux_eeprom_scrivi(void);
+#define hal_usart_scrivi(c) hal_linux_trasmetti(c)
+#define hal_aggiorna() hal_linux_aggiorna()
+#define hal_eeprom_leggi() hal_linux_eeprom_leggi()
+#define hal_eeprom_scrivi() hal_linux_eeprom_scrivi()
+
+//Sleep (avr/sleep.h). La CPU dorme fino al prossimo interrupt: su Linux sleep_cpu() fa avanzare le periferiche simulate,
+//che chiamano le ISR, come se il tempo passasse mentre la CPU è ferma.
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(m) (SMCR = (SMCR & ~((1<<SM2)|(1<<SM1)|(1<<SM0))) | (m))
+#define sleep_enable() (SMCR |= (1<<SE))
+#define sleep_disable() (SMCR &= ~(1<<SE))
+#define sleep_cpu() hal_linux_aggiorna()
+
+#define main firmware_main
+
+#endif /* HAL_LINUX_H_ */
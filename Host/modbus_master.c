@@ -0,0 +1,402 @@
+/*************************************************************************************************************
+------------------------------------MASTER MODBUS RTU DI PROVA PER L'HOST-------------------------------------
+Fa da master Modbus RTU verso la scheda, oppure verso il firmware simulato da pwm_linux sulla sua pty, usando il CRC,
+i registri e le costanti di modbus.h. Serve per provare lo slave del firmware senza un PLC.
+La fine di una risposta si riconosce dalla lunghezza attesa (nota dalla funzione), non dal silenzio: sul PC i tempi
+della seriale USB non sono abbastanza precisi per misurare 3.5 caratteri.
+
+Compilazione:	gcc -Wall -I.. -o modbus_master modbus_master.c
+Uso:
+	modbus_master [-b baud] [-n] <seriale> leggi <indirizzo> holding|input <registro> [n]
+						legge n registri (predefinito 1) e li stampa, uno per riga
+	modbus_master [-b baud] [-n] <seriale> scrivi <indirizzo> <registro> <valore> [valore...]
+						scrive un registro (funzione 0x06) o più registri consecutivi (funzione 0x10)
+	modbus_master [-b baud] [-n] <seriale> bench <indirizzo> [n]
+						invia n richieste (predefinito 1000) una dopo l'altra: scrittura del duty cycle,
+						rilettura degli holding register e lettura degli input register. Controlla ogni
+						risposta e stampa i tempi di risposta visti dal PC e quello massimo misurato dalla scheda
+	modbus_master crc			confronta la tabella del CRC-16 con il calcolo bit per bit
+-b sceglie il baud rate (predefinito 115200), -n toglie la parità (come MODBUS_PARITA 0 nel firmware).
+Esempio con pwm_linux (la scheda parte a 9600 baud con i comandi testuali):
+	echo "baud 115200" > /dev/pts/3; echo "modbus 1" > /dev/pts/3
+	modbus_master /dev/pts/3 bench 1 10000
+In caso di errore l'uscita è 1.
+*************************************************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "modbus.h"
+
+#define MASTER_TIMEOUT_MS 200 //Tempo massimo di attesa di una risposta.
+#define BENCH_N 1000
+#define BENCH_DUTY_MAX 1000 //Duty cycle massimo in decimi di percento (DC_MAX nel firmware).
+
+static int seriale = -1;
+static speed_t velocita = B115200;
+static int parita = 1;
+
+static void uso(void){
+
+	fprintf(stderr, "uso: modbus_master [-b baud] [-n] <seriale> leggi <ind> holding|input <reg> [n] | scrivi <ind> <reg> <valore>... | bench <ind> [n]\n");
+	fprintf(stderr, "     modbus_master crc\n");
+	exit(2);
+
+}
+
+static double secondi(void){
+
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+
+}
+
+//Baud rate in costante di termios. Restituisce 0 se il valore non è tra quelli standard.
+static speed_t velocitaTermios(long baud){
+
+	static const long valori[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 500000, 1000000};
+	static const speed_t costanti[] = {B1200, B2400, B4800, B9600, B19200, B38400, B57600, B115200, B230400, B500000, B1000000};
+	unsigned int i;
+
+	for(i = 0; i < sizeof(valori) / sizeof(valori[0]); i++)
+	if(valori[i] == baud)
+	return costanti[i];
+
+	return 0;
+
+}
+
+//Apre la seriale in modalità raw, 8 bit con parità pari (8E1) oppure senza (8N1).
+static void apri(const char *nome){
+
+	struct termios t;
+
+	seriale = open(nome, O_RDWR | O_NOCTTY);
+	if(seriale < 0){
+		perror(nome);
+		exit(2);
+	}
+
+	if(!tcgetattr(seriale, &t)){
+		cfmakeraw(&t);
+		cfsetspeed(&t, velocita);
+		t.c_cflag |= CLOCAL | CREAD;
+		if(parita)
+		t.c_cflag |= PARENB;
+		else
+		t.c_cflag &= ~PARENB;
+		t.c_cflag &= ~(PARODD | CSTOPB);
+		tcsetattr(seriale, TCSANOW, &t);
+	}
+
+}
+
+//Legge n byte entro la scadenza (in secondi, da secondi()). Restituisce i byte letti.
+static int leggi(unsigned char *buf, int n, double scadenza){
+
+	struct pollfd p = {seriale, POLLIN, 0};
+	int letti = 0;
+	int attesa;
+	ssize_t r;
+
+	while(letti < n){
+		attesa = (scadenza - secondi()) * 1000;
+		if(attesa <= 0 || poll(&p, 1, attesa) <= 0)
+		break;
+
+		r = read(seriale, buf + letti, n - letti);
+		if(r <= 0)
+		break;
+		letti += r;
+	}
+
+	return letti;
+
+}
+
+//Esito di una transazione.
+enum esitoMaster {MASTER_OK, MASTER_TIMEOUT, MASTER_CRC, MASTER_FORMATO, MASTER_ECCEZIONE};
+static const char *nomiEsito[] = {"ok", "nessuna risposta", "CRC sbagliato", "risposta non valida", "eccezione"};
+
+//Invia la richiesta (senza CRC, che viene aggiunto qui) e riceve la risposta in risposta.
+//La lunghezza attesa di una risposta normale dipende dalla funzione; un'eccezione è lunga 5 byte.
+static int transazione(unsigned char *richiesta, unsigned char n, unsigned char *risposta, unsigned char *eccezione){
+
+	unsigned char attesi;
+	unsigned char funzione = richiesta[1];
+	double scadenza;
+
+	n = modbus_chiudi(richiesta, n);
+	tcflush(seriale, TCIFLUSH);
+	if(write(seriale, richiesta, n) != n)
+	return MASTER_TIMEOUT;
+
+	scadenza = secondi() + MASTER_TIMEOUT_MS / 1000.0;
+	if(leggi(risposta, 2, scadenza) != 2)
+	return MASTER_TIMEOUT;
+
+	if(risposta[0] != richiesta[0] || (risposta[1] & ~MODBUS_ECCEZIONE) != funzione)
+	return MASTER_FORMATO;
+
+	if(risposta[1] & MODBUS_ECCEZIONE)
+	attesi = 5;
+	else if(funzione == MB_LEGGI_HOLDING || funzione == MB_LEGGI_INPUT)
+	attesi = 5 + 2 * modbus_leggi16(richiesta + 4);
+	else
+	attesi = 8;
+
+	if(leggi(risposta + 2, attesi - 2, scadenza) != attesi - 2)
+	return MASTER_TIMEOUT;
+
+	if(modbus_crc(risposta, attesi - 2) != (unsigned int) (risposta[attesi - 2] | (risposta[attesi - 1] << 8)))
+	return MASTER_CRC;
+
+	if(risposta[1] & MODBUS_ECCEZIONE){
+		*eccezione = risposta[2];
+		return MASTER_ECCEZIONE;
+	}
+
+	//Le risposte alle letture hanno il numero di byte, quelle alle scritture ripetono i primi 4 byte dei dati.
+	if(funzione == MB_LEGGI_HOLDING || funzione == MB_LEGGI_INPUT){
+		if(risposta[2] != attesi - 5)
+		return MASTER_FORMATO;
+	}
+	else if(memcmp(risposta + 2, richiesta + 2, 4))
+	return MASTER_FORMATO;
+
+	return MASTER_OK;
+
+}
+
+//Prepara una lettura di n registri a partire da registro.
+static unsigned char lettura(unsigned char *buf, unsigned char indirizzo, unsigned char funzione, unsigned int registro, unsigned int n){
+
+	buf[0] = indirizzo;
+	buf[1] = funzione;
+	modbus_scrivi16(buf + 2, registro);
+	modbus_scrivi16(buf + 4, n);
+
+	return 6;
+
+}
+
+//Prepara la scrittura di n valori a partire da registro: funzione 0x06 con un valore, 0x10 con più valori.
+static unsigned char scrittura(unsigned char *buf, unsigned char indirizzo, unsigned int registro, const unsigned int *valori, unsigned int n){
+
+	unsigned char i;
+
+	buf[0] = indirizzo;
+	modbus_scrivi16(buf + 2, registro);
+
+	if(n == 1){
+		buf[1] = MB_SCRIVI_REGISTRO;
+		modbus_scrivi16(buf + 4, valori[0]);
+		return 6;
+	}
+
+	buf[1] = MB_SCRIVI_REGISTRI;
+	modbus_scrivi16(buf + 4, n);
+	buf[6] = 2 * n;
+	for(i = 0; i < n; i++)
+	modbus_scrivi16(buf + 7 + 2 * i, valori[i]);
+
+	return 7 + 2 * n;
+
+}
+
+static int controlla(int esito, unsigned char eccezione){
+
+	if(esito == MASTER_OK)
+	return 0;
+
+	if(esito == MASTER_ECCEZIONE)
+	fprintf(stderr, "eccezione %u\n", eccezione);
+	else
+	fprintf(stderr, "%s\n", nomiEsito[esito]);
+
+	return 1;
+
+}
+
+static int comandoLeggi(int argc, char **argv){
+
+	unsigned char richiesta[MODBUS_MAX_FRAME], risposta[MODBUS_MAX_FRAME];
+	unsigned char funzione, eccezione = 0;
+	unsigned int registro, n, i;
+	int esito;
+
+	if(argc < 3 || argc > 4)
+	uso();
+
+	funzione = !strcmp(argv[1], "input") ? MB_LEGGI_INPUT : MB_LEGGI_HOLDING;
+	registro = atoi(argv[2]);
+	n = argc == 4 ? atoi(argv[3]) : 1;
+	if(n == 0 || n > MODBUS_MAX_REGISTRI)
+	uso();
+
+	esito = transazione(richiesta, lettura(richiesta, atoi(argv[0]), funzione, registro, n), risposta, &eccezione);
+	if(controlla(esito, eccezione))
+	return 1;
+
+	for(i = 0; i < n; i++)
+	printf("%u %u\n", registro + i, modbus_leggi16(risposta + 3 + 2 * i));
+
+	return 0;
+
+}
+
+static int comandoScrivi(int argc, char **argv){
+
+	unsigned char richiesta[MODBUS_MAX_FRAME], risposta[MODBUS_MAX_FRAME];
+	unsigned char eccezione = 0;
+	unsigned int valori[MODBUS_MAX_REGISTRI];
+	unsigned int n, i;
+	int esito;
+
+	if(argc < 3 || argc - 2 > MODBUS_MAX_REGISTRI)
+	uso();
+
+	n = argc - 2;
+	for(i = 0; i < n; i++)
+	valori[i] = atoi(argv[2 + i]);
+
+	esito = transazione(richiesta, scrittura(richiesta, atoi(argv[0]), atoi(argv[1]), valori, n), risposta, &eccezione);
+
+	return controlla(esito, eccezione);
+
+}
+
+//Richieste una dopo l'altra, come un PLC che interroga la scheda di continuo. Ogni terzo passo rilegge il duty cycle
+//appena scritto. Alla fine legge il tempo di risposta massimo misurato dalla scheda (dall'ultimo byte ricevuto).
+static int comandoBench(int argc, char **argv){
+
+	unsigned char richiesta[MODBUS_MAX_FRAME], risposta[MODBUS_MAX_FRAME];
+	unsigned char indirizzo, eccezione = 0;
+	long n, i, errori[MASTER_ECCEZIONE + 1] = {0}, diversi = 0;
+	unsigned int duty = 0;
+	double inizio, tempo, minimo = 1e9, massimo = 0, totale;
+	int esito;
+
+	if(argc < 1 || argc > 2)
+	uso();
+
+	indirizzo = atoi(argv[0]);
+	n = argc == 2 ? atol(argv[1]) : BENCH_N;
+
+	totale = secondi();
+	for(i = 0; i < n; i++){
+
+		inizio = secondi();
+		switch(i % 3){
+			case 0:
+			duty = (duty + 37) % (BENCH_DUTY_MAX + 1);
+			esito = transazione(richiesta, scrittura(richiesta, indirizzo, MB_HR_DUTY, &duty, 1), risposta, &eccezione);
+			break;
+
+			case 1:
+			esito = transazione(richiesta, lettura(richiesta, indirizzo, MB_LEGGI_HOLDING, 0, MB_N_HOLDING), risposta, &eccezione);
+			if(esito == MASTER_OK && modbus_leggi16(risposta + 3 + 2 * MB_HR_DUTY) != duty)
+			diversi++;
+			break;
+
+			default:
+			esito = transazione(richiesta, lettura(richiesta, indirizzo, MB_LEGGI_INPUT, 0, MB_N_INPUT), risposta, &eccezione);
+			break;
+		}
+		tempo = secondi() - inizio;
+
+		errori[esito]++;
+		if(esito == MASTER_OK){
+			if(tempo < minimo)
+			minimo = tempo;
+			if(tempo > massimo)
+			massimo = tempo;
+		}
+	}
+	totale = secondi() - totale;
+
+	printf("bench: %ld richieste in %.3f s, %.0f richieste/s; risposta vista dal PC: minimo %.2f ms, media %.2f ms, massimo %.2f ms\n",
+	n, totale, n / totale, minimo * 1000, totale / n * 1000, massimo * 1000);
+	for(esito = MASTER_TIMEOUT; esito <= MASTER_ECCEZIONE; esito++)
+	if(errori[esito])
+	printf("bench: %ld richieste con esito \"%s\"\n", errori[esito], nomiEsito[esito]);
+	if(diversi)
+	printf("bench: %ld letture del duty cycle diverse dal valore scritto\n", diversi);
+
+	if(transazione(richiesta, lettura(richiesta, indirizzo, MB_LEGGI_INPUT, MB_IR_RICHIESTE, 2), risposta, &eccezione) == MASTER_OK)
+	printf("bench: la scheda ha contato %u richieste e %u frame scartati\n", modbus_leggi16(risposta + 3), modbus_leggi16(risposta + 5));
+	if(transazione(richiesta, lettura(richiesta, indirizzo, MB_LEGGI_INPUT, MB_IR_RISPOSTA_MAX, 1), risposta, &eccezione) == MASTER_OK)
+	printf("bench: tempo di risposta massimo misurato dalla scheda %u us\n", modbus_leggi16(risposta + 3));
+
+	return errori[MASTER_OK] != n || diversi;
+
+}
+
+//Controlla la tabella di modbus.h con l'algoritmo bit per bit e con il valore di prova dello standard.
+static int comandoCRC(void){
+
+	static const unsigned char prova[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	unsigned int i, b, crc;
+
+	for(i = 0; i < 256; i++){
+		crc = i;
+		for(b = 0; b < 8; b++)
+		crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+
+		if(crc != modbusCRC[i]){
+			printf("crc: valore %u della tabella sbagliato (0x%04X invece di 0x%04X)\n", i, modbusCRC[i], crc);
+			return 1;
+		}
+	}
+
+	//Il CRC-16/MODBUS di "123456789" vale 0x4B37.
+	crc = modbus_crc(prova, sizeof(prova));
+	printf("crc: tabella corretta, CRC di \"123456789\" = 0x%04X\n", crc);
+
+	return crc != 0x4B37;
+
+}
+
+int main(int argc, char **argv){
+
+	int i = 1;
+	long baud;
+
+	if(argc == 2 && !strcmp(argv[1], "crc"))
+	return comandoCRC();
+
+	while(i < argc && argv[i][0] == '-'){
+		if(!strcmp(argv[i], "-n"))
+		parita = 0;
+		else if(!strcmp(argv[i], "-b") && i + 1 < argc && (baud = atol(argv[i + 1])) && (velocita = velocitaTermios(baud)))
+		i++;
+		else
+		uso();
+		i++;
+	}
+
+	if(argc - i < 3)
+	uso();
+
+	apri(argv[i]);
+
+	if(!strcmp(argv[i + 1], "leggi"))
+	return comandoLeggi(argc - i - 2, argv + i + 2);
+	if(!strcmp(argv[i + 1], "scrivi"))
+	return comandoScrivi(argc - i - 2, argv + i + 2);
+	if(!strcmp(argv[i + 1], "bench"))
+	return comandoBench(argc - i - 2, argv + i + 2);
+
+	uso();
+	return 2;
+
+}
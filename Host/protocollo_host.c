@@ -0,0 +1,213 @@
+/*************************************************************************************************************
+-------------------------PROGRAMMA DI RIFERIMENTO PER L'HOST DEL PROTOCOLLO BINARIO----------------------------
+Codifica i comandi del protocollo binario (protocollo.h) e decodifica i frame ricevuti dalla scheda.
+Usa lo stesso parser e lo stesso encoder del firmware, quindi serve anche per provarli su Linux.
+
+Compilazione:	gcc -Wall -I.. -o protocollo_host protocollo_host.c
+Uso:
+	protocollo_host enc set <canale> <decimi di percento>	scrive su stdout il frame che imposta il duty cycle
+	protocollo_host enc stato <canale>			scrive su stdout il frame che legge lo stato del canale
+	protocollo_host enc contatori				scrive su stdout il frame che legge i contatori
+	protocollo_host enc telemetria <Hz>			scrive su stdout il frame che avvia la telemetria (0 la ferma)
+	protocollo_host dec					legge i byte da stdin e stampa i frame riconosciuti
+	protocollo_host csv					legge i byte da stdin e scrive una riga CSV per ogni frame di telemetria
+Esempio con la scheda su /dev/ttyACM0 (già configurata con stty a 9600 baud, modalità raw):
+	protocollo_host dec < /dev/ttyACM0 &
+	protocollo_host enc set 0 505 > /dev/ttyACM0
+Registrazione della telemetria per i grafici (a 9600 baud passano al massimo circa 25 frame al secondo):
+	protocollo_host csv < /dev/ttyACM0 > prova.csv &
+	protocollo_host enc telemetria 20 > /dev/ttyACM0
+*************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocollo.h"
+
+static void uso(void){
+	
+	fprintf(stderr, "uso: protocollo_host enc set <canale> <decimi> | enc stato <canale> | enc contatori | enc telemetria <Hz> | dec | csv\n");
+	exit(2);
+	
+}
+
+//Codifica un comando e lo scrive in binario su stdout.
+static int codifica(int argc, char **argv){
+	
+	struct frameProtocollo f;
+	unsigned char buf[PROTO_MAX_FRAME];
+	unsigned char n;
+	
+	memset(&f, 0, sizeof(f));
+	
+	if(argc == 3 && !strcmp(argv[0], "set")){
+		f.opcode = OP_IMPOSTA_DC;
+		f.canale = atoi(argv[1]);
+		f.lunghezza = 2;
+		proto_scrivi16(f.payload, atoi(argv[2]));
+	}
+	else if(argc == 2 && !strcmp(argv[0], "stato")){
+		f.opcode = OP_LEGGI_STATO;
+		f.canale = atoi(argv[1]);
+	}
+	else if(argc == 1 && !strcmp(argv[0], "contatori"))
+	f.opcode = OP_LEGGI_CONTATORI;
+	else if(argc == 2 && !strcmp(argv[0], "telemetria")){
+		f.opcode = OP_TELEMETRIA;
+		f.lunghezza = 2;
+		proto_scrivi16(f.payload, atoi(argv[1]));
+	}
+	else
+	uso();
+	
+	n = proto_encode(buf, &f);
+	fwrite(buf, 1, n, stdout);
+	
+	return 0;
+	
+}
+
+//Stampa un frame decodificato su una riga.
+static void stampaFrame(const struct frameProtocollo *f){
+	
+	const unsigned char *p = f->payload;
+	unsigned char i;
+	
+	switch(f->opcode){
+		
+		case OP_IMPOSTA_DC | PROTO_RISPOSTA:
+		case OP_LEGGI_STATO | PROTO_RISPOSTA:
+		if(f->lunghezza == 7){
+			printf("stato canale=%u duty=%u.%u%% spento=%u stato=%u locale=%u frequenza=%uHz\n",
+			f->canale, proto_leggi16(p) / 10, proto_leggi16(p) % 10, p[2], p[3], p[4], proto_leggi16(p + 5));
+			return;
+		}
+		break;
+		
+		case OP_LEGGI_CONTATORI | PROTO_RISPOSTA:
+		if(f->lunghezza == 6){
+			printf("contatori frame=%u crc=%u persi=%u\n", proto_leggi16(p), proto_leggi16(p + 2), proto_leggi16(p + 4));
+			return;
+		}
+		break;
+		
+		case OP_TELEMETRIA | PROTO_RISPOSTA:
+		if(f->lunghezza == 2){
+			printf("telemetria frequenza=%uHz\n", proto_leggi16(p));
+			return;
+		}
+		break;
+		
+		case OP_DATI_TELEMETRIA | PROTO_RISPOSTA:
+		if(f->lunghezza > TEL_DUTY && (f->lunghezza - TEL_DUTY) % 2 == 0){
+			printf("telemetria ms=%u stato=%u flag=0x%02X dip=0x%03X rpm=%u persi=%u duty=",
+			proto_leggi16(p + TEL_MS), p[TEL_STATO], p[TEL_FLAG], proto_leggi16(p + TEL_DIP), proto_leggi16(p + TEL_RPM), proto_leggi16(p + TEL_PERSI));
+			for(i = TEL_DUTY; i < f->lunghezza; i += 2)
+			printf("%s%u", i == TEL_DUTY ? "" : "/", proto_leggi16(p + i));
+			printf("\n");
+			return;
+		}
+		break;
+		
+		case OP_ERRORE | PROTO_RISPOSTA:
+		if(f->lunghezza == 1){
+			printf("errore canale=%u codice=%u\n", f->canale, p[0]);
+			return;
+		}
+		break;
+	}
+	
+	//Frame sconosciuto o comando: stampo i campi grezzi.
+	printf("frame opcode=0x%02X canale=%u payload=", f->opcode, f->canale);
+	for(i = 0; i < f->lunghezza; i++)
+	printf("%02X", p[i]);
+	printf("\n");
+	
+}
+
+//Legge i byte da stdin e stampa i frame validi. I byte fuori dai frame (ad esempio il testo) vengono ignorati.
+static int decodifica(void){
+	
+	struct parserProtocollo parser;
+	int c;
+	
+	proto_reset(&parser);
+	
+	while((c = getchar()) != EOF){
+		switch(proto_parse(&parser, c)){
+			case PROTO_FRAME_OK: stampaFrame(&parser.frame); break;
+			case PROTO_ERRORE_CRC: printf("errore di CRC\n"); break;
+			case PROTO_ERRORE_LUNGHEZZA: printf("errore di lunghezza\n"); break;
+		}
+		fflush(stdout);
+	}
+	
+	return 0;
+	
+}
+
+//Legge i byte da stdin e scrive in CSV i frame di telemetria, ignorando tutto il resto.
+//I millisecondi della scheda ricominciano da 0 dopo 65535: la colonna "ms" li riporta a un tempo continuo dal primo frame.
+//Le colonne dei duty cycle sono in percento, una per canale; l'intestazione viene scritta al primo frame, quando si conosce il numero di canali.
+static int csv(void){
+	
+	struct parserProtocollo parser;
+	const unsigned char *p = parser.frame.payload;
+	unsigned long tempo = 0;
+	unsigned int ultimoMs = 0;
+	int canali = -1;
+	int c, i;
+	
+	proto_reset(&parser);
+	
+	while((c = getchar()) != EOF){
+		
+		if(proto_parse(&parser, c) != PROTO_FRAME_OK || parser.frame.opcode != (OP_DATI_TELEMETRIA | PROTO_RISPOSTA)
+		|| parser.frame.lunghezza <= TEL_DUTY || (parser.frame.lunghezza - TEL_DUTY) % 2)
+		continue;
+		
+		if(canali < 0){
+			canali = (parser.frame.lunghezza - TEL_DUTY) / 2;
+			printf("ms,stato,priorita_locale,regolazione,remoto_scaduto,sovracorrente,programma,dip,rpm,errori_crc,byte_persi,overrun,errori_frame,telemetria_persi");
+			for(i = 0; i < canali; i++)
+			printf(",duty%d", i);
+			printf("\n");
+		}
+		else{
+			if((parser.frame.lunghezza - TEL_DUTY) / 2 != canali)
+			continue;
+			tempo += (unsigned int)(proto_leggi16(p + TEL_MS) - ultimoMs) & 0xFFFF;
+		}
+		ultimoMs = proto_leggi16(p + TEL_MS);
+		
+		printf("%lu,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u", tempo, p[TEL_STATO], !!(p[TEL_FLAG] & TEL_FLAG_PRIORITA_LOCALE),
+		!!(p[TEL_FLAG] & TEL_FLAG_REGOLAZIONE), !!(p[TEL_FLAG] & TEL_FLAG_REMOTO_SCADUTO), !!(p[TEL_FLAG] & TEL_FLAG_SOVRACORRENTE),
+		!!(p[TEL_FLAG] & TEL_FLAG_PROGRAMMA), proto_leggi16(p + TEL_DIP), proto_leggi16(p + TEL_RPM),
+		proto_leggi16(p + TEL_ERRORI_CRC), proto_leggi16(p + TEL_BYTE_PERSI), proto_leggi16(p + TEL_OVERRUN),
+		proto_leggi16(p + TEL_ERRORI_FRAME), proto_leggi16(p + TEL_PERSI));
+		for(i = 0; i < canali; i++)
+		printf(",%u.%u", proto_leggi16(p + TEL_DUTY + 2 * i) / 10, proto_leggi16(p + TEL_DUTY + 2 * i) % 10);
+		printf("\n");
+		fflush(stdout);
+	}
+	
+	return 0;
+	
+}
+
+int main(int argc, char **argv){
+	
+	if(argc >= 3 && !strcmp(argv[1], "enc"))
+	return codifica(argc - 2, argv + 2);
+	
+	if(argc == 2 && !strcmp(argv[1], "dec"))
+	return decodifica();
+	
+	if(argc == 2 && !strcmp(argv[1], "csv"))
+	return csv();
+	
+	uso();
+	
+	return 2;
+	
+}
@@ -0,0 +1,301 @@
+/*************************************************************************************************************
+------------------------------PROVA DELL'ARBITRO TRA LOCALE E REMOTO PER L'HOST------------------------------
+Prova su Linux l'arbitro del firmware (arbitro.h), chiamando arbitro_passo() una volta per millisecondo come la ISR
+del timer 2, con i millisecondi a 16 bit che ricominciano da 0 come sulla scheda:
+-casi: sequenze scritte a mano con il duty cycle atteso sul canale ad ogni passo (cambio di priorità, timeout del remoto,
+ ritorno del remoto, locale senza un valore valido, timeout oltre il giro dei millisecondi);
+-fuzz: setpoint locali e remoti, cambi di priorità e di timeout casuali, confrontati ad ogni millisecondo con un modello
+ che usa il tempo a 64 bit: il canale deve avere sempre l'ultimo setpoint della sorgente che comanda, già nel tick in cui
+ la sorgente cambia.
+
+Compilazione (dalla cartella principale):	gcc -Wall -I. -o prova_arbitro Host/prova_arbitro.c
+Uso:
+	prova_arbitro casi			esce con 1 se un caso non dà il risultato atteso
+	prova_arbitro fuzz [seme] [n]		prova n sequenze casuali (predefinito 200); esce con 1 alla prima differenza
+*************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arbitro.h"
+
+#define FUZZ_N 200
+#define FUZZ_MS 200000ULL //Millisecondi di ogni sequenza: più di tre giri dei millisecondi a 16 bit.
+
+static unsigned long long seme = 1;
+
+//Generatore a 64 bit: i ritmi e gli istanti vanno oltre i 15 bit del generatore degli altri programmi di prova.
+static unsigned long casuale(unsigned long n){
+
+	seme = seme * 6364136223846793005ULL + 1442695040888963407ULL;
+
+	return (seme >> 33) % n;
+
+}
+
+//Canale simulato: il duty cycle che il firmware avrebbe applicato.
+static struct arbitroDuty arbitro;
+static long canale;
+static unsigned long long adesso;
+static const char *nomeCaso;
+static int errori;
+
+static void avvia(unsigned int dutyRemoto, char prioritaLocale, unsigned int timeout, unsigned long long inizio){
+
+	unsigned int duty;
+
+	memset(&arbitro, 0xA5, sizeof(arbitro));
+	arbitro.prioritaLocale = prioritaLocale;
+	arbitro.timeout = timeout;
+	adesso = inizio;
+	canale = dutyRemoto; //Sulla scheda il canale parte dal duty cycle salvato, anche se comanda il locale.
+	arbitro_avvia(&arbitro, dutyRemoto, adesso & 0xFFFF);
+
+	if(arbitro_passo(&arbitro, adesso & 0xFFFF, &duty) & ARBITRO_APPLICA)
+	canale = duty;
+
+}
+
+//Fa passare ms millisecondi, un tick alla volta.
+static void attendi(unsigned long ms){
+
+	unsigned int duty;
+
+	while(ms--){
+		adesso++;
+		if(arbitro_passo(&arbitro, adesso & 0xFFFF, &duty) & ARBITRO_APPLICA)
+		canale = duty;
+	}
+
+}
+
+static void remoto(unsigned int duty){
+
+	if(arbitro_remoto(&arbitro, duty, adesso & 0xFFFF))
+	canale = duty;
+
+}
+
+static void controlla(long atteso, unsigned char sorgente, const char *cosa){
+
+	if(canale == atteso && arbitro.sorgente == sorgente)
+	return;
+
+	fprintf(stderr, "%s: %s: canale %ld (atteso %ld), sorgente %s (attesa %s)\n", nomeCaso, cosa, canale, atteso,
+	arbitro.sorgente == ARBITRO_LOCALE ? "locale" : "remoto", sorgente == ARBITRO_LOCALE ? "locale" : "remoto");
+	errori++;
+
+}
+
+static int provaCasi(void){
+
+	int prima;
+
+	//Entrambe le sorgenti restano vive: il setpoint di chi non comanda viene tenuto e applicato al cambio di priorità.
+	nomeCaso = "priorita";
+	prima = errori;
+	avvia(500, 0, 0, 1000);
+	controlla(500, ARBITRO_REMOTO, "accensione");
+	arbitro_locale(&arbitro, 300, adesso & 0xFFFF);
+	attendi(5);
+	controlla(500, ARBITRO_REMOTO, "locale senza priorita");
+	arbitro.prioritaLocale = 1;
+	attendi(1);
+	controlla(300, ARBITRO_LOCALE, "priorita al locale, primo tick");
+	remoto(800);
+	attendi(3);
+	controlla(300, ARBITRO_LOCALE, "remoto senza priorita");
+	arbitro.prioritaLocale = 0;
+	attendi(1);
+	controlla(800, ARBITRO_REMOTO, "priorita al remoto, primo tick");
+	remoto(0);
+	controlla(0, ARBITRO_REMOTO, "remoto applicato subito");
+	printf("%-22s %s\n", nomeCaso, errori == prima ? "ok" : "ERRATO");
+
+	//Il remoto tace oltre il timeout: comanda il locale finchè non arriva un nuovo setpoint remoto.
+	nomeCaso = "timeout";
+	prima = errori;
+	avvia(500, 0, 100, 50);
+	arbitro_locale(&arbitro, 200, adesso & 0xFFFF);
+	attendi(99);
+	controlla(500, ARBITRO_REMOTO, "99 ms");
+	attendi(1);
+	controlla(200, ARBITRO_LOCALE, "100 ms");
+	attendi(500);
+	controlla(200, ARBITRO_LOCALE, "600 ms");
+	remoto(650);
+	controlla(650, ARBITRO_REMOTO, "ritorno del remoto");
+	attendi(99);
+	controlla(650, ARBITRO_REMOTO, "99 ms dal ritorno");
+	arbitro_timeout(&arbitro, 0);
+	attendi(10000);
+	controlla(650, ARBITRO_REMOTO, "timeout disattivato");
+	arbitro_timeout(&arbitro, 5000);
+	attendi(1);
+	controlla(200, ARBITRO_LOCALE, "timeout attivato dopo 10 s");
+	printf("%-22s %s\n", nomeCaso, errori == prima ? "ok" : "ERRATO");
+
+	//Con la priorità al locale e i dip switch su un valore non valido il canale resta com'è.
+	nomeCaso = "locale non valido";
+	prima = errori;
+	avvia(400, 1, 0, 0);
+	controlla(400, ARBITRO_LOCALE, "accensione");
+	remoto(900);
+	attendi(20);
+	controlla(400, ARBITRO_LOCALE, "remoto senza priorita");
+	arbitro_locale(&arbitro, 0, adesso & 0xFFFF);
+	attendi(1);
+	controlla(0, ARBITRO_LOCALE, "primo valore locale");
+	printf("%-22s %s\n", nomeCaso, errori == prima ? "ok" : "ERRATO");
+
+	//L'età non torna piccola quando i millisecondi ricominciano da 0: il timeout scade anche dopo il giro.
+	nomeCaso = "giro dei millisecondi";
+	prima = errori;
+	avvia(100, 0, 20, 65530);
+	arbitro_locale(&arbitro, 700, adesso & 0xFFFF);
+	attendi(19);
+	controlla(100, ARBITRO_REMOTO, "19 ms, dopo lo 0");
+	attendi(1);
+	controlla(700, ARBITRO_LOCALE, "20 ms, dopo lo 0");
+	avvia(100, 0, 0, 3);
+	arbitro_locale(&arbitro, 700, adesso & 0xFFFF);
+	attendi(65536);
+	arbitro_timeout(&arbitro, 60000);
+	attendi(1);
+	controlla(700, ARBITRO_LOCALE, "remoto fermo da un giro");
+	printf("%-22s %s\n", nomeCaso, errori == prima ? "ok" : "ERRATO");
+
+	return errori ? 1 : 0;
+
+}
+
+//Modello di riferimento: tempo a 64 bit, nessun numero di sequenza.
+struct modello {
+	char prioritaLocale;
+	unsigned int timeout;
+	char scaduto;
+	unsigned long long remotoIstante;
+	unsigned int remotoDuty;
+	char localeValido;
+	unsigned int localeDuty;
+	long canale;
+	unsigned char sorgente;
+};
+
+static int fuzz(unsigned long semeIniziale, long n){
+
+	struct modello m;
+	unsigned long long fine, inizio;
+	unsigned long ritmoRemoto, ritmoLocale;
+	unsigned int duty;
+	unsigned char esito, sorgente;
+	long prova;
+	char ritorno;
+
+	seme = semeIniziale;
+
+	for(prova = 0; prova < n; prova++){
+		//Ogni sequenza ha un suo ritmo: un remoto che parla di continuo, ogni tanto o quasi mai.
+		ritmoRemoto = casuale(2) ? 1 + casuale(200) : 1 + casuale(200000);
+		ritmoLocale = 1 + casuale(5000);
+		inizio = casuale(65536);
+
+		memset(&m, 0, sizeof(m));
+		m.prioritaLocale = casuale(2);
+		m.timeout = casuale(2) ? 0 : 1 + casuale(casuale(2) ? 100 : ARBITRO_TIMEOUT_MAX);
+		m.remotoDuty = casuale(1001);
+		m.remotoIstante = inizio;
+		m.canale = m.remotoDuty;
+		m.sorgente = m.prioritaLocale ? ARBITRO_LOCALE : ARBITRO_REMOTO;
+
+		avvia(m.remotoDuty, m.prioritaLocale, m.timeout, inizio);
+		nomeCaso = "fuzz";
+		controlla(m.canale, m.sorgente, "accensione");
+
+		for(fine = inizio + FUZZ_MS; adesso < fine && !errori; ){
+			adesso++;
+
+			//Eventi tra due tick: comandi remoti e pulsante o Modbus. Il setpoint locale arriva nella ISR, prima dell'arbitro.
+			if(casuale(ritmoRemoto) == 0){
+				duty = casuale(1001);
+				ritorno = arbitro_remoto(&arbitro, duty, adesso & 0xFFFF);
+				if(ritorno)
+				canale = duty;
+				m.remotoDuty = duty;
+				m.remotoIstante = adesso;
+				m.scaduto = 0;
+				if(!m.prioritaLocale){
+					m.sorgente = ARBITRO_REMOTO;
+					m.canale = duty;
+				}
+				if(ritorno != !m.prioritaLocale){
+					fprintf(stderr, "fuzz: seme %lu, prova %ld, %llu ms: setpoint remoto %s\n", semeIniziale, prova, adesso,
+					ritorno ? "applicato senza priorita" : "non applicato");
+					errori++;
+				}
+			}
+
+			if(casuale(3000) == 0){
+				m.prioritaLocale = !m.prioritaLocale;
+				arbitro.prioritaLocale = m.prioritaLocale;
+			}
+
+			if(casuale(20000) == 0){
+				m.timeout = casuale(3) ? 0 : 1 + casuale(ARBITRO_TIMEOUT_MAX);
+				m.scaduto = 0;
+				arbitro_timeout(&arbitro, m.timeout);
+			}
+
+			if(casuale(ritmoLocale) == 0){
+				m.localeDuty = casuale(1001);
+				m.localeValido = 1;
+				arbitro_locale(&arbitro, m.localeDuty, adesso & 0xFFFF);
+			}
+
+			//Tick del modello.
+			if(m.timeout && !m.scaduto && adesso - m.remotoIstante >= m.timeout)
+			m.scaduto = 1;
+			sorgente = (m.prioritaLocale || m.scaduto) ? ARBITRO_LOCALE : ARBITRO_REMOTO;
+			if(sorgente == ARBITRO_REMOTO)
+			m.canale = m.remotoDuty;
+			else if(m.localeValido)
+			m.canale = m.localeDuty;
+
+			esito = arbitro_passo(&arbitro, adesso & 0xFFFF, &duty);
+			if(esito & ARBITRO_APPLICA)
+			canale = duty;
+
+			if(!(esito & ARBITRO_CAMBIO) != (sorgente == m.sorgente)){
+				fprintf(stderr, "fuzz: seme %lu, prova %ld, %llu ms: cambio di sorgente %s\n", semeIniziale, prova, adesso,
+				(esito & ARBITRO_CAMBIO) ? "inatteso" : "non segnalato");
+				errori++;
+			}
+			m.sorgente = sorgente;
+
+			if(canale != m.canale || arbitro.sorgente != m.sorgente){
+				fprintf(stderr, "fuzz: seme %lu, prova %ld, %llu ms: canale %ld (atteso %ld), sorgente %u (attesa %u)\n",
+				semeIniziale, prova, adesso, canale, m.canale, arbitro.sorgente, m.sorgente);
+				errori++;
+			}
+		}
+
+		if(errori)
+		return 1;
+	}
+
+	printf("fuzz: %ld sequenze senza differenze\n", n);
+	return 0;
+
+}
+
+int main(int argc, char **argv){
+
+	if(argc == 2 && !strcmp(argv[1], "casi"))
+	return provaCasi();
+	if(argc >= 2 && !strcmp(argv[1], "fuzz"))
+	return fuzz(argc >= 3 ? strtoul(argv[2], NULL, 0) : 1, argc >= 4 ? atol(argv[3]) : FUZZ_N);
+
+	fprintf(stderr, "uso: prova_arbitro casi | prova_arbitro fuzz [seme] [n]\n");
+	return 2;
+
+}
@@ -0,0 +1,452 @@
+/*************************************************************************************************************
+----------------------------------PROVA DEL PARSER DEI COMANDI PER L'HOST------------------------------------
+Genera il trie delle parole dei comandi (comandi_trie.h) dall'elenco COMANDI_PAROLE di comandi.h, e prova su Linux
+il parser incrementale del firmware:
+-fuzz: righe casuali fatte di parole dei comandi, numeri, separatori e caratteri qualunque vengono passate al parser
+ un byte alla volta e il risultato viene confrontato con un parser di riferimento che lavora sulla riga intera
+ (strtok, strcmp e un'espressione regolare per i numeri). Prima controlla che il trie compilato sia quello generato
+ dall'elenco attuale, cioè che comandi_trie.h non sia rimasto indietro.
+-bench: passa al parser una serie di comandi tipici e stampa il tempo per byte.
+
+Compilazione (dalla cartella principale):	gcc -Wall -I. -o prova_comandi Host/prova_comandi.c
+Uso:
+	prova_comandi trie			stampa comandi_trie.h su stdout
+	prova_comandi fuzz [seme] [n]		prova n righe casuali (predefinito 1000000) con il seme indicato; esce con 1 al primo errore
+	prova_comandi bench [n]			passa n volte (predefinito 1000000) la serie di comandi e stampa i ns per byte
+Per aggiungere una parola: si aggiunge a COMANDI_PAROLE, si compila con -DCOMANDI_SENZA_TRIE (il vecchio trie non
+corrisponde più all'elenco) e si esegue "prova_comandi trie > comandi_trie.h".
+*************************************************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regex.h>
+
+#include "comandi.h"
+
+#define FUZZ_N 1000000
+#define BENCH_N 1000000
+#define MAX_NODI 255 //Gli indici dei nodi sono di un byte.
+#define MAX_RIGA 200
+
+#define COMANDI_TESTO(token, testo) testo,
+#define COMANDI_NOME(token, testo) #token,
+static const char *testi[N_PAROLE] = {"", COMANDI_PAROLE(COMANDI_TESTO)};
+static const char *nomi[N_PAROLE] = {"PAROLA_NESSUNA", COMANDI_PAROLE(COMANDI_NOME)};
+
+//----------------------GENERAZIONE DEL TRIE------------------------
+
+static struct nodoTrie nodi[MAX_NODI + 1];
+static unsigned char radice[26];
+static unsigned int nNodi = 1; //Il nodo 0 non viene usato.
+
+//Figlio del nodo con il carattere c (nodo 0 = radice), aggiunto in fondo ai fratelli se non c'è.
+static unsigned char figlio(unsigned char nodo, char c){
+
+	unsigned char *collegamento = nodo ? &nodi[nodo].figlio : &radice[c - 'a'];
+
+	while(*collegamento && nodi[*collegamento].carattere != c)
+	collegamento = &nodi[*collegamento].fratello;
+
+	if(*collegamento == 0){
+		if(nNodi > MAX_NODI){
+			fprintf(stderr, "troppi nodi nel trie\n");
+			exit(2);
+		}
+		nodi[nNodi].carattere = c;
+		*collegamento = nNodi++;
+	}
+
+	return *collegamento;
+
+}
+
+static void costruisciTrie(void){
+
+	unsigned char nodo;
+	const char *c;
+	int p;
+
+	for(p = 1; p < N_PAROLE; p++){
+		nodo = 0;
+		for(c = testi[p]; *c; c++){
+			if(*c < 'a' || *c > 'z'){
+				fprintf(stderr, "la parola \"%s\" deve contenere solo lettere minuscole\n", testi[p]);
+				exit(2);
+			}
+			nodo = figlio(nodo, *c);
+		}
+		nodi[nodo].parola = p;
+	}
+
+}
+
+//Testo della parola che arriva al nodo, per il commento accanto a ogni nodo.
+static void prefisso(unsigned char nodo, char *buf){
+
+	unsigned int i;
+	int n = 0;
+	char tmp[MAX_RIGA];
+	unsigned char cerca = nodo;
+
+	//Risale cercando il padre di ogni nodo (il trie è piccolo, basta una ricerca lineare).
+	while(cerca){
+		tmp[n++] = nodi[cerca].carattere;
+		for(i = 1; i < nNodi; i++){
+			unsigned char f = nodi[i].figlio;
+			while(f && f != cerca)
+			f = nodi[f].fratello;
+			if(f == cerca)
+			break;
+		}
+		cerca = (i < nNodi) ? i : 0;
+	}
+
+	for(i = 0; i < (unsigned int) n; i++)
+	buf[i] = tmp[n - 1 - i];
+	buf[n] = '\0';
+
+}
+
+static void stampaTrie(void){
+
+	char buf[MAX_RIGA];
+	unsigned int i;
+
+	printf("/*************************************************************************************************************\n");
+	printf("Trie delle parole dei comandi, generato da Host/prova_comandi.c (\"prova_comandi trie > comandi_trie.h\")\n");
+	printf("a partire dall'elenco COMANDI_PAROLE di comandi.h: non va modificato a mano.\n");
+	printf("*************************************************************************************************************/\n");
+	printf("#ifndef COMANDI_TRIE_H_\n#define COMANDI_TRIE_H_\n\n");
+	printf("#define TRIE_NODI %u\n\n", nNodi);
+
+	printf("//Primo nodo per ogni lettera iniziale, da 'a' a 'z' (0 = nessuna parola).\n");
+	printf("static const unsigned char trieRadice[26] PROGMEM = {");
+	for(i = 0; i < 26; i++)
+	printf("%s%u", i ? ", " : "", radice[i]);
+	printf("};\n\n");
+
+	printf("//Carattere, primo figlio, fratello successivo, parola che finisce nel nodo.\n");
+	printf("static const struct nodoTrie trieNodi[TRIE_NODI] PROGMEM = {\n");
+	printf("\t{0, 0, 0, PAROLA_NESSUNA},\n");
+	for(i = 1; i < nNodi; i++){
+		prefisso(i, buf);
+		printf("\t{'%c', %u, %u, %s}%s //%s\n", nodi[i].carattere, nodi[i].figlio, nodi[i].fratello, nomi[nodi[i].parola],
+		i + 1 < nNodi ? "," : "", buf);
+	}
+	printf("};\n\n#endif /* COMANDI_TRIE_H_ */\n");
+
+}
+
+#ifndef COMANDI_SENZA_TRIE
+
+//----------------------PARSER DI RIFERIMENTO------------------------
+
+static regex_t espressioneNumero;
+
+//Decodifica una parola come il parser del firmware, ma sulla parola intera.
+static void riferimentoParola(const char *s, struct argomento *a){
+
+	regmatch_t m[5];
+	int p, lunghezza, i;
+
+	memset(a, 0, sizeof(*a));
+
+	if(*s >= 'a' && *s <= 'z'){
+		a->tipo = ARG_ERRATO;
+		for(p = 1; p < N_PAROLE; p++){
+			if(!strcmp(s, testi[p])){
+				a->tipo = ARG_PAROLA;
+				a->parola = p;
+			}
+		}
+		return;
+	}
+
+	if(regexec(&espressioneNumero, s, 5, m, 0)){
+		a->tipo = ARG_ERRATO;
+		return;
+	}
+
+	a->tipo = ARG_NUMERO;
+	a->segno = (m[1].rm_eo > m[1].rm_so) ? s[m[1].rm_so] : 0;
+
+	lunghezza = m[2].rm_eo - m[2].rm_so;
+	a->cifre = lunghezza > COMANDI_MAX_CIFRE ? COMANDI_MAX_CIFRE + 1 : lunghezza;
+	for(i = 0; i < lunghezza && i < COMANDI_MAX_CIFRE; i++)
+	a->valore = a->valore * 10 + (s[m[2].rm_so + i] - '0');
+
+	if(m[3].rm_so >= 0){
+		a->punto = 1;
+		lunghezza = m[4].rm_eo - m[4].rm_so;
+		a->decimali = lunghezza > 2 ? 2 : lunghezza;
+		if(lunghezza)
+		a->decimo = s[m[4].rm_so] - '0';
+	}
+
+}
+
+//Divide la riga (senza '\n') nei comandi attesi.
+static int riferimentoRiga(const char *riga, struct comandoTestuale *comandi){
+
+	char pulita[MAX_RIGA], *segmento, *parola, *fineParola;
+	int n = 0, j = 0;
+	const char *c;
+
+	//I caratteri ignorati spariscono prima di tutto.
+	for(c = riga; *c; c++){
+		if(*c >= ' ' && *c <= '~')
+		pulita[j++] = *c;
+	}
+	pulita[j] = '\0';
+
+	segmento = pulita;
+	while(1){
+		char *fine = strchr(segmento, ';');
+		struct comandoTestuale *cmd = &comandi[n];
+
+		if(fine)
+		*fine = '\0';
+
+		memset(cmd, 0, sizeof(*cmd));
+		for(parola = strtok_r(segmento, " ", &fineParola); parola; parola = strtok_r(NULL, " ", &fineParola)){
+			if(cmd->n < COMANDI_MAX_PAROLE)
+			riferimentoParola(parola, &cmd->parole[cmd->n++]);
+			else
+			cmd->n = COMANDI_MAX_PAROLE + 1;
+		}
+
+		//I comandi vuoti contano solo alla fine della riga.
+		if(!fine){
+			cmd->fineRiga = 1;
+			return n + 1;
+		}
+		if(cmd->n)
+		n++;
+		segmento = fine + 1;
+	}
+
+}
+
+static int argomentiUguali(const struct argomento *a, const struct argomento *b){
+
+	if(a->tipo != b->tipo)
+	return 0;
+	if(a->tipo == ARG_PAROLA)
+	return a->parola == b->parola;
+	if(a->tipo == ARG_NUMERO)
+	return a->segno == b->segno && a->punto == b->punto && a->cifre == b->cifre && a->decimali == b->decimali &&
+	a->decimo == b->decimo && a->valore == b->valore;
+
+	return 1;
+
+}
+
+static void stampaComando(const char *nome, const struct comandoTestuale *c){
+
+	int i;
+
+	fprintf(stderr, "  %s: %d parole%s:", nome, c->n, c->fineRiga ? ", fine riga" : "");
+	for(i = 0; i < c->n && i < COMANDI_MAX_PAROLE; i++){
+		const struct argomento *a = &c->parole[i];
+		if(a->tipo == ARG_PAROLA)
+		fprintf(stderr, " [%s]", testi[a->parola]);
+		else if(a->tipo == ARG_NUMERO)
+		fprintf(stderr, " [num %c %lu cifre %u punto %d decimali %u decimo %u]", a->segno ? a->segno : ' ', a->valore, a->cifre,
+		a->punto, a->decimali, a->decimo);
+		else
+		fprintf(stderr, " [errato]");
+	}
+	fprintf(stderr, "\n");
+
+}
+
+//Passa la riga al parser un byte alla volta e confronta ogni comando con quello di riferimento.
+static int provaRiga(struct parserComandi *p, const char *riga){
+
+	struct comandoTestuale attesi[MAX_RIGA];
+	int nAttesi = riferimentoRiga(riga, attesi);
+	int n = 0, i;
+	const char *c;
+
+	for(c = riga; ; c++){
+		if(comandi_byte(p, *c ? *c : '\n') == COMANDI_PRONTO){
+			const struct comandoTestuale *ottenuto = &p->comando;
+			int uguali = n < nAttesi && ottenuto->n == attesi[n].n && ottenuto->fineRiga == attesi[n].fineRiga;
+
+			for(i = 0; uguali && i < ottenuto->n && i < COMANDI_MAX_PAROLE; i++)
+			uguali = argomentiUguali(&ottenuto->parole[i], &attesi[n].parole[i]);
+
+			if(!uguali){
+				fprintf(stderr, "comando %d diverso\n", n + 1);
+				stampaComando("parser", ottenuto);
+				if(n < nAttesi)
+				stampaComando("riferimento", &attesi[n]);
+				return 0;
+			}
+			n++;
+		}
+		if(!*c)
+		break;
+	}
+
+	if(n != nAttesi){
+		fprintf(stderr, "%d comandi invece di %d\n", n, nAttesi);
+		return 0;
+	}
+
+	return 1;
+
+}
+
+//Il trie compilato (comandi_trie.h) deve essere quello che si genera oggi dall'elenco delle parole.
+static int trieAggiornato(void){
+
+	unsigned int i;
+
+	if(TRIE_NODI != nNodi || memcmp(trieRadice, radice, sizeof(radice)))
+	return 0;
+
+	for(i = 0; i < nNodi; i++){
+		if(trieNodi[i].carattere != nodi[i].carattere || trieNodi[i].figlio != nodi[i].figlio ||
+		trieNodi[i].fratello != nodi[i].fratello || trieNodi[i].parola != nodi[i].parola)
+		return 0;
+	}
+
+	return 1;
+
+}
+
+//Pezzi delle righe casuali: parole dei comandi, prefissi e parole allungate, numeri validi e non, separatori.
+static const char *pezzi[] = {
+	" ", " ", " ", ";", ";", "0", "1", "7", "42", "42.5", ".5", "5.", "1.25", "-3", "+5", "+", "-", ".", "+-1", "1+",
+	"99999", "123456789", "1234567890", "57600", "1000000", "u", "x", "a5", "5a", "S", "Up", "\r", "\t", "\x7f", "\xa5", "\xe8"
+};
+#define N_PEZZI (sizeof(pezzi) / sizeof(pezzi[0]))
+
+static void rigaCasuale(char *riga, unsigned int *seme){
+
+	int n = rand_r(seme) % 12, len = 0, k, scelta;
+	const char *s;
+	char tmp[32];
+
+	while(n-- > 0 && len < MAX_RIGA - 40){
+		scelta = rand_r(seme) % 4;
+		if(scelta < 2){
+			s = testi[1 + rand_r(seme) % (N_PAROLE - 1)];
+			strcpy(tmp, s);
+			//A volte la parola viene accorciata o allungata di una lettera, per provare i prefissi.
+			k = rand_r(seme) % 8;
+			if(k == 0 && strlen(tmp) > 1)
+			tmp[strlen(tmp) - 1] = '\0';
+			else if(k == 1)
+			strcat(tmp, (char []){'a' + rand_r(seme) % 26, '\0'});
+			s = tmp;
+		}
+		else if(scelta == 2)
+		s = pezzi[rand_r(seme) % N_PEZZI];
+		else{
+			tmp[0] = 1 + rand_r(seme) % 255;
+			tmp[1] = '\0';
+			if(tmp[0] == '\n')
+			tmp[0] = ' ';
+			s = tmp;
+		}
+		strcpy(riga + len, s);
+		len += strlen(s);
+		if(rand_r(seme) % 2)
+		riga[len++] = ' ';
+		riga[len] = '\0';
+	}
+
+}
+
+static int fuzz(unsigned int seme, long n){
+
+	struct parserComandi p;
+	char riga[MAX_RIGA];
+	long i;
+	int k;
+
+	if(!trieAggiornato()){
+		fprintf(stderr, "comandi_trie.h non corrisponde a COMANDI_PAROLE: va rigenerato con \"prova_comandi trie\"\n");
+		return 1;
+	}
+
+	regcomp(&espressioneNumero, "^([+-]?)([0-9]*)(\\.([0-9]*))?$", REG_EXTENDED);
+	comandi_reset(&p);
+
+	//Prima ogni parola da sola, poi le righe casuali.
+	for(k = 1; k < N_PAROLE; k++){
+		if(!provaRiga(&p, testi[k])){
+			fprintf(stderr, "parola \"%s\"\n", testi[k]);
+			return 1;
+		}
+	}
+
+	for(i = 0; i < n; i++){
+		rigaCasuale(riga, &seme);
+		if(!provaRiga(&p, riga)){
+			fprintf(stderr, "riga %ld: \"%s\"\n", i, riga);
+			return 1;
+		}
+	}
+
+	printf("fuzz: %d parole e %ld righe senza differenze, trie di %u nodi (%u byte di flash)\n", N_PAROLE - 1, n, nNodi,
+	(unsigned int)(sizeof(trieRadice) + sizeof(trieNodi)));
+
+	return 0;
+
+}
+
+//----------------------BENCH------------------------
+
+static int bench(long n){
+
+	static const char serie[] = "set 42.5\nup\ndown 3\nstep -2.5 1\nfreq 20000\nmodo pc\nrampa 50 s\nrpm 1500\n"
+	"baud 115200\ntelemetria 100\nstats 0\nmacchina 1\nset 30; set 50 2; up 3\npriorita\npriorita timeout 5000\npriorita locale\nxyz 5\n";
+	struct parserComandi p;
+	struct timespec t0, t1;
+	unsigned long comandi = 0;
+	double tempo;
+	const char *c;
+	long i;
+
+	comandi_reset(&p);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < n; i++){
+		for(c = serie; *c; c++)
+		comandi += comandi_byte(&p, *c) == COMANDI_PRONTO;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	tempo = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("bench: %ld byte, %lu comandi in %.3f s: %.2f ns per byte, %.0f Mbyte/s\n", n * (long)(sizeof(serie) - 1), comandi,
+	tempo, tempo * 1e9 / (n * (double)(sizeof(serie) - 1)), n * (double)(sizeof(serie) - 1) / tempo / 1e6);
+
+	return 0;
+
+}
+
+#endif
+
+int main(int argc, char **argv){
+
+	costruisciTrie();
+
+	if(argc == 2 && !strcmp(argv[1], "trie")){
+		stampaTrie();
+		return 0;
+	}
+#ifndef COMANDI_SENZA_TRIE
+	if(argc >= 2 && !strcmp(argv[1], "fuzz"))
+	return fuzz(argc >= 3 ? strtoul(argv[2], NULL, 0) : 1, argc >= 4 ? atol(argv[3]) : FUZZ_N);
+	if(argc >= 2 && !strcmp(argv[1], "bench"))
+	return bench(argc >= 3 ? atol(argv[2]) : BENCH_N);
+#endif
+
+	fprintf(stderr, "uso: prova_comandi trie | prova_comandi fuzz [seme] [n] | prova_comandi bench [n]\n");
+	return 2;
+
+}
@@ -0,0 +1,306 @@
+/*************************************************************************************************************
+-------------------------------PROVA DEI PROGRAMMI DEL DUTY CYCLE PER L'HOST---------------------------------
+Prova su Linux la riproduzione dei programmi del firmware (programma.h), chiamando programma_passo() una volta per
+millisecondo come la ISR del timer 2:
+-casi: programmi scritti a mano con l'andamento atteso, cioè il duty cycle in alcuni istanti e l'istante della fine;
+-fuzz: programmi casuali (punti, tempi, duty cycle, interpolazione e ciclo) confrontati ad ogni millisecondo con un
+ calcolo di riferimento che parte dal tempo assoluto (moltiplicazione e divisione a 64 bit, senza stato); controlla anche
+ che il programma finisca all'istante dell'ultimo punto e che il formato salvato in EEPROM si rilegga uguale;
+-andamento: stampa in CSV il duty cycle di un programma dato sulla riga di comando, una riga per ogni cambio.
+
+Compilazione (dalla cartella principale):	gcc -Wall -I. -o prova_programma Host/prova_programma.c
+Uso:
+	prova_programma casi				esce con 1 se un caso non dà l'andamento atteso
+	prova_programma fuzz [seme] [n]			prova n programmi casuali (predefinito 10000); esce con 1 al primo errore
+	prova_programma andamento [lin] [ciclo] <ms> <duty> ...	es. "andamento lin 0 0 1000 100 3000 20" (duty cycle in percento)
+Con "ciclo" l'andamento si ferma dopo due giri.
+*************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "programma.h"
+
+//Parametri presi da main.c: vanno tenuti allineati.
+#define DC_MAX 1000
+
+#define FUZZ_N 10000
+#define FUZZ_TRATTO_MAX 5000 //Durata massima di un tratto nel fuzz, in ms.
+
+//Duty cycle al millisecondo t dall'avvio, calcolato dai soli punti. *fine vale 1 se a t il programma è finito.
+static unsigned int riferimento(const struct programmaDuty *p, unsigned long long t, int *fine){
+
+	unsigned long long giro = p->punti[p->n - 1].tempo;
+	const struct puntoProgramma *a, *b;
+	long long distanza;
+	int i;
+
+	*fine = 0;
+	if(t >= giro){
+		if(!(p->opzioni & PROGRAMMA_CICLO)){
+			*fine = 1;
+			return p->punti[p->n - 1].duty;
+		}
+		t %= giro;
+	}
+
+	for(i = 0; p->punti[i + 1].tempo <= t; i++);
+	a = &p->punti[i];
+	b = &p->punti[i + 1];
+
+	if(!(p->opzioni & PROGRAMMA_LINEARE))
+	return a->duty;
+
+	//Troncamento verso lo zero, come l'accumulo del firmware in salita e in discesa.
+	distanza = (long long) b->duty - a->duty;
+	return a->duty + distanza * (long long) (t - a->tempo) / (long long) (b->tempo - a->tempo);
+
+}
+
+static unsigned long seme = 1;
+
+static unsigned long casuale(unsigned long n){
+
+	seme = seme * 1103515245UL + 12345UL;
+
+	return ((seme >> 16) & 0x7FFF) % n;
+
+}
+
+//Riproduce il programma per durata ms confrontandolo con il riferimento. Restituisce 0 se coincidono sempre.
+static int confronta(struct programmaDuty *p, unsigned long long durata, const char *nome){
+
+	unsigned long long t;
+	unsigned int atteso;
+	int fine, finito;
+
+	if(!programma_avvia(p)){
+		fprintf(stderr, "%s: il programma non parte\n", nome);
+		return 1;
+	}
+
+	for(t = 0; t <= durata; t++){
+		finito = t ? programma_passo(p) : 0;
+		atteso = riferimento(p, t, &fine);
+
+		if(p->duty != atteso || finito != (fine && t == p->punti[p->n - 1].tempo) || p->attivo == fine){
+			fprintf(stderr, "%s: a %llu ms duty cycle %u (atteso %u), fine %d (attesa %d), attivo %d\n", nome, t,
+			p->duty, atteso, finito, fine, p->attivo);
+			return 1;
+		}
+	}
+
+	return 0;
+
+}
+
+static void imposta(struct programmaDuty *p, unsigned char opzioni, const unsigned long *punti, int n){
+
+	int i;
+
+	programma_reset(p);
+	p->opzioni = opzioni;
+	for(i = 0; i < n; i++)
+	programma_aggiungi(p, punti[2 * i], punti[2 * i + 1]);
+
+}
+
+//Casi con l'andamento atteso: coppie (ms, duty cycle) da controllare, -1 come duty cycle per l'istante della fine.
+struct casoProgramma {
+	const char *nome;
+	unsigned char opzioni;
+	int n;
+	unsigned long punti[8];
+	int controlli;
+	long atteso[16];
+};
+
+static const struct casoProgramma casi[] = {
+	{"gradini", 0, 3, {0, 200, 100, 800, 250, 0},
+	5, {0, 200, 99, 200, 100, 800, 249, 800, 250, -1}},
+	{"rampa", PROGRAMMA_LINEARE, 2, {0, 0, 1000, 1000},
+	5, {1, 1, 500, 500, 999, 999, 1000, -1, 1001, 1000}},
+	{"rampa lenta", PROGRAMMA_LINEARE, 2, {0, 0, 60000, 10},
+	5, {5999, 0, 6000, 1, 30000, 5, 59999, 9, 60000, -1}},
+	{"discesa", PROGRAMMA_LINEARE, 2, {0, 1000, 7, 0},
+	5, {1, 858, 3, 572, 6, 143, 7, -1, 100, 0}},
+	{"salto", PROGRAMMA_LINEARE, 2, {0, 0, 1, 1000},
+	2, {0, 0, 1, -1}},
+	{"ciclo", PROGRAMMA_LINEARE | PROGRAMMA_CICLO, 3, {0, 100, 10, 200, 20, 100},
+	6, {5, 150, 10, 200, 15, 150, 20, 100, 25, 150, 1000, 100}},
+	{"ciclo a gradini", PROGRAMMA_CICLO, 3, {0, 300, 40, 700, 50, 0},
+	5, {39, 300, 40, 700, 49, 700, 50, 300, 90, 700}},
+	{"fermo a 0%", 0, 4, {0, 500, 100, 0, 200, 700, 300, 0},
+	6, {99, 500, 100, 0, 199, 0, 200, 700, 299, 700, 300, -1}},
+	{"da 0% lineare", PROGRAMMA_LINEARE, 3, {0, 0, 10, 0, 20, 100},
+	5, {5, 0, 10, 0, 11, 10, 19, 90, 20, -1}},
+};
+#define N_CASI (sizeof(casi) / sizeof(casi[0]))
+
+static int provaCasi(void){
+
+	struct programmaDuty p;
+	unsigned long t, fineAttesa;
+	unsigned int c;
+	int i, errori = 0, finito, errore;
+
+	for(c = 0; c < N_CASI; c++){
+		imposta(&p, casi[c].opzioni, casi[c].punti, casi[c].n);
+		programma_avvia(&p);
+		fineAttesa = (casi[c].opzioni & PROGRAMMA_CICLO) ? 0 : casi[c].punti[2 * (casi[c].n - 1)];
+		errore = 0;
+
+		for(t = 0, i = 0; i < casi[c].controlli; t++){
+			finito = t ? programma_passo(&p) : 0;
+			if(finito != (fineAttesa && t == fineAttesa)){
+				fprintf(stderr, "%s: fine a %lu ms, attesa a %lu ms\n", casi[c].nome, t, fineAttesa);
+				errore = 1;
+				break;
+			}
+
+			if(t != (unsigned long) casi[c].atteso[2 * i])
+			continue;
+
+			if(casi[c].atteso[2 * i + 1] < 0 ? p.attivo : p.duty != casi[c].atteso[2 * i + 1]){
+				fprintf(stderr, "%s: a %lu ms duty cycle %u%s, atteso %ld\n", casi[c].nome, t, p.duty,
+				p.attivo ? "" : " (finito)", casi[c].atteso[2 * i + 1]);
+				errore = 1;
+			}
+			i++;
+		}
+
+		//Lo stesso caso confrontato ad ogni millisecondo con il riferimento, per due giri se è in ciclo.
+		if(!errore)
+		errore = confronta(&p, casi[c].punti[2 * (casi[c].n - 1)] * 2 + 10, casi[c].nome);
+
+		printf("%-16s %s\n", casi[c].nome, errore ? "ERRATO" : "ok");
+		errori += errore;
+	}
+
+	return errori ? 1 : 0;
+
+}
+
+//Salva il programma nel formato della EEPROM, lo rilegge in un altro e controlla che sia uguale e valido.
+static int provaSalvataggio(const struct programmaDuty *p){
+
+	struct programmaDuty letto;
+	unsigned char i;
+
+	memset(&letto, 0xA5, sizeof(letto));
+	for(i = 0; i < PROGRAMMA_DIM; i++)
+	programma_imposta_byte(&letto, i, programma_byte(p, i));
+
+	if(letto.n != p->n || letto.opzioni != p->opzioni || !programma_valido(&letto, DC_MAX))
+	return 1;
+
+	for(i = 0; i < p->n; i++){
+		if(letto.punti[i].tempo != p->punti[i].tempo || letto.punti[i].duty != p->punti[i].duty)
+		return 1;
+	}
+
+	return 0;
+
+}
+
+static int fuzz(unsigned long semeIniziale, long n){
+
+	struct programmaDuty p;
+	unsigned long tempo;
+	unsigned char punti;
+	long prova;
+	char nome[40];
+	int i;
+
+	seme = semeIniziale;
+
+	for(prova = 0; prova < n; prova++){
+		programma_reset(&p);
+		p.opzioni = casuale(4);
+		punti = 2 + casuale(PROGRAMMA_PUNTI - 1);
+
+		//Tratti spesso brevi (anche di 1 ms) e a volte lunghi; duty cycle spesso agli estremi.
+		for(i = 0, tempo = 0; i < punti; i++){
+			if(i)
+			tempo += casuale(4) ? 1 + casuale(20) : 1 + casuale(FUZZ_TRATTO_MAX);
+			if(!programma_aggiungi(&p, tempo, casuale(4) ? casuale(DC_MAX + 1) : casuale(2) * DC_MAX)){
+				fprintf(stderr, "fuzz: seme %lu, prova %ld: punto %d non accettato\n", semeIniziale, prova, i);
+				return 1;
+			}
+		}
+
+		//Un punto fuori ordine o oltre il massimo non deve entrare.
+		if(programma_aggiungi(&p, tempo, 0) || (p.n < PROGRAMMA_PUNTI) != programma_aggiungi(&p, tempo + 1, 0)){
+			fprintf(stderr, "fuzz: seme %lu, prova %ld: controllo dei tempi sbagliato\n", semeIniziale, prova);
+			return 1;
+		}
+
+		if(provaSalvataggio(&p)){
+			fprintf(stderr, "fuzz: seme %lu, prova %ld: programma salvato diverso\n", semeIniziale, prova);
+			return 1;
+		}
+
+		sprintf(nome, "fuzz: seme %lu, prova %ld", semeIniziale, prova);
+		if(confronta(&p, p.punti[p.n - 1].tempo * ((p.opzioni & PROGRAMMA_CICLO) ? 3 : 1) + 5, nome))
+		return 1;
+	}
+
+	printf("fuzz: %ld programmi senza differenze\n", n);
+	return 0;
+
+}
+
+static int andamento(int argc, char **argv){
+
+	struct programmaDuty p;
+	unsigned long long t, durata;
+	unsigned int ultimo = 0xFFFF;
+
+	programma_reset(&p);
+	p.opzioni = 0;
+
+	for(; argc && !strcmp(argv[0], "lin"); argc--, argv++)
+	p.opzioni |= PROGRAMMA_LINEARE;
+	for(; argc && !strcmp(argv[0], "ciclo"); argc--, argv++)
+	p.opzioni |= PROGRAMMA_CICLO;
+
+	for(; argc >= 2; argc -= 2, argv += 2){
+		if(atof(argv[1]) < 0 || atof(argv[1]) > 100 || !programma_aggiungi(&p, strtoul(argv[0], NULL, 0), atof(argv[1]) * 10 + 0.5)){
+			fprintf(stderr, "punto non valido: %s %s\n", argv[0], argv[1]);
+			return 2;
+		}
+	}
+
+	if(argc || !programma_avvia(&p)){
+		fprintf(stderr, "servono almeno due punti, il primo a 0 ms\n");
+		return 2;
+	}
+
+	durata = p.punti[p.n - 1].tempo * ((p.opzioni & PROGRAMMA_CICLO) ? 2 : 1);
+	printf("ms,duty\n");
+
+	for(t = 0; t <= durata; t++){
+		if(t)
+		programma_passo(&p);
+		if(p.duty != ultimo || t == durata)
+		printf("%llu,%u.%u\n", t, p.duty / 10, p.duty % 10);
+		ultimo = p.duty;
+	}
+
+	return 0;
+
+}
+
+int main(int argc, char **argv){
+
+	if(argc == 2 && !strcmp(argv[1], "casi"))
+	return provaCasi();
+	if(argc >= 2 && !strcmp(argv[1], "fuzz"))
+	return fuzz(argc >= 3 ? strtoul(argv[2], NULL, 0) : 1, argc >= 4 ? atol(argv[3]) : FUZZ_N);
+	if(argc >= 2 && !strcmp(argv[1], "andamento"))
+	return andamento(argc - 2, argv + 2);
+
+	fprintf(stderr, "uso: prova_programma casi | prova_programma fuzz [seme] [n] | prova_programma andamento [lin] [ciclo] <ms> <duty> ...\n");
+	return 2;
+
+}
@@ -0,0 +1,248 @@
+/*************************************************************************************************************
+-------------------------PROVA DEL FILTRO E DELLA PROTEZIONE DA SOVRACORRENTE PER L'HOST----------------------
+Fa passare una traccia di corrente del motore, un campione per periodo del PWM come nella ISR dell'ADC del firmware,
+attraverso la media mobile e la protezione di corrente.h, con gli stessi parametri di main.c.
+La corrente in mA viene prima convertita in conteggi dell'ADC (8 bit, fondo scala CORRENTE_FONDO_SCALA_MA), così la prova
+vede anche l'arrotondamento della scheda.
+
+Senza una traccia vengono provati alcuni casi simulati, ognuno con il risultato atteso:
+-regime: corrente costante con rumore, sotto la soglia: nessun intervento e media vicina alla corrente reale;
+-commutazioni: picchi isolati di un campione, ben oltre la soglia (disturbi delle commutazioni): nessun intervento;
+-avvio: spunto all'accensione che resta sotto la soglia e si smorza: nessun intervento;
+-blocco: il rotore si blocca e la corrente sale oltre la soglia: intervento entro CORRENTE_CONFERME campioni dal superamento;
+-riarmo: dopo l'intervento la corrente torna bassa e la protezione viene riarmata: nessun nuovo intervento.
+L'uscita è 1 se un caso non dà il risultato atteso.
+
+Con una traccia registrata (un valore in mA per riga, le righe che non iniziano con un numero vengono saltate)
+viene scritta su stdout una riga CSV per campione e su stderr il campione dell'intervento, se c'è.
+
+Compilazione:	gcc -Wall -I.. -o simulazione_corrente simulazione_corrente.c -lm
+Uso:
+	simulazione_corrente [-s mA] [-c conferme]		prova i casi simulati
+	simulazione_corrente [-s mA] [-c conferme] traccia	filtra la traccia ("-" per stdin)
+-s e -c cambiano soglia e conferme, come il comando "corrente <mA>" (le conferme solo ricompilando il firmware).
+*************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "corrente.h"
+
+//Parametri presi da main.c: vanno tenuti allineati.
+#define CORRENTE_FONDO_SCALA_MA 10000
+#define CORRENTE_SOGLIA_MA 3000
+#define CORRENTE_CONFERME 2
+#define PWM_FREQ_INIT 20000 //Campioni al secondo.
+
+#define CAMPIONI 4000 //Campioni di ogni caso simulato (0.2 s a 20 kHz).
+
+enum caso {REGIME, COMMUTAZIONI, AVVIO, BLOCCO, RIARMO, N_CASI};
+static const char *nomiCasi[N_CASI] = {"regime", "commutazioni", "avvio", "blocco", "riarmo"};
+
+static unsigned int sogliaMa = CORRENTE_SOGLIA_MA;
+static unsigned char conferme = CORRENTE_CONFERME;
+static unsigned long seme = 1;
+
+//Rumore uniforme tra -ampiezza e +ampiezza, ripetibile.
+static double rumore(double ampiezza){
+	
+	seme = seme * 1103515245UL + 12345UL;
+	
+	return ampiezza * ((double) ((seme >> 16) & 0x7FFF) / 16383.5 - 1);
+	
+}
+
+//Corrente reale in mA al campione i di un caso simulato.
+static double correnteCaso(enum caso c, int i){
+	
+	switch(c){
+		
+		case REGIME:
+		return 1500 + rumore(200);
+		
+		case COMMUTAZIONI:
+		return (i % 50 == 0 ? 8000 : 2000) + rumore(100);
+		
+		case AVVIO: //Spunto di 2.8 A che si smorza verso 1 A con costante di tempo di 400 campioni (20 ms).
+		return 1000 + 1800 * exp(-i / 400.0) + rumore(50);
+		
+		case BLOCCO: //Dal campione 1000 la corrente sale di 5 mA per campione fino a 5 A.
+		if(i < 1000)
+		return 1500 + rumore(100);
+		return fmin(1500 + 5.0 * (i - 1000), 5000) + rumore(100);
+		
+		case RIARMO: //Blocco breve, poi il motore riparte: la protezione viene riarmata al campione 2000.
+		return (i >= 1000 && i < 1500 ? 6000 : 1500) + rumore(100);
+		
+		default:
+		return 0;
+	}
+	
+}
+
+//Conteggi dell'ADC per una corrente in mA, come li converte la scheda (troncati, da 0 a 255).
+static unsigned char conteggiADC(double ma){
+	
+	double c = ma * 256 / CORRENTE_FONDO_SCALA_MA;
+	
+	return c < 0 ? 0 : c > 255 ? 255 : (unsigned char) c;
+	
+}
+
+static void inizializza(struct protezioneCorrente *p){
+	
+	p->soglia = corrente_conteggi(sogliaMa, CORRENTE_FONDO_SCALA_MA);
+	p->conferme = conferme;
+	corrente_reset(p);
+	
+}
+
+//Un caso simulato: restituisce 0 se il risultato è quello atteso.
+static int provaCaso(enum caso c){
+	
+	struct protezioneCorrente p;
+	double ma, mediaReale, errore = 0;
+	int i, intervento = -1, interventi = 0, primoSopra = -1, sopra = 0, esito = 0;
+	
+	inizializza(&p);
+	seme = 1 + c;
+	
+	for(i = 0; i < CAMPIONI; i++){
+		
+		if(c == RIARMO && i == 2000)
+		corrente_riarma(&p);
+		
+		ma = correnteCaso(c, i);
+		
+		//Primo campione da cui la corrente resta oltre la soglia (in conteggi) per CORRENTE_CONFERME campioni di fila.
+		sopra = conteggiADC(ma) > p.soglia ? sopra + 1 : 0;
+		if(primoSopra < 0 && sopra == conferme)
+		primoSopra = i;
+		
+		if(corrente_campione(&p, conteggiADC(ma))){
+			interventi++;
+			if(intervento < 0)
+			intervento = i;
+		}
+		
+	}
+	
+	//Media: con corrente costante (caso regime) la media mobile deve stare entro il rumore diviso per la radice della finestra
+	//più l'arrotondamento dei conteggi.
+	if(c == REGIME){
+		seme = 1 + c;
+		mediaReale = 0;
+		for(i = 0; i < CAMPIONI; i++)
+		mediaReale += correnteCaso(c, i);
+		mediaReale /= CAMPIONI;
+		errore = fabs(corrente_ma(corrente_media(&p), CORRENTE_FONDO_SCALA_MA) - mediaReale);
+		if(errore > 200 / 2.0 + 2.0 * CORRENTE_FONDO_SCALA_MA / 256){
+			fprintf(stderr, "%s: media %u mA, attesa %.0f mA\n", nomiCasi[c],
+			corrente_ma(corrente_media(&p), CORRENTE_FONDO_SCALA_MA), mediaReale);
+			esito = 1;
+		}
+	}
+	
+	if(c == BLOCCO){
+		if(intervento < 0 || primoSopra < 0 || intervento != primoSopra){
+			fprintf(stderr, "%s: intervento al campione %d, atteso al %d\n", nomiCasi[c], intervento, primoSopra);
+			esito = 1;
+		}
+		else if(!p.scattata){
+			fprintf(stderr, "%s: guasto non memorizzato\n", nomiCasi[c]);
+			esito = 1;
+		}
+	}
+	else if(c == RIARMO){
+		if(interventi != 1 || p.scattata){
+			fprintf(stderr, "%s: %d interventi, guasto %s dopo il riarmo\n", nomiCasi[c], interventi, p.scattata ? "presente" : "assente");
+			esito = 1;
+		}
+	}
+	else if(intervento >= 0){
+		fprintf(stderr, "%s: intervento inatteso al campione %d\n", nomiCasi[c], intervento);
+		esito = 1;
+	}
+	
+	fprintf(stderr, "%-14s %s: intervento %s", nomiCasi[c], esito ? "ERRATO" : "ok", intervento >= 0 ? "al campione " : "nessuno");
+	if(intervento >= 0)
+	fprintf(stderr, "%d (%.2f ms)", intervento, intervento * 1000.0 / PWM_FREQ_INIT);
+	fprintf(stderr, ", picco %u mA", corrente_ma(p.picco, CORRENTE_FONDO_SCALA_MA));
+	if(c == REGIME)
+	fprintf(stderr, ", errore della media %.0f mA", errore);
+	fprintf(stderr, "\n");
+	
+	return esito;
+	
+}
+
+static int provaTraccia(const char *nome){
+	
+	struct protezioneCorrente p;
+	FILE *f = strcmp(nome, "-") ? fopen(nome, "r") : stdin;
+	char riga[80];
+	double ma;
+	long i = 0, intervento = -1;
+	
+	if(f == NULL){
+		perror(nome);
+		return 2;
+	}
+	
+	inizializza(&p);
+	printf("campione,ma,conteggi,media_ma,scattata\n");
+	
+	while(fgets(riga, sizeof(riga), f)){
+		
+		if(sscanf(riga, "%lf", &ma) != 1)
+		continue;
+		
+		if(corrente_campione(&p, conteggiADC(ma)) && intervento < 0)
+		intervento = i;
+		
+		printf("%ld,%.0f,%u,%u,%d\n", i, ma, conteggiADC(ma), corrente_ma(corrente_media(&p), CORRENTE_FONDO_SCALA_MA), p.scattata);
+		i++;
+	}
+	
+	if(f != stdin)
+	fclose(f);
+	
+	if(intervento >= 0)
+	fprintf(stderr, "%ld campioni, intervento al campione %ld (%.2f ms), picco %u mA\n", i, intervento,
+	intervento * 1000.0 / PWM_FREQ_INIT, corrente_ma(p.picco, CORRENTE_FONDO_SCALA_MA));
+	else
+	fprintf(stderr, "%ld campioni, nessun intervento, picco %u mA\n", i, corrente_ma(p.picco, CORRENTE_FONDO_SCALA_MA));
+	
+	return 0;
+	
+}
+
+int main(int argc, char **argv){
+	
+	int i, errori = 0;
+	
+	for(i = 1; i + 1 < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i += 2){
+		if(!strcmp(argv[i], "-s") && atoi(argv[i + 1]) > 0 && atoi(argv[i + 1]) < CORRENTE_FONDO_SCALA_MA)
+		sogliaMa = atoi(argv[i + 1]);
+		else if(!strcmp(argv[i], "-c") && atoi(argv[i + 1]) > 0 && atoi(argv[i + 1]) < 256)
+		conferme = atoi(argv[i + 1]);
+		else
+		break;
+	}
+	
+	if(i + 1 == argc)
+	return provaTraccia(argv[i]);
+	
+	if(i != argc){
+		fprintf(stderr, "uso: simulazione_corrente [-s mA] [-c conferme] [traccia]\n");
+		return 2;
+	}
+	
+	fprintf(stderr, "soglia %u mA (%u conteggi), %u conferme\n", sogliaMa, corrente_conteggi(sogliaMa, CORRENTE_FONDO_SCALA_MA), conferme);
+	for(i = 0; i < N_CASI; i++)
+	errori += provaCaso(i);
+	
+	return errori ? 1 : 0;
+	
+}
@@ -0,0 +1,129 @@
+/*************************************************************************************************************
+------------------------------SIMULATORE DELLA REGOLAZIONE DI VELOCITA' PER L'HOST----------------------------
+Prova su Linux la misura del tachimetro e il regolatore PID del firmware (regolazione.h) con un motore simulato
+del primo ordine: la velocità tende a GUADAGNO * duty cycle con costante di tempo TAU.
+Il tachimetro viene simulato con gli istanti degli impulsi in conteggi del timer 1 (0.5 us), come la cattura su ICP1,
+e il regolatore gira ogni PID_PERIODO_MS come nella ISR del timer 2.
+Durante la prova la tensione di alimentazione cala (il guadagno scende del 20%), cambia la velocità richiesta
+e arriva un carico che frena il motore: in anello aperto ognuno di questi eventi sposterebbe la velocità.
+
+Compilazione:	gcc -Wall -I.. -o simulazione_pid simulazione_pid.c
+Uso:
+	simulazione_pid [kp ki kd]	stampa su stdout una riga CSV ogni PID_PERIODO_MS e su stderr un riassunto
+I guadagni predefiniti sono quelli di main.c (PID_KP in Q8.8, PID_KI in Q0.16, PID_KD in Q8.8).
+*************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "regolazione.h"
+
+//Parametri presi da main.c: vanno tenuti allineati.
+#define DC_MAX 1000
+#define PID_PERIODO_MS 10
+#define PID_KP 200
+#define PID_KI 1500
+#define PID_KD 0
+#define TACH_IMPULSI_GIRO 2
+#define TACH_FERMO_MS 500
+#define TACH_COSTANTE (60UL * 2000000UL / TACH_IMPULSI_GIRO)
+
+//Motore simulato (una ventola da PC): 3000 rpm al 100%, costante di tempo di 0.4 s.
+#define GUADAGNO 3.0 //rpm per decimo di percento.
+#define TAU 0.4 //s
+#define DURATA_MS 12000
+
+//Riferimento e disturbi nel tempo.
+static unsigned int riferimento(int ms){
+	
+	return ms < 6000 ? 1500 : 2000;
+	
+}
+
+static double guadagno(int ms){
+	
+	return ms < 3000 ? GUADAGNO : GUADAGNO * 0.8;
+	
+}
+
+static double carico(int ms){
+	
+	return ms < 9000 ? 0 : 300; //rpm persi per l'attrito aggiunto.
+	
+}
+
+int main(int argc, char **argv){
+	
+	struct regolatorePID pid = {PID_KP, PID_KI, PID_KD, DC_MAX, 0, 0};
+	double velocita = 0, giri = 0; //Velocità reale in rpm e impulsi contati dall'avvio, con la parte frazionaria.
+	unsigned long tempo = 0; //Conteggi del timer 1.
+	unsigned long ultimo = 0, finestra = 0; //Istante dell'ultimo impulso e dell'ultimo impulso già usato.
+	unsigned char impulsi = 0, letti = 0, finestreVuote = 0;
+	unsigned int misura = 0, duty = 0, rif;
+	double erroreMax[4] = {0, 0, 0, 0}, sovraelongazione = 0;
+	int ms, passo, fase;
+	
+	if(argc == 4){
+		pid.kp = atoi(argv[1]);
+		pid.ki = atoi(argv[2]);
+		pid.kd = atoi(argv[3]);
+	}
+	else if(argc != 1){
+		fprintf(stderr, "uso: simulazione_pid [kp ki kd]\n");
+		return 2;
+	}
+	
+	pid_reset(&pid, 0, 0);
+	printf("ms,riferimento,rpm_misurati,rpm_reali,duty\n");
+	
+	for(ms = 0; ms < DURATA_MS; ms++){
+		
+		//Motore: un passo di Eulero al millisecondo, con gli impulsi distribuiti nel millisecondo.
+		for(passo = 0; passo < 2000; passo++){
+			velocita += (guadagno(ms) * duty - carico(ms) - velocita) / (TAU * 2000000.0);
+			if(velocita < 0)
+			velocita = 0;
+			giri += velocita * TACH_IMPULSI_GIRO / 60.0 / 2000000.0;
+			tempo++;
+			if(giri >= 1){
+				giri -= 1;
+				ultimo = tempo;
+				impulsi++;
+			}
+		}
+		
+		if((ms + 1) % PID_PERIODO_MS)
+		continue;
+		
+		//Misura come nel firmware: impulsi arrivati dall'ultima lettura e tempo tra gli ultimi impulsi delle due letture.
+		if(impulsi != letti){
+			misura = tach_rpm(impulsi - letti, ultimo - finestra, TACH_COSTANTE);
+			letti = impulsi;
+			finestra = ultimo;
+			finestreVuote = 0;
+		}
+		else if(finestreVuote < TACH_FERMO_MS / PID_PERIODO_MS)
+		finestreVuote++;
+		else
+		misura = 0;
+		
+		rif = riferimento(ms);
+		duty = pid_passo(&pid, rif, misura);
+		
+		printf("%d,%u,%u,%.0f,%u\n", ms + 1, rif, misura, velocita, duty);
+		
+		//Errore massimo nell'ultimo secondo di ogni fase (regime) e sovraelongazione dopo il cambio di riferimento.
+		fase = ms / 3000;
+		if(ms % 3000 >= 2000 && abs((int) velocita - (int) rif) > erroreMax[fase])
+		erroreMax[fase] = abs((int) velocita - (int) rif);
+		if(ms >= 6000 && ms < 9000 && velocita - rif > sovraelongazione)
+		sovraelongazione = velocita - rif;
+	}
+	
+	fprintf(stderr, "kp %d ki %u kd %d\n", pid.kp, pid.ki, pid.kd);
+	fprintf(stderr, "errore a regime (rpm): avvio %.0f, alimentazione -20%% %.0f, 2000 rpm %.0f, carico %.0f\n",
+	erroreMax[0], erroreMax[1], erroreMax[2], erroreMax[3]);
+	fprintf(stderr, "sovraelongazione da 1500 a 2000 rpm: %.0f rpm\n", sovraelongazione);
+	
+	return 0;
+	
+}
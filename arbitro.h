@@ -0,0 +1,155 @@
+/*************************************************************************************************************
+-------------------------------ARBITRO TRA DUTY CYCLE LOCALE E REMOTO----------------------------------------
+Il duty cycle del canale principale arriva da due sorgenti, sempre attive:
+-locale: i dip switch, letti ogni millisecondo; un valore fermo per DIP_STABILE_MS e valido diventa un setpoint;
+-remoto: i comandi dal terminale, i frame binari e il Modbus; ogni comando sul canale principale è un setpoint.
+Ogni setpoint porta l'istante (in ms) in cui è arrivato. L'arbitro, chiamato una volta al millisecondo (il tick di controllo,
+nella ISR del timer 2), sceglie la sorgente che comanda:
+-il locale, se il selettore della priorità è sul locale;
+-il locale anche con la priorità al remoto, se è attivo il timeout e il remoto non manda setpoint da più di timeout ms
+ (ad esempio si è staccato il cavo): il remoto torna a comandare con il suo prossimo setpoint;
+-altrimenti il remoto.
+Quando la sorgente cambia, il suo ultimo setpoint viene applicato nello stesso tick, senza aspettare un nuovo valore;
+se la sorgente non ha ancora un setpoint (il locale con i dip switch su un valore non valido) il canale resta com'è.
+I setpoint della sorgente che non comanda vengono conservati e non toccano il canale.
+
+I millisecondi sono a 16 bit e ricominciano da 0 dopo circa 65 secondi: l'età di un setpoint viene controllata ad ogni tick
+e oltre ARBITRO_ETA_MAX il setpoint resta "vecchio", così l'età non torna mai piccola.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c) sia dal programma
+di prova per l'host (Host/prova_arbitro.c), che confronta l'arbitro con un modello a 64 bit su sequenze casuali.
+*************************************************************************************************************/
+#ifndef ARBITRO_H_
+#define ARBITRO_H_
+
+#define ARBITRO_ETA_MAX 60000 //Età massima distinta di un setpoint, in ms: oltre, il setpoint è solo vecchio.
+#define ARBITRO_TIMEOUT_MAX ARBITRO_ETA_MAX //Timeout massimo del remoto, in ms.
+
+enum sorgenteDuty {ARBITRO_REMOTO, ARBITRO_LOCALE};
+
+//Bit dell'esito di arbitro_passo().
+#define ARBITRO_APPLICA 0x01 //Il duty cycle restituito va applicato al canale.
+#define ARBITRO_CAMBIO 0x02 //In questo tick è cambiata la sorgente che comanda.
+
+struct setpointDuty {
+	unsigned int duty; //Decimi di percento, 0 = spento.
+	unsigned int istante; //Millisecondi (16 bit) in cui è arrivato.
+	unsigned char numero; //Cresce ad ogni setpoint e salta lo 0, che vuol dire "nessun setpoint".
+	char vecchio; //1 quando l'età ha superato ARBITRO_ETA_MAX.
+};
+
+struct arbitroDuty {
+	struct setpointDuty locale;
+	struct setpointDuty remoto;
+	char prioritaLocale; //Selettore della priorità: 1 al locale, 0 al remoto.
+	unsigned int timeout; //In ms, 0 = il remoto non scade mai.
+	char scaduto; //Il remoto ha superato il timeout: resta a 1 fino al suo prossimo setpoint.
+	unsigned char sorgente; //Sorgente che comanda il canale (ARBITRO_*).
+	unsigned char applicato; //Numero del setpoint della sorgente che è già sul canale (0 = nessuno).
+};
+
+static inline void arbitro_setpoint(struct setpointDuty *s, unsigned int duty, unsigned int ora){
+
+	s->duty = duty;
+	s->istante = ora;
+	s->vecchio = 0;
+	if(++s->numero == 0)
+	s->numero = 1;
+
+}
+
+//Età del setpoint in ms, al più ARBITRO_ETA_MAX. La maschera serve solo su Linux, dove int è a 32 bit.
+static inline unsigned int arbitro_eta(const struct setpointDuty *s, unsigned int ora){
+
+	unsigned int eta = (ora - s->istante) & 0xFFFF;
+
+	return (s->vecchio || eta > ARBITRO_ETA_MAX) ? ARBITRO_ETA_MAX : eta;
+
+}
+
+static inline unsigned char arbitro_scelta(const struct arbitroDuty *a){
+
+	return (a->prioritaLocale || a->scaduto) ? ARBITRO_LOCALE : ARBITRO_REMOTO;
+
+}
+
+//Stato all'accensione: il remoto parte dal duty cycle salvato, come se fosse appena arrivato; il locale non ha ancora
+//un setpoint. Il primo arbitro_passo() restituisce il duty cycle della sorgente che comanda.
+static inline void arbitro_avvia(struct arbitroDuty *a, unsigned int dutyRemoto, unsigned int ora){
+
+	a->locale.numero = 0;
+	a->locale.istante = ora;
+	a->locale.vecchio = 0;
+	a->remoto.numero = 0;
+	arbitro_setpoint(&a->remoto, dutyRemoto, ora);
+	a->scaduto = 0;
+	a->sorgente = arbitro_scelta(a);
+	a->applicato = 0;
+
+}
+
+//Nuovo setpoint locale: lo applica il prossimo arbitro_passo(), se comanda il locale.
+static inline void arbitro_locale(struct arbitroDuty *a, unsigned int duty, unsigned int ora){
+
+	arbitro_setpoint(&a->locale, duty, ora);
+
+}
+
+//Nuovo setpoint remoto. Restituisce 1 se comanda il remoto: il chiamante applica subito il duty cycle, che l'arbitro
+//considera già sul canale. Con il timeout scaduto e la priorità al remoto, il setpoint riporta il comando al remoto.
+static inline char arbitro_remoto(struct arbitroDuty *a, unsigned int duty, unsigned int ora){
+
+	arbitro_setpoint(&a->remoto, duty, ora);
+	a->scaduto = 0;
+
+	if(a->prioritaLocale)
+	return 0;
+
+	a->sorgente = ARBITRO_REMOTO;
+	a->applicato = a->remoto.numero;
+
+	return 1;
+
+}
+
+//Cambia il timeout del remoto (0 lo disattiva). Il controllo riparte dal prossimo tick con l'età del setpoint remoto.
+static inline void arbitro_timeout(struct arbitroDuty *a, unsigned int timeout){
+
+	a->timeout = timeout;
+	a->scaduto = 0;
+
+}
+
+//Un tick di controllo. Restituisce i bit ARBITRO_*: con ARBITRO_APPLICA il duty cycle da applicare è in *duty.
+static inline unsigned char arbitro_passo(struct arbitroDuty *a, unsigned int ora, unsigned int *duty){
+
+	const struct setpointDuty *s;
+	unsigned char sorgente, esito = 0;
+
+	if(arbitro_eta(&a->locale, ora) == ARBITRO_ETA_MAX)
+	a->locale.vecchio = 1;
+	if(arbitro_eta(&a->remoto, ora) == ARBITRO_ETA_MAX)
+	a->remoto.vecchio = 1;
+
+	if(a->timeout && !a->scaduto && arbitro_eta(&a->remoto, ora) >= a->timeout)
+	a->scaduto = 1;
+
+	sorgente = arbitro_scelta(a);
+	if(sorgente != a->sorgente){
+		a->sorgente = sorgente;
+		a->applicato = 0;
+		esito = ARBITRO_CAMBIO;
+	}
+
+	s = (sorgente == ARBITRO_LOCALE) ? &a->locale : &a->remoto;
+	if(s->numero && s->numero != a->applicato){
+		a->applicato = s->numero;
+		*duty = s->duty;
+		esito |= ARBITRO_APPLICA;
+	}
+
+	return esito;
+
+}
+
+#endif /* ARBITRO_H_ */
@@ -0,0 +1,238 @@
+/*************************************************************************************************************
+-------------------------------PARSER INCREMENTALE DEI COMANDI TESTUALI--------------------------------------
+I comandi testuali vengono riconosciuti un byte alla volta, mentre arrivano dalla seriale: non serve un buffer per
+la riga e non ci sono confronti tra stringhe.
+
+-Una riga finisce con '\n' e contiene uno o più comandi separati da ';'; un comando è fatto di parole separate da spazi
+ (es. "set 42.5 3; up"). I caratteri di controllo diversi da '\n' (es. '\r') e quelli oltre il 127 vengono ignorati.
+-Le parole che iniziano con una lettera vengono cercate, lettera per lettera, in un trie (albero dei prefissi) salvato
+ in flash: ogni nodo ha il carattere, il primo figlio, il fratello successivo e la parola che finisce nel nodo.
+ La prima lettera usa una tabella diretta, quindi ad ogni byte si scorrono al più pochi fratelli.
+ Il trie è in comandi_trie.h, generato da Host/prova_comandi.c a partire dall'elenco COMANDI_PAROLE.
+-Le parole che iniziano con una cifra, un segno o un punto sono numeri: il valore viene calcolato mentre arrivano le cifre
+ e il firmware decide poi, comando per comando, se il numero è ammesso (intero, duty cycle con un decimale, con segno...).
+-Quando arriva ';' o '\n' il parser restituisce COMANDI_PRONTO e il comando decodificato (token della parola e argomenti)
+ si trova in p->comando. Lo stesso parser serve in tutti gli stati della macchina a stati.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c) sia dal programma
+di prova per l'host (Host/prova_comandi.c), che genera il trie, lo confronta con un parser di riferimento su righe
+casuali e misura il costo per byte.
+*************************************************************************************************************/
+#ifndef COMANDI_H_
+#define COMANDI_H_
+
+//Sulla scheda il trie resta in flash; sull'host è una tabella normale.
+#ifndef PROGMEM
+#define PROGMEM
+#define pgm_read_byte(p) (*(const unsigned char *)(p))
+#endif
+
+#define COMANDI_MAX_PAROLE 3 //Parole di un comando (la prima e due argomenti): un comando più lungo non viene riconosciuto.
+#define COMANDI_MAX_CIFRE 9 //Cifre della parte intera di un numero: oltre, il valore smette di crescere e il numero non è ammesso.
+
+//Elenco delle parole riconosciute: token e testo. Per aggiungere una parola si aggiunge qui e si rigenera comandi_trie.h.
+#define COMANDI_PAROLE(X) \
+	X(PAROLA_UP, "up") X(PAROLA_DOWN, "down") X(PAROLA_SET, "set") X(PAROLA_STEP, "step") \
+	X(PAROLA_FREQ, "freq") X(PAROLA_MODO, "modo") X(PAROLA_FAST, "fast") X(PAROLA_PC, "pc") \
+	X(PAROLA_RAMPA, "rampa") X(PAROLA_LIN, "lin") X(PAROLA_S, "s") X(PAROLA_RPM, "rpm") \
+	X(PAROLA_BAUD, "baud") X(PAROLA_AUTO, "auto") X(PAROLA_TELEMETRIA, "telemetria") X(PAROLA_STATS, "stats") \
+	X(PAROLA_MACCHINA, "macchina") X(PAROLA_PRIORITA, "priorita") X(PAROLA_LOCALE, "locale") X(PAROLA_REMOTO, "remoto") \
+	X(PAROLA_MODBUS, "modbus") X(PAROLA_CORRENTE, "corrente") X(PAROLA_RESET, "reset") X(PAROLA_PROGRAMMA, "programma") \
+	X(PAROLA_AVVIA, "avvia") X(PAROLA_STOP, "stop") X(PAROLA_CICLO, "ciclo") X(PAROLA_GRADINI, "gradini") X(PAROLA_SALVA, "salva") \
+	X(PAROLA_TIMEOUT, "timeout")
+
+#define COMANDI_TOKEN(token, testo) token,
+enum parolaComando {PAROLA_NESSUNA, COMANDI_PAROLE(COMANDI_TOKEN) N_PAROLE};
+
+//Nodo del trie. Gli indici valgono 0 quando il figlio o il fratello non c'è (il nodo 0 non viene usato).
+struct nodoTrie {
+	char carattere;
+	unsigned char figlio;
+	unsigned char fratello;
+	unsigned char parola; //Token della parola che finisce in questo nodo, PAROLA_NESSUNA se è solo un prefisso.
+};
+
+#ifndef COMANDI_SENZA_TRIE //Definito solo per compilare Host/prova_comandi.c quando il trie va rigenerato.
+#include "comandi_trie.h"
+
+//Tipo di una parola del comando.
+enum tipoArgomento {ARG_PAROLA, ARG_NUMERO, ARG_ERRATO};
+
+struct argomento {
+	unsigned char tipo;
+	unsigned char parola; //Con ARG_PAROLA, il token.
+	char segno; //'+', '-' oppure 0 se il numero non ha segno.
+	char punto; //1 se il numero ha il punto decimale.
+	unsigned char cifre; //Cifre della parte intera (al più COMANDI_MAX_CIFRE + 1).
+	unsigned char decimali; //Cifre dopo il punto (al più 2).
+	unsigned char decimo; //Prima cifra dopo il punto.
+	unsigned long valore; //Parte intera.
+};
+
+struct comandoTestuale {
+	unsigned char n; //Parole del comando: 0 per un comando vuoto, COMANDI_MAX_PAROLE + 1 se sono troppe.
+	char fineRiga; //1 se il comando è l'ultimo della riga.
+	struct argomento parole[COMANDI_MAX_PAROLE];
+};
+
+//Esito del parser dopo ogni byte.
+enum esitoComandi {COMANDI_NIENTE, COMANDI_PRONTO};
+
+//Stato del parser.
+struct parserComandi {
+	unsigned char nodo; //Nodo del trie raggiunto dalla parola in corso.
+	char inParola; //1 mentre arrivano i caratteri di una parola.
+	char pronto; //Il comando è stato restituito: al prossimo byte si riparte da un comando vuoto.
+	struct comandoTestuale comando;
+};
+
+static inline void comandi_reset(struct parserComandi *p){
+
+	p->inParola = 0;
+	p->pronto = 0;
+	p->comando.n = 0;
+
+}
+
+//Un passo nel trie: dal nodo raggiunto (0 = nessuna lettera ancora) al figlio con il carattere c, oppure 0 se non c'è.
+static inline unsigned char comandi_trie_passo(unsigned char nodo, char c){
+
+	if(nodo == 0)
+	return (c >= 'a' && c <= 'z') ? pgm_read_byte(&trieRadice[c - 'a']) : 0;
+
+	nodo = pgm_read_byte(&trieNodi[nodo].figlio);
+	while(nodo && pgm_read_byte(&trieNodi[nodo].carattere) != c)
+	nodo = pgm_read_byte(&trieNodi[nodo].fratello);
+
+	return nodo;
+
+}
+
+//Chiude la parola in corso: una parola è riconosciuta solo se nel nodo raggiunto finisce una parola dell'elenco.
+static inline void comandi_fine_parola(struct parserComandi *p){
+
+	struct argomento *a;
+
+	if(!p->inParola)
+	return;
+
+	p->inParola = 0;
+
+	if(p->comando.n > COMANDI_MAX_PAROLE)
+	return;
+
+	a = &p->comando.parole[p->comando.n - 1];
+	if(a->tipo != ARG_PAROLA)
+	return;
+
+	a->parola = pgm_read_byte(&trieNodi[p->nodo].parola);
+	if(a->parola == PAROLA_NESSUNA)
+	a->tipo = ARG_ERRATO;
+
+}
+
+//Passa un byte al parser. Quando restituisce COMANDI_PRONTO, il comando completo si trova in p->comando
+//e resta valido fino al byte successivo. I comandi vuoti tra due ';' vengono saltati, mentre '\n' restituisce sempre
+//un comando, anche vuoto, perchè chi usa il parser sappia che la riga è finita.
+static inline unsigned char comandi_byte(struct parserComandi *p, char c){
+
+	struct argomento *a;
+
+	if(p->pronto){
+		p->pronto = 0;
+		p->comando.n = 0;
+	}
+
+	if(c == ' ' || c == ';' || c == '\n'){
+		comandi_fine_parola(p);
+
+		if(c == ' ' || (c == ';' && p->comando.n == 0))
+		return COMANDI_NIENTE;
+
+		p->comando.fineRiga = (c == '\n');
+		p->pronto = 1;
+		return COMANDI_PRONTO;
+	}
+
+	if(c < ' ' || c > '~')
+	return COMANDI_NIENTE;
+
+	//Primo carattere di una parola: il tipo dipende da questo carattere. Dopo COMANDI_MAX_PAROLE parole il comando è troppo lungo.
+	if(!p->inParola){
+		p->inParola = 1;
+		if(p->comando.n >= COMANDI_MAX_PAROLE){
+			p->comando.n = COMANDI_MAX_PAROLE + 1;
+			return COMANDI_NIENTE;
+		}
+
+		a = &p->comando.parole[p->comando.n++];
+		a->tipo = (c >= 'a' && c <= 'z') ? ARG_PAROLA : ARG_NUMERO;
+		a->segno = 0;
+		a->punto = 0;
+		a->cifre = 0;
+		a->decimali = 0;
+		a->decimo = 0;
+		a->valore = 0;
+		p->nodo = 0;
+	}
+	else if(p->comando.n > COMANDI_MAX_PAROLE)
+	return COMANDI_NIENTE;
+
+	a = &p->comando.parole[p->comando.n - 1];
+
+	switch(a->tipo){
+
+		case ARG_PAROLA:
+		p->nodo = comandi_trie_passo(p->nodo, c);
+		if(p->nodo == 0)
+		a->tipo = ARG_ERRATO;
+		break;
+
+		case ARG_NUMERO:
+		if(c >= '0' && c <= '9'){
+			if(a->punto){
+				if(a->decimali == 0)
+				a->decimo = c - '0';
+				if(a->decimali < 2)
+				a->decimali++;
+			}
+			else if(a->cifre < COMANDI_MAX_CIFRE){
+				a->valore = a->valore * 10 + (c - '0');
+				a->cifre++;
+			}
+			else
+			a->cifre = COMANDI_MAX_CIFRE + 1;
+		}
+		else if((c == '+' || c == '-') && !a->segno && !a->cifre && !a->punto)
+		a->segno = c;
+		else if(c == '.' && !a->punto)
+		a->punto = 1;
+		else
+		a->tipo = ARG_ERRATO;
+		break;
+	}
+
+	return COMANDI_NIENTE;
+
+}
+
+//Token della parola se è una parola riconosciuta, altrimenti PAROLA_NESSUNA.
+static inline unsigned char comandi_parola(const struct argomento *a){
+
+	return a->tipo == ARG_PAROLA ? a->parola : PAROLA_NESSUNA;
+
+}
+
+//Token del comando se è fatto di una sola parola riconosciuta (es. "stats"), altrimenti PAROLA_NESSUNA.
+static inline unsigned char comandi_parola_sola(const struct comandoTestuale *c){
+
+	if(c->n != 1)
+	return PAROLA_NESSUNA;
+
+	return comandi_parola(&c->parole[0]);
+
+}
+
+#endif /* COMANDI_SENZA_TRIE */
+
+#endif /* COMANDI_H_ */
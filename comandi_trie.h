@@ -0,0 +1,146 @@
+/*************************************************************************************************************
+Trie delle parole dei comandi, generato da Host/prova_comandi.c ("prova_comandi trie > comandi_trie.h")
+a partire dall'elenco COMANDI_PAROLE di comandi.h: non va modificato a mano.
+*************************************************************************************************************/
+#ifndef COMANDI_TRIE_H_
+#define COMANDI_TRIE_H_
+
+#define TRIE_NODI 129
+
+//Primo nodo per ogni lettera iniziale, da 'a' a 'z' (0 = nessuna parola).
+static const unsigned char trieRadice[26] PROGMEM = {40, 36, 84, 3, 0, 13, 112, 0, 0, 0, 0, 31, 17, 0, 0, 24, 0, 26, 7, 44, 1, 0, 0, 0, 0, 0};
+
+//Carattere, primo figlio, fratello successivo, parola che finisce nel nodo.
+static const struct nodoTrie trieNodi[TRIE_NODI] PROGMEM = {
+	{0, 0, 0, PAROLA_NESSUNA},
+	{'u', 2, 0, PAROLA_NESSUNA}, //u
+	{'p', 0, 0, PAROLA_UP}, //up
+	{'d', 4, 0, PAROLA_NESSUNA}, //d
+	{'o', 5, 0, PAROLA_NESSUNA}, //do
+	{'w', 6, 0, PAROLA_NESSUNA}, //dow
+	{'n', 0, 0, PAROLA_DOWN}, //down
+	{'s', 8, 0, PAROLA_S}, //s
+	{'e', 9, 10, PAROLA_NESSUNA}, //se
+	{'t', 0, 0, PAROLA_SET}, //set
+	{'t', 11, 119, PAROLA_NESSUNA}, //st
+	{'e', 12, 54, PAROLA_NESSUNA}, //ste
+	{'p', 0, 0, PAROLA_STEP}, //step
+	{'f', 14, 0, PAROLA_NESSUNA}, //f
+	{'r', 15, 21, PAROLA_NESSUNA}, //fr
+	{'e', 16, 0, PAROLA_NESSUNA}, //fre
+	{'q', 0, 0, PAROLA_FREQ}, //freq
+	{'m', 18, 0, PAROLA_NESSUNA}, //m
+	{'o', 19, 57, PAROLA_NESSUNA}, //mo
+	{'d', 20, 0, PAROLA_NESSUNA}, //mod
+	{'o', 0, 81, PAROLA_MODO}, //modo
+	{'a', 22, 0, PAROLA_NESSUNA}, //fa
+	{'s', 23, 0, PAROLA_NESSUNA}, //fas
+	{'t', 0, 0, PAROLA_FAST}, //fast
+	{'p', 25, 0, PAROLA_NESSUNA}, //p
+	{'c', 0, 64, PAROLA_PC}, //pc
+	{'r', 27, 0, PAROLA_NESSUNA}, //r
+	{'a', 28, 34, PAROLA_NESSUNA}, //ra
+	{'m', 29, 0, PAROLA_NESSUNA}, //ram
+	{'p', 30, 0, PAROLA_NESSUNA}, //ramp
+	{'a', 0, 0, PAROLA_RAMPA}, //rampa
+	{'l', 32, 0, PAROLA_NESSUNA}, //l
+	{'i', 33, 71, PAROLA_NESSUNA}, //li
+	{'n', 0, 0, PAROLA_LIN}, //lin
+	{'p', 35, 76, PAROLA_NESSUNA}, //rp
+	{'m', 0, 0, PAROLA_RPM}, //rpm
+	{'b', 37, 0, PAROLA_NESSUNA}, //b
+	{'a', 38, 0, PAROLA_NESSUNA}, //ba
+	{'u', 39, 0, PAROLA_NESSUNA}, //bau
+	{'d', 0, 0, PAROLA_BAUD}, //baud
+	{'a', 41, 0, PAROLA_NESSUNA}, //a
+	{'u', 42, 102, PAROLA_NESSUNA}, //au
+	{'t', 43, 0, PAROLA_NESSUNA}, //aut
+	{'o', 0, 0, PAROLA_AUTO}, //auto
+	{'t', 45, 0, PAROLA_NESSUNA}, //t
+	{'e', 46, 123, PAROLA_NESSUNA}, //te
+	{'l', 47, 0, PAROLA_NESSUNA}, //tel
+	{'e', 48, 0, PAROLA_NESSUNA}, //tele
+	{'m', 49, 0, PAROLA_NESSUNA}, //telem
+	{'e', 50, 0, PAROLA_NESSUNA}, //teleme
+	{'t', 51, 0, PAROLA_NESSUNA}, //telemet
+	{'r', 52, 0, PAROLA_NESSUNA}, //telemetr
+	{'i', 53, 0, PAROLA_NESSUNA}, //telemetri
+	{'a', 0, 0, PAROLA_TELEMETRIA}, //telemetria
+	{'a', 55, 106, PAROLA_NESSUNA}, //sta
+	{'t', 56, 0, PAROLA_NESSUNA}, //stat
+	{'s', 0, 0, PAROLA_STATS}, //stats
+	{'a', 58, 0, PAROLA_NESSUNA}, //ma
+	{'c', 59, 0, PAROLA_NESSUNA}, //mac
+	{'c', 60, 0, PAROLA_NESSUNA}, //macc
+	{'h', 61, 0, PAROLA_NESSUNA}, //macch
+	{'i', 62, 0, PAROLA_NESSUNA}, //macchi
+	{'n', 63, 0, PAROLA_NESSUNA}, //macchin
+	{'a', 0, 0, PAROLA_MACCHINA}, //macchina
+	{'r', 65, 0, PAROLA_NESSUNA}, //pr
+	{'i', 66, 95, PAROLA_NESSUNA}, //pri
+	{'o', 67, 0, PAROLA_NESSUNA}, //prio
+	{'r', 68, 0, PAROLA_NESSUNA}, //prior
+	{'i', 69, 0, PAROLA_NESSUNA}, //priori
+	{'t', 70, 0, PAROLA_NESSUNA}, //priorit
+	{'a', 0, 0, PAROLA_PRIORITA}, //priorita
+	{'o', 72, 0, PAROLA_NESSUNA}, //lo
+	{'c', 73, 0, PAROLA_NESSUNA}, //loc
+	{'a', 74, 0, PAROLA_NESSUNA}, //loca
+	{'l', 75, 0, PAROLA_NESSUNA}, //local
+	{'e', 0, 0, PAROLA_LOCALE}, //locale
+	{'e', 77, 0, PAROLA_NESSUNA}, //re
+	{'m', 78, 92, PAROLA_NESSUNA}, //rem
+	{'o', 79, 0, PAROLA_NESSUNA}, //remo
+	{'t', 80, 0, PAROLA_NESSUNA}, //remot
+	{'o', 0, 0, PAROLA_REMOTO}, //remoto
+	{'b', 82, 0, PAROLA_NESSUNA}, //modb
+	{'u', 83, 0, PAROLA_NESSUNA}, //modbu
+	{'s', 0, 0, PAROLA_MODBUS}, //modbus
+	{'c', 85, 0, PAROLA_NESSUNA}, //c
+	{'o', 86, 108, PAROLA_NESSUNA}, //co
+	{'r', 87, 0, PAROLA_NESSUNA}, //cor
+	{'r', 88, 0, PAROLA_NESSUNA}, //corr
+	{'e', 89, 0, PAROLA_NESSUNA}, //corre
+	{'n', 90, 0, PAROLA_NESSUNA}, //corren
+	{'t', 91, 0, PAROLA_NESSUNA}, //corrent
+	{'e', 0, 0, PAROLA_CORRENTE}, //corrente
+	{'s', 93, 0, PAROLA_NESSUNA}, //res
+	{'e', 94, 0, PAROLA_NESSUNA}, //rese
+	{'t', 0, 0, PAROLA_RESET}, //reset
+	{'o', 96, 0, PAROLA_NESSUNA}, //pro
+	{'g', 97, 0, PAROLA_NESSUNA}, //prog
+	{'r', 98, 0, PAROLA_NESSUNA}, //progr
+	{'a', 99, 0, PAROLA_NESSUNA}, //progra
+	{'m', 100, 0, PAROLA_NESSUNA}, //program
+	{'m', 101, 0, PAROLA_NESSUNA}, //programm
+	{'a', 0, 0, PAROLA_PROGRAMMA}, //programma
+	{'v', 103, 0, PAROLA_NESSUNA}, //av
+	{'v', 104, 0, PAROLA_NESSUNA}, //avv
+	{'i', 105, 0, PAROLA_NESSUNA}, //avvi
+	{'a', 0, 0, PAROLA_AVVIA}, //avvia
+	{'o', 107, 0, PAROLA_NESSUNA}, //sto
+	{'p', 0, 0, PAROLA_STOP}, //stop
+	{'i', 109, 0, PAROLA_NESSUNA}, //ci
+	{'c', 110, 0, PAROLA_NESSUNA}, //cic
+	{'l', 111, 0, PAROLA_NESSUNA}, //cicl
+	{'o', 0, 0, PAROLA_CICLO}, //ciclo
+	{'g', 113, 0, PAROLA_NESSUNA}, //g
+	{'r', 114, 0, PAROLA_NESSUNA}, //gr
+	{'a', 115, 0, PAROLA_NESSUNA}, //gra
+	{'d', 116, 0, PAROLA_NESSUNA}, //grad
+	{'i', 117, 0, PAROLA_NESSUNA}, //gradi
+	{'n', 118, 0, PAROLA_NESSUNA}, //gradin
+	{'i', 0, 0, PAROLA_GRADINI}, //gradini
+	{'a', 120, 0, PAROLA_NESSUNA}, //sa
+	{'l', 121, 0, PAROLA_NESSUNA}, //sal
+	{'v', 122, 0, PAROLA_NESSUNA}, //salv
+	{'a', 0, 0, PAROLA_SALVA}, //salva
+	{'i', 124, 0, PAROLA_NESSUNA}, //ti
+	{'m', 125, 0, PAROLA_NESSUNA}, //tim
+	{'e', 126, 0, PAROLA_NESSUNA}, //time
+	{'o', 127, 0, PAROLA_NESSUNA}, //timeo
+	{'u', 128, 0, PAROLA_NESSUNA}, //timeou
+	{'t', 0, 0, PAROLA_TIMEOUT} //timeout
+};
+
+#endif /* COMANDI_TRIE_H_ */
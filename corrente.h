@@ -0,0 +1,107 @@
+/*************************************************************************************************************
+-----------------------------MISURA DELLA CORRENTE E PROTEZIONE DA SOVRACORRENTE------------------------------
+La corrente del motore arriva all'ADC da un amplificatore sullo shunt. Ogni campione (8 bit, 0-255 su tutta la scala
+dell'ADC) passa da qui, nella ISR dell'ADC:
+-una media mobile degli ultimi CORRENTE_MEDIA campioni dà la corrente da mostrare, senza il rumore delle commutazioni;
+-la protezione confronta invece ogni campione con la soglia, senza media, così interviene in pochi campioni: scatta quando
+ "conferme" campioni di fila sono oltre la soglia, per non spegnere il motore per un singolo disturbo;
+-quando scatta, il guasto resta memorizzato (scattata = 1) finchè non viene riarmato: il firmware tiene spenta l'uscita
+ finchè il guasto c'è.
+Niente divisioni e niente moltiplicazioni a 32 bit nel passo del campione, che gira nella ISR.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c) sia dal programma
+per l'host (Host/simulazione_corrente.c), che prova il filtro e la protezione su tracce di corrente registrate o simulate.
+*************************************************************************************************************/
+#ifndef CORRENTE_H_
+#define CORRENTE_H_
+
+#define CORRENTE_MEDIA 8 //Campioni della media mobile (deve essere una potenza di 2).
+
+struct protezioneCorrente {
+	unsigned char campioni[CORRENTE_MEDIA]; //Ultimi campioni, in un buffer circolare.
+	unsigned char indice; //Posizione del prossimo campione.
+	unsigned int somma; //Somma dei campioni nel buffer.
+	unsigned char soglia; //Soglia di intervento, in conteggi dell'ADC: scatta oltre questo valore (255 = mai).
+	unsigned char conferme; //Campioni consecutivi oltre la soglia che fanno scattare la protezione (almeno 1).
+	unsigned char sopra; //Campioni consecutivi oltre la soglia fino ad ora.
+	unsigned char picco; //Campione più alto dall'ultimo riarmo.
+	char scattata; //Guasto memorizzato.
+};
+
+//Svuota il filtro e toglie il guasto. Soglia e conferme restano quelle impostate.
+static inline void corrente_reset(struct protezioneCorrente *p){
+
+	unsigned char i;
+
+	for(i = 0; i < CORRENTE_MEDIA; i++)
+	p->campioni[i] = 0;
+
+	p->indice = 0;
+	p->somma = 0;
+	p->sopra = 0;
+	p->picco = 0;
+	p->scattata = 0;
+
+}
+
+//Toglie il guasto memorizzato. La media non viene toccata: è la corrente che passa adesso.
+static inline void corrente_riarma(struct protezioneCorrente *p){
+
+	p->sopra = 0;
+	p->picco = 0;
+	p->scattata = 0;
+
+}
+
+//Un campione dell'ADC. Restituisce 1 solo al campione che fa scattare la protezione, per segnalare il guasto una volta.
+static inline char corrente_campione(struct protezioneCorrente *p, unsigned char campione){
+
+	p->somma += campione;
+	p->somma -= p->campioni[p->indice];
+	p->campioni[p->indice] = campione;
+	p->indice = (p->indice + 1) & (CORRENTE_MEDIA - 1);
+
+	if(campione > p->picco)
+	p->picco = campione;
+
+	if(campione <= p->soglia){
+		p->sopra = 0;
+		return 0;
+	}
+
+	if(p->sopra < 255)
+	p->sopra++;
+
+	if(p->scattata || p->sopra < p->conferme)
+	return 0;
+
+	p->scattata = 1;
+	return 1;
+
+}
+
+//Media degli ultimi CORRENTE_MEDIA campioni, in conteggi dell'ADC.
+static inline unsigned char corrente_media(const struct protezioneCorrente *p){
+
+	return p->somma / CORRENTE_MEDIA;
+
+}
+
+//Conversioni tra conteggi dell'ADC e mA. fondoScala è la corrente che porta l'ingresso dell'ADC al riferimento (255 + 1 conteggi).
+static inline unsigned int corrente_ma(unsigned char conteggi, unsigned int fondoScala){
+
+	return ((unsigned long) conteggi * fondoScala) >> 8;
+
+}
+
+//Soglia in conteggi per una corrente in mA: la protezione scatta con i campioni che, convertiti, superano ma.
+//Una corrente pari o oltre il fondo scala dà 255, cioè nessun intervento.
+static inline unsigned char corrente_conteggi(unsigned int ma, unsigned int fondoScala){
+
+	unsigned long conteggi = ((unsigned long) ma << 8) / fondoScala;
+
+	return conteggi > 255 ? 255 : conteggi;
+
+}
+
+#endif /* CORRENTE_H_ */
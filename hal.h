@@ -0,0 +1,39 @@
+/*************************************************************************************************************
+--------------------------------------ACCESSO ALL'HARDWARE (HAL)----------------------------------------------
+main.c usa direttamente i registri dell'ATmega328P (UDR0, UCSR0A, OCR0B, PINx, TCCR0x...). Questo file sceglie
+da dove arrivano:
+-con avr-gcc (__AVR__ definito) sono i registri veri di <avr/io.h>;
+-con gcc su Linux sono variabili in memoria (Host/hal_linux.h), e Host/hal_linux.c simula le periferiche che
+ lavorano da sole (USART, timer e pin) chiamando le ISR del firmware, con la seriale collegata a una pty.
+
+Per quasi tutti i registri basta il valore in memoria. Passano da una macro solo le operazioni che sulla scheda
+hanno un effetto in più:
+-hal_usart_scrivi(c): scrittura nel registro dati della USART, cioè la trasmissione di un byte;
+-hal_aggiorna(): chiamata ad ogni giro del ciclo principale e nei cicli che aspettano una periferica.
+ Sulla scheda non fa niente; su Linux fa avanzare le periferiche simulate, che non lavorano in parallelo al main.
+-sleep_cpu(): sulla scheda ferma la CPU fino al prossimo interrupt; su Linux fa avanzare le periferiche come hal_aggiorna().
+-hal_eeprom_leggi() e hal_eeprom_scrivi(): avvio della lettura (EERE) e della scrittura (EEMPE e poi EEPE) del byte
+ della EEPROM all'indirizzo EEAR. Su Linux la EEPROM è un array in memoria e la scrittura dura alcuni millisecondi simulati.
+*************************************************************************************************************/
+#ifndef HAL_H_
+#define HAL_H_
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h> // contiene le macro per salvare costanti in memoria flash (PROGMEM) e rileggerle.
+#include <avr/sleep.h> // contiene le macro per mettere in sleep la CPU (set_sleep_mode(), sleep_cpu()...).
+
+#define hal_usart_scrivi(c) (UDR0 = (c))
+#define hal_aggiorna()
+#define hal_eeprom_leggi() (EECR |= (1<<EERE))
+#define hal_eeprom_scrivi() do{ EECR |= (1<<EEMPE); EECR |= (1<<EEPE); }while(0)
+
+#else
+
+#include "Host/hal_linux.h"
+
+#endif
+
+#endif /* HAL_H_ */
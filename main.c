@@ -18,23 +18,71 @@ Tramite terminale:
 -Se viene scritto il comando "down", ho un decremento del Duty Cycle pari al 1%
 Tramite Dip Switch:
 -Ho uno switch per ogni cifra decimale (tre Dip Switch)
-Devo permettere di selezionare i due metodi, che sono mutualmente esclusivi. Per garantire l'esclusività,
-utilizzo il pulsante sul pin 7 del port B: in questo modo scelgo di abilitare la modifica di duty cycle
-attraverso terminale. Per via software si esclude successivamente, in questo caso, l'inserimento del Duty Cycle
-via selettore esterno.
+Le due sorgenti sono sempre attive e ognuna tiene il suo ultimo valore: il pulsante sul pin 7 del port B
+(o un interruttore, con PRIORITA_INTERRUTTORE) sceglie quale delle due ha la priorità sul canale principale.
+Quando la priorità cambia, il valore dell'altra sorgente viene applicato entro un millisecondo (arbitro.h);
+con il timeout del remoto, se il terminale resta muto troppo a lungo torna a comandare il locale.
 *************************************************************************************************************/
-#define F_CPU 16000000UL //Frequenza del processore, serve per il calcolo del Baud Rate (UBBR_VALUE).
-#define BAUD 9600 //Baud Rate selezionato per la trasmissione USART.
-#define MAX_STR_LEN 60 //Lunghezza massima in termini di caratteri di ogni stringa ricevuta e trasmessa.
+#define F_CPU 16000000UL //Frequenza del processore, serve per il calcolo del Baud Rate (UBBR0).
+#define BAUD 9600 //Baud Rate all'accensione. Si può cambiare a runtime con il comando "baud".
+#define BAUD_ERRORE_MAX 25 //Errore massimo accettato sul baud rate, in millesimi (2.5%).
+#define BAUD_MAX 1000000UL //Baud rate massimo accettato dal comando "baud".
+#define AUTOBAUD_TIMEOUT_MS 10000 //Tempo concesso all'host per inviare il carattere di sincronismo dell'autobaud.
+#define AUTOBAUD_SILENZIO_MS 3 //Dopo questo tempo senza fronti su RXD la misura dell'autobaud è conclusa.
+#define MODBUS_PARITA 1 //Formato dei caratteri in modalità Modbus RTU: 1 con parità pari (8E1, come prevede lo standard), 0 senza (8N1).
+#define MAX_STR_LEN 60 //Lunghezza massima in termini di caratteri di ogni stringa trasmessa.
+#define USART_TX_BUF 128 //Dimensione del buffer circolare di trasmissione (deve essere una potenza di 2).
+#define USART_RX_BUF 64 //Dimensione del buffer circolare di ricezione (deve essere una potenza di 2).
+#define EVENTI_BUF 8 //Dimensione della coda degli eventi generati dalle ISR (deve essere una potenza di 2).
+#define PROTO_TIMEOUT_MS 50 //Un frame binario che resta incompleto per questo tempo (in ms) viene scartato.
+#define TELEMETRIA_HZ_MIN 10 //Frequenza minima e massima della telemetria (comando "telemetria" e OP_TELEMETRIA).
+#define TELEMETRIA_HZ_MAX 1000
 #define UserTop 255 //Utilizzo il timer 0 e voglio sfruttare tutti i possibili valori.
 #define DInit 50 //Valore iniziale di Duty Cycle al primo avvio del programma.
+#define RISOLUZIONE_DC 1000 //Numero di passi del Duty Cycle tra 0% e 100% (100 o 1000): dimensiona la tabella dei valori di compare.
+#define DC_MAX 1000 //Il duty cycle è espresso in decimi di percento: 1000 corrisponde al 100%.
+#define PASSO_DC 10 //Passo dei comandi "up" e "down": 1%.
+#define PWM_TIMER 0 //Timer del PWM: 0 (8 bit, uscita OC0B su PD5) oppure 1 (16 bit con TOP in ICR1, uscita OC1A su PB1).
+#define PWM_FREQ_INIT 20000 //Frequenza della portante PWM al primo avvio, in Hz (con il timer 0 si usa la più vicina disponibile).
+#define PWM_TOP_MIN 100 //Con il timer 1, TOP minimo accettato: sotto questo valore la risoluzione del duty cycle sarebbe troppo bassa.
+#define RAMPA_VELOCITA_INIT 1000 //Velocità della rampa del duty cycle all'avvio, in decimi di percento al secondo (1000: da 0 a 100% in un secondo; 0: nessuna rampa).
+#define SWPWM_PERIODO 250 //Conteggi del timer 2 in un periodo del PWM software: con prescaler 64 il periodo è 1 ms (1 kHz).
+#define CANALE_PRINCIPALE 0 //Canale comandato dai dip switch, tramite l'arbitro, e dai comandi senza numero di canale.
+#define DIP_STABILE_MS 10 //I dip switch devono restare fermi per questo tempo (in ms) prima che il valore diventi il setpoint locale.
+#define PRIORITA_INTERRUTTORE 0 //Se 1, PB7 è un interruttore (a massa: priorità al locale) invece di un pulsante che la scambia.
+#define PULSANTE_FERMO_MS 20 //Il pulsante scambia la priorità solo se PB7 era fermo da questo tempo (in ms): filtra i rimbalzi.
+#define REMOTO_TIMEOUT_MS 0 //Timeout del remoto all'accensione, in ms: senza setpoint remoti per questo tempo comanda il locale (0 = mai).
+#define TACH_IMPULSI_GIRO 2 //Impulsi del tachimetro (ingresso ICP1, PB0) per ogni giro del motore: 2 per le ventole da PC.
+#define TACH_FERMO_MS 500 //Senza impulsi del tachimetro per questo tempo (in ms) il motore è considerato fermo.
+#define RPM_MAX 20000 //Velocità massima accettata dal comando "rpm".
+#define PID_PERIODO_MS 10 //Periodo della regolazione di velocità, in ms.
+#define PID_KP 200 //Guadagno proporzionale, Q8.8 (256 = 1 decimo di percento di duty cycle per ogni rpm di errore).
+#define PID_KI 1500 //Guadagno integrale ad ogni passo, Q0.16. I guadagni si provano su Linux con Host/simulazione_pid.c.
+#define PID_KD 0 //Guadagno derivativo, Q8.8 (0: regolatore PI).
+#define CORRENTE_ADC 6 //Ingresso dell'ADC collegato all'amplificatore dello shunt del motore (ADC6 c'è solo nei package TQFP e QFN, es. Arduino Nano).
+#define CORRENTE_FONDO_SCALA_MA 10000 //Corrente del motore che porta l'ingresso dell'ADC a 5 V (AVcc): dipende da shunt e amplificatore.
+#define CORRENTE_SOGLIA_MA 3000 //Soglia iniziale della protezione da sovracorrente (comando "corrente <mA>").
+#define CORRENTE_CONFERME 2 //Campioni consecutivi oltre la soglia che spengono il canale principale (1 = al primo campione).
+#define BENCHMARK_DUTY 0 //Se 1, all'avvio misura i cicli dell'aggiornamento del duty cycle, con il vecchio ceil() e con la tabella (solo con il PWM sul timer 0).
+#define BENCHMARK_DIP 0 //Se 1, all'avvio misura i cicli della decodifica dei dip switch (solo con il PWM sul timer 0).
+#define BENCHMARK_PID 0 //Se 1, all'avvio misura i cicli del caso peggiore della regolazione di velocità (solo con il PWM sul timer 0).
+#define BENCHMARK_COMANDI 0 //Se 1, all'avvio misura i cicli per byte del parser dei comandi testuali (solo con il PWM sul timer 0).
+#define IMPOSTAZIONI_SLOT 32 //Record del ring delle impostazioni in EEPROM, da 16 byte ciascuno: occupano i primi 512 byte.
+#define IMPOSTAZIONI_FERME_MS 1000 //Le impostazioni cambiate vengono salvate in EEPROM quando restano ferme per questo tempo (in ms).
+#define PROFILO 0 //Se 1, misura la durata delle ISR e degli stati della macchina a stati, stampata dal comando "stats" (solo con il PWM sul timer 0).
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <stdio.h> // contiene funzioni varie per gestire l'input/output (es. sprintf(), sscanf()...).
+#include "hal.h" // registri, interrupt e memoria flash: quelli veri con avr-gcc, simulati su Linux (Host/hal_linux.c).
 #include <string.h> // contiene funzioni varie per manipolare le stringhe (es. strlen(), strcmp()...).
-#include <util/setbaud.h> // contiene l'utility per il calcolo di UBRR_VALUE a partire da F_CPU e BAUD.
-#include <math.h> //Contiene funzioni matematiche utili.
+#include "protocollo.h" // formato dei frame del protocollo binario, condiviso con il programma per l'host.
+#include "regolazione.h" // misura del tachimetro e regolatore PID, condivisi con il simulatore per l'host.
+#include "comandi.h" // parser incrementale dei comandi testuali, condiviso con il programma di prova per l'host.
+#include "modbus.h" // CRC-16, registri e decodifica delle richieste Modbus RTU, condivisi con il master di prova per l'host.
+#include "corrente.h" // filtro della corrente del motore e protezione da sovracorrente, condivisi con il simulatore per l'host.
+#include "programma.h" // riproduzione dei programmi del duty cycle nel tempo, condivisa con il programma di prova per l'host.
+#include "arbitro.h" // scelta tra il duty cycle locale e quello remoto, condivisa con il programma di prova per l'host.
+#if BENCHMARK_DUTY
+#include <math.h> // ceil(), solo per il confronto con il vecchio calcolo del compare.
+#endif
 
 
 //----------------------PROTOTIPI FUNZIONI------------------------
@@ -43,213 +91,648 @@ void init(void);
 
 //Inizializzazione periferica USART, trasmissione e ricezione.
 void USART_init(void);
-void USART_RX_string(char *, unsigned const int);
+char USART_calcola_baud(unsigned long, unsigned int *, char *);
+char USART_imposta_baud(unsigned long);
+void USART_imposta_formato(void);
+void gestisciCambioBaud(void);
+char USART_RX_char(char *);
+char USART_RX_comando(struct comandoTestuale *);
+char USART_TX_char(char);
+void USART_TX_svuota(void);
+void USART_TX_attendi(void);
 void USART_TX_string(char *);
+void USART_TX_string_P(const char *);
+void USART_TX_bytes(unsigned char *, unsigned char);
 
-//Funzioni per accensione e spegnimento del led nel cambio da una modalità di inserimento all'altra.
+//Smistamento dei byte ricevuti tra parser dei comandi testuali e parser dei frame binari.
+void gestisciRicezione(void);
+void eseguiFrame(struct frameProtocollo *);
+unsigned int leggiMillisecondi(void);
+
+//Modbus RTU: frame separati dal silenzio misurato con il confronto A del timer 1, registri della scheda.
+void modbus_imposta(unsigned char);
+void gestisciModbus(void);
+void eseguiModbus(void);
+unsigned int modbus_leggi_registro(unsigned char, unsigned int);
+unsigned char modbus_scrivi_registro(unsigned int, unsigned int);
+
+//Sleep in IDLE quando il main non ha niente da fare e misura del tempo passato a lavorare e a dormire.
+char lavoroInSospeso(void);
+void dormi(void);
+unsigned long tempoTrascorso(void);
+
+//Telemetria: frame binari periodici accodati dalla ISR del timer 2.
+char telemetria_imposta(unsigned int);
+unsigned int telemetria_frequenza(void);
+char telemetria_invia(void);
+unsigned char telemetria_flag(void);
+void stampaTelemetria(void);
+
+//Impostazioni salvate in EEPROM: ring di record con numero di sequenza e CRC, scritti un byte alla volta dalla ISR(EE_READY_vect).
+unsigned char eeprom_leggi(unsigned int);
+void impostazioni_prepara(unsigned char *);
+void impostazioni_carica(void);
+void impostazioni_gestisci(void);
+
+//Base dei tempi a 2 MHz sul timer 1 (solo con il PWM sul timer 0) e autobaud, che la usa per misurare il carattere di sincronismo.
+void base_tempi_init(void);
+void autobaud_avvia(void);
+void autobaud_termina(unsigned long);
+void gestisciAutobaud(void);
+
+//Tachimetro sull'ingresso di cattura del timer 1 e regolazione della velocità del canale principale (solo con il PWM sul timer 0).
+void tachimetro_init(void);
+void regolazione_passo(void);
+char regolazione_avvia(unsigned int);
+unsigned int leggiRpm(void);
+void stampaRpm(void);
+void benchmark_pid(void);
+
+//Profilo delle ISR e degli stati (solo con PROFILO 1) e statistiche stampate dal comando "stats".
+#if PROFILO
+static inline unsigned int profilo_tempo(void);
+static inline void profilo_registra(unsigned char, unsigned int);
+#endif
+void azzeraStatistiche(void);
+void stampaStatistiche(void);
+
+//Coda degli eventi: le ISR accodano, il main gestisce.
+void postaEvento(unsigned char);
+char prelevaEvento(unsigned char *);
+void gestisciEventi(void);
+
+//Funzioni per accensione e spegnimento del led, che indica la sorgente che comanda il canale principale.
 void LedOn(void);
 void LedOff(void);
 
-//Funzioni di utilità che permettono la conversione da bcd a decimale.
-char BinToDec(volatile char[], char);
-char SwitchConcat(char, char, char);
-char potenza(char, char);
+//Impostazione del duty cycle e stampa del valore impostato.
+void impostaDC(unsigned char, unsigned int);
+void impostaDCDiretto(unsigned int);
+char *formattaIntero(char *, unsigned int);
+char *formattaInteroLungo(char *, unsigned long);
+char *formattaDC(char *, unsigned int);
+void stampaDC(const char *, unsigned char);
+char leggiNumero(struct argomento *, unsigned int *);
+char leggiNumeroLungo(struct argomento *, unsigned long *);
+char leggiDC(struct argomento *, unsigned int *);
+char leggiCanale(struct argomento *, unsigned char *);
+
+//Esecuzione dei comandi da terminale.
+void risposta(char *);
+void risposta_P(const char *);
+void aumentaDC(unsigned char);
+void diminuisciDC(unsigned char);
+void impostaCanale(unsigned char, unsigned int);
+char remoto_imposta(unsigned char, unsigned int);
+unsigned int remoto_duty(unsigned char);
+void stampaRemoto(void);
+void applicaDC(unsigned char, unsigned int);
+void stampaFrequenza(void);
+void stampaBaud(const char *, unsigned long);
+void stampaModbus(void);
+unsigned char eseguiComando(struct comandoTestuale *);
+void eseguiComandoRiga(struct comandoTestuale *);
+void benchmark_comandi(void);
+
+//Lettura dei dip switch in una sola parola e conversione da bcd a decimale.
+unsigned int dip_switch_leggi(void);
+unsigned char dip_switch_valore(unsigned int);
+void benchmark_dip(void);
+void benchmark_duty(void);
+
+//Sorgenti del duty cycle del canale principale: avvio dell'arbitro, applicazione dalla ISR del timer 2 e messaggi.
+void sorgenti_init(void);
+void sorgenti_passo(void);
+void gestisciSorgenti(void);
+char *formattaEta(char *, const struct setpointDuty *, unsigned int);
+void stampaPriorita(void);
 
-//Funzione di controllo dello stato degli input esterni.
-void stato_dip_switch(void);
+//Motore PWM: inizializzazione del timer, frequenza, modalità, duty cycle,
+//spegnimento e accensione quando si arriva a 0% del duty cycle.
+void pwm_init(void);
+char pwm_imposta_frequenza(unsigned int);
+void pwm_imposta_modo(unsigned char);
+void pwm_imposta_duty(unsigned char, unsigned int);
+unsigned char pwm_bit_com(unsigned char);
+void pwm_applica(void);
+void pwm_pin_basso(unsigned char);
+void pwm_off(unsigned char);
+void pwm_scollega(unsigned char);
+void pwm_on(unsigned char);
 
-//Inizializzazione del timer e funzioni di spegnimento e accensione quando si arriva a 0% del duty cycle.
-void timer_init(void);
-void timer_off(void);
-void timer_on(void);
+//Misura della corrente del motore con l'ADC, a metà dell'impulso del canale principale, e protezione da sovracorrente.
+void corrente_avvia(void);
+void stampaCorrente(void);
 
-//Funzioni per la stampa delle istruzioni delle modalità e di benvenuto.
-void istruzioniSelettoreEsterno(void);
+//Programma del duty cycle: punti (tempo, duty cycle) del canale principale riprodotti dalla ISR del timer 2
+//e salvati in EEPROM dopo il ring delle impostazioni.
+void programma_carica(void);
+unsigned char programma_eeprom_byte(unsigned char);
+char programma_esegui(void);
+void stampaProgramma(char);
+
+//PWM software sui pin senza uscita di compare, con lista dei fronti ordinata.
+void swpwm_init(void);
+void swpwm_ricalcola(void);
+
+//Rampa del duty cycle, eseguita dalla ISR di overflow del timer del PWM.
+void rampa_calcola(void);
+void rampa_imposta(unsigned int, unsigned char);
+void stampaRampa(void);
+
+//Funzioni per la stampa delle istruzioni e di benvenuto.
 void istruzioniTerminale(void);
 void benvenuto(void);
 
 //----------------------VARIABILI GLOBALI------------------------
 
-volatile unsigned char top = (unsigned char) UserTop;
-volatile unsigned char valoreDC = (unsigned char) DInit; // variabile per memorizzazione percentuale duty cycle.
+//Arbitro tra le due sorgenti del duty cycle del canale principale (arbitro.h): i dip switch (locale) e i comandi
+//da terminale, protocollo binario e Modbus (remoto). I setpoint locali e la scelta della sorgente avvengono nella
+//ISR del timer 2, un tick al millisecondo; i setpoint remoti nel main, con gli interrupt disabilitati.
+struct arbitroDuty arbitro;
+unsigned char sorgenteStampata; //Ultimi valori di sorgente, priorità e timeout già segnalati sul terminale.
+char prioritaStampata, scadutoStampato;
+
+//Pulsante della priorità: la ISR del pin change la scambia solo sul fronte di discesa di PB7, e solo se il pin era fermo
+//da PULSANTE_FERMO_MS. Ogni fronte fa ripartire l'attesa, che la ISR del timer 2 conta alla rovescia: i rimbalzi alla
+//pressione e al rilascio non scambiano di nuovo la priorità.
+#if !PRIORITA_INTERRUTTORE
+volatile unsigned char pulsanteLivello; //Ultimo livello letto di PB7 (rilasciato: alto, per il pull-up).
+volatile unsigned char pulsanteFermo; //Millisecondi che mancano alla fine dell'attesa.
+#endif
+
+//Modalità macchina: niente istruzioni e messaggi, ad ogni riga si risponde con una sola riga breve ("OK 50.5" oppure "ERR 2").
+//Serve quando il terminale è un programma che invia comandi, non una persona.
+char modoMacchina;
+unsigned char canaleRisposta; //Canale dell'ultimo comando, di cui si riporta il duty cycle nella risposta.
+unsigned char comandiRiga; //Comandi eseguiti nella riga in corso e posizione (da 1) del primo non eseguito.
+unsigned char primoErroreRiga;
+
+//Esito di un singolo comando da terminale.
+enum esitoComando {ComandoNonRiconosciuto, ComandoEseguito, ValoreNonAmmesso};
+
+//Canali PWM. Ogni canale pilota un motore o una ventola su un pin diverso.
+//I canali hardware usano le uscite di compare del timer del PWM; gli altri sono generati via software dal timer 2.
+//Le uscite OC1B (PB2) e OC2B (PD3) non si possono usare perchè sono collegate ai dip switch delle centinaia e delle decine,
+//OC2A (PB3) diventa un canale software perchè il timer 2 genera il PWM software.
+enum uscitaPWM {USCITA_OC0B, USCITA_OC0A, USCITA_OC1A, USCITA_SW};
+enum portaPWM {PORTA_B, PORTA_C, PORTA_D};
+
+struct canalePWM {
+	unsigned char uscita; //Uscita di compare o USCITA_SW.
+	unsigned char porta; //Porta e bit del pin, usati per forzarlo basso allo spegnimento e dal PWM software.
+	unsigned char bit;
+	volatile unsigned int duty; //Duty cycle in decimi di percento.
+	volatile char spento; //Se è a 1, l'uscita è spenta. Utilizzato quando si arriva a 0% del duty cycle.
+};
+
+#if PWM_TIMER == 0
+#define N_CANALI 6
+struct canalePWM canali[N_CANALI] = {
+	{USCITA_OC0B, PORTA_D, 5, DInit * (DC_MAX / 100), 0}, //Canale principale, al primo avvio al 50%.
+	{USCITA_OC0A, PORTA_D, 6, 0, 1},
+	{USCITA_SW, PORTA_B, 3, 0, 1},
+	{USCITA_SW, PORTA_B, 4, 0, 1},
+	{USCITA_SW, PORTA_C, 4, 0, 1},
+	{USCITA_SW, PORTA_C, 5, 0, 1}
+};
+#else
+#define N_CANALI 7
+struct canalePWM canali[N_CANALI] = {
+	{USCITA_OC1A, PORTA_B, 1, DInit * (DC_MAX / 100), 0}, //Canale principale, al primo avvio al 50%.
+	{USCITA_SW, PORTA_D, 5, 0, 1},
+	{USCITA_SW, PORTA_D, 6, 0, 1},
+	{USCITA_SW, PORTA_B, 3, 0, 1},
+	{USCITA_SW, PORTA_B, 4, 0, 1},
+	{USCITA_SW, PORTA_C, 4, 0, 1},
+	{USCITA_SW, PORTA_C, 5, 0, 1}
+};
+#endif
+
+//Lista dei fronti del PWM software. All'inizio del periodo si portano alti i pin in "accendi",
+//poi la ISR di compare B del timer 2 scorre i fronti di discesa, già ordinati per istante:
+//il costo per periodo è proporzionale al numero di fronti e non al numero di canali o di conteggi.
+//I canali che si spengono nello stesso istante condividono lo stesso fronte.
+struct fronteSW {
+	unsigned char istante; //Conteggio del timer 2 in cui i pin vanno portati bassi.
+	unsigned char spegni[3]; //Maschere dei pin da portare bassi, per PORTB, PORTC e PORTD.
+};
+
+struct tabellaFronti {
+	unsigned char accendi[3]; //Maschere dei pin da portare alti all'inizio del periodo.
+	unsigned char n; //Numero di fronti di discesa.
+	struct fronteSW fronte[N_CANALI];
+};
+
+//Due tabelle: la ISR usa quella attiva, il main prepara l'altra e la ISR le scambia all'inizio del periodo successivo.
+struct tabellaFronti frontiSW[2];
+volatile unsigned char frontiAttivi; //Indice della tabella usata dalla ISR.
+volatile char frontiPronti; //Se è a 1, la tabella non attiva è pronta e va scambiata.
+volatile unsigned char prossimoFronte; //Indice del prossimo fronte del periodo in corso.
+volatile char frontiInCalcolo; //A 1 mentre swpwm_ricalcola() scrive la tabella non attiva.
+volatile char frontiDaRifare; //Una chiamata arrivata durante il calcolo: la tabella va rifatta con i valori nuovi.
+
+//Stato del motore PWM.
+//Modalità: fast PWM (rampa) oppure phase correct (triangolo, frequenza dimezzata ma impulsi centrati).
+enum modoPWM {PWM_FAST, PWM_PHASE_CORRECT};
+unsigned char pwmModo = PWM_FAST;
+unsigned int pwmFrequenzaRichiesta = PWM_FREQ_INIT; //Frequenza chiesta dall'utente, riusata quando cambia la modalità.
+unsigned int pwmFrequenza; //Frequenza effettivamente ottenuta, in Hz.
+unsigned char pwmCS; //Bit di selezione del prescaler (CSn2..CSn0), salvati per la riaccensione del timer.
+#if PWM_TIMER == 1
+unsigned int pwmTop; //Valore di TOP caricato in ICR1.
+unsigned long pwmScala; //TOP/DC_MAX in virgola fissa (16 bit frazionari): OCR1A = (duty*pwmScala) >> 16.
+#endif
+
+//Registro e vettore dell'interrupt di overflow del timer del PWM, usato dalla rampa.
+#if PWM_TIMER == 0
+#define TIMSK_PWM TIMSK0
+#define TOIE_PWM TOIE0
+#define TIFR_PWM TIFR0
+#define TOV_PWM TOV0
+#define PWM_OVF_vect TIMER0_OVF_vect
+#else
+#define TIMSK_PWM TIMSK1
+#define TOIE_PWM TOIE1
+#define TIFR_PWM TIFR1
+#define TOV_PWM TOV1
+#define PWM_OVF_vect TIMER1_OVF_vect
+#endif
+
+//Corrente del motore: l'ADC converte l'ingresso CORRENTE_ADC a metà dell'impulso del canale principale, quando la corrente
+//nello shunt è quella del motore e le commutazioni sono lontane. Ogni campione passa dalla ISR dell'ADC al filtro e alla
+//protezione di corrente.h; se la protezione scatta, la stessa ISR spegne il canale principale e il guasto resta memorizzato
+//finchè non viene riarmato con "corrente reset".
+#if CORRENTE_SOGLIA_MA >= CORRENTE_FONDO_SCALA_MA
+#error "CORRENTE_SOGLIA_MA deve essere minore di CORRENTE_FONDO_SCALA_MA"
+#endif
+#define CORRENTE_ANTICIPO 4 //Conteggi del timer 1 (0.5 us) tra l'avvio della conversione e il campione: 2 cicli del clock dell'ADC a 1 MHz.
+struct protezioneCorrente corrente = {{0}, 0, 0, CORRENTE_SOGLIA_MA * 256UL / CORRENTE_FONDO_SCALA_MA, CORRENTE_CONFERME, 0, 0, 0};
+#if PWM_TIMER == 0
+signed char correnteSpostamento; //Passi del timer 0 convertiti in conteggi del timer 1: scorrimento a sinistra (a destra se negativo).
+#endif
+
+//Rampa del duty cycle: canali[].duty è il valore impostato (l'obiettivo), rampe[].attuale quello che il timer sta generando.
+//La ISR di overflow del timer del PWM avvicina attuale all'obiettivo circa una volta al millisecondo e scrive il registro di compare
+//subito dopo l'overflow: il registro è bufferizzato dall'hardware, quindi il nuovo valore parte sempre dall'inizio del periodo successivo.
+//Il main imposta solo l'obiettivo, il resto della rampa avviene nella ISR.
+enum formaRampa {RAMPA_LINEARE, RAMPA_S};
+#define RAMPA_FRAZ 10 //Bit frazionari del percorso della rampa: il passo può essere una piccola frazione di decimo di percento.
+#define RAMPA_PUNTI 32 //Intervalli della tabella della curva a S.
+
+struct rampaPWM {
+	unsigned int attuale; //Duty cycle generato in questo momento, in decimi di percento.
+	unsigned int partenza; //Duty cycle all'inizio della rampa.
+	unsigned int distanza; //Distanza tra partenza e obiettivo, in decimi di percento.
+	unsigned long percorso; //Percorso fatto dall'inizio della rampa, con RAMPA_FRAZ bit frazionari.
+	unsigned int scala; //RAMPA_PUNTI*256/distanza, calcolato dalla ISR al primo passo della curva a S (0 = da calcolare).
+};
+
+struct rampaPWM rampe[N_CANALI];
+unsigned int rampaVelocita = RAMPA_VELOCITA_INIT; //Decimi di percento al secondo (0 = nessuna rampa).
+unsigned char rampaForma = RAMPA_LINEARE;
+unsigned long rampaPasso; //Percorso di ogni passo, con RAMPA_FRAZ bit frazionari (0 = nessuna rampa).
+unsigned char rampaDivisore = 1; //Overflow del timer tra due passi, per avere circa un passo al millisecondo.
+unsigned char rampaConteggio = 1;
+
+//Curva a S (3x^2 - 2x^3, la "smoothstep") campionata in RAMPA_PUNTI intervalli e scalata a 255:
+//parte e arriva con pendenza nulla, quindi senza strappi di coppia all'inizio e alla fine della rampa.
+const unsigned char curvaS[RAMPA_PUNTI + 1] PROGMEM = {
+	0, 1, 3, 6, 11, 17, 24, 31, 40, 49, 59, 70, 81, 92, 104, 116,
+	128, 139, 151, 163, 174, 185, 196, 206, 215, 224, 231, 238, 244, 249, 252, 254, 255
+};
+
+//Fattori di divisione del prescaler, comuni ai timer 0 e 1. Il valore dei bit CSn2..CSn0 è l'indice più uno.
+const unsigned int prescalerPWM[] = {1, 8, 64, 256, 1024};
 
-volatile char inserimentoDaTerminale; //Flag di inserimento da terminale. Se '1', il terminale ha precedenza.
+//Tabella dei valori di compare per ogni passo di duty cycle, calcolata dal compilatore e salvata in flash.
+//In questo modo l'aggiornamento del duty cycle è una semplice lettura, senza moltiplicazioni, divisioni o ceil().
+//Il valore è quello che si otteneva con valoreDC*top/100 in aritmetica intera (arrotondamento per difetto).
+//Un passo della tabella è un decimo di percento (RISOLUZIONE_DC = 1000), come valoreDC.
+#define OCR_DA_DC(dc) ((unsigned char)(((unsigned long)(dc) * UserTop) / RISOLUZIONE_DC))
+#define OCR_10(b) OCR_DA_DC(b), OCR_DA_DC((b)+1), OCR_DA_DC((b)+2), OCR_DA_DC((b)+3), OCR_DA_DC((b)+4), \
+OCR_DA_DC((b)+5), OCR_DA_DC((b)+6), OCR_DA_DC((b)+7), OCR_DA_DC((b)+8), OCR_DA_DC((b)+9)
+#define OCR_100(b) OCR_10(b), OCR_10((b)+10), OCR_10((b)+20), OCR_10((b)+30), OCR_10((b)+40), \
+OCR_10((b)+50), OCR_10((b)+60), OCR_10((b)+70), OCR_10((b)+80), OCR_10((b)+90)
 
-volatile char flag_accensione; //Se è a 1, vuol dire che c'è stato lo spegnimento del timer. Utilizzato quando si arriva a 0% del duty cycle (timer spento).
+#if PWM_TIMER == 0 //Con il timer 1 il TOP cambia a runtime e la tabella non serve.
+const unsigned char tabellaOCR[RISOLUZIONE_DC + 1] PROGMEM = {
+	#if RISOLUZIONE_DC == 100
+	OCR_100(0),
+	#elif RISOLUZIONE_DC == 1000
+	OCR_100(0), OCR_100(100), OCR_100(200), OCR_100(300), OCR_100(400),
+	OCR_100(500), OCR_100(600), OCR_100(700), OCR_100(800), OCR_100(900),
+	#else
+	#error "RISOLUZIONE_DC deve essere 100 o 1000"
+	#endif
+	OCR_DA_DC(RISOLUZIONE_DC)
+};
+#endif
 
-//Le seguenti variabili globali vengono utilizzate per capire quale 'bit'.
-//del dip switch delle unità viene modificato.
-//Nei vettori units e tens, il MSB proveniente dal dip switch (o cavo jumper relativo) è all'inidice '0' dei vettori.
-volatile char units[4];
-volatile char tens[4];
-volatile char hundreds[1];
+//Stato dei dip switch, letto con tre sole letture dei registri PIN e raccolto in una parola di 9 bit:
+//bit 0-3 unità (PC0-PC3), bit 4-7 decine (PD2, PD3, PD4, PD7), bit 8 centinaia (PB2).
+//Il bit meno significativo di ogni cifra è il pin con il numero più basso.
+#define DIP_UNITA 0x000F
+#define DIP_DECINE 0x00F0
+#define DIP_CENTINAIA 0x0100
+#define DIP_NON_VALIDO 0xFF //Valore restituito da dip_switch_valore() se una cifra non è bcd.
+
+//Filtro dei dip switch: la ISR del timer 2 campiona i dip switch ogni millisecondo e, quando la parola resta uguale
+//per DIP_STABILE_MS campioni consecutivi, la copia in dipStabile, la passa all'arbitro come setpoint locale e avvisa il main.
+//Mentre si spostano gli switch le combinazioni intermedie cambiano di continuo e non diventano mai un setpoint;
+//quelle che restano ferme ma non sono bcd valide, o superano il 100%, vengono scartate.
+#define DIP_NESSUNO 0xFFFF //Valore che non corrisponde a nessuna combinazione: forza l'uso del prossimo valore stabile.
+volatile unsigned int dipStabile = DIP_NESSUNO;
+unsigned int dipCampione = DIP_NESSUNO; //Ultimo campione e numero di campioni uguali consecutivi, usati solo dalla ISR.
+unsigned char dipContatore;
+
+//Valore di una cifra bcd letta dai dip switch: le combinazioni da 10 a 15 non sono cifre decimali.
+const unsigned char cifraBCD[16] PROGMEM = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, DIP_NON_VALIDO, DIP_NON_VALIDO, DIP_NON_VALIDO, DIP_NON_VALIDO, DIP_NON_VALIDO, DIP_NON_VALIDO};
+
+//Buffer circolari della USART. Gli indici "testa" sono scritti da chi inserisce i dati, gli indici "coda" da chi li preleva:
+//in trasmissione inserisce il main e preleva la ISR(USART_UDRE_vect), in ricezione inserisce la ISR(USART_RX_vect) e preleva il main.
+//In trasmissione inserisce anche la telemetria, dalla ISR del timer 2: per questo il main inserisce con gli interrupt disabilitati
+//e segnala con txRigaInCorso che sta trasmettendo una riga o un frame, che non devono essere spezzati da un frame di telemetria.
+volatile char txBuf[USART_TX_BUF];
+volatile unsigned char txTesta, txCoda;
+volatile char txRigaInCorso;
+volatile char rxBuf[USART_RX_BUF];
+volatile unsigned char rxTesta, rxCoda;
+
+//Parser dei frame binari e contatori del collegamento seriale.
+struct parserProtocollo parserRx;
+unsigned int ultimoByteFrame; //Istante (in ms) dell'ultimo byte del frame in corso, per scartare i frame interrotti.
+unsigned int frameValidi;
+unsigned int frameErroriCRC;
+volatile unsigned int byteRxPersi; //Byte scartati dalla ISR di ricezione perchè il buffer era pieno.
+volatile unsigned int erroriOverrun; //Byte persi dalla USART perchè il precedente non era ancora stato letto dalla ISR (DOR0).
+volatile unsigned int erroriFrame; //Byte ricevuti con il bit di stop a '0' (FE0): di solito l'host usa un altro baud rate.
+
+//Baud rate della USART. Il cambio richiesto con il comando "baud" viene applicato solo dopo che la risposta
+//è stata trasmessa tutta alla velocità vecchia: altrimenti l'host riceverebbe la conferma già illeggibile.
+enum cambioBaud {BaudInvariato, BaudNuovo, BaudAutomatico, BaudModbus}; //BaudModbus: passaggio da e verso Modbus RTU, che cambia il formato dei caratteri.
+unsigned long baudRate = BAUD;
+unsigned long baudRichiesto;
+unsigned char cambioBaud;
+
+//Autobaud: con la ricezione spenta, la ISR del pin change su RXD (PCINT16) salva l'istante del primo e dell'ultimo fronte
+//del carattere 'U' (0x55) inviato dall'host. Tra il fronte di discesa del bit di start e l'ultimo fronte di salita
+//(inizio del bit di stop) passano esattamente 9 bit, quindi basta il primo e l'ultimo fronte anche se la ISR ne perde qualcuno.
+volatile char autobaudAttivo;
+volatile unsigned char autobaudFronti;
+volatile unsigned int autobaudInizio, autobaudFine; //Istanti in conteggi del timer 1 (0.5 us).
+volatile unsigned int autobaudUltimoMs; //Istante in ms dell'ultimo fronte, per capire quando il carattere è finito.
+volatile unsigned char autobaudPIND; //Ultimo valore letto di PIND, per riconoscere i fronti su RXD.
+unsigned int autobaudAvvioMs;
+
+//Modbus RTU: con modbusIndirizzo diverso da 0 tutti i byte ricevuti appartengono ai frame Modbus. La ISR di ricezione riavvia
+//ad ogni byte il confronto A del timer 1, che scatta dopo 3.5 caratteri di silenzio e segna in modbusFine la posizione del
+//buffer circolare in cui il frame è finito: il main esegue il frame quando ha letto tutti i byte fino a quella posizione.
+unsigned char modbusIndirizzo;
+unsigned char modbusRichiesto; //Indirizzo da applicare con BaudModbus, dopo che l'ultima risposta è uscita.
+volatile unsigned int modbusT35; //3.5 caratteri in conteggi del timer 1 (0.5 us), calcolati dal baud rate.
+volatile unsigned char modbusFine;
+volatile char modbusSilenzio;
+unsigned char modbusFrame[MODBUS_MAX_FRAME];
+unsigned char modbusLunghezza; //Byte del frame in corso, MODBUS_MAX_FRAME + 1 se il frame è troppo lungo.
+unsigned int modbusRichieste;
+unsigned int modbusErroriCRC;
+unsigned int modbusRispostaMax; //Tempo di risposta massimo, in us.
+
+//Baud rate standard a cui viene arrotondata la misura dell'autobaud.
+const unsigned long baudStandard[] PROGMEM = {1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600, 76800, 115200, 250000, 500000, 1000000};
+#define N_BAUD_STANDARD (sizeof(baudStandard) / sizeof(baudStandard[0]))
+
+//Tachimetro: la ISR di cattura del timer 1 salva l'istante di ogni impulso, esteso a 32 bit con gli overflow del timer.
+//Ogni PID_PERIODO_MS la velocità viene calcolata dagli impulsi arrivati e dal tempo tra l'ultimo impulso
+//della lettura precedente e l'ultimo di questa: è la media su tutti gli impulsi, senza perdere tempo tra una lettura e l'altra.
+#define TACH_COSTANTE (60UL * (F_CPU / 8) / TACH_IMPULSI_GIRO) //rpm per un impulso al conteggio del timer 1.
+volatile unsigned int tachOverflow; //Overflow del timer 1, parte alta del tempo a 32 bit.
+volatile unsigned long tachUltimo; //Istante dell'ultimo impulso, in conteggi del timer 1 (0.5 us).
+volatile unsigned char tachImpulsi; //Impulsi dall'accensione (conta solo la differenza tra due letture).
+unsigned char tachImpulsiLetti;
+unsigned long tachFinestra; //Istante dell'ultimo impulso già usato per la misura.
+unsigned char tachFinestreVuote; //Letture consecutive senza impulsi.
+volatile unsigned int rpmMisurati;
+
+//Regolazione di velocità del canale principale, attivata con il comando "rpm" ed eseguita ogni PID_PERIODO_MS dalla ISR del timer 2.
+//Qualunque comando di duty cycle sul canale principale (terminale, dip switch o protocollo binario) la chiude.
+volatile char regolazioneAttiva;
+unsigned int rpmRiferimento;
+unsigned char pidConteggio = PID_PERIODO_MS;
+struct regolatorePID pid = {PID_KP, PID_KI, PID_KD, DC_MAX, 0, 0};
+
+//Telemetria: ogni telemetriaPeriodo ms la ISR del timer 2 accoda nel buffer di trasmissione un frame OP_DATI_TELEMETRIA.
+//Il frame viene accodato tutto insieme o per niente: se nel buffer non c'è posto la seriale è satura, il frame viene scartato
+//e contato. Così la ISR non aspetta mai, e i frame che arrivano all'host sono al più vecchi quanto il buffer (tre frame).
+volatile unsigned char telemetriaPeriodo; //In ms (0 = telemetria ferma).
+unsigned char telemetriaConteggio;
+volatile unsigned int telemetriaPerse;
+
+//Tempo passato dal main a lavorare e a dormire in IDLE, in conteggi del timer 2 (4 us), dall'accensione o dall'ultimo "stats 0".
+//Il tempo di una ISR viene contato con la parte in cui arriva: quello della ISR che sveglia la CPU finisce nel sonno.
+unsigned long tempoAttivo, tempoSonno;
+unsigned int ultimoTempoMs; //Istante dell'ultima misura: millisecondi e conteggio del timer 2.
+unsigned char ultimoTempoConteggio;
+
+//Impostazioni salvate in EEPROM: duty cycle remoto del canale principale, priorità, frequenza e modalità del PWM,
+//baud rate e rampa. Ogni salvataggio scrive un record nello slot successivo del ring (wear leveling): con 32 slot ogni cella
+//viene scritta una volta ogni 32 salvataggi, e i byte già uguali non vengono riscritti. Il record più recente è quello
+//il cui slot successivo non ha il numero di sequenza seguente; se il suo CRC è sbagliato (alimentazione mancata durante
+//la scrittura) si usa il precedente. La ISR(EE_READY_vect) scrive un byte ogni 3.4 ms circa, senza mai fermare il main.
+#define IMPOSTAZIONI_VERSIONE 0x52 //Primo byte di ogni record: cambia se cambia il formato (una EEPROM vuota vale 0xFF).
+#define IMPOSTAZIONI_DIM 16
+#define IMPOSTAZIONI_CONTROLLO_MS 100 //Ogni quanto il main confronta le impostazioni con quelle salvate.
+#define IMP_MODO_LOCALE 0x01 //Bit del campo IMP_MODO: priorità al locale (arbitro.prioritaLocale) e forma della rampa.
+#define IMP_MODO_RAMPA_S 0x04 //rampaForma: RAMPA_S. Il bit 0x02 era la modalità live del selettore, che non c'è più.
+#if IMPOSTAZIONI_SLOT * IMPOSTAZIONI_DIM > E2END + 1
+#error "IMPOSTAZIONI_SLOT troppo grande per la EEPROM"
+#endif
+enum campoImpostazioni {IMP_VERSIONE = 0, IMP_SEQUENZA = 1, IMP_DUTY = 2, IMP_MODO = 4, IMP_PWM_MODO = 5, IMP_FREQUENZA = 6,
+IMP_BAUD = 8, IMP_RAMPA = 12, IMP_MODBUS = 14, IMP_CRC = 15}; //Posizione dei campi, i valori a 16 e 32 bit sono little endian.
+
+unsigned char eepromRecord[IMPOSTAZIONI_DIM]; //Ultimo record salvato (o letto all'avvio). La ISR lo legge mentre lo scrive.
+unsigned char eepromSlot; //Slot in cui verrà scritto il prossimo record.
+volatile unsigned int eepromIndirizzo; //Indirizzo del record in scrittura e prossimo byte da scrivere, usati dalla ISR.
+volatile unsigned char eepromIndice;
+unsigned char impostazioniCandidate[IMPOSTAZIONI_DIM]; //Impostazioni dell'ultimo controllo e controlli in cui non sono cambiate.
+unsigned char impostazioniFerme;
+unsigned int impostazioniControllo; //Istante (in ms) dell'ultimo controllo.
+unsigned int impostazioniSalvate; //Record scritti dall'accensione.
+
+//Programma del duty cycle (programma.h). In EEPROM sta dopo il ring delle impostazioni: versione, i PROGRAMMA_DIM byte
+//del programma e CRC. Il salvataggio usa la stessa ISR(EE_READY_vect) delle impostazioni, che legge i byte direttamente
+//da "programma" con programma_eeprom_byte(): finchè la scrittura non è finita punti e opzioni non si possono cambiare.
+#define PROGRAMMA_VERSIONE 0x50 //Primo byte del programma salvato: cambia se cambia il formato.
+#define PROGRAMMA_INDIRIZZO (IMPOSTAZIONI_SLOT * IMPOSTAZIONI_DIM)
+#define PROGRAMMA_EEPROM_DIM (PROGRAMMA_DIM + 2)
+#if PROGRAMMA_INDIRIZZO + PROGRAMMA_EEPROM_DIM > E2END + 1
+#error "Il programma del duty cycle non entra nella EEPROM dopo le impostazioni"
+#endif
+struct programmaDuty programma;
+char programmaDaSalvare; //Comando "programma salva": la scrittura parte appena la EEPROM è libera.
+volatile char eepromProgramma; //1 mentre la ISR(EE_READY_vect) scrive il programma invece di un record delle impostazioni.
+unsigned char programmaCrc; //CRC del programma in scrittura, calcolato all'avvio del salvataggio.
+
+//Millisecondi dall'accensione, contati dalla ISR del timer 2 (ricominciano da 0 dopo circa 65 secondi).
+volatile unsigned int millisecondi;
+
+//Rientro della ISR del timer 2: il passo del programma, la regolazione e la telemetria girano con gli interrupt abilitati,
+//quindi se durano più di un millisecondo arriva il tick successivo. Quel tick fa solo il contatore e i fronti del PWM
+//software e conta in tickArretrati la parte rimandata, che l'istanza interrotta esegue prima di uscire.
+volatile char tickInCorso;
+volatile unsigned char tickArretrati;
+
+//Parser dei comandi testuali: riceve un carattere alla volta da gestisciRicezione(), senza mai bloccare il main.
+//Quando un comando è completo gestisciRicezione() si ferma finchè il main non l'ha letto con USART_RX_comando().
+struct parserComandi parserTesto;
+char comandoPronto;
+
+//Eventi che le ISR (timer 2 e ADC) segnalano al main. Le ISR si limitano ad accodare l'evento:
+//la stampa dei messaggi e il cambio di PresentState avvengono nel main, in gestisciEventi().
+enum evento {EventoDipStabile, EventoSovracorrente, EventoProgrammaFinito};
+
+//Coda degli eventi, con un solo produttore (le ISR, che non si interrompono a vicenda) e un solo consumatore (il main).
+//Gli indici sono di un byte, quindi letti e scritti in modo atomico: non serve disabilitare gli interrupt.
+volatile unsigned char eventi[EVENTI_BUF];
+volatile unsigned char eventiTesta, eventiCoda;
 
 //Voglio creare una macchina a stati.
 //Definisco allora la variabile di stato e i suoi possibili valori.
-volatile enum state {TerminaleAttivo, SelettoreEsternoAttivo, ModificaDCTerminale, ModificaDCSelettore} PresentState = TerminaleAttivo;
-//Si inizia con l'inserimento da terminale.
+//I comandi da terminale si ricevono ed eseguono sempre: chi comanda il canale principale lo decide l'arbitro.
+volatile enum state {TerminaleAttivo, ModificaDCTerminale} PresentState = TerminaleAttivo;
+
+//Profilo del tempo speso nelle ISR e negli stati della macchina a stati, attivato con PROFILO 1.
+//All'ingresso e all'uscita di ogni punto misurato si legge il timer 1, che conta libero a 2 MHz: le durate sono in conteggi
+//da 0.5 us, cioè 8 cicli di clock. Per ogni punto si tengono minimo, massimo, media e un istogramma con classi che raddoppiano
+//(meno di 16 cicli, meno di 32, ... , 1024 cicli e oltre), che fa vedere anche i passaggi lunghi ma rari.
+//La durata di una ISR non comprende il salvataggio e il ripristino dei registri; quella di uno stato comprende le ISR arrivate nel frattempo.
+//Con PROFILO 0 le macro PROFILO_INIZIO e PROFILO_FINE sono vuote e nel firmware non resta niente.
+#if PROFILO
+#if PWM_TIMER != 0
+#error "PROFILO usa il timer 1 come base dei tempi: serve PWM_TIMER 0"
+#endif
+enum puntoProfilo {ProfiloPCINT0, ProfiloPCINT2, ProfiloUSART_RX, ProfiloUSART_UDRE, ProfiloPWM_OVF,
+ProfiloTIMER1_CAPT, ProfiloTIMER1_COMPA, ProfiloTIMER2_COMPA, ProfiloTIMER2_COMPB, ProfiloEE_READY, ProfiloADC, ProfiloStati}; //Gli stati seguono nell'ordine di enum state.
+#define N_PROFILI (ProfiloStati + 2)
+#define PROFILO_CLASSI 8
+
+struct profilo {
+	unsigned long conteggio; //Passaggi dall'accensione o dall'ultimo "stats 0".
+	unsigned int minimo, massimo; //Durate in conteggi del timer 1.
+	unsigned long somma; //Somma delle durate per la media. Quando sta per traboccare si dimezzano somma e campioni.
+	unsigned int campioni;
+	unsigned int classi[PROFILO_CLASSI]; //Istogramma: la classe k conta le durate da 2^k a 2^(k+1)-1 conteggi (la prima anche lo 0, l'ultima anche le più lunghe).
+};
+
+struct profilo profili[N_PROFILI];
+
+const char nomiProfilo[N_PROFILI][20] PROGMEM = {"PCINT0", "PCINT2", "USART_RX", "USART_UDRE", "PWM_OVF",
+	"TIMER1_CAPT", "TIMER1_COMPA", "TIMER2_COMPA", "TIMER2_COMPB", "EE_READY", "ADC", "TerminaleAttivo", "ModificaDCTerminale"};
+
+#define PROFILO_INIZIO() unsigned int profiloInizio = profilo_tempo()
+#define PROFILO_FINE(punto) profilo_registra((punto), (profilo_tempo() - profiloInizio) & 0xFFFF) //La maschera serve solo su Linux, dove int è a 32 bit.
+#else
+#define PROFILO_INIZIO()
+#define PROFILO_FINE(punto)
+#endif
 
 
 //----------------------MAIN PROGRAM------------------------
 int main(void){
 	
 	init();
+	impostazioni_carica(); //Duty cycle, modalità e configurazione salvati in EEPROM, prima di avviare USART e PWM.
+	programma_carica();
+	sorgenti_init(); //Il canale principale parte dal valore della sorgente che comanda.
 	USART_init();
-	LedOn();
-	//Iniziamo a far muovere il motore. Al primo avvio il motore si muove con duty cycle al 50%.
-	timer_init();
+	//Iniziamo a far muovere il motore. Al primo avvio il motore si muove con duty cycle al 50%, poi con l'ultimo impostato.
+	pwm_init();
+	swpwm_init();
+	base_tempi_init();
+	tachimetro_init();
 	
-	char str[MAX_STR_LEN + 1]; // array per la stringa (una cella in più per ospitare il carattere terminatore di stringa).
+	struct comandoTestuale cmd; // ultimo comando ricevuto, già decodificato dal parser.
 	
-	//Le seguenti variabili conterranno, in ordine, la cifra delle unità, decine e centinaia, dopo la conversiona da bcd a decimale.
-	unsigned char u;
-	unsigned char ts;
-	unsigned char hs;
+	
+	//Stato per cui sono già state stampate le istruzioni. Le istruzioni vengono stampate una sola volta
+	//all'ingresso in uno stato di attesa e ristampate alla fine di ogni riga ricevuta, come quando la lettura era bloccante.
+	//ModificaDCTerminale non stampa istruzioni, quindi viene usato come valore "nessuna istruzione stampata".
+	enum state statoIstruzioni = ModificaDCTerminale;
 	
 	//Messaggi di benvenuto.
 	benvenuto();
 	
+#if BENCHMARK_DUTY
+	benchmark_duty();
+#endif
+#if BENCHMARK_DIP
+	benchmark_dip();
+#endif
+#if BENCHMARK_PID
+	benchmark_pid();
+#endif
+#if BENCHMARK_COMANDI
+	benchmark_comandi();
+#endif
+	
 	while(1){
 		
+		hal_aggiorna(); //Sulla scheda non fa niente; su Linux fa avanzare le periferiche simulate.
+		
+		enum state statoPassaggio = PresentState; //Se durante il passaggio lo stato cambia, il nuovo stato va eseguito subito.
+		
+		//Prima di tutto gestisco gli eventi segnalati dalle ISR (pulsante e dip switch), i cambi di sorgente decisi dall'arbitro
+		//e i byte ricevuti: i frame binari vengono eseguiti subito, in qualunque stato.
+		gestisciEventi();
+		gestisciSorgenti();
+		gestisciRicezione();
+		impostazioni_gestisci();
+		
+#if PROFILO
+		unsigned char statoProfilo = PresentState; //Il passaggio può cambiare stato: il tempo va allo stato di partenza.
+#endif
+		PROFILO_INIZIO();
+		
 		switch (PresentState){
 			
-			case TerminaleAttivo: //L'inserimento da terminale è attivo.
-			istruzioniTerminale();//Vengono visualizzate le istruzioni dell'inserimento da terminale.
-			USART_RX_string(str, MAX_STR_LEN); //Leggo la istruzione inserita dall'utente da terminale.
-			
-			if(!inserimentoDaTerminale){ //Se è attiva la modalità di inserimento da terminale, procedo.
-				//Se il comando inserito è valido, si passa allo stato in cui avviene la modifica del duty cycle
-				if((!strcmp(str, "up")) || (!strcmp(str, "down")))
-				PresentState = ModificaDCTerminale;
-				
-				else //Altrimenti non viene riconosciuto il comando e bisogna inserirne uno valido
-				USART_TX_string("\n-> Comando non riconosciuto");
+			case TerminaleAttivo: //Si aspetta un comando da terminale.
+			if(statoIstruzioni != TerminaleAttivo){
+				if(!modoMacchina && cambioBaud != BaudModbus) //Dopo "modbus" il terminale non legge più testo.
+				istruzioniTerminale();//Vengono visualizzate le istruzioni dell'inserimento da terminale.
+				statoIstruzioni = TerminaleAttivo;
 			}
 			
-			else//Se non siamo in modalità da terminale, per esclusione, ci troviamo nella modalità selettore esterno.
-			PresentState = SelettoreEsternoAttivo; //Si entra in modalità Selettore Esterno.
-			
+			//Leggo il prossimo comando inserito dall'utente da terminale, senza bloccare:
+			//se il comando non è ancora arrivato, si ripassa da questo stato al prossimo giro del ciclo.
+			if(!USART_RX_comando(&cmd))
 			break;
 			
-			case SelettoreEsternoAttivo:
-			if(inserimentoDaTerminale){
-				istruzioniSelettoreEsterno();
-				
-				//Faccio in modo che l'inserimento del duty cycle, ossia il salvataggio nel registro OCR0B del valore,
-				//avvenga solo dopo aver finito la fase di inserimento. Questa è definita dai comandi "inizio" e "fine".
-				//In questo modo evito che il motore abbia un duty cycle non desiderato mentre si cambia valore attraverso
-				//il selettore esterno.
-				USART_RX_string(str, MAX_STR_LEN);
-				
-				if(!strcmp(str, "inizio"))
-				PresentState = ModificaDCSelettore;
-				
-				else {
-					USART_TX_string("Devi scrivere \"inizio\" per iniziare la modifica del DC");
-					PresentState = SelettoreEsternoAttivo;
-				}
-			}
+			if(cmd.fineRiga)
+			statoIstruzioni = ModificaDCTerminale;
 			
-			else
-			PresentState = TerminaleAttivo;
+			//Si passa allo stato in cui viene eseguito il comando. I comandi non validi vengono segnalati lì, uno per uno.
+			PresentState = ModificaDCTerminale;
 			
 			break;
 			
 			case ModificaDCTerminale:
-			if(!strcmp(str, "up")){
-				
-				if(flag_accensione == 1){//Se si inserisce il comando "up" quando il motore è spento, ho un ciclo particolare, in cui devo riaccendere il timer.
-					timer_on();
-					OCR0B = ceil(valoreDC*top/100);
-					sprintf(str, "\n-> Duty Cycle aumentato a %d %%", valoreDC);
-					USART_TX_string(str);
-				}
-				
-				else if((valoreDC+1) > 100)//Se inserendo "up", supereri 100% di duty cycle, stampo un messaggio di avviso.
-				USART_TX_string("\n-> Duty Cycle massimo raggiunto");
-				
-				else{
-					valoreDC++;//Se inserendo "up", aumento di 1% il valore percentuale e mappo rispetto a 255 il valore.
-					OCR0B = ceil(valoreDC*top/100);
-					sprintf(str, "\n-> Duty Cycle aumentato a %d %%", valoreDC); //Stampo il valore aggiornato di duty cycle.
-					USART_TX_string(str);
-				}
-			}
-			
-			//Nella seguente condizione faccio a meno di fare un compare con str
-			//perchè in questo stato ci si entra solo nella condizione in cui
-			//str sia o "up" o "down"
-			else{
-				if(valoreDC <= 1){//Spengo il motore
-					timer_off();
-					flag_accensione = 1;
-					USART_TX_string("\n-> Motore Spento !");
-				}
-				
-				else{
-					valoreDC--;//Procedimento analogo di "up" ma, ovviamente, si diminuisce il duty cycle.
-					OCR0B = ceil(valoreDC*top/100);
-					sprintf(str, "\n-> Duty Cycle decrementato a %d %%", valoreDC);
-					USART_TX_string(str);
-				}
-			}
+			//Il comando viene eseguito appena è completo, senza aspettare la fine della riga.
+			eseguiComandoRiga(&cmd);
 			PresentState = TerminaleAttivo;
 			
 			break;
 			
-			case ModificaDCSelettore:
-			USART_TX_string("\nScrivi \"fine\" quando hai finito la modifica del DC");
-			
-			USART_RX_string(str, MAX_STR_LEN);
-			
-			//Utilizzo la funzione BinToDec per convertire in cifra decimale.
-			if(!strcmp(str, "fine")){
-				stato_dip_switch();
-				u = BinToDec(units, 4);
-				ts = BinToDec(tens, 4);
-				hs = BinToDec(hundreds, 1);
-				
-				valoreDC = SwitchConcat(hs, ts, u);//Concateno le tre cifre per formare il numero decimale che costituisce il duty cycle percentuale nuovo.
-				
-				//La codifica bcd non permette che la cifra superi il 9.
-				//Il duty cycle non può superare il 100%, ma con il selettore esterno posso comunque inserire un tale valore.
-				//Via software impedisco queste condizioni, avvisando l'utente con un messaggio.
-				if(valoreDC > 100 || ts > 9 || u > 9)
-				USART_TX_string("\n-> Numero inserito non ammesso.");
-				
-				else if(valoreDC == 0){
-					timer_off();
-					flag_accensione = 1;
-					USART_TX_string("-> Motore spento!");
-				}
-				
-				else{//Sto modificando il duty cycle in un valore maggiore di zero accettabile
-					if(flag_accensione == 1){//Se cambio il duty cycle dopo che era stato impostato a zero, riaccendo il timer.
-						timer_on();
-						valoreDC = SwitchConcat(hs, ts, u);
-						OCR0B = ceil(valoreDC*top/100);
-						sprintf(str, "\n-> Duty Cycle aumentato a %d %%", valoreDC);
-						USART_TX_string(str);
-					}
-					
-					else{
-						OCR0B = ceil(valoreDC*top/100);//Mappo il valore con la funzione "ceil" in un valore tra 0 e 255, salvandolo poi in OCR0B.
-						sprintf(str, "\n-> Duty Cycle impostato a %d %%", valoreDC);
-						USART_TX_string(str);
-					}
-				}
-				
-				PresentState = SelettoreEsternoAttivo;
-			}
-			
-			else{
-				USART_TX_string("Il Duty Cycle non è stato modificato con successo");
-				PresentState = SelettoreEsternoAttivo;
-			}
-			
-			break;
-			
 		}
+		
+		PROFILO_FINE(ProfiloStati + statoProfilo);
+		
+		//Se non c'è più niente da fare, la CPU dorme fino al prossimo interrupt: al più 1 ms, con il timer 2.
+		//Il controllo avviene con gli interrupt disabilitati, così un interrupt arrivato subito dopo non viene perso.
+		cli();
+		if(PresentState == statoPassaggio && !lavoroInSospeso())
+		dormi();
+		sei();
 	}
 }//Fine main
 
@@ -268,312 +751,3789 @@ void init(void){
 	PORTD &= ~( (1<<PORTD2)|(1<<PORTD3)|(1<<PORTD4)|(1<<PORTD7) );
 	PORTC &= ~( (1<<PORTC0)|(1<<PORTC1)|(1<<PORTC2)|(1<<PORTC3) );
 	
-	//Abilito gli interrupt Pin Change 0, 1 e 2.
-	PCICR = (1<<PCIE0)|(1<<PCIE1)|(1<<PCIE2);
+	//Abilito gli interrupt Pin Change 0 e 2.
+	//I dip switch non hanno un interrupt: li campiona ogni millisecondo la ISR del timer 2.
+	PCICR = (1<<PCIE0)|(1<<PCIE2);
 	
-	//Rimuovo le maschere agli interrupt sui pin
-	//PCINT8, PCINT9, PCINT10, PCINT11,PCINT13
-	//PCINT18, PCINT19, PCINT20, PCINT23
-	//PCINT7
-	PCMSK0 = (1<<PCINT7)|(1<<PCINT1);
-	PCMSK1 = (1<<PCINT8)|(1<<PCINT9)|(1<<PCINT10)|(1<<PCINT11);
-	PCMSK2 = (1<<PCINT18)|(1<<PCINT19)|(1<<PCINT20)|(1<<PCINT23);
+	//Rimuovo la maschera al solo PCINT7 (pulsante su PB7), che serve solo se PB7 non è un interruttore.
+	//Su PCINT16 (RXD) la toglie l'autobaud quando serve.
+	PCMSK0 = PRIORITA_INTERRUTTORE ? 0 : (1<<PCINT7);
+	PCMSK1 = 0;
+	PCMSK2 = 0;
 	
 	//PORTD E PORTC
 	PORTB = ~( (1<<PORTB2) );
-	PORTD = ~( (1<<PORTD2)|(1<<PORTD3)|(1<<PORTD4)|(1<<PORTD7) );
+	PORTD = (unsigned char) ~( (1<<PORTD2)|(1<<PORTD3)|(1<<PORTD4)|(1<<PORTD7) );
 	PORTC = ~( (1<<PORTC0)|(1<<PORTC1)|(1<<PORTC2)|(1<<PORTC3) );
 	
+	//Spengo le periferiche che il programma non usa: TWI e SPI tramite PRR (il clock non arriva più)
+	//e il comparatore analogico. Timer 0, 1 e 2, la USART e l'ADC (corrente del motore) restano accesi.
+	PRR = (1<<PRTWI)|(1<<PRSPI);
+	ACSR = (1<<ACD);
+	
+	//Quando non ha niente da fare il main dorme in IDLE: si ferma solo la CPU, mentre timer (quindi il PWM),
+	//USART e pin change continuano a funzionare e la risvegliano con i loro interrupt.
+	set_sleep_mode(SLEEP_MODE_IDLE);
 	
 	//Abilito interrupt globali.
 	sei();
 	
 }
 
-void timer_init(void){
+//Inizializzazione del motore PWM con frequenza e duty cycle iniziali.
+//Il canale principale è OC0B (PD5) con il timer 0, oppure OC1A (PB1) con il timer 1.
+void pwm_init(void){
 	
-	// impostazione del pin 5 del portD (OC0B) come uscita (gli altri pin sono ingressi di default)
-	DDRD = (1<<DDD5);
+	unsigned char c;
 	
-	// Impostazione timer T0 in modalità Fast PWM su OCOB (PD5) con TOP=UserTop e prescaler 1024
-	OCR0A = (char) UserTop;
-	OCR0B = ceil(valoreDC*top/100); //Imposto il primo valore di duty cycle.
+	#if PWM_TIMER == 0
+	// impostazione dei pin 5 e 6 del portD (OC0B e OC0A) come uscite, inizialmente basse
+	PORTD &= ~((1<<PORTD5)|(1<<PORTD6));
+	DDRD |= (1<<DDD5)|(1<<DDD6);
+	#else
+	// impostazione del pin 1 del portB (OC1A) come uscita, inizialmente bassa
+	PORTB &= ~(1<<PORTB1);
+	DDRB |= (1<<DDB1);
+	#endif
 	
-	//Con le seguenti linee di codice, si configurano fattore di prescaler, modalità pwm, polarità.
-	TCCR0A = ((1<<COM0B1)|(1<<WGM01)|(1<<WGM00));
-	TCCR0B = ((1<<WGM02)|(1<<CS02)|(1<<CS00));
+	//Configura il timer e lo avvia. Se la frequenza letta dalla EEPROM non si può ottenere si usa quella iniziale.
+	if(!pwm_imposta_frequenza(pwmFrequenzaRichiesta))
+	pwm_imposta_frequenza(PWM_FREQ_INIT);
+	
+	for(c = 0; c < N_CANALI; c++)
+	impostaDC(c, canali[c].duty); //Imposto il primo valore di duty cycle.
 	
 }
 
-void timer_off(void){
+//Imposta la frequenza della portante PWM, in Hz.
+//Con il timer 0 il TOP è fisso a 255 e si può scegliere solo il prescaler: si usa la frequenza disponibile più vicina.
+//Con il timer 1 si sceglie il prescaler più piccolo che permette di ottenere la frequenza con TOP a 16 bit,
+//in modo da avere la massima risoluzione del duty cycle.
+//Restituisce 0 se la frequenza non si può ottenere.
+char pwm_imposta_frequenza(unsigned int hz){
 	
-	TCCR0B = 0x00; // spegnimento timer
+	unsigned char i;
 	
-	TCNT0 = 0x00; // reset del counter T0
+	if(hz == 0)
+	return 0;
+	
+	#if PWM_TIMER == 0
+	unsigned long f;
+	unsigned long errore;
+	unsigned long erroreMinimo = 0xFFFFFFFF;
+	
+	for(i = 0; i < 5; i++){
+		//Fast PWM: f = F_CPU/(N*256). Phase correct: f = F_CPU/(N*510).
+		f = F_CPU / ((unsigned long) prescalerPWM[i] * (pwmModo == PWM_FAST ? 256 : 510));
+		errore = (f > hz) ? f - hz : hz - f;
+		
+		if(errore < erroreMinimo){
+			erroreMinimo = errore;
+			pwmCS = i + 1;
+			pwmFrequenza = f;
+		}
+	}
+	#else
+	unsigned long conteggi;
+	
+	//Fast PWM: f = F_CPU/(N*(1+TOP)). Phase correct: f = F_CPU/(2*N*TOP).
+	conteggi = F_CPU / hz;
+	if(pwmModo == PWM_PHASE_CORRECT)
+	conteggi /= 2;
+	
+	for(i = 0; i < 5; i++){
+		if(conteggi / prescalerPWM[i] <= 65535UL)
+		break;
+	}
+	
+	if(i == 5 || conteggi / prescalerPWM[i] < PWM_TOP_MIN)
+	return 0;
+	
+	pwmCS = i + 1;
+	pwmTop = conteggi / prescalerPWM[i];
+	if(pwmModo == PWM_FAST)
+	pwmTop--;
+	
+	//Arrotondo per eccesso, così al 100% si arriva a TOP (il valore viene comunque limitato a TOP).
+	pwmScala = (((unsigned long) pwmTop << 16) + DC_MAX - 1) / DC_MAX;
+	pwmFrequenza = F_CPU / ((unsigned long) prescalerPWM[i] * (pwmModo == PWM_FAST ? pwmTop + 1UL : 2UL * pwmTop));
+	#endif
+	
+	pwmFrequenzaRichiesta = hz;
+	rampa_calcola();
+	pwm_applica();
+	
+	return 1;
 	
-	// azzeramento flag di un eventuale output compare appena occorso (l'azzeramento è ottenuto scrivendo '1' nel flag)
-	TIFR0 = (1<<OCF0A);
-
 }
 
-//Funzione utilizzata quando riaccendo il timer dopo lo spegnimento del motore.
-void timer_on(void){
+//Sceglie tra fast PWM e phase correct, mantenendo la frequenza richiesta.
+void pwm_imposta_modo(unsigned char modo){
 	
-	// Impostazione timer T0 in modalità Fast PWM su OCOB (PD5) con TOP=UserTop e prescaler 1024.
-	OCR0A = (char) UserTop;
-	valoreDC = 1; //Inserisco manualmente il valore percentuale 1%.
-	OCR0B = ceil(valoreDC*top/100);
-	TCCR0A = ((1<<COM0B1)|(1<<WGM01)|(1<<WGM00)); //Effettuo di nuovo le operazioni di configurazione del timer.
-	TCCR0B = ((1<<WGM02)|(1<<CS02)|(CS00));
-	flag_accensione = 0; //Faccio il reset del flag che permette di sapere se c'è stato uno spegnimento.
+	pwmModo = modo;
+	pwm_imposta_frequenza(pwmFrequenzaRichiesta);
 	
 }
 
-//Devo inizializzare la periferica USART.
-//Scelgo per il frame il formato 8N1.
-void USART_init(void){
+//Scrive il registro di compare del canale. Il duty cycle è in decimi di percento.
+//Per i canali software aggiorna la lista dei fronti, che verrà usata dal periodo successivo.
+void pwm_imposta_duty(unsigned char canale, unsigned int duty){
 	
-	//Imposto per prima cosa il baud rate.
-	UBRR0 = UBRR_VALUE;
+	#if PWM_TIMER == 1
+	unsigned long ocr;
+	#endif
+	
+	switch(canali[canale].uscita){
+		
+		#if PWM_TIMER == 0
+		//Il valore di compare viene letto dalla tabella in flash: l'aggiornamento richiede pochi cicli e tempo costante.
+		case USCITA_OC0B:
+		OCR0B = pgm_read_byte(&tabellaOCR[duty]);
+		break;
+		
+		case USCITA_OC0A:
+		OCR0A = pgm_read_byte(&tabellaOCR[duty]);
+		break;
+		#else
+		case USCITA_OC1A:
+		ocr = ((unsigned long) duty * pwmScala) >> 16;
+		OCR1A = (ocr > pwmTop) ? pwmTop : ocr;
+		OCR1B = OCR1A >> 1; //Avvio dell'ADC a metà dell'impulso, in fast PWM.
+		break;
+		#endif
+		
+		default:
+		swpwm_ricalcola();
+		break;
+	}
 	
-	//Ora attivo la periferica di TX.
-	UCSR0B = (1<<TXEN0);
+}
+
+//Bit COMnx1 da impostare nel registro TCCRnA per collegare l'uscita del canale (uscita non invertita).
+//Restituisce 0 per i canali software e per quelli spenti.
+unsigned char pwm_bit_com(unsigned char canale){
 	
-	//Imposto la modalità asincrona con 8 bit di dati, nessuna parità, 1 bit di stop.
-	UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
+	if(canali[canale].spento)
+	return 0;
 	
-	//Ci sarebbero anche altri bit da configurare, ma sono '0'.
+	switch(canali[canale].uscita){
+		case USCITA_OC0B: return (1<<COM0B1);
+		case USCITA_OC0A: return (1<<COM0A1);
+		case USCITA_OC1A: return (1<<COM1A1);
+		default: return 0;
+	}
 	
 }
 
-//Le seguenti funzioni USART_TX_string e USART_RX_string permettono di trasmettere e ricevere caratteri attraverso RS-EIA-232.
-void USART_TX_string(char *strPtr){
+//Scrive nei registri del timer la modalità, la frequenza e il duty cycle attuali.
+//Le uscite dei canali spenti restano scollegate.
+void pwm_applica(void){
 	
-	//Devo trasmettere un carattere alla volta.
-	//Trasmetto quindi fino al terminatore di stringa.
+	unsigned char com = 0;
+	unsigned char c;
+	unsigned char sreg = SREG;
 	
-	while(*strPtr != '\0'){
-		//Devo verificare che il buffer di Trasmissione non sia pieno.
-		//In questo modo non sovrascrivo dati ancora da trasmettere.
-		//Rimango alla linea seguente fino a che il buffer di TX si svuota.
-		while (!(UCSR0A & (1<<UDRE0)));
-		
-		//Se si arriva a questo punto, si può proseguire con la trasmissione della stringa,
-		//un carattere per volta.
-		//Con la seguente linea salvo il dato da trasmettere nel registro di trasmissione.
-		UDR0 = *strPtr++;
-	}
+	//Le uscite collegate si calcolano con gli interrupt già disabilitati: se la ISR dell'ADC spegnesse il canale
+	//principale per sovracorrente tra il calcolo e la scrittura del registro, riscriverei OC0B (o OC1A) collegata.
+	cli();
+	for(c = 0; c < N_CANALI; c++)
+	com |= pwm_bit_com(c);
 	
-	//Sono uscito dal ciclo, significa che sono arrivato al terminatore di linea.
-	//Inserisco il "line feed (LF)", per terminare la stringa con un ritorno a capo.
-	//Anche adesso però devo verificare che il buffer di trasmissione sia libero.
-	while (!(UCSR0A & (1<<UDRE0)));
+	#if PWM_TIMER == 0
+	// Timer T0 con TOP=0xFF (UserTop): modalità 3 (fast PWM) o 1 (phase correct).
+	//OCR0A non fa da TOP, quindi anche OC0A è un'uscita PWM.
+	TCCR0B = 0x00;
+	TCCR0A = com | ((pwmModo == PWM_FAST) ? ((1<<WGM01)|(1<<WGM00)) : (1<<WGM00));
+	TCNT0 = 0x00;
+	TCCR0B = pwmCS;
+	#else
+	// Timer T1 con TOP=ICR1: modalità 14 (fast PWM) o 10 (phase correct).
+	//Fermo il timer prima di cambiare ICR1: se il nuovo TOP fosse minore del contatore, il timer arriverebbe fino a 0xFFFF.
+	//Gli interrupt restano disabilitati perchè anche la ISR della rampa scrive OCR1A, e i registri a 16 bit condividono il byte TEMP.
+	TCCR1B = 0x00;
+	TCNT1 = 0;
+	ICR1 = pwmTop;
+	pwm_imposta_duty(CANALE_PRINCIPALE, rampe[CANALE_PRINCIPALE].attuale);
+	TCCR1A = com | (1<<WGM11);
+	TCCR1B = (pwmModo == PWM_FAST ? ((1<<WGM13)|(1<<WGM12)) : (1<<WGM13)) | pwmCS;
+	#endif
+	SREG = sreg;
 	
-	//Posso ora trasmettere il ritorno a capo
-	UDR0 = '\n';
+	//Il centro dell'impulso dipende dalla modalità e, con il timer 0, dal prescaler.
+	corrente_avvia();
 	
 }
 
-void USART_RX_string(char *strPtr, unsigned const int max_char){
+//Forza basso il pin del canale. Il read-modify-write della porta avviene con gli interrupt disabilitati,
+//perchè la ISR del PWM software modifica le stesse porte.
+void pwm_pin_basso(unsigned char canale){
 	
-	//La seguente variabile serve come indice del puntatore
-	unsigned int n_char = 0;
+	unsigned char sreg = SREG;
+	unsigned char maschera = ~(1<<canali[canale].bit);
 	
-	//Attivo l'unità di Ricezione
-	UCSR0B |= (1<<RXEN0);
+	cli();
+	switch(canali[canale].porta){
+		case PORTA_B: PORTB &= maschera; break;
+		case PORTA_C: PORTC &= maschera; break;
+		default: PORTD &= maschera; break;
+	}
+	SREG = sreg;
 	
-	//Ora procedo con la lettura. Il procedimento è analogo alla Tx, ma in senso oppost.
-	do{
-		//Con la seguente linea verifico che il buffer di ricezione non sia pieno.
-		//Nel caso lo sia, mi fermo e aspetto che si liberi spazio.
-		while (!(UCSR0A & (1<<RXC0)));
-		
-		//Ora posso leggere il dato dal buffer
-		strPtr[n_char] = UDR0;
-		
-		//Ora voglio filtrare caratteri stampabili da quelli non stampabili.
-		
-		//Se il carattere è stampabile, quindi nella tabella ASCII,
-		//dopo il carattere ' space '.
-		if(strPtr[n_char] >= ' ')
-		n_char++;
-		else
-		//Se arrivo al terminatore, esco dal ciclo,
-		//in modo da poter inserire il terminatore di stringa.
-		if(strPtr[n_char] == '\n')
-		break;
-		
-	}while(n_char < max_char);
+}
+
+//Spegnimento di un canale: sul canale principale ferma la regolazione e il programma, poi scollega l'uscita.
+void pwm_off(unsigned char canale){
 	
-	//Inserimento terminatore di stringa nella prima cella libera dell'array
-	strPtr[n_char] = '\0';
+	if(canale == CANALE_PRINCIPALE){
+		regolazioneAttiva = 0;
+		programma.attivo = 0;
+	}
 	
-	//Disattivazione unità USART di ricezione (lasciando attiva l'unità di trasmissione)
-	//Svuotamento del buffer FIFO di ricezione in caso di overflow per evitare che i caratteri residui siano acquisiti al ciclo successivo
-	UCSR0B &= ~(1<<RXEN0);
+	pwm_scollega(canale);
 	
 }
 
-//Le seguenti funzioni LedOn e LedOff permettono all'utente di avere un feedback visivo per quanto riguarda la modalità di inserimento attiva.
-//Se il led è acceso, si è nella modalità di inserimento da Terminale.
-//Se il led è spento, si è nella modalità di inserimento da Selettore Esterno.
-void LedOn(void){
+//Scollego l'uscita del canale, forzando il pin a livello basso, senza fermare chi lo comanda: la usano pwm_off() e,
+//quando il duty cycle calcolato arriva a 0%, la regolazione e il programma (impostaDCDiretto()).
+//Il timer continua a girare perchè può pilotare anche altri canali.
+//Senza scollegare l'uscita, il pin resterebbe nello stato dell'ultimo confronto, anche alto.
+//OC0A e OC0B stanno nello stesso TCCR0A, che cambiano anche il tick del timer 2 (arbitro) e la ISR dell'ADC (sovracorrente):
+//il read-modify-write del registro avviene con gli interrupt disabilitati, come in pwm_on().
+void pwm_scollega(unsigned char canale){
 	
-	PORTB &= ~(1<<PORTB5);
-	// accensione led
-	PINB |= (1<<PINB5);
+	unsigned char sreg = SREG;
+	
+	cli();
+	canali[canale].spento = 1;
+	
+	switch(canali[canale].uscita){
+		case USCITA_OC0B: TCCR0A &= ~((1<<COM0B1)|(1<<COM0B0)); break;
+		case USCITA_OC0A: TCCR0A &= ~((1<<COM0A1)|(1<<COM0A0)); break;
+		case USCITA_OC1A: TCCR1A &= ~((1<<COM1A1)|(1<<COM1A0)); break;
+	}
+	SREG = sreg;
+	
+	if(canali[canale].uscita == USCITA_SW)
+	swpwm_ricalcola();
+	
+	pwm_pin_basso(canale);
 	
 }
 
-void LedOff(void){
+//Funzione utilizzata quando riaccendo un canale dopo lo spegnimento del motore.
+//Il duty cycle da usare va impostato prima con impostaDC().
+void pwm_on(unsigned char canale){
 	
-	//Spegnimento led
-	PORTB &= ~(1<<PORTB5);
+	unsigned char sreg = SREG;
+	
+	//Con il guasto di sovracorrente memorizzato il canale principale resta spento, anche se il duty cycle cambia.
+	//Il controllo sta nella stessa sezione senza interrupt della scrittura, così la ISR dell'ADC non può scattare in mezzo.
+	cli();
+	if(canale == CANALE_PRINCIPALE && corrente.scattata){
+		SREG = sreg;
+		return;
+	}
+	
+	canali[canale].spento = 0; //Faccio il reset del flag che permette di sapere se c'è stato uno spegnimento.
+	
+	switch(canali[canale].uscita){
+		case USCITA_OC0B:
+		case USCITA_OC0A: TCCR0A |= pwm_bit_com(canale); break;
+		case USCITA_OC1A: TCCR1A |= pwm_bit_com(canale); break;
+	}
+	SREG = sreg;
+	
+	if(canali[canale].uscita == USCITA_SW)
+	swpwm_ricalcola();
 	
 }
 
-//Funzione che permette di evitare alcuni bug al primo avvio, prima dell'inizializzazione degli interrupt, nel caso i dip switch non si vogliano cambiare.
-//Evita bug al primo avvio.
-void stato_dip_switch(){
+//Avvia le conversioni dell'ADC sulla corrente del motore. L'avvio è automatico e cade a metà dell'impulso del canale principale:
+//-fast PWM: l'impulso va da BOTTOM al confronto, quindi il centro è a metà del valore di compare. Con il timer 1 l'avvio è il
+// confronto B, tenuto a OCR1A/2 da pwm_imposta_duty(); con il timer 0, che non ha un confronto libero (OCR0A è il canale 1),
+// è il confronto B del timer 1, che la ISR dell'ADC programma ogni volta sul centro dell'impulso successivo;
+//-phase correct: l'impulso è centrato su BOTTOM, dove arriva l'overflow del timer del PWM.
+//L'ADC lavora a 1 MHz (prescaler 16): con 8 bit (ADLAR, si legge solo ADCH) la velocità oltre i 200 kHz non toglie precisione
+//e una conversione dura 13.5 us. Gli avvii che arrivano durante una conversione vengono ignorati dall'hardware.
+void corrente_avvia(void){
+	
+	ADMUX = (1<<REFS0)|(1<<ADLAR)|CORRENTE_ADC; //Riferimento AVcc.
+	
+	#if PWM_TIMER == 0
+	unsigned char s;
+	
+	//Il timer 1 conta con prescaler 8: ogni passo del timer 0 vale prescaler/8 conteggi, da 1/8 (scorrimento -3) a 128 (7).
+	for(s = 0; (1U << s) < prescalerPWM[pwmCS - 1]; s++);
+	correnteSpostamento = s - 3;
+	
+	ADCSRB = (pwmModo == PWM_FAST) ? ((1<<ADTS2)|(1<<ADTS0)) : (1<<ADTS2); //Confronto B del timer 1 o overflow del timer 0.
+	#else
+	ADCSRB = (pwmModo == PWM_FAST) ? ((1<<ADTS2)|(1<<ADTS0)) : ((1<<ADTS2)|(1<<ADTS1)); //Confronto B o overflow del timer 1.
+	#endif
+	
+	ADCSRA = (1<<ADEN)|(1<<ADATE)|(1<<ADIE)|(1<<ADIF)|(1<<ADPS2);
 	
-	units[3] = !((PINC & (1<<PINC0)) == 0);
-	units[2] = !((PINC & (1<<PINC1)) == 0);
-	units[1] = !((PINC & (1<<PINC2)) == 0);
-	units[0] = !((PINC & (1<<PINC3)) == 0);
-
-
-	tens[3] = !((PIND & (1<<PIND2)) == 0);
-	tens[2] = !((PIND & (1<<PIND3)) == 0);
-	tens[1] = !((PIND & (1<<PIND4)) == 0);
-	tens[0] = !((PIND & (1<<PIND7)) == 0);
-
-	hundreds[0] = !((PINB & (1<<PINB2)) == 0);
-
 }
 
-//Messaggio di benvenuto.
-void benvenuto(){
+//Stampa la corrente media del motore, il picco dall'ultimo riarmo e la soglia della protezione, poi l'eventuale guasto.
+void stampaCorrente(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	unsigned char media, picco;
+	char guasto;
 	
-	USART_TX_string("Comando motore mediante PWM - Frenki Shqepa");
-	USART_TX_string("~~~~~~~~~~~~~~~~~Benvenuto!~~~~~~~~~~~~~~~~");
-	USART_TX_string("\nPuoi scegliere due modalità di inserimento del Duty Cycle:");
-	USART_TX_string("-Scrivi \"up\" per aumentare il Duty Cycle di 1%");
-	USART_TX_string(" Scrivi \"down\" per decrementare il Duty Cycle di 1%");
-	USART_TX_string("-Se clicchi sul pulsante presente sulla scheda Xplained Mini,");
-	USART_TX_string(" devi utilizzare i Dip Switch sulla Breadboard (uno per ogni cifra)");
+	cli();
+	media = corrente_media(&corrente);
+	picco = corrente.picco;
+	guasto = corrente.scattata;
+	sei();
+	
+	strcpy_P(buf, PSTR("\n-> Corrente "));
+	p = formattaIntero(buf + strlen(buf), corrente_ma(media, CORRENTE_FONDO_SCALA_MA));
+	strcpy_P(p, PSTR(" mA, picco "));
+	p = formattaIntero(p + strlen(p), corrente_ma(picco, CORRENTE_FONDO_SCALA_MA));
+	strcpy_P(p, PSTR(" mA, soglia "));
+	p = formattaIntero(p + strlen(p), corrente_ma(corrente.soglia, CORRENTE_FONDO_SCALA_MA));
+	strcpy_P(p, PSTR(" mA"));
+	risposta(buf);
+	
+	if(guasto)
+	risposta_P(PSTR("-> Sovracorrente: uscita spenta, scrivi \"corrente reset\""));
 	
 }
 
-//Istruzioni per il selettore esterno.
-void istruzioniSelettoreEsterno(){
+//Legge all'avvio il programma salvato in EEPROM. Se manca, se il CRC è sbagliato o se i punti non sono validi il programma resta vuoto.
+void programma_carica(void){
+	
+	unsigned char crc = 0;
+	unsigned char i, dato;
+	
+	if(eeprom_leggi(PROGRAMMA_INDIRIZZO) != PROGRAMMA_VERSIONE)
+	return;
+	
+	for(i = 0; i < PROGRAMMA_EEPROM_DIM - 1; i++){
+		dato = eeprom_leggi(PROGRAMMA_INDIRIZZO + i);
+		crc = proto_crc8(crc, dato);
+		if(i)
+		programma_imposta_byte(&programma, i - 1, dato);
+	}
+	
+	if(crc != eeprom_leggi(PROGRAMMA_INDIRIZZO + i) || !programma_valido(&programma, DC_MAX)){
+		programma_reset(&programma);
+		programma.opzioni = 0;
+	}
 	
-	USART_TX_string("\n~~~~~~~Istruzioni per l'utilizzo del Selettore Esterno~~~~~~");
-	USART_TX_string("L'inserimento da selettore esterno è ora attivo.");
-	USART_TX_string("Orienta la breadboard in modo da avere");
-	USART_TX_string("il Dip Switch singolo all'estrema SX.");
-	USART_TX_string("In questo modo vedrai, da SX a DX");
-	USART_TX_string("i Dip Switch delle centinaia, decine, unità.");
-	USART_TX_string("\nScrivi nel terminale i seguenti comandi:");
-	USART_TX_string("-Scrivi \"inizio\" prima di modificare il DC.");
-	USART_TX_string("-Scrivi \"fine\" quando hai modificato il DC.");
-	USART_TX_string("Il Duty Cycle va da 0% a 100%, con risoluzione 1%");
-	USART_TX_string("Devi usare i Dip Switch con la codifica BCD per ogni cifra");
 }
 
-//Istruzioni per l'inserimento da terminale.
-void istruzioniTerminale(){
+//Byte i del programma come viene salvato in EEPROM: versione, byte di programma_byte() e CRC.
+//La chiama la ISR(EE_READY_vect) durante il salvataggio.
+unsigned char programma_eeprom_byte(unsigned char i){
+	
+	if(i == 0)
+	return PROGRAMMA_VERSIONE;
+	
+	if(i <= PROGRAMMA_DIM)
+	return programma_byte(&programma, i - 1);
+	
+	return programmaCrc;
 	
-	USART_TX_string("\nScrivi \"up\" per aumentare il Duty Cycle di 1%");
-	USART_TX_string("Scrivi \"down\" per decrementare il Duty Cycle di 1%");
 }
 
-//La seguente funzione permette di convertire un numero binario memorizzato in un array in decimale.
-//Il numero nella posizione 0 dell'array è il Most Significant Bit.
-//Significa quindi che il calcolo parte da quel valore.
-char BinToDec(volatile char cifreBin[], char dimensione){
+//Comando "programma avvia": il canale principale parte dal duty cycle del primo punto, senza rampa, e da lì lo cambia
+//la ISR del timer 2. Come "rpm", ferma la rampa e la regolazione; un duty cycle impostato a mano ferma il programma.
+//Restituisce 0 se il programma ha meno di due punti, se c'è il guasto di sovracorrente o se comandano i dip switch.
+char programma_esegui(void){
 	
-	//Nella seguente variabile salvo il numero decimale
-	char dec = 0;
-
-	for(int i=0; i<dimensione; i++){
-		dec = dec + (cifreBin[dimensione-1-i] * potenza(2, i));
+	unsigned char sreg = SREG;
+	
+	cli();
+	if(programma.n < 2 || corrente.scattata || arbitro.sorgente == ARBITRO_LOCALE){
+		SREG = sreg;
+		return 0;
 	}
 	
-	//Questa è il numero corrispondente al numero inserito con il Dip Switch
-	return dec;
+	impostaDC(CANALE_PRINCIPALE, programma.punti[0].duty); //Ferma la regolazione e una rampa in corso.
+	
+	//impostaDCDiretto() riaccende il canale spento, oppure lo lascia spento se il primo punto è a 0%.
+	programma_avvia(&programma);
+	impostaDCDiretto(programma.duty);
+	SREG = sreg;
+	
+	return 1;
 	
 }
 
-//La seguente funzione concatena le unità con le decine e le centinaia.
-//Essendo BCD la codifica utilizzata, posso essere sicuro che l'utente debba mettere un valore tra 0 e 9 per ogni cifra
-//del Numero decimale da inserire. Ottengo il numero decimale:
-//moltiplicando per 100 la cifra delle centinaia;
-//moltiplicando per 10 la cifra delle decine;
-//moltiplicando per 1 la cifra delle unità.
-char SwitchConcat(char centinaia, char decine, char units){
+//Stampa lo stato del programma e, con punti a 1, l'elenco dei punti.
+void stampaProgramma(char punti){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	unsigned long tempo;
+	unsigned int giri;
+	unsigned char i;
+	char attivo;
+	
+	cli();
+	attivo = programma.attivo;
+	tempo = programma_tempo(&programma);
+	giri = programma.giri;
+	sei();
+	
+	strcpy_P(buf, PSTR("\n-> Programma: "));
+	p = formattaIntero(buf + strlen(buf), programma.n);
+	strcpy_P(p, (programma.opzioni & PROGRAMMA_LINEARE) ? PSTR(" punti, lineare") : PSTR(" punti, a gradini"));
+	p += strlen(p);
+	strcpy_P(p, (programma.opzioni & PROGRAMMA_CICLO) ? PSTR(", in ciclo") : PSTR(", una volta"));
+	risposta(buf);
 	
-	char num = 100*centinaia + 10*decine + 1*units;
+	if(attivo){
+		strcpy_P(buf, PSTR("-> In corso a "));
+		p = formattaInteroLungo(buf + strlen(buf), tempo);
+		strcpy_P(p, PSTR(" ms"));
+		if(programma.opzioni & PROGRAMMA_CICLO){
+			strcpy_P(p + strlen(p), PSTR(", giro "));
+			formattaIntero(p + strlen(p), giri + 1);
+		}
+		risposta(buf);
+	}
+	else if(programmaDaSalvare || eepromProgramma)
+	risposta_P(PSTR("-> Salvataggio in EEPROM in corso"));
 	
-	return num;
+	for(i = 0; punti && i < programma.n; i++){
+		strcpy_P(buf, PSTR("   "));
+		p = formattaInteroLungo(buf + strlen(buf), programma.punti[i].tempo);
+		strcpy_P(p, PSTR(" ms: "));
+		p = formattaDC(p + strlen(p), programma.punti[i].duty);
+		strcpy_P(p, PSTR(" %"));
+		risposta(buf);
+	}
 	
 }
 
-//Funzione per il calcolo della potenza di un numero.
-//Vengono usati i char, visto che le variabili non superano il valore 255.
-//Per questo motivo la funzione potenza, in modo che restituisca un tipo char.
-char potenza(char base, char esponente){
+//Inizializzazione del PWM software: timer 2 in modalità CTC con TOP=OCR2A, prescaler 64, periodo di 1 ms.
+//In modalità CTC OCR2B non è bufferizzato, quindi la ISR può spostarlo sul fronte successivo durante il periodo.
+void swpwm_init(void){
 	
-	char pot = 1;
+	unsigned char c;
 	
-	for (int i = 0; i < esponente; i++)
-	pot = pot * base;
+	//I pin dei canali software sono uscite, inizialmente basse.
+	for(c = 0; c < N_CANALI; c++){
+		if(canali[c].uscita != USCITA_SW)
+		continue;
+		
+		pwm_pin_basso(c);
+		switch(canali[c].porta){
+			case PORTA_B: DDRB |= (1<<canali[c].bit); break;
+			case PORTA_C: DDRC |= (1<<canali[c].bit); break;
+			default: DDRD |= (1<<canali[c].bit); break;
+		}
+	}
 	
-	return pot;
+	swpwm_ricalcola();
+	
+	OCR2A = SWPWM_PERIODO - 1;
+	TCCR2A = (1<<WGM21);
+	TCCR2B = (1<<CS22);
+	TIMSK2 = (1<<OCIE2A);
 	
 }
 
-//La seguente ISR ha il compito di gestire la modalità di inserimento.
-//Quando il pulsante, sul pin 7 del portB, viene premuto, si passa da una modalità all'altra.
-ISR(PCINT0_vect){
+//Prepara la lista dei fronti dei canali software nella tabella non attiva, ordinata per istante (insertion sort),
+//e chiede alla ISR di usarla dal periodo successivo.
+//La funzione viene chiamata dal main con gli interrupt abilitati e dalle ISR (rampa, tick del timer 2). Una chiamata che
+//interrompe il calcolo non tocca la tabella: lascia frontiDaRifare, e chi sta calcolando ricomincia con i valori nuovi.
+void swpwm_ricalcola(void){
 	
-	//Leggo lo stato del bit 7 del portB,
-	if((PINB & (1<<PINB7)) == 0){
+	struct tabellaFronti *t;
+	unsigned char c, i, istante, porta, maschera;
+	unsigned char sreg = SREG;
+	
+	cli();
+	if(frontiInCalcolo){
+		frontiDaRifare = 1;
+		SREG = sreg;
+		return;
+	}
+	frontiInCalcolo = 1;
+	
+	do{
+		frontiDaRifare = 0;
+		SREG = sreg;
 		
-		if(!inserimentoDaTerminale){ //Se il terminale è attualmente attivo
-			LedOff();
-			USART_TX_string("Ora sei passato all'inserimento tramite Selettore Esterno");
-			PresentState = SelettoreEsternoAttivo;
-		}
-		else{ //Se il selettore esterno è attualmente attivo
-			PresentState = TerminaleAttivo;
-			USART_TX_string("\nModalità di inserimento tramite Terminale avvenuta con successo");
-			LedOn();
+		//Finchè frontiPronti è a 0 la ISR non scambia le tabelle, quindi posso scrivere quella non attiva.
+		frontiPronti = 0;
+		t = &frontiSW[!frontiAttivi];
+		
+		t->accendi[PORTA_B] = t->accendi[PORTA_C] = t->accendi[PORTA_D] = 0;
+		t->n = 0;
+		
+		for(c = 0; c < N_CANALI; c++){
+			if(canali[c].uscita != USCITA_SW || canali[c].spento)
+			continue;
+			
+			//Il duty cycle in decimi di percento diventa un istante tra 0 e SWPWM_PERIODO (1000/4 = 250).
+			istante = (rampe[c].attuale + 2) >> 2;
+			if(istante == 0)
+			continue;
+			
+			porta = canali[c].porta;
+			maschera = 1<<canali[c].bit;
+			t->accendi[porta] |= maschera;
+			
+			//Al 100% il pin non torna mai basso.
+			if(istante >= SWPWM_PERIODO)
+			continue;
+			
+			//Cerco il fronte con lo stesso istante, oppure la posizione in cui inserirne uno nuovo.
+			for(i = 0; i < t->n && t->fronte[i].istante < istante; i++);
+			
+			if(i == t->n || t->fronte[i].istante != istante){
+				memmove(&t->fronte[i + 1], &t->fronte[i], (t->n - i) * sizeof(struct fronteSW));
+				t->fronte[i].istante = istante;
+				t->fronte[i].spegni[PORTA_B] = t->fronte[i].spegni[PORTA_C] = t->fronte[i].spegni[PORTA_D] = 0;
+				t->n++;
+			}
+			
+			t->fronte[i].spegni[porta] |= maschera;
 		}
 		
-		inserimentoDaTerminale = !inserimentoDaTerminale;
+		cli();
+		frontiPronti = 1;
+	}while(frontiDaRifare);
+	
+	frontiInCalcolo = 0;
+	SREG = sreg;
+	
+}
+
+//Unico punto in cui viene modificato il duty cycle di un canale, in decimi di percento.
+//Con la rampa attiva il valore diventa l'obiettivo, che la ISR di overflow raggiunge da sola alla velocità impostata.
+//Senza rampa il valore viene applicato subito. Un canale spento riparte da 0%, invece che da un gradino.
+void impostaDC(unsigned char canale, unsigned int dc){
+	
+	struct rampaPWM *r = &rampe[canale];
+	char ricalcolaSW = 0;
+	unsigned char sreg = SREG;
+	
+	cli();
+	canali[canale].duty = dc;
+	
+	//Un duty cycle impostato a mano ferma la regolazione di velocità e il programma.
+	if(canale == CANALE_PRINCIPALE){
+		regolazioneAttiva = 0;
+		programma.attivo = 0;
 	}
 	
-	hundreds[0] = !((PINB & (1<<PINB2)) == 0);
+	if(canali[canale].spento)
+	r->attuale = 0;
+	
+	if(rampaPasso == 0)
+	r->attuale = dc;
+	
+	r->partenza = r->attuale;
+	r->distanza = (dc > r->attuale) ? dc - r->attuale : r->attuale - dc;
+	r->percorso = 0;
+	r->scala = 0;
+	
+	if(r->distanza)
+	TIMSK_PWM |= (1<<TOIE_PWM);
+	
+	//Il valore di partenza viene scritto subito: serve senza rampa e quando il canale riparte da spento.
+	if(canali[canale].uscita == USCITA_SW)
+	ricalcolaSW = 1;
+	else
+	pwm_imposta_duty(canale, r->attuale);
+	SREG = sreg;
+	
+	if(ricalcolaSW)
+	swpwm_ricalcola();
+	
+}
+
+//Scrive subito il duty cycle del canale principale, senza rampa: lo usano la regolazione di velocità e il programma,
+//che lo cambiano dalla ISR del timer 2. La ISR della rampa non deve vedere duty e attuale diversi.
+//Va chiamata con gli interrupt disabilitati.
+void impostaDCDiretto(unsigned int dc){
+	
+	canali[CANALE_PRINCIPALE].duty = dc;
+	rampe[CANALE_PRINCIPALE].attuale = dc;
+	rampe[CANALE_PRINCIPALE].distanza = 0;
+	pwm_imposta_duty(CANALE_PRINCIPALE, dc);
+	
+	//0% vuol dire spento, come per "set 0": in fast PWM con il compare a 0 l'uscita si alza comunque a BOTTOM, e ad ogni
+	//periodo uscirebbe un impulso di un conteggio. L'uscita si scollega senza fermare il programma, e si ricollega
+	//(dopo il nuovo valore di compare) con il primo duty cycle diverso da 0.
+	if(dc == 0){
+		if(!canali[CANALE_PRINCIPALE].spento)
+		pwm_scollega(CANALE_PRINCIPALE);
+	}
+	else if(canali[CANALE_PRINCIPALE].spento)
+	pwm_on(CANALE_PRINCIPALE);
 	
 }
 
-//Le seguenti ISR servono per aggiornare i vettori che contengono le cifre binarie provenienti dai dip switch.
-ISR(PCINT1_vect){
+//Calcola il passo della rampa dopo un cambio di velocità o di frequenza del PWM.
+//Gli overflow arrivano alla frequenza del PWM: sopra 1 kHz la ISR ne usa uno ogni rampaDivisore, così i passi sono circa uno al ms.
+void rampa_calcola(void){
+	
+	unsigned int divisore = pwmFrequenza / 1000;
+	unsigned int passiAlSecondo;
+	unsigned long passo;
+	unsigned char sreg;
+	
+	if(divisore == 0)
+	divisore = 1;
+	
+	passiAlSecondo = pwmFrequenza / divisore;
+	if(passiAlSecondo == 0)
+	passiAlSecondo = 1;
 	
-	units[3] = !((PINC & (1<<PINC0)) == 0);
-	units[2] = !((PINC & (1<<PINC1)) == 0);
-	units[1] = !((PINC & (1<<PINC2)) == 0);
-	units[0] = !((PINC & (1<<PINC3)) == 0);
+	passo = (((unsigned long) rampaVelocita << RAMPA_FRAZ) + passiAlSecondo / 2) / passiAlSecondo;
+	
+	if(rampaVelocita && passo == 0)
+	passo = 1;
+	if(passo > ((unsigned long) DC_MAX << RAMPA_FRAZ))
+	passo = (unsigned long) DC_MAX << RAMPA_FRAZ;
+	
+	sreg = SREG;
+	cli();
+	rampaPasso = passo;
+	rampaDivisore = divisore;
+	rampaConteggio = 1;
+	SREG = sreg;
+	
+}
 
-	hundreds[0] = !((PINB & (1<<PINB2)) == 0);
+//Imposta velocità (decimi di percento al secondo, 0 = nessuna rampa) e forma della rampa.
+//Le rampe in corso proseguono con i nuovi valori; senza rampa arrivano all'obiettivo al passo successivo.
+void rampa_imposta(unsigned int velocita, unsigned char forma){
+	
+	rampaVelocita = velocita;
+	rampaForma = forma;
+	rampa_calcola();
 	
 }
 
-ISR(PCINT2_vect){
+void stampaRampa(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	if(rampaVelocita == 0){
+		risposta_P(PSTR("\n-> Rampa disattivata"));
+		return;
+	}
+	
+	strcpy_P(buf, PSTR("\n-> Rampa "));
+	p = formattaDC(buf + strlen(buf), rampaVelocita);
+	strcpy_P(p, (rampaForma == RAMPA_S) ? PSTR(" %/s (curva a S)") : PSTR(" %/s (lineare)"));
+	risposta(buf);
+	
+}
+
+//Scrive in p le cifre decimali di n e restituisce il puntatore al terminatore di stringa.
+//Sostituisce sprintf("%d"): le cifre si ottengono per sottrazioni successive, senza divisioni.
+char *formattaIntero(char *p, unsigned int n){
+	
+	static const unsigned int potenze10[] = {10000, 1000, 100, 10, 1};
+	char cifra;
+	char cifreScritte = 0;
+	
+	for(unsigned char i = 0; i < 5; i++){
+		
+		cifra = '0';
+		while(n >= potenze10[i]){
+			n -= potenze10[i];
+			cifra++;
+		}
+		
+		//Salto gli zeri iniziali, tranne l'ultima cifra (per scrivere "0").
+		if(cifra != '0' || cifreScritte || i == 4){
+			*p++ = cifra;
+			cifreScritte = 1;
+		}
+	}
+	
+	*p = '\0';
+	
+	return p;
+	
+}
+
+//Come formattaIntero, ma per valori a 32 bit (es. il baud rate): le cifre oltre le ultime quattro
+//vengono scritte ricorsivamente, le ultime quattro sempre, con gli zeri.
+char *formattaInteroLungo(char *p, unsigned long n){
+	
+	unsigned int resto;
+	
+	if(n < 10000)
+	return formattaIntero(p, n);
+	
+	p = formattaInteroLungo(p, n / 10000);
+	resto = n % 10000;
+	
+	for(unsigned int potenza10 = 1000; potenza10 > 0; potenza10 /= 10){
+		
+		*p = '0';
+		while(resto >= potenza10){
+			resto -= potenza10;
+			(*p)++;
+		}
+		p++;
+	}
+	
+	*p = '\0';
+	
+	return p;
+	
+}
+
+//Scrive in p il duty cycle in percentuale a partire dai decimi di percento (es. 505 -> "50.5", 500 -> "50").
+//Restituisce il puntatore al terminatore di stringa.
+char *formattaDC(char *p, unsigned int dc){
+	
+	char decimi;
+	
+	//Sotto l'1% serve lo zero davanti alla virgola.
+	if(dc < 10)
+	*p++ = '0';
+	
+	p = formattaIntero(p, dc);
+	
+	//L'ultima cifra scritta sono i decimi: la stampo dopo il punto solo se non è zero.
+	decimi = *--p;
+	if(decimi != '0'){
+		*p++ = '.';
+		*p++ = decimi;
+	}
+	
+	*p = '\0';
+	
+	return p;
+	
+}
+
+//Legge un numero decimale senza segno, già decodificato dal parser dei comandi.
+//Restituisce 0 se la parola non è un numero intero senza segno o se il numero supera 65535.
+char leggiNumero(struct argomento *a, unsigned int *n){
+	
+	unsigned long valore;
+	
+	if(!leggiNumeroLungo(a, &valore) || valore > 65535UL)
+	return 0;
+	
+	*n = valore;
+	
+	return 1;
+	
+}
+
+//Come leggiNumero, per valori a 32 bit (es. il baud rate). Si accettano al più 9 cifre.
+char leggiNumeroLungo(struct argomento *a, unsigned long *n){
+	
+	if(a->tipo != ARG_NUMERO || a->segno || a->punto || a->cifre == 0 || a->cifre > COMANDI_MAX_CIFRE)
+	return 0;
+	
+	*n = a->valore;
+	
+	return 1;
+	
+}
+
+//Legge un duty cycle in percentuale, con al più una cifra decimale (es. "50" oppure "50.5"),
+//e lo restituisce in decimi di percento. Restituisce 0 se la parola non è un numero valido.
+char leggiDC(struct argomento *a, unsigned int *dc){
+	
+	if(a->tipo != ARG_NUMERO || a->segno || a->cifre > 5)
+	return 0;
+	
+	//Con il punto serve esattamente una cifra decimale ("50." e "50.25" non sono ammessi), senza serve almeno una cifra.
+	if(a->punto ? a->decimali != 1 : a->cifre == 0)
+	return 0;
+	
+	if(a->valore * 10 + a->decimo > 65535UL)
+	return 0;
+	
+	*dc = a->valore * 10 + a->decimo;
+	
+	return 1;
+	
+}
+
+//Legge il numero di un canale. Restituisce 0 se non è un numero o se il canale non esiste.
+char leggiCanale(struct argomento *a, unsigned char *canale){
+	
+	unsigned int numero;
+	
+	if(!leggiNumero(a, &numero) || numero >= N_CANALI)
+	return 0;
+	
+	*canale = numero;
+	
+	return 1;
+	
+}
+
+//Messaggio di risposta a un comando: in modalità macchina non viene stampato.
+void risposta(char *messaggio){
+	
+	if(!modoMacchina)
+	USART_TX_string(messaggio);
+	
+}
+
+//Come risposta, per i messaggi in memoria flash.
+void risposta_P(const char *messaggio){
+	
+	if(!modoMacchina)
+	USART_TX_string_P(messaggio);
+	
+}
+
+//Comando "up": aumenta di 1% il duty cycle del canale. Un canale spento riparte dall'1%.
+//Sul canale principale il valore di partenza è l'ultimo setpoint remoto, anche quando comandano i dip switch.
+void aumentaDC(unsigned char canale){
+	
+	unsigned int dc = remoto_duty(canale);
+	
+	if((dc + PASSO_DC) > DC_MAX)//Se inserendo "up", supereri 100% di duty cycle, stampo un messaggio di avviso.
+	risposta_P(PSTR("\n-> Duty Cycle massimo raggiunto"));
+	
+	else if(remoto_imposta(canale, dc + PASSO_DC))
+	stampaDC(PSTR("\n-> Duty Cycle aumentato a "), canale); //Stampo il valore aggiornato di duty cycle.
+	
+	else
+	stampaRemoto();
+	
+}
+
+//Comando "down": diminuisce di 1% il duty cycle del canale, fino allo spegnimento.
+void diminuisciDC(unsigned char canale){
+	
+	unsigned int dc = remoto_duty(canale);
+	
+	dc = (dc <= PASSO_DC) ? 0 : dc - PASSO_DC; //Sotto l'1% spengo il motore.
+	
+	if(!remoto_imposta(canale, dc))
+	stampaRemoto();
+	
+	else if(dc == 0)
+	risposta_P(PSTR("\n-> Motore Spento !"));
+	
+	else
+	stampaDC(PSTR("\n-> Duty Cycle decrementato a "), canale);
+	
+}
+
+//Porta il canale al duty cycle indicato, riaccendendolo o spegnendolo se serve.
+void impostaCanale(unsigned char canale, unsigned int dc){
+	
+	if(dc == 0){
+		pwm_off(canale);
+		return;
+	}
+	
+	impostaDC(canale, dc);
+	
+	if(canali[canale].spento)
+	pwm_on(canale);
+	
+}
+
+//Setpoint remoto: terminale, protocollo binario e Modbus passano da qui. Gli altri canali lo applicano sempre;
+//sul canale principale lo riceve l'arbitro, e il canale cambia solo se comanda il remoto. Restituisce 1 se il valore
+//è stato applicato, 0 se è stato solo memorizzato per quando il remoto tornerà ad avere la priorità.
+//L'arbitro e il canale cambiano con gli interrupt disabilitati: la ISR del timer 2 non può applicare il valore locale nel mezzo.
+char remoto_imposta(unsigned char canale, unsigned int dc){
+	
+	unsigned char sreg = SREG;
+	char applica;
+	
+	if(canale != CANALE_PRINCIPALE){
+		impostaCanale(canale, dc);
+		return 1;
+	}
+	
+	cli();
+	applica = arbitro_remoto(&arbitro, dc, millisecondi);
+	if(applica)
+	impostaCanale(CANALE_PRINCIPALE, dc);
+	SREG = sreg;
+	
+	return applica;
+	
+}
+
+//Duty cycle da cui partono "up", "down" e "step" (0 se il canale è spento). Sul canale principale, quando comandano
+//i dip switch, è l'ultimo setpoint remoto: i comandi continuano a spostare il valore del remoto, non quello locale.
+unsigned int remoto_duty(unsigned char canale){
+	
+	unsigned int dc;
+	unsigned char sreg = SREG;
+	
+	cli();
+	if(canale == CANALE_PRINCIPALE && arbitro.sorgente == ARBITRO_LOCALE)
+	dc = arbitro.remoto.duty;
+	else
+	dc = canali[canale].spento ? 0 : canali[canale].duty;
+	SREG = sreg;
+	
+	return dc;
+	
+}
+
+//Risposta a un setpoint remoto memorizzato ma non applicato, perchè il canale principale lo comandano i dip switch.
+void stampaRemoto(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	strcpy_P(buf, PSTR("\n-> Remoto a "));
+	p = formattaDC(buf + strlen(buf), arbitro.remoto.duty);
+	strcpy_P(p, PSTR(" %: comandano i Dip Switch"));
+	risposta(buf);
+	
+}
+
+//Comandi "set" e "step": imposta il duty cycle del canale e stampa il risultato.
+void applicaDC(unsigned char canale, unsigned int dc){
+	
+	if(!remoto_imposta(canale, dc))
+	stampaRemoto();
+	
+	else if(dc == 0)
+	risposta_P(PSTR("\n-> Motore Spento !"));
+	
+	else
+	stampaDC(PSTR("\n-> Duty Cycle impostato a "), canale);
+	
+}
+
+//Stampa la frequenza e la modalità attuali del PWM.
+void stampaFrequenza(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	strcpy_P(buf, PSTR("\n-> Frequenza PWM "));
+	p = formattaIntero(buf + strlen(buf), pwmFrequenza);
+	strcpy_P(p, (pwmModo == PWM_FAST) ? PSTR(" Hz (fast PWM)") : PSTR(" Hz (phase correct)"));
+	risposta(buf);
+	
+}
+
+//Stampa il messaggio (in memoria flash) seguito dal baud rate.
+void stampaBaud(const char *msg, unsigned long baud){
+	
+	char buf[MAX_STR_LEN + 1];
+	
+	strcpy_P(buf, msg);
+	formattaInteroLungo(buf + strlen(buf), baud);
+	risposta(buf);
+	
+}
+
+//Conferma del passaggio a Modbus RTU, con l'indirizzo che verrà usato.
+void stampaModbus(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	
+	strcpy_P(buf, PSTR("\n-> Modbus RTU attivo, indirizzo "));
+	formattaIntero(buf + strlen(buf), modbusRichiesto);
+	risposta(buf);
+	
+}
+
+//Esegue un singolo comando da terminale, già decodificato dal parser dei comandi:
+//"up [canale]", "down [canale]", "set <dc> [canale]", "step <+/-dc> [canale]",
+//"freq <Hz>", "modo fast", "modo pc", "rampa <%/s> [lin|s]", "rpm [n]", "macchina 1", "macchina 0", "baud <n>", "baud auto",
+//"priorita [locale|remoto]", "priorita timeout <ms>".
+//Il duty cycle si scrive in percentuale, con al più un decimale (es. "set 50.5", "step -2").
+unsigned char eseguiComando(struct comandoTestuale *c){
+	
+	struct argomento *parole = c->parole;
+	unsigned char n = c->n;
+	unsigned char canale = CANALE_PRINCIPALE;
+	unsigned int valore;
+	unsigned int dc;
+	unsigned long baud;
+	unsigned int ubrr;
+	char u2x;
+	unsigned char forma;
+	char segno;
+	unsigned long tempo;
+	unsigned char parola;
+	
+	if(n == 0 || n > COMANDI_MAX_PAROLE)
+	return ComandoNonRiconosciuto;
+	
+	//La prima parola è già stata cercata nel trie: basta il suo token.
+	switch(comandi_parola(&parole[0])){
+		
+		case PAROLA_UP:
+		case PAROLA_DOWN:
+		if(n == 3 || (n == 2 && !leggiCanale(&parole[1], &canale)))
+		return ValoreNonAmmesso;
+		
+		if(parole[0].parola == PAROLA_UP)
+		aumentaDC(canale);
+		else
+		diminuisciDC(canale);
+		break;
+		
+		case PAROLA_SET:
+		if(n == 1 || !leggiDC(&parole[1], &dc) || dc > DC_MAX || (n == 3 && !leggiCanale(&parole[2], &canale)))
+		return ValoreNonAmmesso;
+		
+		applicaDC(canale, dc);
+		break;
+		
+		case PAROLA_STEP:
+		//Il segno viene tolto prima di leggere il duty cycle, che da solo non lo ammette.
+		segno = (n > 1) ? parole[1].segno : 0;
+		if(n > 1)
+		parole[1].segno = 0;
+		
+		if(n == 1 || !leggiDC(&parole[1], &valore) || (n == 3 && !leggiCanale(&parole[2], &canale)))
+		return ValoreNonAmmesso;
+		
+		//Il risultato viene limitato tra 0% e 100%. Un canale spento parte da 0%.
+		dc = remoto_duty(canale);
+		
+		if(segno == '-')
+		dc = (valore >= dc) ? 0 : dc - valore;
+		else
+		dc = (valore >= DC_MAX - dc) ? DC_MAX : dc + valore;
+		
+		applicaDC(canale, dc);
+		break;
+		
+		case PAROLA_FREQ:
+		if(n != 2 || !leggiNumero(&parole[1], &valore) || !pwm_imposta_frequenza(valore))
+		return ValoreNonAmmesso;
+		
+		stampaFrequenza();
+		break;
+		
+		case PAROLA_MODO:
+		if(n != 2)
+		return ComandoNonRiconosciuto;
+		
+		if(comandi_parola(&parole[1]) == PAROLA_FAST)
+		pwm_imposta_modo(PWM_FAST);
+		else if(comandi_parola(&parole[1]) == PAROLA_PC)
+		pwm_imposta_modo(PWM_PHASE_CORRECT);
+		else
+		return ValoreNonAmmesso;
+		
+		stampaFrequenza();
+		break;
+		
+		case PAROLA_RAMPA:
+		//"rampa <%/s> [lin|s]": velocità in percento al secondo, con al più un decimale. Con 0 la rampa è disattivata.
+		forma = rampaForma;
+		
+		if(n == 1 || !leggiDC(&parole[1], &valore))
+		return ValoreNonAmmesso;
+		
+		if(n == 3){
+			if(comandi_parola(&parole[2]) == PAROLA_LIN)
+			forma = RAMPA_LINEARE;
+			else if(comandi_parola(&parole[2]) == PAROLA_S)
+			forma = RAMPA_S;
+			else
+			return ValoreNonAmmesso;
+		}
+		
+		rampa_imposta(valore, forma);
+		stampaRampa();
+		break;
+		
+		case PAROLA_RPM:
+		//"rpm" stampa la velocità misurata, "rpm <n>" regola il canale principale a n giri al minuto, "rpm 0" ferma il motore.
+		//Mentre comandano i dip switch la regolazione non parte, e "rpm 0" diventa un setpoint remoto a 0%.
+#if PWM_TIMER == 0
+		if(n == 3 || (n == 2 && (!leggiNumero(&parole[1], &valore) || valore > RPM_MAX)))
+		return ValoreNonAmmesso;
+		
+		if(n == 2 && valore == 0)
+		applicaDC(CANALE_PRINCIPALE, 0);
+		else{
+			if(n == 2 && !regolazione_avvia(valore))
+			return ValoreNonAmmesso;
+			stampaRpm();
+		}
+		break;
+#else
+		return ValoreNonAmmesso;
+#endif
+		
+		case PAROLA_BAUD:
+		if(n != 2)
+		return ComandoNonRiconosciuto;
+		
+		//Il cambio viene applicato da gestisciCambioBaud(), dopo che la risposta è uscita alla velocità vecchia.
+		if(comandi_parola(&parole[1]) == PAROLA_AUTO){
+#if PWM_TIMER == 0
+			cambioBaud = BaudAutomatico;
+			risposta_P(PSTR("\n-> Autobaud: invia 'U' alla nuova velocità"));
+#else
+			return ValoreNonAmmesso;
+#endif
+		}
+		else{
+			if(!leggiNumeroLungo(&parole[1], &baud) || baud > BAUD_MAX || !USART_calcola_baud(baud, &ubrr, &u2x))
+			return ValoreNonAmmesso;
+			
+			baudRichiesto = baud;
+			cambioBaud = BaudNuovo;
+			stampaBaud(PSTR("\n-> Baud rate impostato a "), baud);
+		}
+		break;
+		
+		case PAROLA_TELEMETRIA:
+		//"telemetria <Hz>" avvia l'invio periodico dei frame binari di telemetria, "telemetria 0" lo ferma.
+		if(n == 3 || (n == 2 && (!leggiNumero(&parole[1], &valore) || !telemetria_imposta(valore))))
+		return ValoreNonAmmesso;
+		
+		stampaTelemetria();
+		break;
+		
+		case PAROLA_STATS:
+		//"stats" stampa gli errori di ricezione e il profilo delle ISR e degli stati, "stats 0" li azzera.
+		if(n == 3 || (n == 2 && (!leggiNumero(&parole[1], &valore) || valore != 0 || parole[1].cifre != 1)))
+		return ValoreNonAmmesso;
+		
+		if(n == 2){
+			azzeraStatistiche();
+			risposta_P(PSTR("\n-> Statistiche azzerate"));
+		}
+		else
+		stampaStatistiche();
+		break;
+		
+		case PAROLA_MODBUS:
+		//"modbus <indirizzo>" passa al protocollo Modbus RTU dopo la risposta. Si torna ai comandi testuali scrivendo 0
+		//nell'holding register dell'indirizzo, oppure accendendo la scheda con il pulsante premuto.
+#if PWM_TIMER == 0
+		if(n != 2 || !leggiNumero(&parole[1], &valore) || valore == 0 || valore > MODBUS_INDIRIZZO_MAX)
+		return ValoreNonAmmesso;
+		
+		modbusRichiesto = valore;
+		cambioBaud = BaudModbus;
+		stampaModbus();
+		break;
+#else
+		return ValoreNonAmmesso;
+#endif
+		
+		case PAROLA_CORRENTE:
+		//"corrente" stampa la corrente del motore, "corrente <mA>" cambia la soglia della protezione, "corrente reset" toglie il guasto.
+		//Dopo il riarmo il canale principale resta spento finchè il duty cycle non viene impostato di nuovo.
+		if(n == 2 && comandi_parola(&parole[1]) == PAROLA_RESET){
+			cli();
+			corrente_riarma(&corrente);
+			sei();
+			risposta_P(PSTR("\n-> Protezione riarmata: imposta di nuovo il Duty Cycle"));
+			break;
+		}
+		
+		if(n == 3 || (n == 2 && (!leggiNumero(&parole[1], &valore) || valore == 0 || valore >= CORRENTE_FONDO_SCALA_MA)))
+		return ValoreNonAmmesso;
+		
+		if(n == 2)
+		corrente.soglia = corrente_conteggi(valore, CORRENTE_FONDO_SCALA_MA);
+		stampaCorrente();
+		break;
+		
+		case PAROLA_PROGRAMMA:
+		//"programma" stampa il programma del canale principale, "programma <ms> <duty>" aggiunge un punto in fondo,
+		//"programma avvia|stop" lo riproduce e lo ferma, "programma lin|gradini" e "programma ciclo <0|1>" scelgono
+		//interpolazione e ripetizione, "programma salva" lo salva in EEPROM e "programma reset" lo cancella.
+		if(n == 1){
+			stampaProgramma(1);
+			break;
+		}
+		
+		//Durante il salvataggio la ISR della EEPROM legge punti e opzioni: si può solo avviare e fermare.
+		parola = comandi_parola(&parole[1]);
+		if(parola != PAROLA_AVVIA && parola != PAROLA_STOP && (programmaDaSalvare || eepromProgramma))
+		return ValoreNonAmmesso;
+		
+		if(n == 3 && parola == PAROLA_CICLO){
+			if(!leggiNumero(&parole[2], &valore) || valore > 1)
+			return ValoreNonAmmesso;
+			
+			if(valore)
+			programma.opzioni |= PROGRAMMA_CICLO;
+			else
+			programma.opzioni &= ~PROGRAMMA_CICLO;
+		}
+		else if(n == 3){
+			//I punti si aggiungono solo a programma fermo: la ISR del timer 2 li sta leggendo.
+			if(programma.attivo || !leggiNumeroLungo(&parole[1], &tempo) || !leggiDC(&parole[2], &dc) || dc > DC_MAX
+			|| !programma_aggiungi(&programma, tempo, dc))
+			return ValoreNonAmmesso;
+		}
+		else switch(parola){
+			
+			case PAROLA_AVVIA:
+			if(!programma_esegui())
+			return ValoreNonAmmesso;
+			break;
+			
+			case PAROLA_STOP:
+			programma.attivo = 0;
+			break;
+			
+			case PAROLA_LIN:
+			programma.opzioni |= PROGRAMMA_LINEARE;
+			break;
+			
+			case PAROLA_GRADINI:
+			programma.opzioni &= ~PROGRAMMA_LINEARE;
+			break;
+			
+			case PAROLA_SALVA:
+			programmaDaSalvare = 1;
+			break;
+			
+			case PAROLA_RESET:
+			cli();
+			programma_reset(&programma);
+			sei();
+			break;
+			
+			default:
+			return ValoreNonAmmesso;
+		}
+		
+		stampaProgramma(0);
+		break;
+		
+		case PAROLA_PRIORITA:
+		//"priorita" stampa le sorgenti del duty cycle, "priorita locale|remoto" sposta la priorità come il pulsante
+		//(non con l'interruttore), "priorita timeout <ms>" cambia il timeout del remoto (0 = disattivato).
+		if(n == 3){
+			if(comandi_parola(&parole[1]) != PAROLA_TIMEOUT || !leggiNumero(&parole[2], &valore) || valore > ARBITRO_TIMEOUT_MAX)
+			return ValoreNonAmmesso;
+			
+			cli();
+			arbitro_timeout(&arbitro, valore);
+			sei();
+		}
+		else if(n == 2){
+			parola = comandi_parola(&parole[1]);
+			if(PRIORITA_INTERRUTTORE || (parola != PAROLA_LOCALE && parola != PAROLA_REMOTO))
+			return ValoreNonAmmesso;
+			
+			//Il passo dell'arbitro si fa subito, così la risposta (e "OK" in modalità macchina) riporta già il nuovo valore.
+			//Se la priorità cambia, i messaggi sono quelli del pulsante; altrimenti si stampa lo stato.
+			if(arbitro.prioritaLocale != (parola == PAROLA_LOCALE)){
+				cli();
+				arbitro.prioritaLocale = (parola == PAROLA_LOCALE);
+				sorgenti_passo();
+				sei();
+				gestisciSorgenti();
+				break;
+			}
+		}
+		
+		stampaPriorita();
+		break;
+		
+		case PAROLA_MACCHINA:
+		if(n != 2)
+		return ComandoNonRiconosciuto;
+		
+		//Si accettano solo "1" e "0", con una cifra.
+		if(!leggiNumero(&parole[1], &valore) || valore > 1 || parole[1].cifre != 1)
+		return ValoreNonAmmesso;
+		
+		modoMacchina = valore;
+		break;
+		
+		default:
+		return ComandoNonRiconosciuto;
+	}
+	
+	canaleRisposta = canale;
+	
+	return ComandoEseguito;
+	
+}
+
+//Esegue un comando della riga in corso (i comandi di una riga sono separati da ';', es. "set 30; set 50 2; up 3").
+//Il parser restituisce i comandi uno alla volta: l'ultimo della riga ha fineRiga a 1, e può essere vuoto (es. riga vuota o ';' finale).
+//In modalità macchina, alla fine della riga si risponde con una sola riga: "OK <duty>" con il duty cycle dell'ultimo canale comandato,
+//oppure "ERR <n>" con la posizione (da 1) del primo comando non eseguito.
+void eseguiComandoRiga(struct comandoTestuale *c){
+	
+	char buf[MAX_STR_LEN + 1];
+	unsigned char esito;
+	
+	if(c->n != 0){
+		comandiRiga++;
+		esito = eseguiComando(c);
+		
+		if(esito != ComandoEseguito){
+			if(!primoErroreRiga)
+			primoErroreRiga = comandiRiga;
+			
+			risposta_P(esito == ValoreNonAmmesso ? PSTR("\n-> Valore non ammesso") : PSTR("\n-> Comando non riconosciuto"));
+		}
+	}
+	
+	if(!c->fineRiga)
+	return;
+	
+	if(modoMacchina){
+		if(primoErroreRiga){
+			strcpy_P(buf, PSTR("ERR "));
+			formattaIntero(buf + 4, primoErroreRiga);
+		}
+		else{
+			strcpy_P(buf, PSTR("OK "));
+			formattaDC(buf + 3, canali[canaleRisposta].spento ? 0 : canali[canaleRisposta].duty);
+		}
+		USART_TX_string(buf);
+	}
+	
+	//La prossima riga riparte dal canale principale.
+	canaleRisposta = CANALE_PRINCIPALE;
+	comandiRiga = 0;
+	primoErroreRiga = 0;
+	
+}
+
+//Stampa il messaggio (in memoria flash) seguito dal duty cycle attuale del canale in percentuale (es. "-> Duty Cycle impostato a 50 %").
+//Per i canali diversi dal principale viene aggiunto il numero del canale.
+void stampaDC(const char *messaggio, unsigned char canale){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	if(modoMacchina)
+	return;
+	
+	strcpy_P(buf, messaggio);
+	
+	p = formattaDC(buf + strlen(buf), canali[canale].duty);
+	*p++ = ' ';
+	*p++ = '%';
+	*p = '\0';
+	
+	if(canale != CANALE_PRINCIPALE){
+		strcpy_P(p, PSTR(" (canale "));
+		p = formattaIntero(p + strlen(p), canale);
+		*p++ = ')';
+		*p = '\0';
+	}
+	
+	//Dopo un comando che accende il canale, resta spento solo il canale principale con il guasto di sovracorrente (pwm_on()).
+	if(canali[canale].spento)
+	strcpy_P(p, PSTR(" (sovracorrente)"));
+	
+	USART_TX_string(buf);
+	
+}
+
+//Devo inizializzare la periferica USART.
+//Scelgo per il frame il formato 8N1 (8E1 in modalità Modbus RTU).
+void USART_init(void){
+	
+	//Imposto per prima cosa il baud rate.
+	USART_imposta_baud(baudRate);
+	
+	//Svuoto i buffer circolari.
+	txTesta = txCoda = 0;
+	rxTesta = rxCoda = 0;
+	comandi_reset(&parserTesto);
+	comandoPronto = 0;
+	
+	//Ora attivo le periferiche di TX e RX, insieme all'interrupt di ricezione.
+	//La ricezione resta sempre attiva: i caratteri inviati dall'host mentre il main è occupato
+	//vengono conservati nel buffer circolare invece di andare persi.
+	//L'interrupt di registro dati vuoto (UDRIE0) viene abilitato solo quando c'è qualcosa da trasmettere.
+	UCSR0B = (1<<TXEN0)|(1<<RXEN0)|(1<<RXCIE0);
+	
+	USART_imposta_formato();
+	
+	//Ci sarebbero anche altri bit da configurare, ma sono '0'.
+	
+}
+
+//Imposto la modalità asincrona con 8 bit di dati, nessuna parità, 1 bit di stop.
+//In modalità Modbus RTU, con MODBUS_PARITA a 1, si aggiunge la parità pari.
+void USART_imposta_formato(void){
+	
+	if(modbusIndirizzo && MODBUS_PARITA)
+	UCSR0C = (1<<UPM01)|(1<<UCSZ01)|(1<<UCSZ00);
+	else
+	UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
+	
+}
+
+//Calcola UBRR0 per il baud rate richiesto, sia in velocità normale (16 campioni per bit) sia con U2X0 (8 campioni per bit).
+//U2X0 viene scelto solo se l'errore è minore: a parità di errore la velocità normale tollera meglio i disturbi in ricezione.
+//Restituisce 0 se nessuna delle due soluzioni ha un errore entro BAUD_ERRORE_MAX.
+//Con F_CPU a 16 MHz: 9600 -> UBRR0 = 103 (0.2%), 115200 -> UBRR0 = 16 con U2X0 (2.1%), 1000000 -> UBRR0 = 0 (0%).
+char USART_calcola_baud(unsigned long baud, unsigned int *ubrr, char *u2x){
+	
+	unsigned long divisore;
+	unsigned long valore;
+	unsigned long reale;
+	unsigned long errore;
+	unsigned long erroreMinimo = 0xFFFFFFFFUL;
+	
+	if(baud == 0)
+	return 0;
+	
+	for(char doppia = 0; doppia < 2; doppia++){
+		
+		divisore = (doppia ? 8 : 16) * baud;
+		
+		//Divisione arrotondata: valore = UBRR0 + 1.
+		valore = (F_CPU + divisore / 2) / divisore;
+		if(valore == 0 || valore > 4096)
+		continue;
+		
+		reale = F_CPU / (valore * (doppia ? 8 : 16));
+		errore = (reale > baud ? reale - baud : baud - reale) * 1000 / baud;
+		
+		if(errore < erroreMinimo){
+			erroreMinimo = errore;
+			*ubrr = valore - 1;
+			*u2x = doppia;
+		}
+	}
+	
+	return erroreMinimo <= BAUD_ERRORE_MAX;
+	
+}
+
+//Imposta il baud rate della USART. Restituisce 0, senza cambiare nulla, se il baud rate non si può ottenere.
+char USART_imposta_baud(unsigned long baud){
+	
+	unsigned int ubrr;
+	char u2x;
+	unsigned char sreg;
+	
+	if(!USART_calcola_baud(baud, &ubrr, &u2x))
+	return 0;
+	
+	//Scrivendo 0 su TXC0 il flag non viene toccato.
+	UCSR0A = u2x ? (1<<U2X0) : 0;
+	UBRR0 = ubrr;
+	baudRate = baud;
+	
+	//Silenzio che chiude un frame Modbus: 3.5 caratteri da 11 bit, cioè 38.5 bit, in conteggi da 0.5 us.
+	//Da 1200 baud in giù non sta in 16 bit e si ferma a 32 ms.
+	sreg = SREG;
+	cli();
+	modbusT35 = (77000000UL / baud > 0xFFFF) ? 0xFFFF : 77000000UL / baud;
+	SREG = sreg;
+	
+	return 1;
+	
+}
+
+//Applica il cambio di baud rate richiesto quando il buffer di trasmissione è vuoto e l'ultimo byte è uscito dal pin:
+//TXC0 viene azzerato dalla ISR(USART_UDRE_vect) quando scrive l'ultimo byte del buffer, quindi torna a '1'
+//solo quando anche lo shift register ha finito.
+void gestisciCambioBaud(void){
+	
+	if(cambioBaud == BaudInvariato || txTesta != txCoda || !(UCSR0A & (1<<TXC0)))
+	return;
+	
+	if(cambioBaud == BaudNuovo)
+	USART_imposta_baud(baudRichiesto);
+	else if(cambioBaud == BaudModbus)
+	modbus_imposta(modbusRichiesto);
+#if PWM_TIMER == 0
+	else
+	autobaud_avvia();
+#endif
+	
+	cambioBaud = BaudInvariato;
+	
+}
+
+//Inserisce un carattere nel buffer di trasmissione senza bloccare.
+//Restituisce 1 se il carattere è stato accodato, 0 se il buffer è pieno.
+char USART_TX_char(char c){
+	
+	unsigned char prossima;
+	unsigned char sreg = SREG;
+	
+	//La ISR del timer 2 può accodare un frame di telemetria: non deve trovare txTesta a metà aggiornamento.
+	cli();
+	prossima = (txTesta + 1) & (USART_TX_BUF - 1);
+	
+	if(prossima == txCoda){
+		SREG = sreg;
+		return 0;
+	}
+	
+	txBuf[txTesta] = c;
+	txTesta = prossima;
+	
+	//Abilito l'interrupt di registro dati vuoto: sarà la ISR a trasmettere il carattere.
+	UCSR0B |= (1<<UDRIE0);
+	SREG = sreg;
+	
+	return 1;
+	
+}
+
+//Trasmette direttamente un carattere del buffer, aspettando che il registro di trasmissione sia libero.
+//Serve solo quando il buffer è pieno e gli interrupt sono disabilitati (ad esempio se si trasmette da una ISR):
+//in quel caso la ISR(USART_UDRE_vect) non può svuotare il buffer al posto nostro.
+void USART_TX_svuota(void){
+	
+	while (!(UCSR0A & (1<<UDRE0)))
+	hal_aggiorna();
+	
+	hal_usart_scrivi(txBuf[txCoda]);
+	txCoda = (txCoda + 1) & (USART_TX_BUF - 1);
+	
+}
+
+//Aspetta che nel buffer di trasmissione si liberi un posto. Con gli interrupt abilitati la CPU dorme finchè la ISR
+//di trasmissione non preleva un carattere, invece di ricontrollare il buffer di continuo.
+void USART_TX_attendi(void){
+	
+	if(!(SREG & (1<<SREG_I)))
+	USART_TX_svuota();
+	
+	else{
+		cli();
+		if(((txTesta + 1) & (USART_TX_BUF - 1)) == txCoda)
+		dormi();
+		sei();
+	}
+	
+	hal_aggiorna();
+	
+}
+
+//Le seguenti funzioni USART_TX_string e USART_RX_comando permettono di trasmettere e ricevere caratteri attraverso RS-EIA-232.
+//La stringa viene accodata nel buffer di trasmissione, seguita dal "line feed (LF)".
+//Si aspetta solo se il buffer è pieno, cioè quando il messaggio è più lungo dello spazio libero.
+void USART_TX_string(char *strPtr){
+	
+	//In modalità Modbus RTU sul bus passano solo i frame Modbus: i messaggi testuali vengono scartati.
+	if(modbusIndirizzo)
+	return;
+	
+	txRigaInCorso = 1;
+	
+	//Accodo un carattere alla volta, fino al terminatore di stringa.
+	while(*strPtr != '\0'){
+		
+		while(!USART_TX_char(*strPtr))
+		USART_TX_attendi();
+		
+		strPtr++;
+	}
+	
+	//Inserisco il ritorno a capo.
+	while(!USART_TX_char('\n'))
+	USART_TX_attendi();
+	
+	txRigaInCorso = 0;
+	
+}
+
+//Come USART_TX_string, ma la stringa si trova in memoria flash (PSTR o PROGMEM) e viene letta un byte alla volta:
+//i messaggi fissi non occupano SRAM e non vengono copiati dalla flash all'avvio.
+void USART_TX_string_P(const char *strPtr){
+	
+	char c;
+	
+	if(modbusIndirizzo)
+	return;
+	
+	txRigaInCorso = 1;
+	
+	while((c = pgm_read_byte(strPtr)) != '\0'){
+		
+		while(!USART_TX_char(c))
+		USART_TX_attendi();
+		
+		strPtr++;
+	}
+	
+	while(!USART_TX_char('\n'))
+	USART_TX_attendi();
+	
+	txRigaInCorso = 0;
+	
+}
+
+//Preleva un carattere dal buffer di ricezione senza bloccare.
+//Restituisce 1 se è stato letto un carattere, 0 se il buffer è vuoto.
+char USART_RX_char(char *c){
+	
+	if(rxCoda == rxTesta)
+	return 0;
+	
+	*c = rxBuf[rxCoda];
+	rxCoda = (rxCoda + 1) & (USART_RX_BUF - 1);
+	
+	return 1;
+	
+}
+
+//Accoda una sequenza di byte (ad esempio un frame binario), aspettando se il buffer è pieno.
+void USART_TX_bytes(unsigned char *buf, unsigned char n){
+	
+	txRigaInCorso = 1;
+	
+	while(n--){
+		while(!USART_TX_char(*buf))
+		USART_TX_attendi();
+		buf++;
+	}
+	
+	txRigaInCorso = 0;
+	
+}
+
+//Legge i millisecondi dall'accensione. La variabile è a 16 bit, quindi la lettura avviene con gli interrupt disabilitati.
+unsigned int leggiMillisecondi(void){
+	
+	unsigned int ms;
+	unsigned char sreg = SREG;
+	
+	cli();
+	ms = millisecondi;
+	SREG = sreg;
+	
+	return ms;
+	
+}
+
+//Indica se il main ha del lavoro da fare subito: eventi delle ISR, byte ricevuti, un comando o un frame Modbus non ancora eseguito
+//o un cambio di baud rate che aspetta la fine della trasmissione (il bit TXC0 non genera un interrupt, quindi va controllato).
+//Tutto il resto (timeout dei frame, autobaud) dipende dal tempo e viene ricontrollato al risveglio del millisecondo successivo.
+char lavoroInSospeso(void){
+	
+	return eventiTesta != eventiCoda || rxTesta != rxCoda || comandoPronto || modbusSilenzio || cambioBaud != BaudInvariato;
+	
+}
+
+//Mette la CPU in IDLE fino al prossimo interrupt e misura il tempo passato a lavorare e a dormire.
+//Va chiamata con gli interrupt disabilitati, dopo aver controllato che non ci sia lavoro: l'istruzione che segue sei()
+//viene sempre eseguita prima di un interrupt, quindi un interrupt arrivato dopo il controllo sveglia subito la CPU.
+//Esce con gli interrupt disabilitati.
+void dormi(void){
+	
+	tempoAttivo += tempoTrascorso();
+	
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	
+	cli();
+	tempoSonno += tempoTrascorso();
+	
+	//Prima che le somme trabocchino (dopo circa 2 ore) le dimezzo entrambe: il rapporto non cambia.
+	if(tempoAttivo + tempoSonno > 0x7FFFFFFFUL){
+		tempoAttivo >>= 1;
+		tempoSonno >>= 1;
+	}
+	
+}
+
+//Conteggi del timer 2 (4 us) passati dall'ultima chiamata. Va chiamata con gli interrupt disabilitati.
+//Se il compare del timer 2 è scattato ma la ISR non è ancora stata eseguita, TCNT2 è già ripartito da 0
+//mentre millisecondi non è ancora stato incrementato: in quel caso il millisecondo va aggiunto a mano.
+unsigned long tempoTrascorso(void){
+	
+	unsigned int ms = millisecondi;
+	unsigned char conteggio = TCNT2;
+	unsigned long trascorso;
+	
+	if(TIFR2 & (1<<OCF2A)){
+		conteggio = TCNT2;
+		ms++;
+	}
+	
+	trascorso = (unsigned long)(unsigned int)(ms - ultimoTempoMs) * SWPWM_PERIODO + conteggio - ultimoTempoConteggio;
+	ultimoTempoMs = ms;
+	ultimoTempoConteggio = conteggio;
+	
+	return trascorso;
+	
+}
+
+//Avvia la telemetria a circa hz frame al secondo, o la ferma con hz = 0. Il periodo è un numero intero di millisecondi,
+//quindi la frequenza ottenuta può essere un po' diversa (300 Hz diventano 333 Hz). Restituisce 0 se hz non è ammessa.
+char telemetria_imposta(unsigned int hz){
+	
+	unsigned char sreg = SREG;
+	
+	if(hz != 0 && (hz < TELEMETRIA_HZ_MIN || hz > TELEMETRIA_HZ_MAX))
+	return 0;
+	
+	cli();
+	telemetriaPeriodo = hz ? (1000 + hz / 2) / hz : 0;
+	telemetriaConteggio = telemetriaPeriodo;
+	SREG = sreg;
+	
+	return 1;
+	
+}
+
+//Frequenza della telemetria in Hz (0 se è ferma).
+unsigned int telemetria_frequenza(void){
+	
+	return telemetriaPeriodo ? 1000 / telemetriaPeriodo : 0;
+	
+}
+
+//Bit TEL_FLAG_* dello stato, per la telemetria e per il Modbus.
+unsigned char telemetria_flag(void){
+	
+	return (arbitro.prioritaLocale ? TEL_FLAG_PRIORITA_LOCALE : 0) | (regolazioneAttiva ? TEL_FLAG_REGOLAZIONE : 0)
+	| (arbitro.scaduto ? TEL_FLAG_REMOTO_SCADUTO : 0) | (corrente.scattata ? TEL_FLAG_SOVRACORRENTE : 0) | (programma.attivo ? TEL_FLAG_PROGRAMMA : 0);
+	
+}
+
+//Prepara un frame OP_DATI_TELEMETRIA e lo accoda nel buffer di trasmissione, senza mai aspettare.
+//Viene chiamata dalla ISR del timer 2 con gli interrupt abilitati. Restituisce 0 se il frame va rimandato al prossimo
+//millisecondo, perchè il main sta accodando una riga o un frame o sta per cambiare baud rate (che aspetta il buffer vuoto).
+char telemetria_invia(void){
+	
+	struct frameProtocollo f;
+	unsigned char buf[PROTO_MAX_FRAME];
+	unsigned char n, i, c, testa;
+	unsigned char sreg = SREG;
+	
+	if(txRigaInCorso || cambioBaud != BaudInvariato || autobaudAttivo)
+	return 0;
+	
+	f.opcode = OP_DATI_TELEMETRIA | PROTO_RISPOSTA;
+	f.canale = 0;
+	f.lunghezza = TEL_DUTY + 2 * N_CANALI;
+	
+	//I valori aggiornati dalle altre ISR vengono letti con gli interrupt disabilitati, per avere una fotografia coerente.
+	//Quelli del main non cambiano, perchè il main riparte solo alla fine di questa ISR.
+	cli();
+	proto_scrivi16(&f.payload[TEL_MS], millisecondi);
+	f.payload[TEL_STATO] = PresentState;
+	f.payload[TEL_FLAG] = telemetria_flag();
+	proto_scrivi16(&f.payload[TEL_DIP], dip_switch_leggi());
+	proto_scrivi16(&f.payload[TEL_RPM], rpmMisurati);
+	proto_scrivi16(&f.payload[TEL_ERRORI_CRC], frameErroriCRC);
+	proto_scrivi16(&f.payload[TEL_BYTE_PERSI], byteRxPersi);
+	proto_scrivi16(&f.payload[TEL_OVERRUN], erroriOverrun);
+	proto_scrivi16(&f.payload[TEL_ERRORI_FRAME], erroriFrame);
+	proto_scrivi16(&f.payload[TEL_PERSI], telemetriaPerse);
+	for(c = 0; c < N_CANALI; c++)
+	proto_scrivi16(&f.payload[TEL_DUTY + 2 * c], canali[c].spento ? 0 : rampe[c].attuale);
+	SREG = sreg;
+	
+	n = proto_encode(buf, &f);
+	
+	//Spazio libero nel buffer circolare (una cella resta sempre vuota per distinguere il buffer pieno da quello vuoto).
+	if((unsigned char)((txCoda - txTesta - 1) & (USART_TX_BUF - 1)) < n){
+		telemetriaPerse++;
+		return 1;
+	}
+	
+	//Scrivo tutto il frame e solo alla fine sposto txTesta: la ISR di trasmissione non vede mai un frame a metà.
+	testa = txTesta;
+	for(i = 0; i < n; i++){
+		txBuf[testa] = buf[i];
+		testa = (testa + 1) & (USART_TX_BUF - 1);
+	}
+	txTesta = testa;
+	UCSR0B |= (1<<UDRIE0);
+	
+	return 1;
+	
+}
+
+//Stampa la frequenza della telemetria e i frame non inviati perchè la seriale era satura.
+void stampaTelemetria(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	unsigned int perse;
+	unsigned char sreg = SREG;
+	
+	cli();
+	perse = telemetriaPerse;
+	SREG = sreg;
+	
+	if(telemetriaPeriodo){
+		strcpy_P(buf, PSTR("\n-> Telemetria a "));
+		p = formattaIntero(buf + strlen(buf), telemetria_frequenza());
+		strcpy_P(p, PSTR(" Hz, frame persi "));
+	}
+	else{
+		strcpy_P(buf, PSTR("\n-> Telemetria ferma, frame persi "));
+		p = buf;
+	}
+	
+	formattaIntero(p + strlen(p), perse);
+	risposta(buf);
+	
+}
+
+//Legge un byte della EEPROM. Va chiamata solo quando non c'è una scrittura in corso (all'avvio e dalla ISR(EE_READY_vect)):
+//durante la lettura la CPU si ferma per 4 cicli.
+unsigned char eeprom_leggi(unsigned int indirizzo){
+	
+	EEAR = indirizzo;
+	hal_eeprom_leggi();
+	
+	return EEDR;
+	
+}
+
+//Riempie i campi di un record con le impostazioni attuali (tutti tranne versione, sequenza e CRC).
+//Il duty cycle salvato è quello del remoto: i dip switch si rileggono all'accensione. Durante la regolazione di velocità
+//e il programma il duty cycle cambia di continuo: si tiene quello salvato prima.
+void impostazioni_prepara(unsigned char *r){
+	
+	if(regolazioneAttiva || programma.attivo)
+	proto_scrivi16(r + IMP_DUTY, proto_leggi16(eepromRecord + IMP_DUTY));
+	else
+	proto_scrivi16(r + IMP_DUTY, remoto_duty(CANALE_PRINCIPALE));
+	
+	r[IMP_MODO] = (arbitro.prioritaLocale ? IMP_MODO_LOCALE : 0) | (rampaForma == RAMPA_S ? IMP_MODO_RAMPA_S : 0);
+	r[IMP_PWM_MODO] = pwmModo;
+	proto_scrivi16(r + IMP_FREQUENZA, pwmFrequenzaRichiesta);
+	proto_scrivi16(r + IMP_BAUD, baudRate & 0xFFFF);
+	proto_scrivi16(r + IMP_BAUD + 2, baudRate >> 16);
+	proto_scrivi16(r + IMP_RAMPA, rampaVelocita);
+	r[IMP_MODBUS] = modbusIndirizzo;
+	
+}
+
+//Cerca nel ring il record più recente con il CRC giusto e ne applica i valori, prima dell'avvio di USART e PWM.
+//Si leggono solo i primi due byte di ogni slot e poi i record candidati: al più 2*IMPOSTAZIONI_SLOT+IMPOSTAZIONI_DIM letture,
+//circa 1500 cicli (0.1 ms) con la EEPROM piena. Con la EEPROM vuota restano i valori iniziali.
+void impostazioni_carica(void){
+	
+	unsigned char r[IMPOSTAZIONI_DIM];
+	unsigned char slot, successivo, sequenza, crc, i, n;
+	unsigned int indirizzo;
+	unsigned int ubrr;
+	char u2x;
+	unsigned long baud;
+	
+	//Il più recente è il primo record valido seguito da uno slot che non ne è la continuazione.
+	//Con 32 slot e la sequenza a 8 bit la catena non può chiudersi su se stessa, quindi se c'è un record si trova.
+	for(slot = 0; slot < IMPOSTAZIONI_SLOT; slot++){
+		indirizzo = slot * IMPOSTAZIONI_DIM;
+		if(eeprom_leggi(indirizzo + IMP_VERSIONE) != IMPOSTAZIONI_VERSIONE)
+		continue;
+		
+		sequenza = eeprom_leggi(indirizzo + IMP_SEQUENZA);
+		successivo = (slot + 1) % IMPOSTAZIONI_SLOT;
+		indirizzo = successivo * IMPOSTAZIONI_DIM;
+		if(eeprom_leggi(indirizzo + IMP_VERSIONE) != IMPOSTAZIONI_VERSIONE || eeprom_leggi(indirizzo + IMP_SEQUENZA) != (unsigned char)(sequenza + 1))
+		break;
+	}
+	
+	//Dal più recente all'indietro, il primo record integro. Un record scritto a metà ha il CRC sbagliato.
+	for(n = 0; slot < IMPOSTAZIONI_SLOT && n < IMPOSTAZIONI_SLOT; n++){
+		indirizzo = slot * IMPOSTAZIONI_DIM;
+		crc = 0;
+		for(i = 0; i < IMPOSTAZIONI_DIM; i++){
+			r[i] = eeprom_leggi(indirizzo + i);
+			if(i < IMP_CRC)
+			crc = proto_crc8(crc, r[i]);
+		}
+		
+		if(r[IMP_VERSIONE] == IMPOSTAZIONI_VERSIONE && crc == r[IMP_CRC])
+		break;
+		
+		slot = slot ? slot - 1 : IMPOSTAZIONI_SLOT - 1;
+	}
+	
+	if(slot == IMPOSTAZIONI_SLOT || n == IMPOSTAZIONI_SLOT){
+		//EEPROM vuota o senza record integri: il primo salvataggio riparte dal primo slot.
+		impostazioni_prepara(eepromRecord);
+		eepromRecord[IMP_SEQUENZA] = 0;
+		eepromSlot = 0;
+		return;
+	}
+	
+	memcpy(eepromRecord, r, IMPOSTAZIONI_DIM);
+	eepromSlot = (slot + 1) % IMPOSTAZIONI_SLOT;
+	
+	canali[CANALE_PRINCIPALE].duty = proto_leggi16(r + IMP_DUTY) <= DC_MAX ? proto_leggi16(r + IMP_DUTY) : DC_MAX;
+	canali[CANALE_PRINCIPALE].spento = canali[CANALE_PRINCIPALE].duty == 0;
+	
+	//Con l'interruttore la priorità la decide il suo livello, letto da sorgenti_init().
+#if !PRIORITA_INTERRUTTORE
+	arbitro.prioritaLocale = (r[IMP_MODO] & IMP_MODO_LOCALE) != 0;
+#endif
+	
+	pwmModo = r[IMP_PWM_MODO] == PWM_PHASE_CORRECT ? PWM_PHASE_CORRECT : PWM_FAST;
+	if(proto_leggi16(r + IMP_FREQUENZA))
+	pwmFrequenzaRichiesta = proto_leggi16(r + IMP_FREQUENZA);
+	
+	baud = proto_leggi16(r + IMP_BAUD) | ((unsigned long) proto_leggi16(r + IMP_BAUD + 2) << 16);
+	if(baud <= BAUD_MAX && USART_calcola_baud(baud, &ubrr, &u2x))
+	baudRate = baud;
+	
+	rampaVelocita = proto_leggi16(r + IMP_RAMPA);
+	rampaForma = (r[IMP_MODO] & IMP_MODO_RAMPA_S) ? RAMPA_S : RAMPA_LINEARE;
+	
+	//Con il pulsante premuto all'accensione si riparte dai comandi testuali, anche se l'indirizzo Modbus salvato non si conosce.
+	//L'interruttore resta a massa per tutto il tempo in cui comanda il locale: in quel caso l'indirizzo salvato vale sempre.
+#if PWM_TIMER == 0
+	if(r[IMP_MODBUS] <= MODBUS_INDIRIZZO_MAX && (PRIORITA_INTERRUTTORE || (PINB & (1<<PINB7))))
+	modbusIndirizzo = r[IMP_MODBUS];
+#endif
+	
+}
+
+//Salva le impostazioni quando sono cambiate e restano ferme per IMPOSTAZIONI_FERME_MS: mentre si danno comandi
+//o si spostano i dip switch non si consuma la EEPROM. Il main prepara il record e avvia la scrittura abilitando EERIE,
+//il resto avviene nella ISR(EE_READY_vect). Se c'è ancora una scrittura in corso il salvataggio aspetta il controllo successivo.
+void impostazioni_gestisci(void){
+	
+	unsigned char r[IMPOSTAZIONI_DIM];
+	unsigned int ms = leggiMillisecondi();
+	unsigned char i;
+	
+	if((unsigned int)(ms - impostazioniControllo) < IMPOSTAZIONI_CONTROLLO_MS)
+	return;
+	
+	impostazioniControllo = ms;
+	
+	//Il programma da salvare ha la precedenza: le impostazioni aspettano la fine della sua scrittura.
+	if(programmaDaSalvare){
+		if(EECR & (1<<EERIE))
+		return;
+		
+		programmaCrc = 0;
+		for(i = 0; i < PROGRAMMA_EEPROM_DIM - 1; i++)
+		programmaCrc = proto_crc8(programmaCrc, programma_eeprom_byte(i));
+		
+		programmaDaSalvare = 0;
+		eepromProgramma = 1;
+		eepromIndirizzo = PROGRAMMA_INDIRIZZO;
+		eepromIndice = 0;
+		EECR |= (1<<EERIE);
+		return;
+	}
+	
+	impostazioni_prepara(r);
+	
+	if(memcmp(r + IMP_DUTY, impostazioniCandidate + IMP_DUTY, IMP_CRC - IMP_DUTY)){
+		memcpy(impostazioniCandidate, r, IMPOSTAZIONI_DIM);
+		impostazioniFerme = 0;
+		return;
+	}
+	
+	if(impostazioniFerme < IMPOSTAZIONI_FERME_MS / IMPOSTAZIONI_CONTROLLO_MS){
+		impostazioniFerme++;
+		return;
+	}
+	
+	if((EECR & (1<<EERIE)) || !memcmp(r + IMP_DUTY, eepromRecord + IMP_DUTY, IMP_CRC - IMP_DUTY))
+	return;
+	
+	r[IMP_VERSIONE] = IMPOSTAZIONI_VERSIONE;
+	r[IMP_SEQUENZA] = eepromRecord[IMP_SEQUENZA] + 1;
+	r[IMP_CRC] = 0;
+	for(i = 0; i < IMP_CRC; i++)
+	r[IMP_CRC] = proto_crc8(r[IMP_CRC], r[i]);
+	
+	//Il CRC è l'ultimo byte scritto: finchè non c'è, il record non è valido.
+	memcpy(eepromRecord, r, IMPOSTAZIONI_DIM);
+	eepromIndirizzo = eepromSlot * IMPOSTAZIONI_DIM;
+	eepromIndice = 0;
+	eepromSlot = (eepromSlot + 1) % IMPOSTAZIONI_SLOT;
+	impostazioniSalvate++;
+	EECR |= (1<<EERIE);
+	
+}
+
+#if PWM_TIMER == 0
+//Il timer 1 non genera il PWM, quindi conta libero con prescaler 8: TCNT1 avanza ogni 0.5 us e ricomincia da 0 ogni 32.768 ms.
+//Serve per misurare intervalli brevi, come la durata dei bit nell'autobaud e il periodo del tachimetro.
+//Il filtro antirumore dell'ingresso di cattura (ICNC1) scarta gli impulsi più brevi di 4 cicli di clock.
+void base_tempi_init(void){
+	
+	TCCR1A = 0x00;
+	TCCR1B = (1<<ICNC1)|(1<<CS11);
+	
+}
+
+//Avvia l'autobaud: spengo la ricezione, così il carattere di sincronismo non finisce tra i comandi,
+//e abilito il pin change su RXD (PD0). Il pull-up di PD0 tiene la linea alta finchè l'host non trasmette.
+void autobaud_avvia(void){
+	
+	UCSR0B &= ~(1<<RXEN0);
+	
+	autobaudFronti = 0;
+	autobaudPIND = PIND;
+	autobaudAvvioMs = leggiMillisecondi();
+	autobaudAttivo = 1;
+	
+	PCMSK2 |= (1<<PCINT16);
+	
+}
+
+//Conclude l'autobaud con il baud rate rilevato (0 se la misura non è valida: resta quello di prima)
+//e lo comunica all'host, già alla nuova velocità.
+void autobaud_termina(unsigned long baud){
+	
+	char buf[MAX_STR_LEN + 1];
+	
+	PCMSK2 &= ~(1<<PCINT16);
+	autobaudAttivo = 0;
+	
+	if(baud && !USART_imposta_baud(baud))
+	baud = 0;
+	
+	UCSR0B |= (1<<RXEN0);
+	
+	if(modoMacchina){
+		strcpy_P(buf, baud ? PSTR("OK ") : PSTR("ERR "));
+		formattaInteroLungo(buf + strlen(buf), baudRate);
+		USART_TX_string(buf);
+	}
+	else
+	stampaBaud(baud ? PSTR("\n-> Baud rate rilevato: ") : PSTR("\n-> Baud rate non rilevato, resta "), baudRate);
+	
+}
+
+//Controlla la misura dell'autobaud in corso. Quando su RXD non ci sono fronti da AUTOBAUD_SILENZIO_MS,
+//il carattere è finito: dai 9 bit misurati ricavo il baud rate e lo arrotondo al più vicino tra quelli standard.
+//Con la ISR che legge TCNT1 con qualche microsecondo di ritardo, la misura è affidabile fino a 115200 baud;
+//le velocità più alte si impostano con "baud <n>".
+void gestisciAutobaud(void){
+	
+	unsigned char fronti;
+	unsigned int durata;
+	unsigned int ultimoMs;
+	unsigned long misura;
+	unsigned long standard;
+	unsigned long errore;
+	unsigned long erroreMinimo = 0xFFFFFFFFUL;
+	unsigned long scelto = 0;
+	unsigned char sreg;
+	
+	if(!autobaudAttivo)
+	return;
+	
+	sreg = SREG;
+	cli();
+	fronti = autobaudFronti;
+	durata = autobaudFine - autobaudInizio;
+	ultimoMs = autobaudUltimoMs;
+	SREG = sreg;
+	
+	if(fronti == 0){
+		if((unsigned int)(leggiMillisecondi() - autobaudAvvioMs) > AUTOBAUD_TIMEOUT_MS)
+		autobaud_termina(0);
+		return;
+	}
+	
+	if((unsigned int)(leggiMillisecondi() - ultimoMs) <= AUTOBAUD_SILENZIO_MS)
+	return;
+	
+	//Il carattere deve finire con la linea alta (bit di stop): altrimenti non era una 'U'.
+	if(fronti >= 2 && durata != 0 && (PIND & (1<<PIND0))){
+		
+		//9 bit in "durata" conteggi da 0.5 us.
+		misura = (9UL * (F_CPU / 8)) / durata;
+		
+		for(unsigned char i = 0; i < N_BAUD_STANDARD; i++){
+			standard = pgm_read_dword(&baudStandard[i]);
+			errore = (misura > standard ? misura - standard : standard - misura) * 1000 / standard;
+			
+			if(errore < erroreMinimo){
+				erroreMinimo = errore;
+				scelto = standard;
+			}
+		}
+		
+		//Più del 6% di differenza dal baud rate standard più vicino: la misura non è attendibile.
+		if(erroreMinimo > 60)
+		scelto = 0;
+	}
+	
+	autobaud_termina(scelto);
+	
+}
+
+//Tachimetro sull'ingresso di cattura ICP1 (PB0), già in ingresso con il pull-up attivo come serve ai sensori open collector.
+//La cattura avviene sul fronte di discesa (ICES1 a '0').
+void tachimetro_init(void){
+	
+	TIFR1 = (1<<ICF1)|(1<<TOV1);
+	TIMSK1 |= (1<<ICIE1)|(1<<TOIE1);
+	
+}
+
+//Misura della velocità e, se attiva, un passo della regolazione.
+//Viene chiamata ogni PID_PERIODO_MS dalla ISR del timer 2, con gli interrupt di nuovo abilitati.
+void regolazione_passo(void){
+	
+	unsigned char impulsi;
+	unsigned long ultimo;
+	unsigned int rpm, dc;
+	unsigned char sreg = SREG;
+	
+	cli();
+	impulsi = tachImpulsi;
+	ultimo = tachUltimo;
+	SREG = sreg;
+	
+	if(impulsi != tachImpulsiLetti){
+		rpm = tach_rpm(impulsi - tachImpulsiLetti, ultimo - tachFinestra, TACH_COSTANTE);
+		tachImpulsiLetti = impulsi;
+		tachFinestra = ultimo;
+		tachFinestreVuote = 0;
+	}
+	else if(tachFinestreVuote < TACH_FERMO_MS / PID_PERIODO_MS){ //A bassa velocità tra due impulsi passa più di un periodo.
+		tachFinestreVuote++;
+		rpm = rpmMisurati;
+	}
+	else
+	rpm = 0;
+	
+	rpmMisurati = rpm;
+	
+	if(!regolazioneAttiva)
+	return;
+	
+	dc = pid_passo(&pid, rpmRiferimento, rpm);
+	
+	//Il duty cycle calcolato va applicato subito, senza rampa. Quando il regolatore satura a 0% (motore troppo veloce,
+	//o trascinato dal carico) il canale si spegne come con "set 0", e si riaccende con la prima uscita diversa da 0.
+	cli();
+	impostaDCDiretto(dc);
+	SREG = sreg;
+	
+}
+
+//Comando "rpm <n>": porta il canale principale in regolazione di velocità.
+//Il regolatore parte dal duty cycle generato in quel momento, così la velocità non salta; un canale spento parte da 0%.
+//Tutto avviene con gli interrupt disabilitati: restituisce 0, senza toccare il canale, se comandano i dip switch.
+char regolazione_avvia(unsigned int rpm){
+	
+	unsigned int dc;
+	unsigned char sreg = SREG;
+	
+	cli();
+	if(arbitro.sorgente == ARBITRO_LOCALE){
+		SREG = sreg;
+		return 0;
+	}
+	
+	dc = canali[CANALE_PRINCIPALE].spento ? 0 : rampe[CANALE_PRINCIPALE].attuale;
+	
+	impostaDC(CANALE_PRINCIPALE, dc); //Ferma una eventuale rampa in corso.
+	
+	//Un canale spento resta scollegato finchè il regolatore non chiede più di 0% (impostaDCDiretto()).
+	pid_reset(&pid, dc, rpmMisurati);
+	rpmRiferimento = rpm;
+	regolazioneAttiva = 1;
+	SREG = sreg;
+	
+	return 1;
+	
+}
+
+unsigned int leggiRpm(void){
+	
+	unsigned int rpm;
+	unsigned char sreg = SREG;
+	
+	cli();
+	rpm = rpmMisurati;
+	SREG = sreg;
+	
+	return rpm;
+	
+}
+
+//Stampa la velocità misurata e, in regolazione, quella richiesta.
+void stampaRpm(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	strcpy_P(buf, PSTR("\n-> Velocità "));
+	p = formattaIntero(buf + strlen(buf), leggiRpm());
+	
+	if(regolazioneAttiva){
+		strcpy_P(p, PSTR(" rpm, richiesta "));
+		p = formattaIntero(p + strlen(p), rpmRiferimento);
+		strcpy_P(p, PSTR(" rpm"));
+	}
+	else
+	strcpy_P(p, PSTR(" rpm (duty cycle fisso)"));
+	
+	risposta(buf);
+	
+}
+#else
+//Con il PWM sul timer 1 non c'è una base dei tempi libera: l'autobaud e il tachimetro non sono disponibili.
+void base_tempi_init(void){
+	
+}
+
+void tachimetro_init(void){
+	
+}
+#endif
+
+//Smista i byte ricevuti: il SYNC e i byte che lo seguono vanno al parser dei frame binari,
+//gli altri vanno al parser dei comandi testuali (comandi.h), che li decodifica appena arrivano.
+//Finchè il comando completo non viene letto, i byte che seguono restano nel buffer circolare.
+void gestisciRicezione(void){
+	
+	char c;
+	
+	gestisciCambioBaud();
+#if PWM_TIMER == 0
+	gestisciAutobaud();
+#endif
+	
+	//In modalità Modbus RTU tutti i byte ricevuti appartengono ai frame Modbus.
+	if(modbusIndirizzo){
+		gestisciModbus();
+		return;
+	}
+	
+	//Un frame interrotto non deve bloccare per sempre la ricezione dei comandi testuali.
+	if(proto_in_corso(&parserRx) && (unsigned int)(leggiMillisecondi() - ultimoByteFrame) > PROTO_TIMEOUT_MS)
+	proto_reset(&parserRx);
+	
+	while(!comandoPronto && USART_RX_char(&c)){
+		
+		if(proto_in_corso(&parserRx) || (unsigned char) c == PROTO_SYNC){
+			ultimoByteFrame = leggiMillisecondi();
+			
+			switch(proto_parse(&parserRx, c)){
+				case PROTO_FRAME_OK:
+				frameValidi++;
+				eseguiFrame(&parserRx.frame);
+				break;
+				
+				case PROTO_ERRORE_CRC:
+				case PROTO_ERRORE_LUNGHEZZA:
+				frameErroriCRC++;
+				break;
+			}
+			continue;
+		}
+		
+		//Il parser scarta da solo i caratteri non stampabili (es. '\r') e riconosce le parole mentre arrivano.
+		if(comandi_byte(&parserTesto, c) == COMANDI_PRONTO)
+		comandoPronto = 1;
+	}
+	
+}
+
+//Esegue un comando ricevuto come frame binario e trasmette la risposta.
+//Il duty cycle impostato è un setpoint remoto, come per i comandi testuali: mentre comandano i dip switch viene solo memorizzato,
+//e la risposta riporta il canale com'è (payload[4] a 1).
+void eseguiFrame(struct frameProtocollo *f){
+	
+	struct frameProtocollo r;
+	unsigned char buf[PROTO_MAX_FRAME];
+	unsigned int dc;
+	
+	r.opcode = f->opcode | PROTO_RISPOSTA;
+	r.canale = f->canale;
+	r.lunghezza = 0;
+	
+	switch(f->opcode){
+		
+		case OP_IMPOSTA_DC:
+		case OP_LEGGI_STATO:
+		if(f->canale >= N_CANALI){
+			r.payload[r.lunghezza++] = ERR_CANALE;
+			break;
+		}
+		
+		if(f->opcode == OP_IMPOSTA_DC){
+			if(f->lunghezza != 2 || (dc = proto_leggi16(f->payload)) > DC_MAX){
+				r.payload[r.lunghezza++] = ERR_VALORE;
+				break;
+			}
+			
+			remoto_imposta(f->canale, dc);
+		}
+		
+		//Entrambi i comandi rispondono con lo stato del canale.
+		proto_scrivi16(&r.payload[0], canali[f->canale].duty);
+		r.payload[2] = canali[f->canale].spento;
+		r.payload[3] = PresentState;
+		r.payload[4] = (f->canale == CANALE_PRINCIPALE && arbitro.sorgente == ARBITRO_LOCALE);
+		proto_scrivi16(&r.payload[5], pwmFrequenza);
+		r.lunghezza = 7;
+		break;
+		
+		case OP_LEGGI_CONTATORI:
+		proto_scrivi16(&r.payload[0], frameValidi);
+		proto_scrivi16(&r.payload[2], frameErroriCRC);
+		cli();
+		proto_scrivi16(&r.payload[4], byteRxPersi);
+		sei();
+		r.lunghezza = 6;
+		break;
+		
+		case OP_TELEMETRIA:
+		if(f->lunghezza != 2 || !telemetria_imposta(proto_leggi16(f->payload))){
+			r.payload[r.lunghezza++] = ERR_VALORE;
+			break;
+		}
+		
+		proto_scrivi16(&r.payload[0], telemetria_frequenza());
+		r.lunghezza = 2;
+		break;
+		
+		default:
+		r.payload[r.lunghezza++] = ERR_OPCODE;
+		break;
+	}
+	
+	//Le risposte di errore hanno OPCODE 0xFF e il codice di errore come unico byte del payload.
+	if(r.lunghezza == 1)
+	r.opcode = OP_ERRORE | PROTO_RISPOSTA;
+	
+	USART_TX_bytes(buf, proto_encode(buf, &r));
+	
+}
+
+//Passa al protocollo Modbus RTU con l'indirizzo indicato, oppure torna ai comandi testuali con 0.
+//Viene applicata da gestisciCambioBaud() quando la trasmissione è finita, perchè cambia il formato dei caratteri.
+//I byte ricevuti e non ancora letti appartengono al protocollo di prima e vengono scartati.
+void modbus_imposta(unsigned char indirizzo){
+	
+	unsigned char sreg = SREG;
+	
+#if PWM_TIMER != 0
+	indirizzo = 0; //Il silenzio tra i frame si misura con il timer 1, che qui genera il PWM.
+#endif
+	
+	cli();
+	modbusIndirizzo = indirizzo;
+	modbusSilenzio = 0;
+	TIMSK1 &= ~(1<<OCIE1A);
+	rxCoda = rxTesta;
+	SREG = sreg;
+	
+	modbusLunghezza = 0;
+	comandi_reset(&parserTesto);
+	comandoPronto = 0;
+	proto_reset(&parserRx);
+	USART_imposta_formato();
+	
+	//I frame della telemetria disturberebbero il bus.
+	if(indirizzo)
+	telemetria_imposta(0);
+	
+}
+
+//Copia i byte ricevuti nel frame Modbus in corso ed esegue il frame quando la ISR del timer 1 ha visto il silenzio
+//e sono stati letti tutti i byte arrivati prima. I byte del frame successivo restano nel buffer circolare.
+//Il master aspetta la risposta prima di inviare la richiesta successiva, quindi c'è al più un frame finito da eseguire.
+void gestisciModbus(void){
+	
+	char c;
+	char fineFrame;
+	unsigned char sreg;
+	
+	while(1){
+		
+		sreg = SREG;
+		cli();
+		fineFrame = modbusSilenzio && rxCoda == modbusFine;
+		if(fineFrame)
+		modbusSilenzio = 0;
+		SREG = sreg;
+		
+		if(fineFrame){
+			eseguiModbus();
+			modbusLunghezza = 0;
+		}
+		else if(USART_RX_char(&c)){
+			if(modbusLunghezza < MODBUS_MAX_FRAME)
+			modbusFrame[modbusLunghezza] = c;
+			if(modbusLunghezza <= MODBUS_MAX_FRAME)
+			modbusLunghezza++;
+		}
+		else
+		break;
+	}
+	
+}
+
+//Esegue il frame Modbus ricevuto e trasmette la risposta, tranne che per il broadcast.
+//Prima di leggere o scrivere si controlla che tutti i registri esistano: una richiesta con un registro sbagliato
+//non cambia niente. Le scritture avvengono nell'ordine dei registri e si fermano al primo valore non ammesso.
+void eseguiModbus(void){
+	
+	struct richiestaModbus r;
+	unsigned char buf[MODBUS_MAX_FRAME];
+	unsigned char n = 2;
+	unsigned char eccezione = 0;
+	unsigned int i;
+	unsigned int registri;
+	unsigned int tempo;
+	unsigned char sreg;
+	
+	if(modbusLunghezza == 0)
+	return;
+	
+	switch(modbusLunghezza > MODBUS_MAX_FRAME ? MODBUS_ERRORE : modbus_decodifica(modbusFrame, modbusLunghezza, modbusIndirizzo, &r)){
+		
+		case MODBUS_ERRORE:
+		modbusErroriCRC++;
+		return;
+		
+		case MODBUS_ALTRO:
+		return;
+		
+		case MODBUS_RISPOSTA_ECCEZIONE:
+		modbusRichieste++;
+		eccezione = r.eccezione;
+		break;
+		
+		default:
+		modbusRichieste++;
+		registri = (r.funzione == MB_LEGGI_INPUT) ? MB_N_INPUT : MB_N_HOLDING;
+		if(r.registro >= registri || r.quantita > registri - r.registro){
+			eccezione = MB_ECC_INDIRIZZO;
+			break;
+		}
+		
+		if(r.funzione == MB_LEGGI_HOLDING || r.funzione == MB_LEGGI_INPUT){
+			buf[n++] = 2 * r.quantita;
+			for(i = 0; i < r.quantita; i++, n += 2)
+			modbus_scrivi16(buf + n, modbus_leggi_registro(r.funzione, r.registro + i));
+		}
+		else{
+			for(i = 0; i < r.quantita && !eccezione; i++)
+			eccezione = modbus_scrivi_registro(r.registro + i, modbus_leggi16(r.valori + 2 * i));
+			
+			//Entrambe le risposte ripetono i primi 4 byte dei dati: registro e valore oppure primo registro e numero di registri.
+			memcpy(buf + n, modbusFrame + 2, 4);
+			n += 4;
+		}
+		break;
+	}
+	
+	if(r.indirizzo == 0)
+	return;
+	
+	if(eccezione)
+	n = modbus_eccezione(buf, r.indirizzo, r.funzione, eccezione);
+	else{
+		buf[0] = r.indirizzo;
+		buf[1] = r.funzione;
+		n = modbus_chiudi(buf, n);
+	}
+	
+	USART_TX_bytes(buf, n);
+	
+	//Tempo dall'ultimo byte della richiesta: il confronto A è scattato modbusT35 conteggi dopo quel byte.
+	sreg = SREG;
+	cli();
+	tempo = ((TCNT1 - OCR1A + modbusT35) & 0xFFFF) / 2;
+	SREG = sreg;
+	
+	if(tempo > modbusRispostaMax)
+	modbusRispostaMax = tempo;
+	
+}
+
+//Valore di un holding register (MB_LEGGI_HOLDING) o di un input register (MB_LEGGI_INPUT). Il registro esiste sempre.
+//I valori aggiornati dalle ISR vengono letti con gli interrupt disabilitati.
+unsigned int modbus_leggi_registro(unsigned char funzione, unsigned int registro){
+	
+	unsigned int valore;
+	unsigned char sreg = SREG;
+	
+	cli();
+	
+	if(funzione == MB_LEGGI_HOLDING){
+		switch(registro){
+			case MB_HR_DUTY: valore = remoto_duty(CANALE_PRINCIPALE); break;
+			case MB_HR_PRIORITA: valore = arbitro.prioritaLocale; break;
+			case MB_HR_FREQUENZA: valore = pwmFrequenza; break;
+			case MB_HR_PWM_MODO: valore = (pwmModo == PWM_PHASE_CORRECT); break;
+			case MB_HR_INDIRIZZO: valore = modbusIndirizzo; break;
+			default: valore = arbitro.timeout; break;
+		}
+	}
+	else{
+		switch(registro){
+			case MB_IR_DUTY: valore = canali[CANALE_PRINCIPALE].spento ? 0 : rampe[CANALE_PRINCIPALE].attuale; break;
+			case MB_IR_STATO: valore = PresentState; break;
+			case MB_IR_FLAG: valore = telemetria_flag(); break;
+			case MB_IR_RPM: valore = rpmMisurati; break;
+			case MB_IR_RICHIESTE: valore = modbusRichieste; break;
+			case MB_IR_ERRORI_CRC: valore = modbusErroriCRC; break;
+			case MB_IR_BYTE_PERSI: valore = byteRxPersi; break;
+			case MB_IR_OVERRUN: valore = erroriOverrun; break;
+			case MB_IR_ERRORI_FRAME: valore = erroriFrame; break;
+			case MB_IR_RISPOSTA_MAX: valore = modbusRispostaMax; break;
+			case MB_IR_CORRENTE: valore = corrente_ma(corrente_media(&corrente), CORRENTE_FONDO_SCALA_MA); break;
+			default: valore = arbitro.locale.numero ? arbitro.locale.duty : 0xFFFF; break;
+		}
+	}
+	
+	SREG = sreg;
+	
+	return valore & 0xFFFF;
+	
+}
+
+//Scrive un holding register. Restituisce 0 se il valore è stato applicato, altrimenti il codice di eccezione.
+unsigned char modbus_scrivi_registro(unsigned int registro, unsigned int valore){
+	
+	switch(registro){
+		
+		case MB_HR_DUTY:
+		//Come nel protocollo binario, è un setpoint remoto: mentre comandano i dip switch viene solo memorizzato.
+		if(valore > DC_MAX)
+		return MB_ECC_VALORE;
+		
+		remoto_imposta(CANALE_PRINCIPALE, valore);
+		break;
+		
+		case MB_HR_PRIORITA:
+		//Con l'interruttore la priorità la decide il suo livello.
+		if(valore > 1)
+		return MB_ECC_VALORE;
+		if(PRIORITA_INTERRUTTORE)
+		return MB_ECC_DISPOSITIVO;
+		
+		//Come il comando "priorita": il passo dell'arbitro si fa subito, così una lettura dopo la scrittura
+		//riporta già la nuova sorgente, e il led e i messaggi si aggiornano come con il pulsante.
+		if(arbitro.prioritaLocale != (valore == 1)){
+			cli();
+			arbitro.prioritaLocale = valore;
+			sorgenti_passo();
+			sei();
+			gestisciSorgenti();
+		}
+		break;
+		
+		case MB_HR_TIMEOUT:
+		if(valore > ARBITRO_TIMEOUT_MAX)
+		return MB_ECC_VALORE;
+		
+		cli();
+		arbitro_timeout(&arbitro, valore);
+		sei();
+		break;
+		
+		case MB_HR_FREQUENZA:
+		if(!pwm_imposta_frequenza(valore))
+		return MB_ECC_VALORE;
+		break;
+		
+		case MB_HR_PWM_MODO:
+		if(valore > 1)
+		return MB_ECC_VALORE;
+		
+		pwm_imposta_modo(valore ? PWM_PHASE_CORRECT : PWM_FAST);
+		break;
+		
+		default: //MB_HR_INDIRIZZO
+		if(valore > MODBUS_INDIRIZZO_MAX)
+		return MB_ECC_VALORE;
+		
+		//Il nuovo indirizzo vale dopo la risposta, che esce ancora con quello vecchio.
+		modbusRichiesto = valore;
+		cambioBaud = BaudModbus;
+		break;
+	}
+	
+	return 0;
+	
+}
+
+//Copia in cmd l'ultimo comando ricevuto, se è completo.
+//Non blocca: restituisce 1 se il comando è stato copiato, 0 se il comando non è ancora arrivato.
+char USART_RX_comando(struct comandoTestuale *cmd){
+	
+	gestisciRicezione();
+	
+	if(!comandoPronto)
+	return 0;
+	
+	*cmd = parserTesto.comando;
+	
+	//Il comando è stato consumato, la ricezione può riprendere.
+	comandoPronto = 0;
+	
+	return 1;
+	
+}
+
+//Le seguenti funzioni LedOn e LedOff permettono all'utente di avere un feedback visivo sulla sorgente che comanda il canale principale.
+//Se il led è acceso, comanda il remoto (terminale, protocollo binario o Modbus).
+//Se il led è spento, comandano i Dip Switch (locale). Il led lo aggiorna gestisciSorgenti().
+void LedOn(void){
+	
+	PORTB &= ~(1<<PORTB5);
+	// accensione led
+	PINB |= (1<<PINB5);
+	
+}
+
+void LedOff(void){
+	
+	//Spegnimento led
+	PORTB &= ~(1<<PORTB5);
+	
+}
+
+//Messaggio di benvenuto.
+void benvenuto(){
+	
+	USART_TX_string_P(PSTR("Comando motore mediante PWM - Frenki Shqepa"));
+	USART_TX_string_P(PSTR("~~~~~~~~~~~~~~~~~Benvenuto!~~~~~~~~~~~~~~~~"));
+	USART_TX_string_P(PSTR("\nIl Duty Cycle arriva da due sorgenti, sempre attive:"));
+	USART_TX_string_P(PSTR("-remoto: i comandi da terminale (es. \"up\", \"down\", \"set 42\")"));
+	USART_TX_string_P(PSTR("-locale: i Dip Switch sulla Breadboard, uno per ogni cifra in BCD"));
+	USART_TX_string_P(PRIORITA_INTERRUTTORE ? PSTR("L'interruttore della scheda sceglie chi ha la priorità") : PSTR("Il pulsante della scheda passa la priorità all'altra sorgente"));
+	
+}
+
+//Istruzioni per l'inserimento da terminale.
+void istruzioniTerminale(){
+	
+	USART_TX_string_P(PSTR("\nScrivi \"up\" per aumentare il Duty Cycle di 1%"));
+	USART_TX_string_P(PSTR("Scrivi \"down\" per decrementare il Duty Cycle di 1%"));
+	USART_TX_string_P(PSTR("Scrivi \"set <n>\" per impostare il Duty Cycle a n% (es. \"set 42.5\")"));
+	USART_TX_string_P(PSTR("Scrivi \"step <+/-n>\" per variare il Duty Cycle di n% (es. \"step -5\")"));
+	USART_TX_string_P(PSTR("Aggiungi il numero del canale per gli altri motori (es. \"up 3\", \"set 20 2\")"));
+	USART_TX_string_P(PSTR("Scrivi \"freq <Hz>\", \"modo fast\" o \"modo pc\" per configurare il PWM"));
+	USART_TX_string_P(PSTR("Scrivi \"rampa <n> [lin|s]\" per variare il Duty Cycle al massimo di n% al secondo (0 = subito)"));
+	USART_TX_string_P(PSTR("Scrivi \"rpm <n>\" per mantenere il motore a n giri al minuto, \"rpm\" per leggere la velocità"));
+	USART_TX_string_P(PSTR("Puoi scrivere più comandi sulla stessa riga, separati da ';'"));
+	USART_TX_string_P(PSTR("Scrivi \"macchina 1\" per le risposte brevi (OK/ERR) senza istruzioni"));
+	USART_TX_string_P(PSTR("Scrivi \"baud <n>\" per cambiare velocità della seriale, \"baud auto\" per rilevarla da una 'U'"));
+	USART_TX_string_P(PSTR("Scrivi \"telemetria <Hz>\" per ricevere lo stato in frame binari (0 = ferma)"));
+	USART_TX_string_P(PSTR("Scrivi \"stats\" per gli errori della seriale e i tempi delle ISR, \"stats 0\" per azzerarli"));
+	USART_TX_string_P(PSTR("Scrivi \"modbus <indirizzo>\" per passare al protocollo Modbus RTU (indirizzo da 1 a 247)"));
+	USART_TX_string_P(PSTR("Scrivi \"corrente\" per la corrente del motore, \"corrente <mA>\" per la soglia, \"corrente reset\" dopo un guasto"));
+	USART_TX_string_P(PSTR("Scrivi \"programma <ms> <n>\" per aggiungere un punto al programma, \"programma\" per vederlo,"));
+	USART_TX_string_P(PSTR("\"programma avvia|stop|lin|gradini|salva|reset\" e \"programma ciclo <0|1>\" per usarlo"));
+	USART_TX_string_P(PSTR("Scrivi \"priorita\" per le sorgenti del Duty Cycle, \"priorita locale|remoto\" per sceglierla,"));
+	USART_TX_string_P(PSTR("\"priorita timeout <ms>\" perchè comandi il locale quando il remoto tace (0 = mai)"));
+}
+
+//Legge i tre registri PIN e raccoglie i 9 bit dei dip switch in una parola, senza cicli:
+//le unità sono già ai bit 0-3 di PINC, PD2-PD4 vanno spostati di due posizioni, PD7 è già al bit 7, PB2 va al bit 8.
+unsigned int dip_switch_leggi(void){
+	
+	unsigned char pind = PIND;
+	
+	return (PINC & 0x0F) | ((pind & ((1<<PIND2)|(1<<PIND3)|(1<<PIND4))) << 2) | (pind & (1<<PIND7)) | ((unsigned int)(PINB & (1<<PINB2)) << 6);
+	
+}
+
+//Converte la parola dei dip switch nel numero decimale a tre cifre (da 0 a 199).
+//Le cifre delle unità e delle decine passano dalla tabella cifraBCD: se una delle due non è una cifra bcd
+//la tabella restituisce DIP_NON_VALIDO, che ha il bit 7 a '1' e viene riconosciuto con un solo controllo.
+unsigned char dip_switch_valore(unsigned int parola){
+	
+	unsigned char unita = pgm_read_byte(&cifraBCD[parola & DIP_UNITA]);
+	unsigned char decine = pgm_read_byte(&cifraBCD[(unsigned char) parola >> 4]);
+	
+	if((unita | decine) & 0x80)
+	return DIP_NON_VALIDO;
+	
+	return ((parola & DIP_CENTINAIA) ? 100 : 0) + decine * 10 + unita;
+	
+}
+
+//Avvio delle sorgenti, prima del PWM: il remoto parte dal duty cycle salvato, il locale dai dip switch letti adesso
+//(se il valore è valido). Il primo passo dell'arbitro decide da quale valore parte il canale principale.
+void sorgenti_init(void){
+	
+	unsigned int parola = dip_switch_leggi();
+	unsigned char valore = dip_switch_valore(parola);
+	unsigned int dc;
+	
+	arbitro_timeout(&arbitro, REMOTO_TIMEOUT_MS);
+#if PRIORITA_INTERRUTTORE
+	arbitro.prioritaLocale = (PINB & (1<<PINB7)) == 0;
+#else
+	//Il pulsante premuto all'accensione non conta come pressione: si aspetta che venga rilasciato.
+	pulsanteLivello = PINB & (1<<PINB7);
+	pulsanteFermo = PULSANTE_FERMO_MS;
+#endif
+	arbitro_avvia(&arbitro, canali[CANALE_PRINCIPALE].spento ? 0 : canali[CANALE_PRINCIPALE].duty, millisecondi);
+	
+	if(valore <= 100)
+	arbitro_locale(&arbitro, valore * (DC_MAX / 100), millisecondi);
+	
+	if(arbitro_passo(&arbitro, millisecondi, &dc) & ARBITRO_APPLICA){
+		canali[CANALE_PRINCIPALE].duty = dc;
+		canali[CANALE_PRINCIPALE].spento = (dc == 0);
+	}
+	
+	//Il filtro parte dal valore appena letto: se i dip switch restano fermi non diventa un secondo setpoint.
+	dipStabile = parola;
+	dipCampione = parola;
+	dipContatore = DIP_STABILE_MS;
+	
+	sorgenteStampata = arbitro.sorgente;
+	prioritaStampata = arbitro.prioritaLocale;
+	scadutoStampato = 0;
+	
+	if(arbitro.sorgente == ARBITRO_REMOTO)
+	LedOn();
+	else
+	LedOff();
+	
+}
+
+//Un tick dell'arbitro, dalla ISR del timer 2 (o dal main, con gli interrupt disabilitati, dopo il comando "priorita").
+//Quando passa al locale ferma la regolazione e il programma: se uno dei due era attivo, il valore generato in quel momento
+//diventa il setpoint remoto, da cui il canale ripartirà quando la priorità tornerà al remoto.
+//Il valore scelto dall'arbitro viene applicato come ogni duty cycle impostato a mano (con la rampa, se è attiva).
+void sorgenti_passo(void){
+	
+	unsigned int dc;
+	unsigned char esito;
+	
+#if PRIORITA_INTERRUTTORE
+	arbitro.prioritaLocale = (PINB & (1<<PINB7)) == 0;
+#endif
+	esito = arbitro_passo(&arbitro, millisecondi, &dc);
+	
+	if(arbitro.sorgente == ARBITRO_LOCALE){
+		if((esito & ARBITRO_CAMBIO) && (regolazioneAttiva || programma.attivo))
+		arbitro.remoto.duty = canali[CANALE_PRINCIPALE].spento ? 0 : canali[CANALE_PRINCIPALE].duty;
+		
+		regolazioneAttiva = 0;
+		programma.attivo = 0;
+	}
+	
+	if(esito & ARBITRO_APPLICA)
+	impostaCanale(CANALE_PRINCIPALE, dc);
+	
+}
+
+//Segnala sul terminale i cambi di priorità, di timeout e di sorgente decisi nelle ISR e aggiorna il led:
+//acceso quando comanda il remoto, spento quando comandano i dip switch.
+void gestisciSorgenti(void){
+	
+	unsigned char sorgente = arbitro.sorgente;
+	char priorita = arbitro.prioritaLocale;
+	char scaduto = arbitro.scaduto;
+	
+	if(priorita != prioritaStampata){
+		prioritaStampata = priorita;
+		risposta_P(priorita ? PSTR("\n-> Priorità al locale") : PSTR("\n-> Priorità al remoto"));
+	}
+	
+	if(scaduto != scadutoStampato){
+		scadutoStampato = scaduto;
+		if(scaduto)
+		risposta_P(PSTR("\n-> Remoto fermo da oltre il timeout"));
+	}
+	
+	if(sorgente == sorgenteStampata)
+	return;
+	
+	sorgenteStampata = sorgente;
+	
+	if(sorgente == ARBITRO_REMOTO)
+	LedOn();
+	else
+	LedOff();
+	
+	//Il canale può essere spento dal valore della sorgente o dalla sovracorrente, che stampaDC() già segnala.
+	if(canali[CANALE_PRINCIPALE].spento && !corrente.scattata)
+	risposta_P(sorgente == ARBITRO_REMOTO ? PSTR("\n-> Comanda il remoto: Motore Spento !") : PSTR("\n-> Comandano i Dip Switch: Motore Spento !"));
+	else
+	stampaDC(sorgente == ARBITRO_REMOTO ? PSTR("\n-> Comanda il remoto: Duty Cycle a ") : PSTR("\n-> Comandano i Dip Switch: Duty Cycle a "), CANALE_PRINCIPALE);
+	
+}
+
+//Scrive in p l'età di un setpoint ("1234 ms fa" oppure "oltre 60 s fa") e restituisce la fine della stringa.
+char *formattaEta(char *p, const struct setpointDuty *s, unsigned int ora){
+	
+	unsigned int eta = arbitro_eta(s, ora);
+	
+	if(eta == ARBITRO_ETA_MAX){
+		strcpy_P(p, PSTR("oltre 60 s fa"));
+		return p + strlen(p);
+	}
+	
+	p = formattaIntero(p, eta);
+	strcpy_P(p, PSTR(" ms fa"));
+	
+	return p + strlen(p);
+	
+}
+
+//Comando "priorita": chi ha la priorità, chi comanda, gli ultimi setpoint delle due sorgenti con la loro età e il timeout.
+void stampaPriorita(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	struct arbitroDuty a;
+	unsigned int ora;
+	
+	if(modoMacchina)
+	return;
+	
+	cli();
+	a = arbitro;
+	ora = millisecondi;
+	sei();
+	
+	strcpy_P(buf, a.prioritaLocale ? PSTR("\n-> Priorità al locale") : PSTR("\n-> Priorità al remoto"));
+	strcpy_P(buf + strlen(buf), PRIORITA_INTERRUTTORE ? PSTR(" (interruttore)") : PSTR(" (pulsante)"));
+	USART_TX_string(buf);
+	USART_TX_string_P(a.sorgente == ARBITRO_LOCALE ? PSTR("Comandano i Dip Switch") : PSTR("Comanda il remoto"));
+	
+	strcpy_P(buf, PSTR("Locale: "));
+	if(a.locale.numero){
+		p = formattaDC(buf + strlen(buf), a.locale.duty);
+		strcpy_P(p, PSTR(" %, "));
+		formattaEta(p + strlen(p), &a.locale, ora);
+	}
+	else
+	strcpy_P(buf + strlen(buf), PSTR("nessun valore valido dai Dip Switch"));
+	USART_TX_string(buf);
+	
+	strcpy_P(buf, PSTR("Remoto: "));
+	p = formattaDC(buf + strlen(buf), a.remoto.duty);
+	strcpy_P(p, PSTR(" %, "));
+	formattaEta(p + strlen(p), &a.remoto, ora);
+	USART_TX_string(buf);
+	
+	strcpy_P(buf, PSTR("Timeout del remoto: "));
+	if(a.timeout){
+		p = formattaIntero(buf + strlen(buf), a.timeout);
+		strcpy_P(p, a.scaduto ? PSTR(" ms (scaduto)") : PSTR(" ms"));
+	}
+	else
+	strcpy_P(buf + strlen(buf), PSTR("disattivato"));
+	USART_TX_string(buf);
+	
+}
+
+#if BENCHMARK_DUTY
+#if PWM_TIMER != 0
+#error "BENCHMARK_DUTY usa il timer 1 come contatore dei cicli: serve PWM_TIMER 0"
+#endif
+//Calcolo precedente del compare, tenuto solo come riferimento: duty cycle in percento e TOP in variabili volatile a 8 bit,
+//moltiplicazione e divisione intere, poi conversione in virgola mobile per ceil() e di nuovo in intero.
+static volatile unsigned char topVecchio = (unsigned char) UserTop;
+static volatile unsigned char valoreDCVecchio = (unsigned char) DInit;
+
+//Misura i cicli di clock di un aggiornamento del compare del canale principale, con il vecchio calcolo
+//(OCR0B = ceil(valoreDC*top/100)) e con pwm_imposta_duty(), che legge tabellaOCR[] dalla flash, contando con il timer 1
+//senza prescaler e togliendo il costo della misura stessa (misura a vuoto). Alla fine il compare torna al valore attuale.
+void benchmark_duty(void){
+	
+	unsigned int inizio, vuoto, vecchia, nuova;
+	unsigned char sreg = SREG;
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	cli();
+	TCCR1B = (1<<CS10);
+	
+	inizio = TCNT1;
+	vuoto = TCNT1 - inizio;
+	
+	inizio = TCNT1;
+	OCR0B = ceil(valoreDCVecchio*topVecchio/100);
+	vecchia = TCNT1 - inizio - vuoto;
+	
+	inizio = TCNT1;
+	pwm_imposta_duty(CANALE_PRINCIPALE, rampe[CANALE_PRINCIPALE].attuale);
+	nuova = TCNT1 - inizio - vuoto;
+	
+	base_tempi_init();
+	SREG = sreg;
+	
+	strcpy_P(buf, PSTR("Duty cycle: ceil() "));
+	p = formattaIntero(buf + strlen(buf), vecchia);
+	strcpy_P(p, PSTR(" cicli, tabella "));
+	p = formattaIntero(p + strlen(p), nuova);
+	strcpy_P(p, PSTR(" cicli"));
+	USART_TX_string(buf);
+	
+}
+#endif
+
+#if BENCHMARK_DIP
+#if PWM_TIMER != 0
+#error "BENCHMARK_DIP usa il timer 1 come contatore dei cicli: serve PWM_TIMER 0"
+#endif
+//Decodifica precedente, tenuta solo come riferimento per il confronto: un char per ogni bit,
+//conversione con un ciclo e una potenza di 2 calcolata a sua volta con un ciclo.
+static volatile char unitaVecchie[4], decineVecchie[4], centinaiaVecchie[1];
+
+static char potenzaVecchia(char base, char esponente){
+	
+	char pot = 1;
+	
+	for (int i = 0; i < esponente; i++)
+	pot = pot * base;
+	
+	return pot;
+	
+}
+
+static char binToDecVecchia(volatile char cifreBin[], char dimensione){
+	
+	char dec = 0;
+	
+	for(int i=0; i<dimensione; i++)
+	dec = dec + (cifreBin[dimensione-1-i] * potenzaVecchia(2, i));
+	
+	return dec;
+	
+}
+
+static unsigned char decodificaVecchia(void){
+	
+	unsigned char u, ts, hs;
+	
+	unitaVecchie[3] = !((PINC & (1<<PINC0)) == 0);
+	unitaVecchie[2] = !((PINC & (1<<PINC1)) == 0);
+	unitaVecchie[1] = !((PINC & (1<<PINC2)) == 0);
+	unitaVecchie[0] = !((PINC & (1<<PINC3)) == 0);
+	decineVecchie[3] = !((PIND & (1<<PIND2)) == 0);
+	decineVecchie[2] = !((PIND & (1<<PIND3)) == 0);
+	decineVecchie[1] = !((PIND & (1<<PIND4)) == 0);
+	decineVecchie[0] = !((PIND & (1<<PIND7)) == 0);
+	centinaiaVecchie[0] = !((PINB & (1<<PINB2)) == 0);
+	
+	u = binToDecVecchia(unitaVecchie, 4);
+	ts = binToDecVecchia(decineVecchie, 4);
+	hs = binToDecVecchia(centinaiaVecchie, 1);
+	
+	return (ts > 9 || u > 9) ? DIP_NON_VALIDO : (unsigned char)(100*hs + 10*ts + u);
+	
+}
+
+//Misura i cicli di clock della lettura e decodifica dei dip switch, con la vecchia e con la nuova funzione,
+//contando con il timer 1 senza prescaler e togliendo il costo della misura stessa (misura a vuoto).
+void benchmark_dip(void){
+	
+	volatile unsigned char risultato;
+	unsigned int inizio, vuoto, vecchia, nuova;
+	unsigned char sreg = SREG;
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	cli();
+	TCCR1B = (1<<CS10);
+	
+	inizio = TCNT1;
+	vuoto = TCNT1 - inizio;
+	
+	inizio = TCNT1;
+	risultato = decodificaVecchia();
+	vecchia = TCNT1 - inizio - vuoto;
+	
+	inizio = TCNT1;
+	risultato = dip_switch_valore(dip_switch_leggi());
+	nuova = TCNT1 - inizio - vuoto;
+	
+	base_tempi_init();
+	SREG = sreg;
+	(void) risultato;
+	
+	strcpy_P(buf, PSTR("Decodifica dip switch: vecchia "));
+	p = formattaIntero(buf + strlen(buf), vecchia);
+	strcpy_P(p, PSTR(" cicli, nuova "));
+	p = formattaIntero(p + strlen(p), nuova);
+	strcpy_P(p, PSTR(" cicli"));
+	USART_TX_string(buf);
+	
+}
+#endif
+
+#if BENCHMARK_PID
+#if PWM_TIMER != 0
+#error "BENCHMARK_PID usa il timer 1 come contatore dei cicli: serve PWM_TIMER 0"
+#endif
+//Misura i cicli della parte di calcolo di regolazione_passo() (misura della velocità e passo del PID),
+//con velocità da fermo a oltre il massimo ed errori che portano l'uscita in saturazione, e stampa il caso peggiore.
+//La divisione a 32 bit della misura dura più o meno a seconda degli operandi, per questo si provano più casi.
+void benchmark_pid(void){
+	
+	static const unsigned long durate[] = {1, 2000, 60000, 1000000, 0x7FFFFFFF};
+	static const unsigned char impulsi[] = {1, 3, 10};
+	static const unsigned int riferimenti[] = {0, 1500, RPM_MAX};
+	struct regolatorePID prova = {PID_KP, PID_KI, PID_KD, DC_MAX, 0, 0};
+	volatile unsigned int risultato;
+	unsigned long durata;
+	unsigned int inizio, vuoto, cicli, peggiore = 0;
+	unsigned char d, i, r;
+	unsigned char sreg = SREG;
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	cli();
+	TCCR1B = (1<<CS10);
+	
+	inizio = TCNT1;
+	vuoto = TCNT1 - inizio;
+	
+	for(d = 0; d < sizeof(durate) / sizeof(durate[0]); d++)
+	for(i = 0; i < sizeof(impulsi); i++)
+	for(r = 0; r < sizeof(riferimenti) / sizeof(riferimenti[0]); r++){
+		durata = durate[d];
+		inizio = TCNT1;
+		risultato = pid_passo(&prova, riferimenti[r], tach_rpm(impulsi[i], durata, TACH_COSTANTE));
+		cicli = TCNT1 - inizio - vuoto;
+		
+		if(cicli > peggiore)
+		peggiore = cicli;
+	}
+	
+	base_tempi_init();
+	SREG = sreg;
+	(void) risultato;
+	
+	strcpy_P(buf, PSTR("Regolazione di velocità: caso peggiore "));
+	p = formattaIntero(buf + strlen(buf), peggiore);
+	strcpy_P(p, PSTR(" cicli"));
+	USART_TX_string(buf);
+	
+}
+#endif
+
+#if BENCHMARK_COMANDI
+#if PWM_TIMER != 0
+#error "BENCHMARK_COMANDI usa il timer 1 come contatore dei cicli: serve PWM_TIMER 0"
+#endif
+//Misura i cicli del parser dei comandi testuali per ogni byte di una riga di prova, con parole, numeri e separatori,
+//e stampa il caso peggiore e la media. Il parser di prova è separato da quello della seriale, che non viene toccato.
+void benchmark_comandi(void){
+	
+	static const char riga[] PROGMEM = "set 42.5 3; step -10 1; rampa 12.5 lin; telemetria 50; baud 115200; macchina 0\n";
+	struct parserComandi prova;
+	volatile unsigned char risultato;
+	unsigned int inizio, vuoto, cicli, peggiore = 0;
+	unsigned long totale = 0;
+	unsigned char i;
+	char c;
+	unsigned char sreg = SREG;
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	comandi_reset(&prova);
+	
+	cli();
+	TCCR1B = (1<<CS10);
+	
+	inizio = TCNT1;
+	vuoto = TCNT1 - inizio;
+	
+	for(i = 0; (c = pgm_read_byte(&riga[i])) != '\0'; i++){
+		inizio = TCNT1;
+		risultato = comandi_byte(&prova, c);
+		cicli = TCNT1 - inizio - vuoto;
+		
+		totale += cicli;
+		if(cicli > peggiore)
+		peggiore = cicli;
+	}
+	
+	base_tempi_init();
+	SREG = sreg;
+	(void) risultato;
+	
+	strcpy_P(buf, PSTR("Parser dei comandi: caso peggiore "));
+	p = formattaIntero(buf + strlen(buf), peggiore);
+	strcpy_P(p, PSTR(" cicli per byte, media "));
+	p = formattaIntero(p + strlen(p), totale / i);
+	strcpy_P(p, PSTR(" cicli"));
+	USART_TX_string(buf);
+	
+}
+#endif
+
+#if PROFILO
+//Legge il timer 1 con gli interrupt disabilitati. La lettura di un registro a 16 bit passa dal registro TEMP, comune
+//a tutti i registri a 16 bit del timer: una ISR che legge TCNT1 o ICR1 tra i due byte renderebbe sbagliata la parte alta.
+static inline unsigned int profilo_tempo(void){
+	
+	unsigned int t;
+	unsigned char sreg = SREG;
+	
+	cli();
+	t = TCNT1;
+	SREG = sreg;
+	
+	return t;
+	
+}
+
+//Aggiunge una durata (in conteggi del timer 1) al profilo di un punto. Viene chiamata alla fine delle ISR, quindi deve essere breve:
+//è inline per evitare la chiamata, che nella ISR obbligherebbe a salvare tutti i registri, e la classe si trova con al più 7 spostamenti.
+static inline void profilo_registra(unsigned char punto, unsigned int durata){
+	
+	struct profilo *p = &profili[punto];
+	unsigned int resto = durata >> 1;
+	unsigned char classe = 0;
+	
+	if(p->conteggio == 0 || durata < p->minimo)
+	p->minimo = durata;
+	if(durata > p->massimo)
+	p->massimo = durata;
+	
+	if(p->somma > 0xFFFFFFFFUL - 0xFFFF || p->campioni == 0xFFFF){
+		p->somma >>= 1;
+		p->campioni >>= 1;
+	}
+	p->somma += durata;
+	p->campioni++;
+	p->conteggio++;
+	
+	while(resto && classe < PROFILO_CLASSI - 1){
+		resto >>= 1;
+		classe++;
+	}
+	if(p->classi[classe] != 0xFFFF)
+	p->classi[classe]++;
+	
+}
+
+#endif
+
+//Azzera i contatori degli errori di ricezione, il tempo attivo e in sonno e il profilo di tutti i punti ("stats 0").
+//I byte persi per il buffer pieno restano: fanno parte dei contatori letti con il protocollo binario.
+void azzeraStatistiche(void){
+	
+	unsigned char sreg = SREG;
+	
+	cli();
+	erroriOverrun = 0;
+	erroriFrame = 0;
+	tempoAttivo = 0;
+	tempoSonno = 0;
+#if PROFILO
+	memset(profili, 0, sizeof(profili));
+#endif
+	SREG = sreg;
+	
+}
+
+//Stampa i contatori degli errori di ricezione della USART, i salvataggi delle impostazioni in EEPROM e, con PROFILO 1, il profilo di ogni punto misurato
+//che è stato eseguito almeno una volta: passaggi, durata minima, media e massima in cicli e istogramma delle durate.
+void stampaStatistiche(void){
+	
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	unsigned int overrun, frame, persi;
+	unsigned long attivo, totale;
+	unsigned char sreg = SREG;
+#if PROFILO
+	struct profilo copia;
+	unsigned char i, k;
+#endif
+	
+	cli();
+	overrun = erroriOverrun;
+	frame = erroriFrame;
+	persi = byteRxPersi;
+	SREG = sreg;
+	
+	strcpy_P(buf, PSTR("\n-> Seriale: overrun "));
+	p = formattaIntero(buf + strlen(buf), overrun);
+	strcpy_P(p, PSTR(", frame "));
+	p = formattaIntero(p + strlen(p), frame);
+	strcpy_P(p, PSTR(", buffer pieno "));
+	formattaIntero(p + strlen(p), persi);
+	risposta(buf);
+	
+	//Tempo attivo in millesimi del totale, stampato come percentuale con un decimale.
+	cli();
+	attivo = tempoAttivo;
+	totale = tempoAttivo + tempoSonno;
+	SREG = sreg;
+	
+	strcpy_P(buf, PSTR("CPU attiva "));
+	p = formattaDC(buf + strlen(buf), totale >= 1000 ? attivo / (totale / 1000) : 1000);
+	strcpy_P(p, PSTR("% su "));
+	p = formattaInteroLungo(p + strlen(p), totale / SWPWM_PERIODO);
+	strcpy_P(p, PSTR(" ms, il resto in sleep"));
+	risposta(buf);
+	
+	strcpy_P(buf, PSTR("EEPROM: impostazioni salvate "));
+	p = formattaIntero(buf + strlen(buf), impostazioniSalvate);
+	strcpy_P(p, PSTR(" volte, prossimo slot "));
+	formattaIntero(p + strlen(p), eepromSlot);
+	risposta(buf);
+	
+#if PROFILO
+	risposta_P(PSTR("Durate in cicli (min/media/max), classi <16 <32 <64 ... >=1024"));
+	
+	for(i = 0; i < N_PROFILI; i++){
+		
+		//Copia con gli interrupt disabilitati: le ISR aggiornano il proprio profilo in qualunque momento.
+		cli();
+		copia = profili[i];
+		SREG = sreg;
+		
+		if(copia.conteggio == 0)
+		continue;
+		
+		strcpy_P(buf, nomiProfilo[i]);
+		strcpy_P(buf + strlen(buf), PSTR(": "));
+		p = formattaInteroLungo(buf + strlen(buf), copia.conteggio);
+		strcpy_P(p, PSTR(" volte"));
+		risposta(buf);
+		
+		strcpy_P(buf, PSTR("  "));
+		p = formattaInteroLungo(buf + strlen(buf), (unsigned long) copia.minimo * 8);
+		*p++ = '/';
+		p = formattaInteroLungo(p, copia.somma / copia.campioni * 8 + copia.somma % copia.campioni * 8 / copia.campioni);
+		*p++ = '/';
+		p = formattaInteroLungo(p, (unsigned long) copia.massimo * 8);
+		strcpy_P(p, PSTR(" cicli"));
+		risposta(buf);
+		
+		strcpy_P(buf, PSTR("  classi"));
+		p = buf + strlen(buf);
+		for(k = 0; k < PROFILO_CLASSI; k++){
+			*p++ = ' ';
+			p = formattaIntero(p, copia.classi[k]);
+		}
+		risposta(buf);
+	}
+#endif
+	
+}
+
+//Accoda un evento. Viene chiamata solo dalle ISR: se la coda è piena l'evento viene scartato.
+void postaEvento(unsigned char e){
+	
+	unsigned char prossima = (eventiTesta + 1) & (EVENTI_BUF - 1);
+	
+	if(prossima != eventiCoda){
+		eventi[eventiTesta] = e;
+		eventiTesta = prossima;
+	}
+	
+}
+
+//Preleva un evento dalla coda senza bloccare.
+//Restituisce 1 se è stato prelevato un evento, 0 se la coda è vuota.
+char prelevaEvento(unsigned char *e){
+	
+	if(eventiCoda == eventiTesta)
+	return 0;
+	
+	*e = eventi[eventiCoda];
+	eventiCoda = (eventiCoda + 1) & (EVENTI_BUF - 1);
+	
+	return 1;
+	
+}
+
+//Gestisce, nel main, gli eventi accodati dalle ISR.
+//In questo modo PresentState viene modificato solo dal main e non può cambiare a metà di uno stato.
+void gestisciEventi(void){
+	
+	unsigned char e;
+	unsigned char valore;
+	char buf[MAX_STR_LEN + 1];
+	char *p;
+	
+	while(prelevaEvento(&e)){
+		
+		switch(e){
+			
+			case EventoDipStabile:
+			//I dip switch sono fermi da DIP_STABILE_MS: la ISR ha già passato il valore all'arbitro, qui resta solo il messaggio.
+			//La codifica bcd non permette che una cifra superi il 9 e il duty cycle non può superare il 100%:
+			//questi valori non diventano un setpoint, e il locale tiene il precedente.
+			cli();
+			valore = dip_switch_valore(dipStabile);
+			sei();
+			
+			if(valore > 100)
+			risposta_P(PSTR("\n-> Numero inserito non ammesso."));
+			
+			else if(arbitro.sorgente == ARBITRO_REMOTO){
+				strcpy_P(buf, PSTR("\n-> Dip Switch a "));
+				p = formattaIntero(buf + strlen(buf), valore);
+				strcpy_P(p, PSTR(" %: comanda il remoto"));
+				risposta(buf);
+			}
+			
+			else if(valore == 0)
+			risposta_P(PSTR("\n-> Motore spento!"));
+			
+			else
+			stampaDC(PSTR("\n-> Duty Cycle impostato a "), CANALE_PRINCIPALE);
+			break;
+			
+			case EventoSovracorrente:
+			//La ISR dell'ADC ha già spento il canale principale: qui resta solo l'avviso.
+			USART_TX_string_P(PSTR("\n-> Sovracorrente: motore spento, scrivi \"corrente reset\" per riarmare la protezione"));
+			break;
+			
+			case EventoProgrammaFinito:
+			stampaDC(PSTR("\n-> Programma finito: Duty Cycle a "), CANALE_PRINCIPALE);
+			break;
+			
+		}
+	}
+	
+}
+
+//La seguente ISR ha il compito di gestire la priorità tra le sorgenti del duty cycle.
+//Quando il pulsante, sul pin 7 del portB, viene premuto, la priorità passa all'altra sorgente: l'arbitro applica il suo valore
+//al prossimo tick del timer 2. Il messaggio lo stampa il main, in gestisciSorgenti(): la stampa richiederebbe decine di
+//millisecondi con gli interrupt disabilitati, durante i quali il tick e la seriale resterebbero fermi.
+//Conta solo il fronte di discesa, con il pin fermo da PULSANTE_FERMO_MS (vedi pulsanteFermo).
+//Con PRIORITA_INTERRUTTORE il pin è un interruttore, letto ad ogni tick dalla ISR del timer 2, e questo interrupt è spento.
+ISR(PCINT0_vect){
+	
+	PROFILO_INIZIO();
+	
+#if !PRIORITA_INTERRUTTORE
+	unsigned char livello = PINB & (1<<PINB7);
+	
+	if(!livello && pulsanteLivello && !pulsanteFermo)
+	arbitro.prioritaLocale = !arbitro.prioritaLocale;
+	
+	pulsanteLivello = livello;
+	pulsanteFermo = PULSANTE_FERMO_MS;
+#endif
+	
+	PROFILO_FINE(ProfiloPCINT0);
+	
+}
+
+#if PWM_TIMER == 0
+//Pin change su RXD (PD0), abilitato solo durante l'autobaud: salva l'istante del primo e dell'ultimo fronte.
+ISR(PCINT2_vect){
+	
+	PROFILO_INIZIO();
+	
+	//L'istante viene letto per primo, per non sommare alla misura il tempo speso nella ISR.
+	unsigned int istante = TCNT1;
+	unsigned char pind = PIND;
+	unsigned char cambiati = pind ^ autobaudPIND;
+	
+	autobaudPIND = pind;
+	
+	//Il primo fronte valido è la discesa del bit di start.
+	if(autobaudAttivo && (cambiati & (1<<PIND0)) && (autobaudFronti || !(pind & (1<<PIND0)))){
+		if(autobaudFronti == 0)
+		autobaudInizio = istante;
+		autobaudFine = istante;
+		autobaudUltimoMs = millisecondi;
+		if(autobaudFronti < 255)
+		autobaudFronti++;
+	}
+	
+	PROFILO_FINE(ProfiloPCINT2);
+	
+}
+#endif
+
+#if PWM_TIMER == 0
+//Overflow del timer 1 (ogni 32.768 ms): parte alta del tempo del tachimetro.
+ISR(TIMER1_OVF_vect){
+	
+	tachOverflow++;
+	
+}
+
+//Impulso del tachimetro. ICR1 contiene l'istante del fronte, salvato dall'hardware.
+//Se l'overflow è avvenuto ma la sua ISR non è ancora stata eseguita, e la cattura è successiva (valore basso), lo conto qui.
+ISR(TIMER1_CAPT_vect){
+	
+	unsigned int cattura = ICR1;
+	unsigned int overflow = tachOverflow;
+	PROFILO_INIZIO();
+	
+	if((TIFR1 & (1<<TOV1)) && cattura < 0x8000)
+	overflow++;
+	
+	tachUltimo = ((unsigned long) overflow << 16) | cattura;
+	tachImpulsi++;
+	
+	PROFILO_FINE(ProfiloTIMER1_CAPT);
+	
+}
+
+//Modbus RTU: 3.5 caratteri senza byte ricevuti, il frame è finito e i suoi byte arrivano fino a rxTesta.
+//Il confronto resta disabilitato fino al prossimo byte, così scatta una volta sola per frame.
+ISR(TIMER1_COMPA_vect){
+	
+	PROFILO_INIZIO();
+	
+	TIMSK1 &= ~(1<<OCIE1A);
+	modbusFine = rxTesta;
+	modbusSilenzio = 1;
+	
+	PROFILO_FINE(ProfiloTIMER1_COMPA);
+	
+}
+#endif
+
+//ISR di registro dati vuoto: trasmette il prossimo carattere del buffer circolare.
+//Quando il buffer si svuota, l'interrupt viene disabilitato fino al prossimo USART_TX_char().
+ISR(USART_UDRE_vect){
+	
+	PROFILO_INIZIO();
+	
+	if(txCoda != txTesta){
+		hal_usart_scrivi(txBuf[txCoda]);
+		txCoda = (txCoda + 1) & (USART_TX_BUF - 1);
+	}
+	
+	//Con l'ultimo byte azzero TXC0 (si azzera scrivendo '1'): tornerà a '1' quando il byte sarà uscito tutto.
+	if(txCoda == txTesta){
+		UCSR0A |= (1<<TXC0);
+		UCSR0B &= ~(1<<UDRIE0);
+	}
+	
+	PROFILO_FINE(ProfiloUSART_UDRE);
+	
+}
+
+//ISR di ricezione: salva il carattere nel buffer circolare.
+//Se il buffer è pieno il carattere viene scartato e contato.
+//I bit di errore di UCSR0A valgono per il carattere in UDR0, quindi vanno letti prima di UDR0.
+ISR(USART_RX_vect){
+	
+	PROFILO_INIZIO();
+	unsigned char stato = UCSR0A;
+	char c = UDR0;
+	unsigned char prossima = (rxTesta + 1) & (USART_RX_BUF - 1);
+	
+	if(stato & (1<<DOR0))
+	erroriOverrun++;
+	if(stato & (1<<FE0))
+	erroriFrame++;
+	
+	if(prossima != rxCoda){
+		rxBuf[rxTesta] = c;
+		rxTesta = prossima;
+	}
+	else
+	byteRxPersi++;
+	
+#if PWM_TIMER == 0
+	//Modbus RTU: ogni byte riavvia la misura del silenzio che chiude il frame.
+	if(modbusIndirizzo){
+		OCR1A = TCNT1 + modbusT35;
+		TIFR1 = (1<<OCF1A);
+		TIMSK1 |= (1<<OCIE1A);
+	}
+#endif
+	
+	PROFILO_FINE(ProfiloUSART_RX);
+	
+}
+
+//ISR di EEPROM pronta: scrive il prossimo byte del record (o del programma) che è diverso da quello già in EEPROM.
+//L'interrupt resta attivo finchè la EEPROM è libera, quindi si disabilita quando il record è finito.
+ISR(EE_READY_vect){
+	
+	PROFILO_INIZIO();
+	unsigned char dato;
+	
+	while(eepromIndice < (eepromProgramma ? PROGRAMMA_EEPROM_DIM : IMPOSTAZIONI_DIM)){
+		dato = eepromProgramma ? programma_eeprom_byte(eepromIndice) : eepromRecord[eepromIndice];
+		if(eeprom_leggi(eepromIndirizzo + eepromIndice++) != dato){
+			//EEAR è già quello del byte letto. EEMPE e poi EEPE entro 4 cicli, con gli interrupt disabilitati.
+			EEDR = dato;
+			hal_eeprom_scrivi();
+			PROFILO_FINE(ProfiloEE_READY);
+			return;
+		}
+	}
+	
+	EECR &= ~(1<<EERIE);
+	eepromProgramma = 0;
+	
+	PROFILO_FINE(ProfiloEE_READY);
+	
+}
+
+//Campione della corrente del motore, preso a metà dell'impulso del canale principale (corrente_avvia()).
+//Quando la protezione scatta l'uscita viene scollegata qui, come in pwm_off(), senza passare dal main: tra il campione
+//oltre la soglia e lo spegnimento passa solo questa ISR. Le uscite dei timer si modificano sempre con gli interrupt
+//disabilitati (pwm_applica(), pwm_on(), pwm_off()) e guardano il flag spento, quindi nessuno può ricollegare OC0B a metà
+//della scrittura; pwm_off() viene comunque ripetuta ad ogni campione finchè il guasto resta memorizzato.
+ISR(ADC_vect){
+	
+	PROFILO_INIZIO();
+	
+	#if PWM_TIMER == 0
+	unsigned char t0;
+	unsigned int t1, attesa, periodo;
+	
+	//Fast PWM sul timer 0: programmo il prossimo avvio a metà dell'impulso di OC0B. Timer 0 e timer 1 usano lo stesso
+	//prescaler, quindi la distanza tra i due contatori resta fissa: il centro arriva tra (OCR0B/2 - TCNT0) passi del timer 0.
+	//Il confronto scatta CORRENTE_ANTICIPO conteggi prima del centro, il tempo che l'ADC impiega a prendere il campione.
+	if(pwmModo == PWM_FAST){
+		t0 = TCNT0;
+		t1 = TCNT1;
+		attesa = (unsigned char) ((OCR0B >> 1) - t0);
+		
+		if(correnteSpostamento < 0){
+			attesa >>= 3;
+			periodo = 256 >> 3;
+		}
+		else{
+			attesa <<= correnteSpostamento;
+			periodo = 256U << correnteSpostamento;
+		}
+		
+		if(attesa < 2 * CORRENTE_ANTICIPO) //Centro troppo vicino per questa ISR: prendo quello del periodo successivo.
+		attesa += periodo;
+		
+		OCR1B = t1 + attesa - CORRENTE_ANTICIPO;
+	}
+	#endif
+	
+	//L'avvio arriva sul fronte di salita del flag del timer: azzero il flag per il prossimo avvio. Il flag di overflow
+	//lo azzera già la ISR della rampa, quando è abilitata, e non va toccato perchè la rampa perderebbe un passo.
+	if(pwmModo == PWM_FAST)
+	TIFR1 = (1<<OCF1B);
+	else if(!(TIMSK_PWM & (1<<TOIE_PWM)))
+	TIFR_PWM = (1<<TOV_PWM);
+	
+	if(corrente_campione(&corrente, ADCH))
+	postaEvento(EventoSovracorrente);
+	
+	if(corrente.scattata)
+	pwm_off(CANALE_PRINCIPALE);
+	
+	PROFILO_FINE(ProfiloADC);
+	
+}
+
+//Passo della rampa del duty cycle, all'overflow del timer del PWM (inizio del periodo in fast PWM, BOTTOM in phase correct).
+//L'interrupt è abilitato solo finchè c'è una rampa in corso. Sopra 1 kHz di PWM si esegue un overflow ogni rampaDivisore.
+ISR(PWM_OVF_vect){
+	
+	struct rampaPWM *r;
+	unsigned char c;
+	char inCorso = 0;
+	char ricalcolaSW = 0;
+	unsigned int obiettivo, lineare, indice, curva, delta;
+	unsigned char a, b;
+	PROFILO_INIZIO();
+	
+	if(--rampaConteggio){
+		PROFILO_FINE(ProfiloPWM_OVF);
+		return;
+	}
+	
+	rampaConteggio = rampaDivisore;
+	
+	for(c = 0; c < N_CANALI; c++){
+		
+		r = &rampe[c];
+		obiettivo = canali[c].duty;
+		
+		if(canali[c].spento || r->attuale == obiettivo)
+		continue;
+		
+		if(rampaPasso == 0 || rampaPasso >= ((unsigned long) r->distanza << RAMPA_FRAZ) - r->percorso)
+		r->attuale = obiettivo;
+		
+		else{
+			r->percorso += rampaPasso;
+			lineare = r->percorso >> RAMPA_FRAZ;
+			
+			if(rampaForma == RAMPA_S){
+				//Posizione nella tabella con 8 bit frazionari, poi interpolazione lineare tra due punti.
+				if(r->scala == 0)
+				r->scala = ((unsigned int) RAMPA_PUNTI << 8) / r->distanza;
+				
+				indice = lineare * r->scala;
+				a = pgm_read_byte(&curvaS[indice >> 8]);
+				b = (indice >> 8) < RAMPA_PUNTI ? pgm_read_byte(&curvaS[(indice >> 8) + 1]) : a;
+				curva = ((unsigned int) a << 8) + (b - a) * (indice & 0xFF);
+				delta = ((unsigned long) r->distanza * curva) >> 16;
+			}
+			else
+			delta = lineare;
+			
+			r->attuale = (obiettivo > r->partenza) ? r->partenza + delta : r->partenza - delta;
+			inCorso = 1;
+		}
+		
+		if(canali[c].uscita == USCITA_SW)
+		ricalcolaSW = 1;
+		else
+		pwm_imposta_duty(c, r->attuale);
+	}
+	
+	if(ricalcolaSW)
+	swpwm_ricalcola();
+	
+	if(!inCorso)
+	TIMSK_PWM &= ~(1<<TOIE_PWM);
+	
+	PROFILO_FINE(ProfiloPWM_OVF);
+	
+}
+
+//Inizio del periodo del PWM software, ogni millisecondo: aggiorno il contatore dei millisecondi.
+//Se il main ha preparato una nuova lista di fronti la rendo attiva,
+//poi porto alti i pin dei canali accesi e programmo il compare B sul primo fronte di discesa.
+ISR(TIMER2_COMPA_vect){
+	
+	struct tabellaFronti *t;
+	unsigned int campione;
+	unsigned char valore;
+	char fine;
+	PROFILO_INIZIO();
+	
+	millisecondi++;
+	
+	if(frontiPronti){
+		frontiAttivi = !frontiAttivi;
+		frontiPronti = 0;
+	}
+	
+	t = &frontiSW[frontiAttivi];
+	
+	PORTB |= t->accendi[PORTA_B];
+	PORTC |= t->accendi[PORTA_C];
+	PORTD |= t->accendi[PORTA_D];
+	
+	prossimoFronte = 0;
+	
+	if(t->n){
+		OCR2B = t->fronte[0].istante;
+		TIFR2 = (1<<OCF2B);
+		TIMSK2 |= (1<<OCIE2B);
+	}
+	else
+	TIMSK2 &= ~(1<<OCIE2B);
+	
+	//Da qui in poi gli interrupt possono tornare abilitati: un tick che arriva prima della fine esce subito (vedi tickInCorso).
+	if(tickInCorso){
+		tickArretrati++;
+		PROFILO_FINE(ProfiloTIMER2_COMPA);
+		return;
+	}
+	
+	tickInCorso = 1;
+	
+	for(;;){
+		//Filtro dei dip switch, dopo i fronti del PWM software per non ritardarli. Un nuovo valore diventa il setpoint locale
+		//al più DIP_STABILE_MS millisecondi dopo l'ultimo movimento degli switch.
+		campione = dip_switch_leggi();
+		
+		if(campione != dipCampione){
+			dipCampione = campione;
+			dipContatore = 0;
+		}
+		else if(dipContatore < DIP_STABILE_MS && ++dipContatore == DIP_STABILE_MS && campione != dipStabile){
+			dipStabile = campione;
+			valore = dip_switch_valore(campione);
+			if(valore <= 100)
+			arbitro_locale(&arbitro, valore * (DC_MAX / 100), millisecondi);
+			postaEvento(EventoDipStabile);
+		}
+		
+#if !PRIORITA_INTERRUTTORE
+		//Attesa del pulsante dopo l'ultimo fronte di PB7 (vedi ISR(PCINT0_vect)).
+		if(pulsanteFermo)
+		pulsanteFermo--;
+		
+#endif
+		//Arbitro tra locale e remoto, prima del programma e della regolazione: quando comanda il locale li ferma,
+		//e il valore scelto arriva sul canale in questo stesso tick.
+		sorgenti_passo();
+		
+		//Programma del duty cycle: un passo al millisecondo. Il tempo viene dal quarzo, come il PWM, quindi non ha deriva e ha solo
+		//il ritardo di questa ISR. All'inizio di ogni tratto c'è una divisione a 32 bit (circa 40 us): come per la regolazione
+		//riabilito gli interrupt, e il duty cycle si scrive con gli interrupt di nuovo disabilitati. Se la protezione da sovracorrente
+		//ferma il programma durante il passo, il duty cycle non viene più scritto.
+		if(programma.attivo){
+			sei();
+			fine = programma_passo(&programma);
+			cli();
+			
+			if((fine || programma.attivo) && programma.duty != canali[CANALE_PRINCIPALE].duty)
+			impostaDCDiretto(programma.duty);
+			
+			if(fine)
+			postaEvento(EventoProgrammaFinito);
+		}
+		
+#if PWM_TIMER == 0
+		//Misura della velocità e regolazione ogni PID_PERIODO_MS. Il calcolo dura decine di microsecondi, quindi
+		//riabilito gli interrupt: i fronti del PWM software, la rampa e la seriale non devono aspettarne la fine.
+		if(--pidConteggio == 0){
+			pidConteggio = PID_PERIODO_MS;
+			sei();
+			regolazione_passo();
+		}
+#endif
+		
+		//Telemetria ogni telemetriaPeriodo ms, anche questa con gli interrupt abilitati: il calcolo del CRC del frame dura
+		//circa 100 us. Un frame rimandato perchè il main sta trasmettendo riprova al millisecondo successivo.
+		if(telemetriaPeriodo && --telemetriaConteggio == 0){
+			sei();
+			telemetriaConteggio = telemetria_invia() ? telemetriaPeriodo : 1;
+		}
+		
+		//Gli interrupt tornano disabilitati per controllare i tick rimandati nel frattempo, uno alla volta: il programma
+		//non perde millisecondi anche se un passo è durato troppo.
+		cli();
+		if(tickArretrati == 0)
+		break;
+		tickArretrati--;
+	}
+	
+	tickInCorso = 0;
+	
+	PROFILO_FINE(ProfiloTIMER2_COMPA);
+	
+}
+
+//Fronte di discesa del PWM software: porto bassi i pin del fronte e passo al successivo.
+//I fronti troppo vicini, che il timer supererebbe prima della fine della ISR, vengono eseguiti subito.
+ISR(TIMER2_COMPB_vect){
+	
+	struct tabellaFronti *t = &frontiSW[frontiAttivi];
+	struct fronteSW *f;
+	PROFILO_INIZIO();
+	
+	do{
+		f = &t->fronte[prossimoFronte++];
+		PORTB &= ~f->spegni[PORTA_B];
+		PORTC &= ~f->spegni[PORTA_C];
+		PORTD &= ~f->spegni[PORTA_D];
+	}while(prossimoFronte < t->n && t->fronte[prossimoFronte].istante <= TCNT2 + 1);
+	
+	if(prossimoFronte < t->n)
+	OCR2B = t->fronte[prossimoFronte].istante;
+	else
+	TIMSK2 &= ~(1<<OCIE2B);
 	
-	tens[3] = !((PIND & (1<<PIND2)) == 0);
-	tens[2] = !((PIND & (1<<PIND3)) == 0);
-	tens[1] = !((PIND & (1<<PIND4)) == 0);
-	tens[0] = !((PIND & (1<<PIND7)) == 0);
+	PROFILO_FINE(ProfiloTIMER2_COMPB);
 	
 }
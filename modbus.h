@@ -0,0 +1,242 @@
+/*************************************************************************************************************
+--------------------------------------------MODBUS RTU (SLAVE)------------------------------------------------
+Con il comando "modbus <indirizzo>" la USART passa dai comandi testuali al protocollo Modbus RTU, per collegare la scheda
+a un bus RS-485 con un master (PLC o PC). Un frame (ADU) è fatto così:
+
+	INDIRIZZO | FUNZIONE | DATI | CRC-16 (prima il byte basso)
+
+-I frame non hanno un byte di inizio: un frame finisce quando la linea resta ferma per 3.5 caratteri. Il silenzio viene
+ misurato dal firmware con il confronto A del timer 1, riavviato ad ogni byte ricevuto.
+-I registri e i valori sono a 16 bit big endian (prima il byte alto), il contrario del protocollo binario.
+-Il CRC è il CRC-16 Modbus (polinomio 0xA001 riflesso, valore iniziale 0xFFFF), calcolato con una tabella di 256 valori
+ in flash: un accesso alla tabella per byte invece di 8 passi di shift.
+-L'indirizzo 0 è il broadcast: le scritture vengono eseguite ma non c'è risposta.
+
+Funzioni gestite: 0x03 lettura degli holding register, 0x04 lettura degli input register, 0x06 scrittura di un registro,
+0x10 scrittura di più registri. Le richieste sbagliate ricevono una risposta di eccezione: FUNZIONE | 0x80 e un byte
+con il codice.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c) sia dal master di prova
+per l'host (Host/modbus_master.c), che controlla anche la tabella del CRC.
+*************************************************************************************************************/
+#ifndef MODBUS_H_
+#define MODBUS_H_
+
+//Sulla scheda la tabella resta in flash; sull'host è una tabella normale.
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(p) (*(p))
+#endif
+
+#define MODBUS_MAX_FRAME 48 //Frame più lungo accettato: bastano 16 registri per richiesta. I frame più lunghi vengono scartati.
+#define MODBUS_MAX_REGISTRI 16 //Registri letti o scritti al più con una richiesta.
+#define MODBUS_INDIRIZZO_MAX 247 //Indirizzi ammessi per uno slave: da 1 a 247.
+#define MODBUS_ECCEZIONE 0x80 //Bit della FUNZIONE che indica una risposta di eccezione.
+
+enum funzioneModbus {
+	MB_LEGGI_HOLDING = 0x03, //Dati: primo registro, numero di registri. Risposta: byte, valori.
+	MB_LEGGI_INPUT = 0x04, //Come MB_LEGGI_HOLDING.
+	MB_SCRIVI_REGISTRO = 0x06, //Dati: registro, valore. Risposta: uguale alla richiesta.
+	MB_SCRIVI_REGISTRI = 0x10 //Dati: primo registro, numero di registri, byte, valori. Risposta: primo registro, numero di registri.
+};
+
+//Codici delle risposte di eccezione.
+enum eccezioneModbus {MB_ECC_FUNZIONE = 1, MB_ECC_INDIRIZZO, MB_ECC_VALORE, MB_ECC_DISPOSITIVO};
+
+//Holding register (lettura e scrittura).
+enum holdingModbus {
+	MB_HR_DUTY, //Setpoint remoto del duty cycle del canale principale in decimi di percento (0 = spento).
+	MB_HR_PRIORITA, //Priorità: 0 al remoto, 1 al locale (dip switch). Non scrivibile con l'interruttore della priorità.
+	MB_HR_FREQUENZA, //Frequenza del PWM in Hz: si legge quella ottenuta.
+	MB_HR_PWM_MODO, //0 fast PWM, 1 phase correct.
+	MB_HR_INDIRIZZO, //Indirizzo Modbus della scheda. Scrivendo 0 si torna ai comandi testuali.
+	MB_HR_TIMEOUT, //Timeout del remoto in ms (da 0, disattivato, a 60000).
+	MB_N_HOLDING
+};
+
+//Input register (solo lettura). I contatori ricominciano da 0 dopo 65535.
+enum inputModbus {
+	MB_IR_DUTY, //Duty cycle generato dal canale principale, con la rampa (0 se spento).
+	MB_IR_STATO, //PresentState.
+	MB_IR_FLAG, //Bit TEL_FLAG_* del protocollo binario (priorità, regolazione, timeout, sovracorrente, programma).
+	MB_IR_RPM, //Velocità misurata dal tachimetro.
+	MB_IR_RICHIESTE, //Richieste ricevute con CRC corretto e indirizzo della scheda (o broadcast).
+	MB_IR_ERRORI_CRC, //Frame scartati per il CRC sbagliato o perchè troppo corti o troppo lunghi.
+	MB_IR_BYTE_PERSI, //Byte ricevuti persi per il buffer pieno.
+	MB_IR_OVERRUN, //Overrun della USART.
+	MB_IR_ERRORI_FRAME, //Errori di frame della USART.
+	MB_IR_RISPOSTA_MAX, //Tempo massimo tra la fine di una richiesta (ultimo byte ricevuto) e la sua risposta accodata, in us.
+	MB_IR_CORRENTE, //Corrente media del motore in mA.
+	MB_IR_LOCALE, //Setpoint locale dei dip switch in decimi di percento (0xFFFF finchè non c'è un valore valido).
+	MB_N_INPUT
+};
+
+//Esito della decodifica di un frame.
+enum esitoModbus {
+	MODBUS_ERRORE, //Frame troppo corto o con CRC sbagliato: va solo contato.
+	MODBUS_ALTRO, //Frame per un altro slave, oppure lettura in broadcast: va ignorato.
+	MODBUS_RICHIESTA, //Richiesta valida, decodificata in struct richiestaModbus.
+	MODBUS_RISPOSTA_ECCEZIONE //Richiesta per la scheda ma non valida: il codice è in r->eccezione.
+};
+
+struct richiestaModbus {
+	unsigned char indirizzo; //Indirizzo della richiesta (0 per il broadcast).
+	unsigned char funzione;
+	unsigned int registro; //Primo registro.
+	unsigned int quantita; //Numero di registri.
+	const unsigned char *valori; //Valori da scrivere (big endian), nel frame ricevuto.
+	unsigned char eccezione;
+};
+
+//Tabella del CRC-16 Modbus: CRC del byte i partendo da 0, cioè 8 passi dell'algoritmo bit per bit.
+static const unsigned int modbusCRC[256] PROGMEM = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+//Aggiorna il CRC con un byte: l'indice della tabella è il byte basso del CRC combinato con il nuovo byte.
+static inline unsigned int modbus_crc_byte(unsigned int crc, unsigned char byte){
+
+	return (crc >> 8) ^ pgm_read_word(&modbusCRC[(crc ^ byte) & 0xFF]);
+
+}
+
+//CRC-16 dei primi n byte di buf.
+static inline unsigned int modbus_crc(const unsigned char *buf, unsigned char n){
+
+	unsigned int crc = 0xFFFF;
+
+	while(n--)
+	crc = modbus_crc_byte(crc, *buf++);
+
+	return crc;
+
+}
+
+//Lettura e scrittura di valori a 16 bit big endian.
+static inline unsigned int modbus_leggi16(const unsigned char *p){
+
+	return ((unsigned int) p[0] << 8) | p[1];
+
+}
+
+static inline void modbus_scrivi16(unsigned char *p, unsigned int valore){
+
+	p[0] = valore >> 8;
+	p[1] = valore & 0xFF;
+
+}
+
+//Aggiunge il CRC (prima il byte basso) ai primi n byte di buf e restituisce la lunghezza del frame completo.
+static inline unsigned char modbus_chiudi(unsigned char *buf, unsigned char n){
+
+	unsigned int crc = modbus_crc(buf, n);
+
+	buf[n] = crc & 0xFF;
+	buf[n + 1] = crc >> 8;
+
+	return n + 2;
+
+}
+
+//Scrive in buf la risposta di eccezione e restituisce il numero di byte.
+static inline unsigned char modbus_eccezione(unsigned char *buf, unsigned char indirizzo, unsigned char funzione, unsigned char codice){
+
+	buf[0] = indirizzo;
+	buf[1] = funzione | MODBUS_ECCEZIONE;
+	buf[2] = codice;
+
+	return modbus_chiudi(buf, 3);
+
+}
+
+//Controlla un frame completo di n byte e, se è per lo slave con questo indirizzo, decodifica la richiesta.
+//Qui si controllano solo il formato e il numero di registri: se i registri esistono lo decide chi li gestisce.
+static inline unsigned char modbus_decodifica(const unsigned char *buf, unsigned char n, unsigned char indirizzo, struct richiestaModbus *r){
+
+	if(n < 4 || modbus_crc(buf, n - 2) != (buf[n - 2] | ((unsigned int) buf[n - 1] << 8)))
+	return MODBUS_ERRORE;
+
+	r->indirizzo = buf[0];
+	r->funzione = buf[1];
+	if(r->indirizzo != indirizzo && r->indirizzo != 0)
+	return MODBUS_ALTRO;
+
+	n -= 2; //Da qui n conta i byte senza CRC.
+
+	switch(r->funzione){
+
+		case MB_LEGGI_HOLDING:
+		case MB_LEGGI_INPUT:
+		if(r->indirizzo == 0) //Una lettura in broadcast non ha senso: nessuno risponderebbe.
+		return MODBUS_ALTRO;
+		if(n != 6)
+		break;
+		r->registro = modbus_leggi16(buf + 2);
+		r->quantita = modbus_leggi16(buf + 4);
+		if(r->quantita == 0 || r->quantita > MODBUS_MAX_REGISTRI)
+		break;
+		return MODBUS_RICHIESTA;
+
+		case MB_SCRIVI_REGISTRO:
+		if(n != 6)
+		break;
+		r->registro = modbus_leggi16(buf + 2);
+		r->quantita = 1;
+		r->valori = buf + 4;
+		return MODBUS_RICHIESTA;
+
+		case MB_SCRIVI_REGISTRI:
+		if(n < 7)
+		break;
+		r->registro = modbus_leggi16(buf + 2);
+		r->quantita = modbus_leggi16(buf + 4);
+		r->valori = buf + 7;
+		if(r->quantita == 0 || r->quantita > MODBUS_MAX_REGISTRI || buf[6] != 2 * r->quantita || n != 7 + buf[6])
+		break;
+		return MODBUS_RICHIESTA;
+
+		default:
+		r->eccezione = MB_ECC_FUNZIONE;
+		return MODBUS_RISPOSTA_ECCEZIONE;
+	}
+
+	//Lunghezza o numero di registri sbagliati.
+	r->eccezione = MB_ECC_VALORE;
+	return MODBUS_RISPOSTA_ECCEZIONE;
+
+}
+
+#endif /* MODBUS_H_ */
@@ -0,0 +1,224 @@
+/*************************************************************************************************************
+-----------------------------------PROGRAMMA DEL DUTY CYCLE NEL TEMPO-----------------------------------------
+Un programma è una lista di punti (tempo, duty cycle), con i tempi in millisecondi dall'inizio e crescenti: il primo
+punto è a 0 ms. Durante la riproduzione programma_passo() viene chiamata una volta al millisecondo (nella ISR del timer 2)
+e calcola il duty cycle da generare:
+-a gradini: tra due punti resta il duty cycle del primo;
+-lineare: tra due punti il duty cycle va in linea retta dal primo al secondo. All'inizio di ogni tratto una sola divisione
+ dà il passo per millisecondo e il resto, che viene accumulato come nell'algoritmo di Bresenham: dopo k millisecondi
+ il duty cycle è esattamente partenza + distanza * k / durata (troncato), senza moltiplicazioni e divisioni ad ogni passo.
+All'istante dell'ultimo punto il programma finisce e il duty cycle resta quello dell'ultimo punto; con PROGRAMMA_CICLO
+riparte invece dal primo punto, quindi l'ultimo punto segna solo la fine del giro.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c) sia dal programma
+di prova per l'host (Host/prova_programma.c), che confronta la riproduzione con l'andamento atteso.
+*************************************************************************************************************/
+#ifndef PROGRAMMA_H_
+#define PROGRAMMA_H_
+
+#define PROGRAMMA_PUNTI 16 //Punti al massimo in un programma.
+#define PROGRAMMA_DIM (2 + 6 * PROGRAMMA_PUNTI) //Byte del programma salvato: punti, opzioni e per ogni punto tempo (32 bit) e duty cycle (16 bit).
+
+#define PROGRAMMA_LINEARE 0x01 //Bit delle opzioni: interpolazione lineare (altrimenti a gradini).
+#define PROGRAMMA_CICLO 0x02 //Bit delle opzioni: all'ultimo punto si riparte dal primo.
+
+struct puntoProgramma {
+	unsigned long tempo; //Millisecondi dall'inizio del programma.
+	unsigned int duty; //Duty cycle in decimi di percento.
+};
+
+struct programmaDuty {
+	struct puntoProgramma punti[PROGRAMMA_PUNTI];
+	unsigned char n; //Punti del programma.
+	unsigned char opzioni; //Bit PROGRAMMA_*.
+
+	//Riproduzione.
+	char attivo; //1 durante la riproduzione.
+	unsigned char punto; //Punto da cui parte il tratto in corso.
+	unsigned long tempo; //Millisecondi dall'inizio del tratto.
+	unsigned long durata; //Durata del tratto in millisecondi.
+	unsigned int duty; //Duty cycle da generare.
+	unsigned int quoziente; //Con l'interpolazione lineare: decimi di percento da aggiungere (o togliere) ad ogni millisecondo,
+	unsigned long resto; //resto della divisione, accumulato ad ogni millisecondo
+	unsigned long accumulo; //e aggiunto come decimo in più quando supera la durata.
+	char scende; //1 se nel tratto il duty cycle diminuisce.
+	unsigned int giri; //Giri completati con PROGRAMMA_CICLO.
+};
+
+//Cancella i punti e ferma la riproduzione. Le opzioni restano quelle impostate.
+static inline void programma_reset(struct programmaDuty *p){
+
+	p->n = 0;
+	p->attivo = 0;
+
+}
+
+//Aggiunge un punto in fondo al programma. Restituisce 0 se il programma è pieno o se il tempo non è valido:
+//il primo punto deve essere a 0 ms e gli altri devono avere tempi crescenti. Il duty cycle va controllato da chi chiama.
+static inline char programma_aggiungi(struct programmaDuty *p, unsigned long tempo, unsigned int duty){
+
+	if(p->n == PROGRAMMA_PUNTI || (p->n == 0 ? tempo != 0 : tempo <= p->punti[p->n - 1].tempo))
+	return 0;
+
+	p->punti[p->n].tempo = tempo;
+	p->punti[p->n].duty = duty;
+	p->n++;
+
+	return 1;
+
+}
+
+//Controlla un programma letto dalla EEPROM: numero di punti, tempi e duty cycle non oltre dutyMax.
+static inline char programma_valido(const struct programmaDuty *p, unsigned int dutyMax){
+
+	unsigned char i;
+
+	if(p->n > PROGRAMMA_PUNTI || (p->n && p->punti[0].tempo != 0))
+	return 0;
+
+	for(i = 0; i < p->n; i++){
+		if(p->punti[i].duty > dutyMax || (i && p->punti[i].tempo <= p->punti[i - 1].tempo))
+		return 0;
+	}
+
+	return 1;
+
+}
+
+//Prepara il tratto dal punto p->punto al successivo: l'unica divisione della riproduzione.
+static inline void programma_tratto(struct programmaDuty *p){
+
+	const struct puntoProgramma *a = &p->punti[p->punto];
+	const struct puntoProgramma *b = a + 1;
+	unsigned int distanza;
+
+	p->duty = a->duty;
+	p->tempo = 0;
+	p->durata = b->tempo - a->tempo;
+	p->accumulo = 0;
+	p->scende = b->duty < a->duty;
+	distanza = p->scende ? a->duty - b->duty : b->duty - a->duty;
+
+	if(p->opzioni & PROGRAMMA_LINEARE){
+		p->quoziente = distanza / p->durata;
+		p->resto = distanza % p->durata;
+	}
+	else{
+		p->quoziente = 0;
+		p->resto = 0;
+	}
+
+}
+
+//Avvia la riproduzione dal primo punto: il duty cycle da generare subito è in p->duty.
+//Restituisce 0 se il programma ha meno di due punti.
+static inline char programma_avvia(struct programmaDuty *p){
+
+	if(p->n < 2)
+	return 0;
+
+	p->punto = 0;
+	p->giri = 0;
+	programma_tratto(p);
+	p->attivo = 1;
+
+	return 1;
+
+}
+
+//Un millisecondo di riproduzione: aggiorna p->duty. Restituisce 1 solo al passo in cui il programma finisce.
+static inline char programma_passo(struct programmaDuty *p){
+
+	unsigned int passo;
+
+	if(!p->attivo)
+	return 0;
+
+	if(++p->tempo < p->durata){
+		//Il confronto con durata - accumulo evita l'overflow di accumulo + resto con i tratti molto lunghi.
+		passo = p->quoziente;
+		if(p->resto >= p->durata - p->accumulo){
+			p->accumulo -= p->durata - p->resto;
+			passo++;
+		}
+		else
+		p->accumulo += p->resto;
+
+		p->duty = p->scende ? p->duty - passo : p->duty + passo;
+		return 0;
+	}
+
+	//Fine del tratto: il duty cycle è esattamente quello del punto raggiunto.
+	if(++p->punto < p->n - 1){
+		programma_tratto(p);
+		return 0;
+	}
+
+	if(p->opzioni & PROGRAMMA_CICLO){
+		p->punto = 0;
+		p->giri++;
+		programma_tratto(p);
+		return 0;
+	}
+
+	p->duty = p->punti[p->n - 1].duty;
+	p->attivo = 0;
+
+	return 1;
+
+}
+
+//Millisecondi dall'inizio del giro in corso.
+static inline unsigned long programma_tempo(const struct programmaDuty *p){
+
+	return p->punti[p->punto].tempo + p->tempo;
+
+}
+
+//Byte i (da 0 a PROGRAMMA_DIM - 1) del programma salvato, little endian. Solo i punti fino a p->n contano.
+static inline unsigned char programma_byte(const struct programmaDuty *p, unsigned char i){
+
+	const struct puntoProgramma *q;
+
+	if(i == 0)
+	return p->n;
+	if(i == 1)
+	return p->opzioni;
+
+	q = &p->punti[(i - 2) / 6];
+	i = (i - 2) % 6;
+
+	return i < 4 ? (q->tempo >> (8 * i)) & 0xFF : (q->duty >> (8 * (i - 4))) & 0xFF;
+
+}
+
+//Scrive il byte i del programma salvato, letto dalla EEPROM: l'inverso di programma_byte(), con i byte in ordine crescente.
+static inline void programma_imposta_byte(struct programmaDuty *p, unsigned char i, unsigned char b){
+
+	struct puntoProgramma *q;
+
+	if(i == 0){
+		p->n = b;
+		return;
+	}
+	if(i == 1){
+		p->opzioni = b;
+		return;
+	}
+
+	q = &p->punti[(i - 2) / 6];
+	i = (i - 2) % 6;
+
+	//I byte arrivano in ordine: il primo di ogni campo lo azzera, così restano solo i 32 e i 16 bit salvati.
+	if(i == 0)
+	q->tempo = b;
+	else if(i < 4)
+	q->tempo |= (unsigned long) b << (8 * i);
+	else if(i == 4)
+	q->duty = b;
+	else
+	q->duty |= (unsigned int) b << 8;
+
+}
+
+#endif /* PROGRAMMA_H_ */
@@ -0,0 +1,198 @@
+/*************************************************************************************************************
+----------------------------------PROTOCOLLO BINARIO DI CONTROLLO A FRAME-------------------------------------
+Formato di un frame (comando dall'host o risposta della scheda), sulla stessa USART dei comandi testuali:
+
+	SYNC | OPCODE | CANALE | LUNGHEZZA | PAYLOAD[LUNGHEZZA] | CRC
+
+-SYNC vale 0xA5: non è un carattere ASCII, quindi non può comparire nei comandi testuali.
+-Le risposte hanno lo stesso OPCODE del comando con il bit 7 a '1'.
+-I valori a 16 bit nel payload sono little endian (prima il byte meno significativo).
+-Il CRC è un CRC-8 (polinomio 0x07, valore iniziale 0) calcolato da OPCODE fino all'ultimo byte del payload.
+-Con la telemetria attiva (OP_TELEMETRIA) la scheda invia da sola un frame OP_DATI_TELEMETRIA a intervalli regolari.
+Esempio: impostare il canale 0 al 50.5% (505 decimi di percento) richiede 7 byte: A5 01 00 02 F9 01 CRC.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c)
+sia dal programma di riferimento per l'host (Host/protocollo_host.c), che si compila e si prova su Linux.
+*************************************************************************************************************/
+#ifndef PROTOCOLLO_H_
+#define PROTOCOLLO_H_
+
+#define PROTO_SYNC 0xA5 //Byte di sincronismo all'inizio di ogni frame.
+#define PROTO_MAX_PAYLOAD 32 //Lunghezza massima del payload (il più lungo è quello della telemetria).
+#define PROTO_MAX_FRAME (PROTO_MAX_PAYLOAD + 5) //Lunghezza massima di un frame completo.
+#define PROTO_RISPOSTA 0x80 //Bit dell'OPCODE che distingue le risposte dai comandi.
+
+//Comandi.
+enum opcodeProtocollo {
+	OP_IMPOSTA_DC = 0x01, //Payload: duty cycle in decimi di percento (16 bit), setpoint remoto. Risposta: come OP_LEGGI_STATO.
+	OP_LEGGI_STATO = 0x02, //Payload vuoto. Risposta: duty (16 bit), spento, PresentState, comanda il locale, frequenza PWM (16 bit).
+	OP_LEGGI_CONTATORI = 0x03, //Payload vuoto. Risposta: frame validi, errori di CRC, byte ricevuti persi (16 bit ciascuno).
+	OP_TELEMETRIA = 0x04, //Payload: frequenza della telemetria in Hz (16 bit, da 10 a 1000; 0 la ferma). Risposta: frequenza ottenuta (16 bit).
+	OP_DATI_TELEMETRIA = 0x05, //Solo come frame spontaneo della scheda (0x85), con il payload descritto sotto.
+	OP_ERRORE = 0x7F //Solo come risposta (0xFF): payload di un byte con il codice di errore.
+};
+
+//Payload di OP_DATI_TELEMETRIA: posizione dei campi fissi, poi il duty cycle generato da ogni canale (16 bit ciascuno,
+//0 se il canale è spento). Il numero di canali è (LUNGHEZZA - TEL_DUTY) / 2. I contatori ricominciano da 0 dopo 65535.
+enum campoTelemetria {
+	TEL_MS = 0, //Millisecondi dall'accensione (16 bit, ricominciano da 0 dopo circa 65 secondi).
+	TEL_STATO = 2, //PresentState.
+	TEL_FLAG = 3, //Bit TEL_FLAG_*.
+	TEL_DIP = 4, //Parola dei dip switch (16 bit): bit 0-3 unità, 4-7 decine, 8 centinaia.
+	TEL_RPM = 6, //Velocità misurata dal tachimetro (16 bit).
+	TEL_ERRORI_CRC = 8, //Frame ricevuti con CRC sbagliato (16 bit).
+	TEL_BYTE_PERSI = 10, //Byte ricevuti persi per il buffer pieno (16 bit).
+	TEL_OVERRUN = 12, //Overrun della USART (16 bit).
+	TEL_ERRORI_FRAME = 14, //Errori di frame della USART (16 bit).
+	TEL_PERSI = 16, //Frame di telemetria non inviati perchè la seriale era satura (16 bit).
+	TEL_DUTY = 18 //Duty cycle del canale 0 in decimi di percento (16 bit), poi gli altri canali.
+};
+
+#define TEL_FLAG_PRIORITA_LOCALE 0x01 //La priorità è al locale (dip switch).
+#define TEL_FLAG_REGOLAZIONE 0x02 //Il canale principale è in regolazione di velocità.
+#define TEL_FLAG_REMOTO_SCADUTO 0x04 //Il remoto non manda setpoint da oltre il timeout: comanda il locale.
+#define TEL_FLAG_SOVRACORRENTE 0x08 //La protezione da sovracorrente è scattata: il canale principale resta spento fino al riarmo.
+#define TEL_FLAG_PROGRAMMA 0x10 //Il canale principale segue il programma del duty cycle.
+
+//Codici di errore della risposta OP_ERRORE.
+enum erroreProtocollo {ERR_OPCODE = 1, ERR_CANALE, ERR_VALORE, ERR_MODO}; //ERR_MODO non viene più restituito: il codice resta riservato.
+
+//Esito del parser dopo ogni byte.
+enum esitoParser {PROTO_INCOMPLETO, PROTO_FRAME_OK, PROTO_ERRORE_CRC, PROTO_ERRORE_LUNGHEZZA};
+
+struct frameProtocollo {
+	unsigned char opcode;
+	unsigned char canale;
+	unsigned char lunghezza;
+	unsigned char payload[PROTO_MAX_PAYLOAD];
+};
+
+//Stato del parser: riceve un byte alla volta, dal SYNC al CRC.
+struct parserProtocollo {
+	unsigned char stato; //Indice del prossimo campo atteso (0 = in attesa di SYNC).
+	unsigned char indice; //Byte del payload già ricevuti.
+	unsigned char crc; //CRC calcolato fin qui.
+	struct frameProtocollo frame;
+};
+
+enum statoParser {ATTESA_SYNC, ATTESA_OPCODE, ATTESA_CANALE, ATTESA_LUNGHEZZA, ATTESA_PAYLOAD, ATTESA_CRC};
+
+//Aggiorna il CRC-8 (polinomio 0x07) con un byte, un bit alla volta: niente tabella, pochi byte di flash.
+static inline unsigned char proto_crc8(unsigned char crc, unsigned char byte){
+
+	unsigned char i;
+
+	crc ^= byte;
+	for(i = 0; i < 8; i++)
+	crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+
+	return crc;
+
+}
+
+//Riporta il parser in attesa del SYNC, scartando un eventuale frame incompleto.
+static inline void proto_reset(struct parserProtocollo *p){
+
+	p->stato = ATTESA_SYNC;
+
+}
+
+//Indica se il parser sta ricevendo un frame (cioè ha già visto il SYNC).
+static inline char proto_in_corso(const struct parserProtocollo *p){
+
+	return p->stato != ATTESA_SYNC;
+
+}
+
+//Passa un byte al parser. Quando restituisce PROTO_FRAME_OK, il frame completo si trova in p->frame.
+//Dopo un frame o un errore il parser torna in attesa del SYNC.
+static inline unsigned char proto_parse(struct parserProtocollo *p, unsigned char byte){
+
+	switch(p->stato){
+
+		case ATTESA_SYNC:
+		if(byte == PROTO_SYNC){
+			p->crc = 0;
+			p->stato = ATTESA_OPCODE;
+		}
+		break;
+
+		case ATTESA_OPCODE:
+		p->frame.opcode = byte;
+		p->crc = proto_crc8(p->crc, byte);
+		p->stato = ATTESA_CANALE;
+		break;
+
+		case ATTESA_CANALE:
+		p->frame.canale = byte;
+		p->crc = proto_crc8(p->crc, byte);
+		p->stato = ATTESA_LUNGHEZZA;
+		break;
+
+		case ATTESA_LUNGHEZZA:
+		if(byte > PROTO_MAX_PAYLOAD){
+			p->stato = ATTESA_SYNC;
+			return PROTO_ERRORE_LUNGHEZZA;
+		}
+		p->frame.lunghezza = byte;
+		p->crc = proto_crc8(p->crc, byte);
+		p->indice = 0;
+		p->stato = (byte == 0) ? ATTESA_CRC : ATTESA_PAYLOAD;
+		break;
+
+		case ATTESA_PAYLOAD:
+		p->frame.payload[p->indice++] = byte;
+		p->crc = proto_crc8(p->crc, byte);
+		if(p->indice == p->frame.lunghezza)
+		p->stato = ATTESA_CRC;
+		break;
+
+		default:
+		p->stato = ATTESA_SYNC;
+		return (byte == p->crc) ? PROTO_FRAME_OK : PROTO_ERRORE_CRC;
+	}
+
+	return PROTO_INCOMPLETO;
+
+}
+
+//Scrive in buf il frame completo (SYNC, intestazione, payload e CRC) e restituisce il numero di byte.
+//buf deve contenere almeno PROTO_MAX_FRAME byte.
+static inline unsigned char proto_encode(unsigned char *buf, const struct frameProtocollo *f){
+
+	unsigned char n = 0;
+	unsigned char crc = 0;
+	unsigned char i;
+
+	buf[n++] = PROTO_SYNC;
+	buf[n++] = f->opcode;
+	buf[n++] = f->canale;
+	buf[n++] = f->lunghezza;
+
+	for(i = 0; i < f->lunghezza; i++)
+	buf[n++] = f->payload[i];
+
+	for(i = 1; i < n; i++)
+	crc = proto_crc8(crc, buf[i]);
+
+	buf[n++] = crc;
+
+	return n;
+
+}
+
+//Lettura e scrittura di valori a 16 bit little endian nel payload.
+static inline unsigned int proto_leggi16(const unsigned char *p){
+
+	return p[0] | ((unsigned int) p[1] << 8);
+
+}
+
+static inline void proto_scrivi16(unsigned char *p, unsigned int valore){
+
+	p[0] = valore & 0xFF;
+	p[1] = valore >> 8;
+
+}
+
+#endif /* PROTOCOLLO_H_ */
@@ -0,0 +1,83 @@
+/*************************************************************************************************************
+-------------------------------REGOLAZIONE DELLA VELOCITA' IN VIRGOLA FISSA----------------------------------
+Misura della velocità dagli impulsi del tachimetro e regolatore PID: il regolatore riceve la velocità richiesta
+e quella misurata (in rpm) e restituisce il duty cycle da applicare, in decimi di percento.
+Niente float: sull'ATmega328P sarebbero emulati via software.
+
+-I guadagni proporzionale e derivativo sono in Q8.8 (256 = 1 decimo di percento di duty cycle per rpm).
+-Il guadagno integrale è in Q0.16 (65536 = 1 decimo di percento per rpm, ad ogni passo), perchè con un passo
+ di pochi millisecondi serve un guadagno molto più piccolo di 1/256.
+-Il termine integrale viene accumulato in Q16.16 e limitato all'intervallo dell'uscita (anti-windup).
+-Il termine derivativo è calcolato sulla misura e non sull'errore, così un cambio di velocità richiesta non dà un colpo all'uscita.
+
+Il file non dipende dai registri del microcontrollore: viene incluso sia dal firmware (main.c)
+sia dal simulatore per l'host (Host/simulazione_pid.c), che prova il regolatore su Linux con un motore simulato.
+*************************************************************************************************************/
+#ifndef REGOLAZIONE_H_
+#define REGOLAZIONE_H_
+
+//Velocità in rpm da un certo numero di impulsi del tachimetro e dal tempo che li contiene, in conteggi del timer.
+//costante vale 60 * (conteggi del timer in un secondo) / (impulsi per giro). Il risultato viene limitato a 65535 rpm:
+//se costante * impulsi supera i 32 bit, in pochi millisecondi sono arrivati così tanti impulsi che si è comunque oltre.
+static inline unsigned int tach_rpm(unsigned char impulsi, unsigned long durata, unsigned long costante){
+
+	unsigned long rpm;
+
+	if(durata == 0 || impulsi > 0xFFFFFFFFUL / costante)
+	return 0xFFFF;
+
+	rpm = costante * impulsi / durata;
+
+	return rpm > 0xFFFF ? 0xFFFF : rpm;
+
+}
+
+struct regolatorePID {
+	int kp; //Guadagno proporzionale, Q8.8.
+	unsigned int ki; //Guadagno integrale per passo, Q0.16.
+	int kd; //Guadagno derivativo per passo, Q8.8.
+	int uscitaMax; //Uscita massima, in decimi di percento (la minima è 0).
+	long integrale; //Termine integrale, Q16.16 in decimi di percento.
+	unsigned int misuraPrecedente; //Misura del passo precedente, per il termine derivativo.
+};
+
+//Limita un valore a 32 bit all'intervallo [minimo, massimo].
+static inline long pid_limita(long valore, long minimo, long massimo){
+
+	if(valore < minimo)
+	return minimo;
+	if(valore > massimo)
+	return massimo;
+
+	return valore;
+
+}
+
+//Prepara il regolatore a partire dall'uscita attuale, così l'ingresso in regolazione non fa saltare il duty cycle.
+static inline void pid_reset(struct regolatorePID *r, unsigned int uscita, unsigned int misura){
+
+	r->integrale = pid_limita(uscita, 0, r->uscitaMax) << 16;
+	r->misuraPrecedente = misura;
+
+}
+
+//Un passo del regolatore, da chiamare a intervalli regolari. Restituisce il duty cycle in decimi di percento.
+//Gli errori vengono limitati a +-32767 rpm, così nessun prodotto supera i 32 bit.
+static inline unsigned int pid_passo(struct regolatorePID *r, unsigned int riferimento, unsigned int misura){
+
+	long errore = pid_limita((long) riferimento - misura, -32767, 32767);
+	long variazione = pid_limita((long) misura - r->misuraPrecedente, -32767, 32767);
+	long uscita;
+
+	r->misuraPrecedente = misura;
+
+	r->integrale = pid_limita(r->integrale + (long) r->ki * errore, 0, (long) r->uscitaMax << 16);
+
+	//Ogni termine viene riportato a decimi di percento prima della somma, per non uscire dai 32 bit.
+	uscita = (r->integrale >> 16) + (((long) r->kp * errore) >> 8) - (((long) r->kd * variazione) >> 8);
+
+	return pid_limita(uscita, 0, r->uscitaMax);
+
+}
+
+#endif /* REGOLAZIONE_H_ */